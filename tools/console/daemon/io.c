@@ -43,6 +43,7 @@
 #include <util.h>
 #elif defined(__linux__)
 #include <pty.h>
+#include <sys/epoll.h>
 #elif defined(__sun__)
 #include <stropts.h>
 #elif defined(__FreeBSD__)
@@ -61,6 +62,14 @@
 /* Duration of each time period in ms */
 #define RATE_LIMIT_PERIOD 200
 
+/* Buffered log output is written out once this much is pending */
+#define LOG_FLUSH_THRESHOLD (16 * 1024)
+
+/* Domains looked up per XEN_DOMCTL_getdomaininfo batch */
+#define DOMINFO_BATCH 256
+
+#define DOM_HASH_SIZE 256
+
 extern int log_reload;
 extern int log_guest;
 extern int log_hv;
@@ -71,17 +80,34 @@ extern int discard_overflowed_data;
 extern int replace_escape;
 
 static int log_time_hv_needts = 1;
-static int log_time_guest_needts = 1;
 static int log_hv_fd = -1;
+static struct buffer hv_log;
 
 static xengnttab_handle *xgt_handle = NULL;
 
-static struct pollfd  *fds;
-static unsigned int current_array_size;
-static unsigned int nr_fds;
-
 #define ROUNDUP(_x,_w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
 
+/*
+ * A file descriptor the main loop waits on.  It is registered with the
+ * event set once, and the set is only touched again when the events it is
+ * waited for change, so idle consoles cost nothing per loop iteration.
+ */
+struct io_fd {
+	int fd;
+	short events;		/* Registered interest, 0 if not registered */
+	short revents;		/* Pending events, cleared on removal */
+	int idx;		/* Slot in fds[] with the poll() backend */
+	void (*handler)(struct io_fd *io);
+	void *data;
+};
+
+static struct io_fd **ready_fds;
+static unsigned int nr_ready;
+static bool io_failed;
+
+/* Monotonic time in ms, updated around each wait for events. */
+static long long now_ms;
+
 struct buffer {
 	char *data;
 	size_t consumed;
@@ -93,17 +119,23 @@ struct buffer {
 struct console {
 	char *ttyname;
 	int master_fd;
-	int master_pollfd_idx;
+	struct io_fd tty_io;
 	int slave_fd;
 	int log_fd;
 	struct buffer buffer;
+	struct buffer log;
+	int log_needts;
+	bool log_queued;
+	struct console *log_next;
 	char *xspath;
 	char *log_suffix;
 	int ring_ref;
 	xenevtchn_handle *xce_handle;
-	int xce_pollfd_idx;
+	struct io_fd xce_io;
 	int event_count;
 	long long next_period;
+	bool throttled;
+	struct console *throttle_next;
 	xenevtchn_port_or_error_t local_port;
 	xenevtchn_port_or_error_t remote_port;
 	struct xencons_interface *interface;
@@ -146,14 +178,21 @@ struct domain {
 	bool is_dead;
 	unsigned last_seen;
 	struct domain *next;
+	struct domain *hash_next;
 	struct console console[NUM_CONSOLE_TYPE];
 };
 
 static struct domain *dom_head;
+static struct domain *dom_hash[DOM_HASH_SIZE];
+static bool dead_domains;
+
+/* Consoles with log output waiting to be written out. */
+static struct console *log_queue;
+/* Consoles with their event channel masked by the rate limit. */
+static struct console *throttled_consoles;
 
 typedef void (*VOID_ITER_FUNC_ARG1)(struct console *);
 typedef int (*INT_ITER_FUNC_ARG1)(struct console *);
-typedef void (*VOID_ITER_FUNC_ARG2)(struct console *,  void *);
 typedef int (*INT_ITER_FUNC_ARG3)(struct console *,
 				  struct domain *dom, void **);
 
@@ -173,18 +212,6 @@ static inline void console_iter_void_arg1(struct domain *d,
 	}
 }
 
-static inline void console_iter_void_arg2(struct domain *d,
-					  VOID_ITER_FUNC_ARG2 iter_func,
-					  void *iter_data)
-{
-	unsigned int i;
-	struct console *con = &d->console[0];
-
-	for (i = 0; i < NUM_CONSOLE_TYPE; i++, con++) {
-		iter_func(con, iter_data);
-	}
-}
-
 static inline int console_iter_int_arg1(struct domain *d,
 					INT_ITER_FUNC_ARG1 iter_func)
 {
@@ -228,6 +255,212 @@ static inline int console_iter_int_arg3(struct domain *d,
 	return ret;
 }
 
+#if defined(__linux__)
+
+static int epoll_fd = -1;
+
+#define MAX_READY_FDS 256
+
+static int io_setup(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		dolog(LOG_ERR, "Failed to create epoll instance: %d (%s)",
+		      errno, strerror(errno));
+		return -1;
+	}
+
+	ready_fds = malloc(sizeof(*ready_fds) * MAX_READY_FDS);
+	if (ready_fds == NULL) {
+		dolog(LOG_ERR, "Out of memory %s:%s():L%d",
+		      __FILE__, __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void io_teardown(void)
+{
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+	free(ready_fds);
+	ready_fds = NULL;
+}
+
+static bool io_ctl(struct io_fd *io, int fd, short events)
+{
+	/* The EPOLL* event bits have the values of their POLL* counterparts */
+	struct epoll_event ev = { .events = events, .data.ptr = io };
+	int op;
+
+	if (!io->events)
+		op = EPOLL_CTL_ADD;
+	else if (events)
+		op = EPOLL_CTL_MOD;
+	else
+		op = EPOLL_CTL_DEL;
+
+	if (epoll_ctl(epoll_fd, op, fd, &ev) == -1) {
+		dolog(LOG_ERR, "epoll_ctl failed, ignoring fd %d: %d (%s)",
+		      fd, errno, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static int io_wait(int timeout)
+{
+	struct epoll_event evs[MAX_READY_FDS];
+	int i, ret;
+
+	nr_ready = 0;
+	ret = epoll_wait(epoll_fd, evs, MAX_READY_FDS, timeout);
+	for (i = 0; i < ret; i++) {
+		struct io_fd *io = evs[i].data.ptr;
+
+		io->revents = evs[i].events;
+		ready_fds[nr_ready++] = io;
+	}
+
+	return ret;
+}
+
+#else /* !__linux__ */
+
+static struct pollfd  *fds;
+static struct io_fd **fd_io;
+static unsigned int current_array_size;
+static unsigned int nr_fds;
+
+static int io_setup(void)
+{
+	return 0;
+}
+
+static void io_teardown(void)
+{
+	free(fds);
+	free(fd_io);
+	free(ready_fds);
+	fds = NULL;
+	fd_io = ready_fds = NULL;
+	current_array_size = nr_fds = 0;
+}
+
+static bool io_grow(void)
+{
+	unsigned long newsize;
+	void *p;
+
+	/* Round up to 2^8 boundary, in practice this just
+	 * make newsize larger than current_array_size.
+	 */
+	newsize = ROUNDUP(nr_fds + 1, 8);
+
+	p = realloc(fds, sizeof(*fds) * newsize);
+	if (!p)
+		return false;
+	fds = p;
+	p = realloc(fd_io, sizeof(*fd_io) * newsize);
+	if (!p)
+		return false;
+	fd_io = p;
+	p = realloc(ready_fds, sizeof(*ready_fds) * newsize);
+	if (!p)
+		return false;
+	ready_fds = p;
+
+	current_array_size = newsize;
+	return true;
+}
+
+static bool io_ctl(struct io_fd *io, int fd, short events)
+{
+	if (!io->events) {
+		if (current_array_size < nr_fds + 1 && !io_grow()) {
+			dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
+			return false;
+		}
+		io->idx = nr_fds++;
+		fds[io->idx].fd = fd;
+		fd_io[io->idx] = io;
+	} else if (!events) {
+		/* Move the last slot into the one being freed. */
+		nr_fds--;
+		fds[io->idx] = fds[nr_fds];
+		fd_io[io->idx] = fd_io[nr_fds];
+		fd_io[io->idx]->idx = io->idx;
+		io->idx = -1;
+		return true;
+	}
+
+	fds[io->idx].events = events;
+	fds[io->idx].revents = 0;
+	return true;
+}
+
+static int io_wait(int timeout)
+{
+	unsigned int i;
+	int ret;
+
+	nr_ready = 0;
+	ret = poll(fds, nr_fds, timeout);
+	for (i = 0; ret > 0 && i < nr_fds; i++) {
+		if (!fds[i].revents)
+			continue;
+		fd_io[i]->revents = fds[i].revents;
+		ready_fds[nr_ready++] = fd_io[i];
+	}
+
+	return ret;
+}
+
+#endif /* __linux__ */
+
+static void io_fd_init(struct io_fd *io, void (*handler)(struct io_fd *),
+		       void *data)
+{
+	io->fd = -1;
+	io->events = 0;
+	io->revents = 0;
+	io->idx = -1;
+	io->handler = handler;
+	io->data = data;
+}
+
+/*
+ * Wait for events on fd, or stop waiting if events is 0.  Must be called
+ * with fd -1 before the descriptor is closed.
+ */
+static void io_update(struct io_fd *io, int fd, short events)
+{
+	if (fd != io->fd) {
+		if (io->events)
+			io_ctl(io, io->fd, 0);
+		io->events = 0;
+		io->revents = 0;
+		io->fd = fd;
+	}
+
+	if (fd == -1 || events == io->events)
+		return;
+
+	if (io_ctl(io, fd, events) || !events)
+		io->events = events;
+	if (!events)
+		io->revents = 0;
+}
+
+static void io_remove(struct io_fd *io)
+{
+	io_update(io, -1, 0);
+}
+
 static void do_replace_escape(const char *src, char *dest, int len)
 {
 	int i;
@@ -243,19 +476,7 @@ static void do_replace_escape(const char *src, char *dest, int len)
 static int write_all(int fd, const char* buf, size_t len)
 {
 	while (len) {
-		ssize_t ret;
-		if (replace_escape) {
-			char buf_replaced[1024];
-			size_t this_round;
-
-			if (len > sizeof(buf_replaced))
-				this_round = sizeof(buf_replaced);
-			else
-				this_round = len;
-			do_replace_escape(buf, buf_replaced, this_round);
-			ret = write(fd, buf_replaced, this_round);
-		} else
-			ret = write(fd, buf, len);
+		ssize_t ret = write(fd, buf, len);
 		if (ret == -1 && errno == EINTR)
 			continue;
 		if (ret <= 0)
@@ -267,14 +488,59 @@ static int write_all(int fd, const char* buf, size_t len)
 	return 0;
 }
 
-static int write_with_timestamp(int fd, const char *data, size_t sz,
-				int *needts)
+/* The timestamp prefix only changes once a second, so keep it around. */
+static const char *log_timestamp(size_t *len)
 {
-	char ts[32];
+	static char ts[32];
+	static size_t tslen;
+	static time_t last;
 	time_t now = time(NULL);
-	const struct tm *tmnow = localtime(&now);
-	size_t tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ", tmnow);
+
+	if (!tslen || now != last) {
+		tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ",
+				 localtime(&now));
+		last = now;
+	}
+
+	*len = tslen;
+	return ts;
+}
+
+static void log_copy(struct buffer *log, const char *data, size_t len)
+{
+	if ((log->capacity - log->size) < len) {
+		log->capacity = log->size + len + 1024;
+		log->data = realloc(log->data, log->capacity);
+		if (log->data == NULL) {
+			dolog(LOG_ERR, "Memory allocation failed");
+			exit(ENOMEM);
+		}
+	}
+
+	if (replace_escape)
+		do_replace_escape(data, log->data + log->size, len);
+	else
+		memcpy(log->data + log->size, data, len);
+	log->size += len;
+}
+
+/*
+ * Queue data for a log file, prefixing each line with a timestamp unless
+ * needts is NULL.  Nothing is written until log_flush().
+ */
+static void log_append(struct buffer *log, const char *data, size_t sz,
+		       int *needts)
+{
 	const char *last_byte = data + sz - 1;
+	const char *ts;
+	size_t tslen;
+
+	if (needts == NULL) {
+		log_copy(log, data, sz);
+		return;
+	}
+
+	ts = log_timestamp(&tslen);
 
 	while (data <= last_byte) {
 		const char *nl = memchr(data, '\n', last_byte + 1 - data);
@@ -282,9 +548,9 @@ static int write_with_timestamp(int fd, const char *data, size_t sz,
 		if (!found_nl)
 			nl = last_byte;
 
-		if ((*needts && write_all(fd, ts, tslen))
-		    || write_all(fd, data, nl + 1 - data))
-			return -1;
+		if (*needts)
+			log_copy(log, ts, tslen);
+		log_copy(log, data, nl + 1 - data);
 
 		*needts = found_nl;
 		data = nl + 1;
@@ -294,8 +560,37 @@ static int write_with_timestamp(int fd, const char *data, size_t sz,
 				data++;
 		}
 	}
+}
 
-	return 0;
+static int log_flush(int fd, struct buffer *log)
+{
+	int ret = write_all(fd, log->data, log->size);
+
+	log->size = 0;
+	return ret;
+}
+
+static void console_flush_log(struct console *con)
+{
+	if (con->log_fd == -1 || con->log.size == 0)
+		return;
+
+	if (log_flush(con->log_fd, &con->log) < 0)
+		dolog(LOG_ERR, "Write to log failed "
+		      "on domain %d: %d (%s)\n",
+		      con->d->domid, errno, strerror(errno));
+}
+
+/* Write out everything logged during this loop iteration. */
+static void flush_logs(void)
+{
+	struct console *con;
+
+	while ((con = log_queue) != NULL) {
+		log_queue = con->log_next;
+		con->log_queued = false;
+		console_flush_log(con);
+	}
 }
 
 static inline bool buffer_available(struct console *con)
@@ -311,7 +606,6 @@ static inline bool buffer_available(struct console *con)
 static void buffer_append(struct console *con)
 {
 	struct buffer *buffer = &con->buffer;
-	struct domain *dom = con->d;
 	XENCONS_RING_IDX cons, prod, size;
 	struct xencons_interface *intf = con->interface;
 
@@ -342,25 +636,20 @@ static void buffer_append(struct console *con)
 
 	/* Get the data to the logfile as early as possible because if
 	 * no one is listening on the console pty then it will fill up
-	 * and handle_tty_write will stop being called.
+	 * and handle_tty_write will stop being called.  It is written
+	 * out at the end of the loop iteration, or once enough of it
+	 * has been queued.
 	 */
 	if (con->log_fd != -1) {
-		int logret;
-		if (log_time_guest) {
-			logret = write_with_timestamp(
-				con->log_fd,
-				buffer->data + buffer->size - size,
-				size, &log_time_guest_needts);
-		} else {
-			logret = write_all(
-				con->log_fd,
-				buffer->data + buffer->size - size,
-				size);
+		log_append(&con->log, buffer->data + buffer->size - size,
+			   size, log_time_guest ? &con->log_needts : NULL);
+		if (con->log.size >= LOG_FLUSH_THRESHOLD) {
+			console_flush_log(con);
+		} else if (!con->log_queued) {
+			con->log_queued = true;
+			con->log_next = log_queue;
+			log_queue = con;
 		}
-		if (logret < 0)
-			dolog(LOG_ERR, "Write to log failed "
-			      "on domain %d: %d (%s)\n",
-			      dom->domid, errno, strerror(errno));
 	}
 
 	if (discard_overflowed_data && buffer->max_capacity &&
@@ -405,6 +694,53 @@ static void buffer_advance(struct buffer *buffer, size_t len)
 	}
 }
 
+static int ring_free_bytes(struct console *con)
+{
+	struct xencons_interface *intf = con->interface;
+	XENCONS_RING_IDX cons, prod, space;
+
+	cons = intf->in_cons;
+	prod = intf->in_prod;
+	xen_mb();
+
+	space = prod - cons;
+	if (space > sizeof(intf->in))
+		return 0; /* ring is screwed: ignore it */
+
+	return (sizeof(intf->in) - space);
+}
+
+/*
+ * Work out what to wait for on the console's event channel and tty.  Needs
+ * calling whenever anything these depend on may have changed, which is
+ * after handling any of the console's events.
+ */
+static void console_update_events(struct console *con)
+{
+	short events = 0;
+
+	if (con->xce_handle != NULL && !con->d->is_dead &&
+	    con->event_count < RATE_LIMIT_ALLOWANCE && buffer_available(con))
+		events = POLLIN|POLLPRI;
+	io_update(&con->xce_io,
+		  con->xce_handle ? xenevtchn_fd(con->xce_handle) : -1,
+		  events);
+
+	events = 0;
+	if (con->master_fd != -1) {
+		if (!con->d->is_dead && con->interface &&
+		    ring_free_bytes(con))
+			events |= POLLIN;
+
+		if (!buffer_empty(&con->buffer))
+			events |= POLLOUT;
+
+		if (events)
+			events |= POLLPRI;
+	}
+	io_update(&con->tty_io, con->master_fd, events);
+}
+
 static bool domain_is_valid(int domid)
 {
 	bool ret;
@@ -428,9 +764,9 @@ static int create_hv_log(void)
 		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
 		      logfile, errno, strerror(errno));
 	if (fd != -1 && log_time_hv) {
-		if (write_with_timestamp(fd, "Logfile Opened\n",
-					 strlen("Logfile Opened\n"),
-					 &log_time_hv_needts) < 0) {
+		log_append(&hv_log, "Logfile Opened\n",
+			   strlen("Logfile Opened\n"), &log_time_hv_needts);
+		if (log_flush(fd, &hv_log) < 0) {
 			dolog(LOG_ERR, "Failed to log opening timestamp "
 				       "in %s: %d (%s)", logfile, errno,
 				       strerror(errno));
@@ -477,9 +813,9 @@ static int create_console_log(struct console *con)
 		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
 		      logfile, errno, strerror(errno));
 	if (fd != -1 && log_time_guest) {
-		if (write_with_timestamp(fd, "Logfile Opened\n",
-					 strlen("Logfile Opened\n"),
-					 &log_time_guest_needts) < 0) {
+		log_append(&con->log, "Logfile Opened\n",
+			   strlen("Logfile Opened\n"), &con->log_needts);
+		if (log_flush(fd, &con->log) < 0) {
 			dolog(LOG_ERR, "Failed to log opening timestamp "
 				       "in %s: %d (%s)", logfile, errno,
 				       strerror(errno));
@@ -492,6 +828,8 @@ static int create_console_log(struct console *con)
 
 static void console_close_tty(struct console *con)
 {
+	io_remove(&con->tty_io);
+
 	if (con->master_fd != -1) {
 		close(con->master_fd);
 		con->master_fd = -1;
@@ -750,6 +1088,7 @@ static int console_create_ring(struct console *con)
 
 	con->local_port = -1;
 	con->remote_port = -1;
+	io_remove(&con->xce_io);
 	if (con->xce_handle != NULL)
 		xenevtchn_close(con->xce_handle);
 
@@ -788,6 +1127,7 @@ static int console_create_ring(struct console *con)
 		con->log_fd = create_console_log(con);
 
  out:
+	console_update_events(con);
 	return err;
 }
 
@@ -811,6 +1151,9 @@ static bool watch_domain(struct domain *dom, bool watch)
 	return success;
 }
 
+static void console_ring_event(struct io_fd *io);
+static void console_tty_event(struct io_fd *io);
+
 static int console_init(struct console *con, struct domain *dom, void **data)
 {
 	char *s;
@@ -826,13 +1169,14 @@ static int console_init(struct console *con, struct domain *dom, void **data)
 	}
 
 	con->master_fd = -1;
-	con->master_pollfd_idx = -1;
+	io_fd_init(&con->tty_io, console_tty_event, con);
 	con->slave_fd = -1;
 	con->log_fd = -1;
+	con->log_needts = 1;
 	con->ring_ref = -1;
 	con->local_port = -1;
 	con->remote_port = -1;
-	con->xce_pollfd_idx = -1;
+	io_fd_init(&con->xce_io, console_ring_event, con);
 	con->next_period = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + RATE_LIMIT_PERIOD;
 	con->d = dom;
 	con->ttyname = (*con_type)->ttyname;
@@ -883,6 +1227,8 @@ static struct domain *create_domain(int domid)
 
 	dom->next = dom_head;
 	dom_head = dom;
+	dom->hash_next = dom_hash[domid % DOM_HASH_SIZE];
+	dom_hash[domid % DOM_HASH_SIZE] = dom;
 
 	dolog(LOG_DEBUG, "New domain %d", domid);
 
@@ -897,7 +1243,7 @@ static struct domain *lookup_domain(int domid)
 {
 	struct domain *dom;
 
-	for (dom = dom_head; dom; dom = dom->next)
+	for (dom = dom_hash[domid % DOM_HASH_SIZE]; dom; dom = dom->hash_next)
 		if (dom->domid == domid)
 			return dom;
 	return NULL;
@@ -909,6 +1255,14 @@ static void remove_domain(struct domain *dom)
 
 	dolog(LOG_DEBUG, "Removing domain-%d", dom->domid);
 
+	for (pp = &dom_hash[dom->domid % DOM_HASH_SIZE]; *pp;
+	     pp = &(*pp)->hash_next) {
+		if (dom == *pp) {
+			*pp = dom->hash_next;
+			break;
+		}
+	}
+
 	for (pp = &dom_head; *pp; pp = &(*pp)->next) {
 		if (dom == *pp) {
 			*pp = dom->next;
@@ -928,6 +1282,9 @@ static void console_cleanup(struct console *con)
 	free(con->buffer.data);
 	con->buffer.data = NULL;
 
+	free(con->log.data);
+	con->log.data = NULL;
+
 	free(con->xspath);
 	con->xspath = NULL;
 }
@@ -941,17 +1298,38 @@ static void cleanup_domain(struct domain *d)
 	remove_domain(d);
 }
 
+static void console_unthrottle(struct console *con)
+{
+	struct console **pp;
+
+	if (!con->throttled)
+		return;
+
+	for (pp = &throttled_consoles; *pp; pp = &(*pp)->throttle_next) {
+		if (con == *pp) {
+			*pp = con->throttle_next;
+			break;
+		}
+	}
+	con->throttled = false;
+}
+
 static void console_close_evtchn(struct console *con)
 {
+	console_unthrottle(con);
+	io_remove(&con->xce_io);
+
 	if (con->xce_handle != NULL)
 		xenevtchn_close(con->xce_handle);
 
 	con->xce_handle = NULL;
 }
 
+/* The domain is cleaned up at the end of the current loop iteration. */
 static void shutdown_domain(struct domain *d)
 {
 	d->is_dead = true;
+	dead_domains = true;
 	watch_domain(d, false);
 	console_iter_void_arg1(d, console_unmap_interface);
 	console_iter_void_arg1(d, console_close_evtchn);
@@ -961,41 +1339,55 @@ static unsigned enum_pass = 0;
 
 static void enum_domains(void)
 {
-	int domid = 1;
-	xc_dominfo_t dominfo;
+	static xc_domaininfo_t info[DOMINFO_BATCH];
+	uint32_t domid = 1;
 	struct domain *dom;
+	int i, nr;
 
 	enum_pass++;
 
-	while (xc_domain_getinfo(xc, domid, 1, &dominfo) == 1) {
-		dom = lookup_domain(dominfo.domid);
-		if (dominfo.dying) {
+	do {
+		nr = xc_domain_getinfolist(xc, domid, DOMINFO_BATCH, info);
+		for (i = 0; i < nr; i++) {
+			dom = lookup_domain(info[i].domain);
+			if (info[i].flags & XEN_DOMINF_dying) {
+				if (dom)
+					shutdown_domain(dom);
+			} else {
+				if (dom == NULL)
+					dom = create_domain(info[i].domain);
+			}
 			if (dom)
-				shutdown_domain(dom);
-		} else {
-			if (dom == NULL)
-				dom = create_domain(dominfo.domid);
+				dom->last_seen = enum_pass;
 		}
-		if (dom)
-			dom->last_seen = enum_pass;
-		domid = dominfo.domid + 1;
+		if (nr > 0)
+			domid = info[nr - 1].domain + 1;
+	} while (nr == DOMINFO_BATCH);
+
+	/* Don't lose track of every domain over a failed hypercall. */
+	if (nr < 0) {
+		dolog(LOG_ERR, "Failed to list domains: %d (%s)",
+		      errno, strerror(errno));
+		return;
 	}
+
+	/* Domains which went away without being seen dying. */
+	for (dom = dom_head; dom; dom = dom->next)
+		if (dom->last_seen != enum_pass && !dom->is_dead)
+			shutdown_domain(dom);
 }
 
-static int ring_free_bytes(struct console *con)
+static void cleanup_dead_domains(void)
 {
-	struct xencons_interface *intf = con->interface;
-	XENCONS_RING_IDX cons, prod, space;
-
-	cons = intf->in_cons;
-	prod = intf->in_prod;
-	xen_mb();
+	struct domain *d, *n;
 
-	space = prod - cons;
-	if (space > sizeof(intf->in))
-		return 0; /* ring is screwed: ignore it */
+	dead_domains = false;
 
-	return (sizeof(intf->in) - space);
+	for (d = dom_head; d; d = n) {
+		n = d->next;
+		if (d->is_dead)
+			cleanup_domain(d);
+	}
 }
 
 static void console_handle_broken_tty(struct console *con, int recreate)
@@ -1070,25 +1462,41 @@ static void handle_tty_write(struct console *con)
 	}
 }
 
-static void console_evtchn_unmask(struct console *con, void *data)
+/*
+ * Give rate limited consoles a new allowance once their period is up.
+ * Returns when the next of the remaining ones is due, or 0 if none are.
+ */
+static long long expire_throttles(void)
 {
-	long long now = *(long long *)data;
-
-	if (!console_enabled(con))
-		return;
+	struct console **pp = &throttled_consoles, *con;
+	long long next_timeout = 0;
+
+	while ((con = *pp) != NULL) {
+		/* CS 16257:955ee4fa1345 introduces a 5ms fuzz
+		 * for select(), it is not clear poll() has
+		 * similar behavior (returning a couple of ms
+		 * sooner than requested) as well. Just leave
+		 * the fuzz here. Remove it with a separate
+		 * patch if necessary */
+		if ((now_ms+5) > con->next_period) {
+			*pp = con->throttle_next;
+			con->throttled = false;
+			con->next_period = now_ms + RATE_LIMIT_PERIOD;
+			con->event_count = 0;
+			if (console_enabled(con))
+				(void)xenevtchn_unmask(con->xce_handle,
+						       con->local_port);
+			console_update_events(con);
+			continue;
+		}
 
-	/* CS 16257:955ee4fa1345 introduces a 5ms fuzz
-	 * for select(), it is not clear poll() has
-	 * similar behavior (returning a couple of ms
-	 * sooner than requested) as well. Just leave
-	 * the fuzz here. Remove it with a separate
-	 * patch if necessary */
-	if ((now+5) > con->next_period) {
-		con->next_period = now + RATE_LIMIT_PERIOD;
-		if (con->event_count >= RATE_LIMIT_ALLOWANCE)
-			(void)xenevtchn_unmask(con->xce_handle, con->local_port);
-		con->event_count = 0;
+		/* Determine if we're going to be the next time slice to expire */
+		if (!next_timeout || con->next_period < next_timeout)
+			next_timeout = con->next_period;
+		pp = &con->throttle_next;
 	}
+
+	return next_timeout;
 }
 
 static void handle_ring_read(struct console *con)
@@ -1108,27 +1516,34 @@ static void handle_ring_read(struct console *con)
 		return;
 	}
 
+	/* Start a new period if the last one is up (see expire_throttles). */
+	if ((now_ms+5) > con->next_period) {
+		con->next_period = now_ms + RATE_LIMIT_PERIOD;
+		con->event_count = 0;
+	}
+
 	con->event_count++;
 
 	buffer_append(con);
 
 	if (con->event_count < RATE_LIMIT_ALLOWANCE)
 		(void)xenevtchn_unmask(con->xce_handle, port);
+	else if (!con->throttled) {
+		con->throttled = true;
+		con->throttle_next = throttled_consoles;
+		throttled_consoles = con;
+	}
 }
 
-static void handle_console_ring(struct console *con)
+static void console_ring_event(struct io_fd *io)
 {
-	if (con->event_count < RATE_LIMIT_ALLOWANCE) {
-		if (con->xce_handle != NULL &&
-		    con->xce_pollfd_idx != -1 &&
-		    !(fds[con->xce_pollfd_idx].revents &
-		      ~(POLLIN|POLLOUT|POLLPRI)) &&
-		    (fds[con->xce_pollfd_idx].revents &
-		     POLLIN))
-			handle_ring_read(con);
-	}
+	struct console *con = io->data;
+
+	if (!(io->revents & ~(POLLIN|POLLOUT|POLLPRI)) &&
+	    (io->revents & POLLIN))
+		handle_ring_read(con);
 
-	con->xce_pollfd_idx = -1;
+	console_update_events(con);
 }
 
 static void handle_xs(void)
@@ -1136,23 +1551,38 @@ static void handle_xs(void)
 	char **vec;
 	int domid;
 	struct domain *dom;
-	unsigned int num;
+	bool domlist = false;
 
-	vec = xs_read_watch(xs, &num);
-	if (!vec)
-		return;
+	/*
+	 * Drain every pending watch, so that a burst of domains being
+	 * created or destroyed only rescans the domain list once.
+	 */
+	while ((vec = xs_check_watch(xs)) != NULL) {
+		if (!strcmp(vec[XS_WATCH_TOKEN], "domlist"))
+			domlist = true;
+		else if (sscanf(vec[XS_WATCH_TOKEN], "dom%u", &domid) == 1) {
+			dom = lookup_domain(domid);
+			/* We may get watches firing for domains that have
+			   recently been removed, so dom may be NULL here. */
+			if (dom && dom->is_dead == false)
+				console_iter_int_arg1(dom, console_create_ring);
+		}
 
-	if (!strcmp(vec[XS_WATCH_TOKEN], "domlist"))
-		enum_domains();
-	else if (sscanf(vec[XS_WATCH_TOKEN], "dom%u", &domid) == 1) {
-		dom = lookup_domain(domid);
-		/* We may get watches firing for domains that have recently
-		   been removed, so dom may be NULL here. */
-		if (dom && dom->is_dead == false)
-			console_iter_int_arg1(dom, console_create_ring);
+		free(vec);
 	}
 
-	free(vec);
+	if (domlist)
+		enum_domains();
+}
+
+static void xs_event(struct io_fd *io)
+{
+	if (io->revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		dolog(LOG_ERR, "Failure in poll xs_handle: %d (%s)",
+		      errno, strerror(errno));
+		io_failed = true;
+	} else if (io->revents & POLLIN)
+		handle_xs();
 }
 
 static void handle_hv_logs(xenevtchn_handle *xce_handle, bool force)
@@ -1168,20 +1598,14 @@ static void handle_hv_logs(xenevtchn_handle *xce_handle, bool force)
 
 	do
 	{
-		int logret;
-
 		size = sizeof(buffer);
 		if (xc_readconsolering(xc, bufptr, &size, 0, 1, &index) != 0 ||
 		    size == 0)
 			break;
 
-		if (log_time_hv)
-			logret = write_with_timestamp(log_hv_fd, buffer, size,
-						      &log_time_hv_needts);
-		else
-			logret = write_all(log_hv_fd, buffer, size);
-
-		if (logret < 0)
+		log_append(&hv_log, buffer, size,
+			   log_time_hv ? &log_time_hv_needts : NULL);
+		if (log_flush(log_hv_fd, &hv_log) < 0)
 			dolog(LOG_ERR, "Failed to write hypervisor log: "
 				       "%d (%s)", errno, strerror(errno));
 	} while (size == sizeof(buffer));
@@ -1190,11 +1614,24 @@ static void handle_hv_logs(xenevtchn_handle *xce_handle, bool force)
 		(void)xenevtchn_unmask(xce_handle, port);
 }
 
+static void hv_event(struct io_fd *io)
+{
+	if (io->revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		dolog(LOG_ERR,
+		      "Failure in poll xce_handle: %d (%s)",
+		      errno, strerror(errno));
+		io_failed = true;
+	} else if (io->revents & POLLIN)
+		handle_hv_logs(io->data, false);
+}
+
 static void console_open_log(struct console *con)
 {
 	if (console_enabled(con)) {
-		if (con->log_fd != -1)
+		if (con->log_fd != -1) {
+			console_flush_log(con);
 			close(con->log_fd);
+		}
 		con->log_fd = create_console_log(con);
 	}
 }
@@ -1215,108 +1652,42 @@ static void handle_log_reload(void)
 	}
 }
 
-/* Returns index inside fds array if succees, -1 if fail */
-static int set_fds(int fd, short events)
-{
-	int ret;
-	if (current_array_size < nr_fds + 1) {
-		struct pollfd  *new_fds = NULL;
-		unsigned long newsize;
-
-		/* Round up to 2^8 boundary, in practice this just
-		 * make newsize larger than current_array_size.
-		 */
-		newsize = ROUNDUP(nr_fds + 1, 8);
-
-		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
-		if (!new_fds)
-			goto fail;
-		fds = new_fds;
-
-		memset(&fds[0] + current_array_size, 0,
-		       sizeof(struct pollfd) * (newsize-current_array_size));
-		current_array_size = newsize;
-	}
-
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
-
-	return ret;
-fail:
-	dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
-	return -1;
-}
-
-static void reset_fds(void)
+static void console_tty_event(struct io_fd *io)
 {
-	nr_fds = 0;
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
-}
-
-static void maybe_add_console_evtchn_fd(struct console *con, void *data)
-{
-	long long next_timeout = *((long long *)data);
-
-	if (con->event_count >= RATE_LIMIT_ALLOWANCE) {
-		/* Determine if we're going to be the next time slice to expire */
-		if (!next_timeout ||
-		    con->next_period < next_timeout)
-			next_timeout = con->next_period;
-	} else if (con->xce_handle != NULL) {
-		if (buffer_available(con)) {
-			int evtchn_fd = xenevtchn_fd(con->xce_handle);
-			con->xce_pollfd_idx = set_fds(evtchn_fd,
-						      POLLIN|POLLPRI);
-		}
+	struct console *con = io->data;
+
+	if (io->revents & ~(POLLIN|POLLOUT|POLLPRI))
+		console_handle_broken_tty(con, domain_is_valid(con->d->domid));
+	else {
+		if (io->revents & POLLIN)
+			handle_tty_read(con);
+		/* A broken tty found while reading clears revents. */
+		if (io->revents & POLLOUT)
+			handle_tty_write(con);
 	}
 
-	*((long long *)data) = next_timeout;
+	console_update_events(con);
 }
 
-static void maybe_add_console_tty_fd(struct console *con)
+static int update_now(void)
 {
-	if (con->master_fd != -1) {
-		short events = 0;
-		if (!con->d->is_dead && ring_free_bytes(con))
-			events |= POLLIN;
-
-		if (!buffer_empty(&con->buffer))
-			events |= POLLOUT;
-
-		if (events)
-			con->master_pollfd_idx =
-				set_fds(con->master_fd, events|POLLPRI);
-	}
-}
+	struct timespec ts;
 
-static void handle_console_tty(struct console *con)
-{
-	if (con->master_fd != -1 && con->master_pollfd_idx != -1) {
-		if (fds[con->master_pollfd_idx].revents &
-		    ~(POLLIN|POLLOUT|POLLPRI))
-			console_handle_broken_tty(con, domain_is_valid(con->d->domid));
-		else {
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLIN)
-				handle_tty_read(con);
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLOUT)
-				handle_tty_write(con);
-		}
-	}
-	con->master_pollfd_idx = -1;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return -1;
+	now_ms = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+	return 0;
 }
 
 void handle_io(void)
 {
 	int ret;
 	xenevtchn_port_or_error_t log_hv_evtchn = -1;
-	int xce_pollfd_idx = -1;
-	int xs_pollfd_idx = -1;
 	xenevtchn_handle *xce_handle = NULL;
+	struct io_fd xs_io, hv_io;
+
+	if (io_setup())
+		goto out;
 
 	if (log_hv) {
 		xce_handle = xenevtchn_open(NULL, 0);
@@ -1336,6 +1707,9 @@ void handle_io(void)
 		}
 		/* Log the boot dmesg even if VIRQ_CON_RING isn't pending. */
 		handle_hv_logs(xce_handle, true);
+
+		io_fd_init(&hv_io, hv_event, xce_handle);
+		io_update(&hv_io, xenevtchn_fd(xce_handle), POLLIN|POLLPRI);
 	}
 
 	xgt_handle = xengnttab_open(NULL, 0);
@@ -1344,48 +1718,34 @@ void handle_io(void)
 		      errno, strerror(errno));
 	}
 
-	enum_domains();
-
-	for (;;) {
-		struct domain *d, *n;
-		int poll_timeout; /* timeout in milliseconds */
-		struct timespec ts;
-		long long now, next_timeout = 0;
-
-		reset_fds();
+	io_fd_init(&xs_io, xs_event, NULL);
+	io_update(&xs_io, xs_fileno(xs), POLLIN|POLLPRI);
 
-		xs_pollfd_idx = set_fds(xs_fileno(xs), POLLIN|POLLPRI);
+	enum_domains();
+	cleanup_dead_domains();
 
-		if (log_hv)
-			xce_pollfd_idx = set_fds(xenevtchn_fd(xce_handle),
-						 POLLIN|POLLPRI);
+	while (!io_failed) {
+		int poll_timeout = -1; /* timeout in milliseconds */
+		long long next_timeout;
+		unsigned int i;
 
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		if (update_now() < 0)
 			break;
-		now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 
 		/* Re-calculate any event counter allowances & unblock
 		   domains with new allowance */
-		for (d = dom_head; d; d = d->next) {
-
-			console_iter_void_arg2(d, console_evtchn_unmask, (void *)&now);
-
-			console_iter_void_arg2(d, maybe_add_console_evtchn_fd, 
-					       (void *)&next_timeout);
-
-			console_iter_void_arg1(d, maybe_add_console_tty_fd);
-		}
+		next_timeout = expire_throttles();
 
 		/* If any domain has been rate limited, we need to work
 		   out what timeout to supply to poll */
 		if (next_timeout) {
-			long long duration = (next_timeout - now);
+			long long duration = (next_timeout - now_ms);
 			if (duration <= 0) /* sanity check */
 				duration = 1;
 			poll_timeout = (int)duration;
 		}
 
-		ret = poll(fds, nr_fds, next_timeout ? poll_timeout : -1);
+		ret = io_wait(poll_timeout);
 
 		if (log_reload) {
 			int saved_errno = errno;
@@ -1406,57 +1766,37 @@ void handle_io(void)
 			break;
 		}
 
-		if (log_hv && xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xce_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN)
-				handle_hv_logs(xce_handle, false);
-
-			xce_pollfd_idx = -1;
-		}
-
-		if (ret <= 0)
-			continue;
+		if (update_now() < 0)
+			break;
 
-		if (xs_pollfd_idx != -1) {
-			if (fds[xs_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xs_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xs_pollfd_idx].revents & POLLIN)
-				handle_xs();
+		/*
+		 * Handlers may stop waiting on, or replace, descriptors
+		 * further down the list, which clears their revents.
+		 * Domains are only freed once all of them have run.
+		 */
+		for (i = 0; i < nr_ready; i++) {
+			struct io_fd *io = ready_fds[i];
 
-			xs_pollfd_idx = -1;
+			if (!io->revents)
+				continue;
+			io->handler(io);
+			io->revents = 0;
 		}
 
-		for (d = dom_head; d; d = n) {
-
-			n = d->next;
-
-			console_iter_void_arg1(d, handle_console_ring);
+		flush_logs();
 
-			console_iter_void_arg1(d, handle_console_tty);
-
-			if (d->last_seen != enum_pass)
-				shutdown_domain(d);
-
-			if (d->is_dead)
-				cleanup_domain(d);
-		}
+		if (dead_domains)
+			cleanup_dead_domains();
 	}
 
-	free(fds);
-	current_array_size = 0;
-
  out:
+	io_teardown();
 	if (log_hv_fd != -1) {
 		close(log_hv_fd);
 		log_hv_fd = -1;
 	}
+	free(hv_log.data);
+	hv_log.data = NULL;
 	if (xce_handle != NULL) {
 		xenevtchn_close(xce_handle);
 		xce_handle = NULL;
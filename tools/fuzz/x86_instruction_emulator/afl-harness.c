@@ -1,18 +1,32 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <getopt.h>
 #include "fuzz-emul.h"
 
 static uint8_t input[INPUT_SIZE];
 
+static unsigned long long ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 int main(int argc, char **argv)
 {
     size_t size;
     FILE *fp = NULL;
     int max, count;
+    bool throughput = false;
+    unsigned int inputs = 0;
+    unsigned long long ns = 0;
 
     setbuf(stdin, NULL);
     setbuf(stdout, NULL);
@@ -21,9 +35,11 @@ int main(int argc, char **argv)
     {
         enum {
             OPT_MIN_SIZE,
+            OPT_THROUGHPUT,
         };
         static const struct option lopts[] = {
             { "min-input-size", no_argument, NULL, OPT_MIN_SIZE },
+            { "throughput", no_argument, NULL, OPT_THROUGHPUT },
             { 0, 0, 0, 0 }
         };
         int c = getopt_long_only(argc, argv, "", lopts, NULL);
@@ -38,8 +54,13 @@ int main(int argc, char **argv)
             exit(0);
             break;
 
+        case OPT_THROUGHPUT:
+            throughput = true;
+            break;
+
         case '?':
-            printf("Usage: %s $FILE [$FILE...] | [--min-input-size]\n", argv[0]);
+            printf("Usage: %s [--throughput] $FILE [$FILE...] | [--min-input-size]\n",
+                   argv[0]);
             exit(-1);
             break;
 
@@ -102,7 +123,11 @@ int main(int argc, char **argv)
         /* Only run the test if the input file was smaller than INPUT_SIZE */
         if ( feof(fp) )
         {
+            unsigned long long start = ns_now();
+
             LLVMFuzzerTestOneInput(input, size);
+            ns += ns_now() - start;
+            inputs++;
         }
         else
         {
@@ -119,6 +144,13 @@ int main(int argc, char **argv)
         }
     }
 
+    /* Machine readable summary, for tracking corpus throughput. */
+    if ( throughput && inputs )
+        printf("throughput: inputs=%u emulations=%lu ns=%llu"
+               " ns_per_input=%llu ns_per_emulation=%llu\n",
+               inputs, fuzz_emulations(), ns, ns / inputs,
+               fuzz_emulations() ? ns / fuzz_emulations() : 0);
+
     return 0;
 }
 
@@ -819,6 +819,9 @@ int LLVMFuzzerInitialize(int *argc, char ***argv)
     return 0;
 }
 
+/* Number of x86_emulate() invocations, for throughput reporting. */
+static unsigned long emulations;
+
 int LLVMFuzzerTestOneInput(const uint8_t *data_p, size_t size)
 {
     struct fuzz_state state = {
@@ -864,6 +867,7 @@ int LLVMFuzzerTestOneInput(const uint8_t *data_p, size_t size)
         dump_state(&ctxt);
 
         rc = x86_emulate(&ctxt, &state.ops);
+        emulations++;
         printf("Emulation result: %d\n", rc);
     } while ( rc == X86EMUL_OKAY );
 
@@ -875,6 +879,11 @@ unsigned int fuzz_minimal_input_size(void)
     return DATA_OFFSET + 1;
 }
 
+unsigned long fuzz_emulations(void)
+{
+    return emulations;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -4,6 +4,7 @@
 extern int LLVMFuzzerInitialize(int *argc, char ***argv);
 extern int LLVMFuzzerTestOneInput(const uint8_t *data_p, size_t size);
 extern unsigned int fuzz_minimal_input_size(void);
+extern unsigned long fuzz_emulations(void);
 
 #define INPUT_SIZE  4096
 
@@ -24,113 +24,287 @@
 
 #define ROUNDUP(_x,_w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
 
-pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Threads are spread over the shards of every handle's buffer cache,
+ * round robin in the order they first allocate or free a buffer.
+ */
+static pthread_key_t shard_pkey;
+static pthread_once_t shard_pkey_once = PTHREAD_ONCE_INIT;
+
+static void init_shard_pkey(void)
+{
+    pthread_key_create(&shard_pkey, NULL);
+}
+
+static struct buffer_cache *cache_shard(xencall_handle *xcall)
+{
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static unsigned long next_shard;
+    unsigned long shard;
+    int saved_errno;
+
+    if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
+        return &xcall->buffer_cache[0];
 
-static void cache_lock(xencall_handle *xcall)
+    saved_errno = errno;
+    pthread_once(&shard_pkey_once, init_shard_pkey);
+
+    /* Stored plus one, as NULL means none has been picked yet. */
+    shard = (unsigned long)pthread_getspecific(shard_pkey);
+    if ( !shard )
+    {
+        pthread_mutex_lock(&mutex);
+        shard = next_shard++ % BUFFER_CACHE_SHARDS + 1;
+        pthread_mutex_unlock(&mutex);
+        pthread_setspecific(shard_pkey, (void *)shard);
+    }
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+
+    return &xcall->buffer_cache[shard - 1];
+}
+
+static void cache_lock(xencall_handle *xcall, pthread_mutex_t *lock)
 {
     int saved_errno = errno;
     if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
         return;
-    pthread_mutex_lock(&cache_mutex);
+    pthread_mutex_lock(lock);
     /* Ignore pthread errors. */
     errno = saved_errno;
 }
 
-static void cache_unlock(xencall_handle *xcall)
+static void cache_unlock(xencall_handle *xcall, pthread_mutex_t *lock)
 {
     int saved_errno = errno;
     if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
         return;
-    pthread_mutex_unlock(&cache_mutex);
+    pthread_mutex_unlock(lock);
     /* Ignore pthread errors. */
     errno = saved_errno;
 }
 
+/* Size class of an allocation, or -1 if it is too big to be cached. */
+static int cache_class(size_t nr_pages)
+{
+    int class = 0;
+
+    while ( (1UL << class) < nr_pages )
+        if ( ++class == BUFFER_CACHE_CLASSES )
+            return -1;
+
+    return class;
+}
+
+/*
+ * Number of pages actually allocated for a request of nr_pages: rounded up
+ * to the size class, or to whole huge buffers if they are in use.
+ */
+static size_t alloc_pages_for(xencall_handle *xcall, size_t nr_pages)
+{
+    int class = cache_class(nr_pages);
+
+    if ( class >= 0 )
+        return 1UL << class;
+
+    if ( xcall->flags & XENCALL_OPENFLAG_HUGE_BUFFERS )
+        return (nr_pages + HUGE_BUFFER_PAGES - 1) &
+               ~(size_t)(HUGE_BUFFER_PAGES - 1);
+
+    return nr_pages;
+}
+
 static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
 {
+    struct buffer_cache *bc = cache_shard(xcall);
+    int class = cache_class(nr_pages);
     void *p = NULL;
 
-    cache_lock(xcall);
+    cache_lock(xcall, &bc->lock);
 
-    xcall->buffer_total_allocations++;
-    xcall->buffer_current_allocations++;
-    if ( xcall->buffer_current_allocations > xcall->buffer_maximum_allocations )
-        xcall->buffer_maximum_allocations = xcall->buffer_current_allocations;
+    bc->total_allocations++;
+    bc->current_allocations++;
 
-    if ( nr_pages > 1 )
+    if ( class < 0 )
     {
-        xcall->buffer_cache_toobig++;
+        bc->cache_toobig++;
     }
-    else if ( xcall->buffer_cache_nr > 0 )
+    else if ( bc->nr[class] > 0 )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        xcall->buffer_cache_hits++;
+        p = bc->cache[class][--bc->nr[class]];
+        bc->nr_pages -= 1U << class;
+        bc->cache_hits++;
     }
     else
     {
-        xcall->buffer_cache_misses++;
+        bc->cache_misses++;
     }
 
-    cache_unlock(xcall);
+    cache_unlock(xcall, &bc->lock);
 
     return p;
 }
 
 static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
 {
+    struct buffer_cache *bc = cache_shard(xcall);
+    int class = cache_class(nr_pages);
     int rc = 0;
 
-    cache_lock(xcall);
+    cache_lock(xcall, &bc->lock);
+
+    bc->total_releases++;
+    bc->current_allocations--;
+
+    if ( class >= 0 &&
+         bc->nr[class] < BUFFER_CACHE_SIZE &&
+         bc->nr_pages + (1U << class) <= BUFFER_CACHE_MAX_PAGES )
+    {
+        bc->cache[class][bc->nr[class]++] = p;
+        bc->nr_pages += 1U << class;
+        rc = 1;
+    }
+
+    cache_unlock(xcall, &bc->lock);
 
-    xcall->buffer_total_releases++;
-    xcall->buffer_current_allocations--;
+    return rc;
+}
 
-    if ( nr_pages == 1 &&
-         xcall->buffer_cache_nr < BUFFER_CACHE_SIZE )
+static void *huge_cache_alloc(xencall_handle *xcall, size_t nr_pages)
+{
+    void *p = NULL;
+    int i;
+
+    cache_lock(xcall, &xcall->huge_lock);
+
+    for ( i = 0; i < xcall->huge_cache_nr; i++ )
     {
-        xcall->buffer_cache[xcall->buffer_cache_nr++] = p;
+        if ( xcall->huge_cache_pages[i] != nr_pages )
+            continue;
+
+        p = xcall->huge_cache[i];
+        xcall->huge_cache_nr--;
+        xcall->huge_cache[i] = xcall->huge_cache[xcall->huge_cache_nr];
+        xcall->huge_cache_pages[i] =
+            xcall->huge_cache_pages[xcall->huge_cache_nr];
+        break;
+    }
+
+    if ( p )
+        xcall->huge_cache_hits++;
+    else
+        xcall->huge_cache_misses++;
+
+    cache_unlock(xcall, &xcall->huge_lock);
+
+    return p;
+}
+
+static int huge_cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
+{
+    size_t cached = 0;
+    int i, rc = 0;
+
+    cache_lock(xcall, &xcall->huge_lock);
+
+    for ( i = 0; i < xcall->huge_cache_nr; i++ )
+        cached += xcall->huge_cache_pages[i];
+
+    if ( xcall->huge_cache_nr < HUGE_CACHE_SIZE &&
+         cached + nr_pages <= HUGE_CACHE_MAX_PAGES )
+    {
+        xcall->huge_cache[xcall->huge_cache_nr] = p;
+        xcall->huge_cache_pages[xcall->huge_cache_nr] = nr_pages;
+        xcall->huge_cache_nr++;
         rc = 1;
     }
 
-    cache_unlock(xcall);
+    cache_unlock(xcall, &xcall->huge_lock);
 
     return rc;
 }
 
+void buffer_init_cache(xencall_handle *xcall)
+{
+    int i;
+
+    memset(xcall->buffer_cache, 0, sizeof(xcall->buffer_cache));
+    for ( i = 0; i < BUFFER_CACHE_SHARDS; i++ )
+        pthread_mutex_init(&xcall->buffer_cache[i].lock, NULL);
+
+    pthread_mutex_init(&xcall->huge_lock, NULL);
+    xcall->huge_cache_nr = 0;
+    xcall->huge_cache_hits = 0;
+    xcall->huge_cache_misses = 0;
+}
+
 void buffer_release_cache(xencall_handle *xcall)
 {
-    void *p;
+    int total_allocations = 0, total_releases = 0, current_allocations = 0;
+    int cache_nr = 0, cache_hits = 0, cache_misses = 0, cache_toobig = 0;
+    int i, class;
 
-    cache_lock(xcall);
+    for ( i = 0; i < BUFFER_CACHE_SHARDS; i++ )
+    {
+        struct buffer_cache *bc = &xcall->buffer_cache[i];
+
+        cache_lock(xcall, &bc->lock);
+
+        total_allocations += bc->total_allocations;
+        total_releases += bc->total_releases;
+        current_allocations += bc->current_allocations;
+        cache_hits += bc->cache_hits;
+        cache_misses += bc->cache_misses;
+        cache_toobig += bc->cache_toobig;
+
+        for ( class = 0; class < BUFFER_CACHE_CLASSES; class++ )
+        {
+            cache_nr += bc->nr[class];
+            while ( bc->nr[class] > 0 )
+                osdep_free_pages(xcall, bc->cache[class][--bc->nr[class]],
+                                 1UL << class);
+        }
+        bc->nr_pages = 0;
+
+        cache_unlock(xcall, &bc->lock);
+        pthread_mutex_destroy(&bc->lock);
+    }
 
     DBGPRINTF("total allocations:%d total releases:%d",
-              xcall->buffer_total_allocations,
-              xcall->buffer_total_releases);
-    DBGPRINTF("current allocations:%d maximum allocations:%d",
-              xcall->buffer_current_allocations,
-              xcall->buffer_maximum_allocations);
-    DBGPRINTF("cache current size:%d",
-              xcall->buffer_cache_nr);
+              total_allocations, total_releases);
+    DBGPRINTF("current allocations:%d", current_allocations);
+    DBGPRINTF("cache current size:%d", cache_nr);
     DBGPRINTF("cache hits:%d misses:%d toobig:%d",
-              xcall->buffer_cache_hits,
-              xcall->buffer_cache_misses,
-              xcall->buffer_cache_toobig);
+              cache_hits, cache_misses, cache_toobig);
 
-    while ( xcall->buffer_cache_nr > 0 )
+    cache_lock(xcall, &xcall->huge_lock);
+
+    DBGPRINTF("huge cache current size:%d hits:%d misses:%d",
+              xcall->huge_cache_nr, xcall->huge_cache_hits,
+              xcall->huge_cache_misses);
+
+    while ( xcall->huge_cache_nr > 0 )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        osdep_free_pages(xcall, p, 1);
+        xcall->huge_cache_nr--;
+        osdep_free_pages(xcall, xcall->huge_cache[xcall->huge_cache_nr],
+                         xcall->huge_cache_pages[xcall->huge_cache_nr]);
     }
 
-    cache_unlock(xcall);
+    cache_unlock(xcall, &xcall->huge_lock);
+    pthread_mutex_destroy(&xcall->huge_lock);
 }
 
 void *xencall_alloc_buffer_pages(xencall_handle *xcall, size_t nr_pages)
 {
+    size_t actual_pages = alloc_pages_for(xcall, nr_pages);
     void *p = cache_alloc(xcall, nr_pages);
 
+    if ( !p && cache_class(nr_pages) < 0 &&
+         (xcall->flags & XENCALL_OPENFLAG_HUGE_BUFFERS) )
+        p = huge_cache_alloc(xcall, actual_pages);
+
     if ( !p )
-        p = osdep_alloc_pages(xcall, nr_pages);
+        p = osdep_alloc_pages(xcall, actual_pages);
 
     if (!p)
         return NULL;
@@ -142,11 +316,20 @@ void *xencall_alloc_buffer_pages(xencall_handle *xcall, size_t nr_pages)
 
 void xencall_free_buffer_pages(xencall_handle *xcall, void *p, size_t nr_pages)
 {
+    size_t actual_pages = alloc_pages_for(xcall, nr_pages);
+
     if ( p == NULL )
         return;
 
-    if ( !cache_free(xcall, p, nr_pages) )
-        osdep_free_pages(xcall, p, nr_pages);
+    if ( cache_free(xcall, p, nr_pages) )
+        return;
+
+    if ( cache_class(nr_pages) < 0 &&
+         (xcall->flags & XENCALL_OPENFLAG_HUGE_BUFFERS) &&
+         huge_cache_free(xcall, p, actual_pages) )
+        return;
+
+    osdep_free_pages(xcall, p, actual_pages);
 }
 
 struct allocation_header {
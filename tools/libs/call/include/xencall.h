@@ -34,6 +34,15 @@ typedef struct xencall_handle xencall_handle;
  */
 #define XENCALL_OPENFLAG_NON_REENTRANT (1U<<0)
 
+/*
+ * Allocate buffers larger than 16 pages in multiples of 2MiB, and keep a
+ * few of them around once freed for reuse by later allocations of the
+ * same rounded size.  Where the OS allows, they are backed by huge pages.
+ * Worth it for callers repeatedly issuing hypercalls with large buffers,
+ * e.g. dirty bitmaps during migration.
+ */
+#define XENCALL_OPENFLAG_HUGE_BUFFERS  (1U<<1)
+
 /*
  * Return a handle onto the hypercall driver.  Logs errors.
  * *
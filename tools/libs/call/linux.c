@@ -107,8 +107,18 @@ static void *alloc_pages_nobufdev(xencall_handle *xcall, size_t npages)
     void *p;
     int rc, i, saved_errno;
 
+    p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    /* Back huge buffers with huge pages if any are reserved. */
+    if ( (xcall->flags & XENCALL_OPENFLAG_HUGE_BUFFERS) &&
+         !(npages % HUGE_BUFFER_PAGES) )
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED|MAP_HUGETLB, -1, 0);
+#endif
+
     /* Address returned by mmap is page aligned. */
-    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED, -1, 0);
+    if ( p == MAP_FAILED )
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED, -1, 0);
     if ( p == MAP_FAILED )
     {
         PERROR("alloc_pages: mmap(,%zu,...) [nobufdev] failed", size);
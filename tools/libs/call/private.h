@@ -1,6 +1,8 @@
 #ifndef XENCALL_PRIVATE_H
 #define XENCALL_PRIVATE_H
 
+#include <pthread.h>
+
 #include <xentoollog.h>
 #include <xentoolcore_internal.h>
 
@@ -29,25 +31,47 @@ struct xencall_handle {
     Xentoolcore__Active_Handle tc_ah;
 
     /*
-     * A simple cache of unused, single page, hypercall buffers
+     * Caches of unused hypercall buffers of 1, 2, 4, 8 and 16 pages.
      *
-     * Protected by a global lock.
+     * Each thread uses one of the shards, and each shard has its own
+     * lock, so that concurrent users of the handle rarely contend.
+     * A shard holds at most BUFFER_CACHE_SIZE buffers per size class
+     * and BUFFER_CACHE_MAX_PAGES pages in total.
      */
-#define BUFFER_CACHE_SIZE 4
-    int buffer_cache_nr;
-    void *buffer_cache[BUFFER_CACHE_SIZE];
+#define BUFFER_CACHE_SHARDS    8
+#define BUFFER_CACHE_CLASSES   5
+#define BUFFER_CACHE_SIZE      4
+#define BUFFER_CACHE_MAX_PAGES 32
+    struct buffer_cache {
+        pthread_mutex_t lock;
+        int nr[BUFFER_CACHE_CLASSES];
+        void *cache[BUFFER_CACHE_CLASSES][BUFFER_CACHE_SIZE];
+        unsigned int nr_pages;
+
+        /* Hypercall buffer statistics, protected by the shard lock. */
+        int total_allocations;
+        int total_releases;
+        int current_allocations;
+        int cache_hits;
+        int cache_misses;
+        int cache_toobig;
+    } __attribute__((aligned(64))) buffer_cache[BUFFER_CACHE_SHARDS];
 
     /*
-     * Hypercall buffer statistics. All protected by the global
-     * buffer_cache lock.
+     * With XENCALL_OPENFLAG_HUGE_BUFFERS, buffers too large for the
+     * caches above are allocated in multiples of HUGE_BUFFER_PAGES and
+     * kept in the cache below once freed, for reuse by allocations
+     * rounding up to the same size.
      */
-    int buffer_total_allocations;
-    int buffer_total_releases;
-    int buffer_current_allocations;
-    int buffer_maximum_allocations;
-    int buffer_cache_hits;
-    int buffer_cache_misses;
-    int buffer_cache_toobig;
+#define HUGE_BUFFER_PAGES      512 /* 2MiB */
+#define HUGE_CACHE_SIZE        4
+#define HUGE_CACHE_MAX_PAGES   (32 * HUGE_BUFFER_PAGES)
+    pthread_mutex_t huge_lock;
+    int huge_cache_nr;
+    void *huge_cache[HUGE_CACHE_SIZE];
+    size_t huge_cache_pages[HUGE_CACHE_SIZE];
+    int huge_cache_hits;
+    int huge_cache_misses;
 };
 
 int osdep_xencall_open(xencall_handle *xcall);
@@ -58,6 +82,7 @@ int osdep_hypercall(xencall_handle *xcall, privcmd_hypercall_t *hypercall);
 void *osdep_alloc_pages(xencall_handle *xcall, size_t nr_pages);
 void osdep_free_pages(xencall_handle *xcall, void *p, size_t nr_pages);
 
+void buffer_init_cache(xencall_handle *xcall);
 void buffer_release_cache(xencall_handle *xcall);
 
 #define PERROR(_f...) xtl_log(xcall->logger, XTL_ERROR, errno, "xencall", _f)
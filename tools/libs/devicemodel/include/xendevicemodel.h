@@ -103,6 +103,43 @@ int xendevicemodel_unmap_io_range_from_ioreq_server(
     xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, int is_mmio,
     uint64_t start, uint64_t end);
 
+/**
+ * This function marks a range of memory or I/O ports, already registered
+ * for emulation, as accepting posted writes. Such writes are queued on the
+ * buffered ioreq ring, with one event channel notification per batch,
+ * rather than being sent synchronously. The IOREQ Server must have been
+ * created with HVM_IOREQSRV_BUFIOREQ_ATOMIC, and the emulator must follow
+ * the ring protocol described alongside XEN_DMOP_map_posted_io_range in
+ * xen/include/public/hvm/dm_op.h.
+ *
+ * @parm dmod a handle to an open devicemodel interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm is_mmio is this a range of ports or memory
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xendevicemodel_map_posted_io_range(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, int is_mmio,
+    uint64_t start, uint64_t end);
+
+/**
+ * This function stops writes to a range of memory or I/O ports from being
+ * posted.
+ *
+ * @parm dmod a handle to an open devicemodel interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm is_mmio is this a range of ports or memory
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xendevicemodel_unmap_posted_io_range(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, int is_mmio,
+    uint64_t start, uint64_t end);
+
 /**
  * This function registers/deregisters a memory type for emulation.
  *
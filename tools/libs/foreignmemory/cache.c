@@ -0,0 +1,345 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "private.h"
+
+/*
+ * A mapping made by xenforeignmemory_cache_map().  Entries are on the
+ * by-gfn hash until invalidated, on the by-address hash until unmapped,
+ * and on the LRU list while nobody holds a reference.
+ */
+struct cache_entry {
+    uint32_t dom;
+    int prot;
+    xen_pfn_t gfn;
+    size_t pages;
+    void *addr;
+    unsigned int refcnt;
+    bool stale;
+    cache_entry *gfn_next;
+    cache_entry *addr_next;
+    XENTOOLCORE_TAILQ_ENTRY(cache_entry) lru;
+};
+
+static void cache_lock(xenforeignmemory_handle *fmem)
+{
+    int saved_errno = errno;
+    pthread_mutex_lock(&fmem->cache_lock);
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+}
+
+static void cache_unlock(xenforeignmemory_handle *fmem)
+{
+    int saved_errno = errno;
+    pthread_mutex_unlock(&fmem->cache_lock);
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+}
+
+static cache_entry **gfn_bucket(xenforeignmemory_handle *fmem,
+                                uint32_t dom, xen_pfn_t gfn)
+{
+    return &fmem->cache_by_gfn[(gfn ^ (dom * 0x9e37U)) % CACHE_HASH_SIZE];
+}
+
+static cache_entry **addr_bucket(xenforeignmemory_handle *fmem, void *addr)
+{
+    return &fmem->cache_by_addr[((uintptr_t)addr >> PAGE_SHIFT) %
+                                CACHE_HASH_SIZE];
+}
+
+static void unhash_gfn(xenforeignmemory_handle *fmem, cache_entry *ent)
+{
+    cache_entry **pp;
+
+    for ( pp = gfn_bucket(fmem, ent->dom, ent->gfn); *pp;
+          pp = &(*pp)->gfn_next )
+    {
+        if ( *pp == ent )
+        {
+            *pp = ent->gfn_next;
+            break;
+        }
+    }
+}
+
+/* Unmap and free an unreferenced entry. */
+static void cache_drop(xenforeignmemory_handle *fmem, cache_entry *ent)
+{
+    cache_entry **pp;
+
+    if ( !ent->stale )
+        unhash_gfn(fmem, ent);
+
+    for ( pp = addr_bucket(fmem, ent->addr); *pp; pp = &(*pp)->addr_next )
+    {
+        if ( *pp == ent )
+        {
+            *pp = ent->addr_next;
+            break;
+        }
+    }
+
+    XENTOOLCORE_TAILQ_REMOVE(&fmem->cache_lru, ent, lru);
+
+    (void)osdep_xenforeignmemory_unmap(fmem, ent->addr, ent->pages);
+
+    fmem->cache_stats.entries--;
+    fmem->cache_stats.pages -= ent->pages;
+    free(ent);
+}
+
+/* Unmap released mappings, oldest first, until within the size limit. */
+static void cache_shrink(xenforeignmemory_handle *fmem)
+{
+    cache_entry *ent;
+
+    while ( fmem->cache_stats.pages > fmem->cache_max_pages &&
+            (ent = XENTOOLCORE_TAILQ_FIRST(&fmem->cache_lru)) != NULL )
+    {
+        fmem->cache_stats.evictions++;
+        cache_drop(fmem, ent);
+    }
+}
+
+void cache_init(xenforeignmemory_handle *fmem)
+{
+    pthread_mutex_init(&fmem->cache_lock, NULL);
+    fmem->cache_max_pages = 0;
+    memset(fmem->cache_by_gfn, 0, sizeof(fmem->cache_by_gfn));
+    memset(fmem->cache_by_addr, 0, sizeof(fmem->cache_by_addr));
+    XENTOOLCORE_TAILQ_INIT(&fmem->cache_lru);
+    memset(&fmem->cache_stats, 0, sizeof(fmem->cache_stats));
+}
+
+/*
+ * Undo the released mappings.  Ones still in use are left alone, as
+ * with mappings from xenforeignmemory_map() still around on close.
+ */
+void cache_release(xenforeignmemory_handle *fmem)
+{
+    cache_entry *ent, *next;
+    unsigned int i;
+
+    cache_lock(fmem);
+
+    while ( (ent = XENTOOLCORE_TAILQ_FIRST(&fmem->cache_lru)) != NULL )
+        cache_drop(fmem, ent);
+
+    for ( i = 0; i < CACHE_HASH_SIZE; i++ )
+    {
+        for ( ent = fmem->cache_by_addr[i]; ent; ent = next )
+        {
+            next = ent->addr_next;
+            free(ent);
+        }
+        fmem->cache_by_addr[i] = NULL;
+        fmem->cache_by_gfn[i] = NULL;
+    }
+
+    cache_unlock(fmem);
+    pthread_mutex_destroy(&fmem->cache_lock);
+}
+
+void *xenforeignmemory_cache_map(xenforeignmemory_handle *fmem, uint32_t dom,
+                                 int prot, xen_pfn_t gfn, size_t pages)
+{
+    cache_entry *ent, **bucket;
+    xen_pfn_t *arr;
+    void *addr;
+    size_t i;
+
+    if ( !pages )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    cache_lock(fmem);
+
+    bucket = gfn_bucket(fmem, dom, gfn);
+    for ( ent = *bucket; ent; ent = ent->gfn_next )
+    {
+        if ( ent->dom != dom || ent->gfn != gfn || ent->pages != pages ||
+             ent->prot != prot )
+            continue;
+
+        if ( !ent->refcnt++ )
+            XENTOOLCORE_TAILQ_REMOVE(&fmem->cache_lru, ent, lru);
+        fmem->cache_stats.hits++;
+        addr = ent->addr;
+        cache_unlock(fmem);
+
+        return addr;
+    }
+
+    fmem->cache_stats.misses++;
+
+    cache_unlock(fmem);
+
+    ent = malloc(sizeof(*ent));
+    arr = malloc(pages * sizeof(*arr));
+    if ( !ent || !arr )
+    {
+        free(ent);
+        free(arr);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for ( i = 0; i < pages; i++ )
+        arr[i] = gfn + i;
+
+    /* With no error array, a partial failure undoes the mapping. */
+    addr = xenforeignmemory_map(fmem, dom, prot, pages, arr, NULL);
+    free(arr);
+    if ( !addr )
+    {
+        free(ent);
+        return NULL;
+    }
+
+    ent->dom = dom;
+    ent->prot = prot;
+    ent->gfn = gfn;
+    ent->pages = pages;
+    ent->addr = addr;
+    ent->refcnt = 1;
+    ent->stale = false;
+
+    /*
+     * Another thread may have mapped the same range meanwhile.  Both
+     * mappings stay valid, and the older one is found first by lookups.
+     */
+    cache_lock(fmem);
+
+    bucket = gfn_bucket(fmem, dom, gfn);
+    while ( *bucket )
+        bucket = &(*bucket)->gfn_next;
+    ent->gfn_next = NULL;
+    *bucket = ent;
+
+    bucket = addr_bucket(fmem, addr);
+    ent->addr_next = *bucket;
+    *bucket = ent;
+
+    fmem->cache_stats.entries++;
+    fmem->cache_stats.pages += pages;
+
+    cache_shrink(fmem);
+
+    cache_unlock(fmem);
+
+    return addr;
+}
+
+int xenforeignmemory_cache_unmap(xenforeignmemory_handle *fmem, void *addr)
+{
+    cache_entry *ent;
+
+    cache_lock(fmem);
+
+    for ( ent = *addr_bucket(fmem, addr); ent; ent = ent->addr_next )
+        if ( ent->addr == addr )
+            break;
+
+    if ( !ent || !ent->refcnt )
+    {
+        cache_unlock(fmem);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( !--ent->refcnt )
+    {
+        XENTOOLCORE_TAILQ_INSERT_TAIL(&fmem->cache_lru, ent, lru);
+        if ( ent->stale )
+            cache_drop(fmem, ent);
+        else
+            cache_shrink(fmem);
+    }
+
+    cache_unlock(fmem);
+
+    return 0;
+}
+
+int xenforeignmemory_cache_set_size(xenforeignmemory_handle *fmem,
+                                    size_t pages)
+{
+    cache_lock(fmem);
+
+    fmem->cache_max_pages = pages;
+    cache_shrink(fmem);
+
+    cache_unlock(fmem);
+
+    return 0;
+}
+
+void xenforeignmemory_cache_invalidate(xenforeignmemory_handle *fmem,
+                                       uint32_t dom)
+{
+    cache_entry *ent, *next;
+    unsigned int i;
+
+    cache_lock(fmem);
+
+    for ( i = 0; i < CACHE_HASH_SIZE; i++ )
+    {
+        for ( ent = fmem->cache_by_gfn[i]; ent; ent = next )
+        {
+            next = ent->gfn_next;
+            if ( dom != DOMID_INVALID && ent->dom != dom )
+                continue;
+
+            fmem->cache_stats.invalidations++;
+            if ( !ent->refcnt )
+                cache_drop(fmem, ent);
+            else
+            {
+                /* No new users, and unmapped on release. */
+                unhash_gfn(fmem, ent);
+                ent->stale = true;
+            }
+        }
+    }
+
+    cache_unlock(fmem);
+}
+
+void xenforeignmemory_cache_get_stats(xenforeignmemory_handle *fmem,
+                                      xenforeignmemory_cache_stats *stats)
+{
+    cache_lock(fmem);
+    *stats = fmem->cache_stats;
+    cache_unlock(fmem);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -42,6 +42,7 @@ xenforeignmemory_handle *xenforeignmemory_open(xentoollog_logger *logger,
     fmem->fd = -1;
     fmem->logger = logger;
     fmem->logger_tofree = NULL;
+    cache_init(fmem);
 
     fmem->tc_ah.restrict_callback = all_restrict_cb;
     xentoolcore__register_active_handle(&fmem->tc_ah);
@@ -74,6 +75,7 @@ int xenforeignmemory_close(xenforeignmemory_handle *fmem)
         return 0;
 
     xentoolcore__deregister_active_handle(&fmem->tc_ah);
+    cache_release(fmem);
     rc = osdep_xenforeignmemory_close(fmem);
     xtl_logger_destroy(fmem->logger_tofree);
     free(fmem);
@@ -179,6 +179,60 @@ xenforeignmemory_resource_handle *xenforeignmemory_map_resource(
 int xenforeignmemory_unmap_resource(
     xenforeignmemory_handle *fmem, xenforeignmemory_resource_handle *fres);
 
+/*
+ * Cached mappings, for callers mapping the same guest frames over and over.
+ *
+ * xenforeignmemory_cache_map() maps @pages contiguous frames of domain
+ * @dom starting at @gfn, all or nothing, and returns the address of the
+ * mapping or NULL with errno set.  The mapping must be released with
+ * xenforeignmemory_cache_unmap().  Mappings of the same range with the
+ * same @prot are shared and reference counted.
+ *
+ * Released mappings are kept, up to the number of pages set with
+ * xenforeignmemory_cache_set_size(), so that mapping the range again is
+ * nearly free.  The least recently used are unmapped first.  The size is
+ * 0 by default, i.e. mappings are undone as soon as they are released.
+ *
+ * Cached mappings hold on to the domain's memory, and the range might
+ * belong to a different domain once the domid is reused.  Callers must
+ * call xenforeignmemory_cache_invalidate() when a domain is destroyed
+ * (e.g. on the @releaseDomain xenstore watch), or with DOMID_INVALID to
+ * drop every cached mapping.  Mappings still in use are unmapped once
+ * released.
+ */
+void *xenforeignmemory_cache_map(xenforeignmemory_handle *fmem, uint32_t dom,
+                                 int prot, xen_pfn_t gfn, size_t pages);
+
+/*
+ * Release a mapping returned by xenforeignmemory_cache_map().
+ *
+ * Returns 0 on success on failure sets errno and returns -1.
+ */
+int xenforeignmemory_cache_unmap(xenforeignmemory_handle *fmem, void *addr);
+
+/*
+ * Set the number of pages released mappings may keep mapped.
+ *
+ * Returns 0 on success on failure sets errno and returns -1.
+ */
+int xenforeignmemory_cache_set_size(xenforeignmemory_handle *fmem,
+                                    size_t pages);
+
+void xenforeignmemory_cache_invalidate(xenforeignmemory_handle *fmem,
+                                       uint32_t dom);
+
+typedef struct xenforeignmemory_cache_stats {
+    uint64_t hits;          /* Mappings found in the cache */
+    uint64_t misses;        /* Mappings which had to be made */
+    uint64_t evictions;     /* Released mappings unmapped to make room */
+    uint64_t invalidations; /* Mappings dropped by _cache_invalidate() */
+    uint64_t entries;       /* Mappings currently held */
+    uint64_t pages;         /* Pages mapped by them */
+} xenforeignmemory_cache_stats;
+
+void xenforeignmemory_cache_get_stats(xenforeignmemory_handle *fmem,
+                                      xenforeignmemory_cache_stats *stats);
+
 #endif
 
 /*
@@ -1,6 +1,8 @@
 #ifndef XENFOREIGNMEMORY_PRIVATE_H
 #define XENFOREIGNMEMORY_PRIVATE_H
 
+#include <pthread.h>
+
 #include <xentoollog.h>
 
 #include <xenforeignmemory.h>
@@ -18,12 +20,28 @@
 #define PAGE_MASK            (~(PAGE_SIZE-1))
 #endif
 
+typedef struct cache_entry cache_entry;
+
 struct xenforeignmemory_handle {
     xentoollog_logger *logger, *logger_tofree;
     unsigned flags;
     int fd;
     Xentoolcore__Active_Handle tc_ah;
     int unimpl_errno;
+
+    /*
+     * Mappings made by xenforeignmemory_cache_map(), hashed by range and
+     * by address, and the released ones in least recently used order.
+     *
+     * All protected by cache_lock.
+     */
+#define CACHE_HASH_SIZE 256
+    pthread_mutex_t cache_lock;
+    size_t cache_max_pages;
+    cache_entry *cache_by_gfn[CACHE_HASH_SIZE];
+    cache_entry *cache_by_addr[CACHE_HASH_SIZE];
+    XENTOOLCORE_TAILQ_HEAD(, cache_entry) cache_lru;
+    xenforeignmemory_cache_stats cache_stats;
 };
 
 int osdep_xenforeignmemory_open(xenforeignmemory_handle *fmem);
@@ -36,6 +54,9 @@ void *osdep_xenforeignmemory_map(xenforeignmemory_handle *fmem,
 int osdep_xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
                                  void *addr, size_t num);
 
+void cache_init(xenforeignmemory_handle *fmem);
+void cache_release(xenforeignmemory_handle *fmem);
+
 #if defined(__NetBSD__) || defined(__sun__)
 /* Strictly compat for those two only only */
 void *compat_mapforeign_batch(xenforeignmem_handle *fmem, uint32_t dom,
@@ -509,7 +509,8 @@ int xc_domain_create(xc_interface *xch, uint32_t *pdomid,
 
 
 /* Functions to produce a dump of a given domain
- *  xc_domain_dumpcore - produces a dump to a specified file
+ *  xc_domain_dumpcore - produces a dump to a specified file, as a sparse
+ *                       file with holes for the all-zero pages
  *  xc_domain_dumpcore_via_callback - produces a dump, using a specified
  *                                    callback function
  */
@@ -938,6 +939,26 @@ int xc_vcpu_getinfo(xc_interface *xch,
                     uint32_t vcpu,
                     xc_vcpuinfo_t *info);
 
+/**
+ * This function returns information about the vCPUs of one or more domains,
+ * using a single hypercall.  A domain's vCPUs are either all reported or
+ * not at all, so callers continue with the domain following the last one
+ * returned.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm first_domain the first domain to enumerate vCPUs of
+ * @parm max_vcpus the number of elements in info
+ * @parm info an array of max_vcpus size that will contain the information
+ *            for the enumerated vCPUs, ordered by domain and vCPU ID
+ * @return the number of vCPUs enumerated or -1 on error (errno ENOBUFS if
+ *         not even the first domain's vCPUs fit)
+ */
+typedef struct xen_sysctl_vcpuinfo xc_vcpuinfolist_t;
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t first_domain,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfolist_t *info);
+
 long long xc_domain_get_cpu_usage(xc_interface *xch,
                                   uint32_t domid,
                                   int vcpu);
@@ -1059,6 +1080,30 @@ int xc_domain_p2m_audit(xc_interface *xch,
                         uint64_t *m2p_bad,   
                         uint64_t *p2m_bad);
 
+/**
+ * This function reports the number of 4k, 2M and 1G mappings the p2m of an
+ * HVM domain is made of.  If coalesce is set, ranges which are fully
+ * populated with contiguous, uniformly typed memory get turned back into
+ * superpage mappings first (with the domain paused meanwhile), and the
+ * number of 2M and 1G mappings created gets reported in coalesced (which
+ * may be NULL).
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id to operate on
+ * @parm coalesce whether to rebuild superpage mappings
+ * @parm mappings 4k, 2M and 1G mapping counts
+ * @parm coalesced 2M and 1G mappings created
+ * return 0 on success, -1 on failure
+ * errno values on failure include:
+ *          -EOPNOTSUPP: not supported for this domain (e.g. not using EPT)
+ *          -EBUSY: log-dirty mode is active
+ */
+int xc_domain_p2m_superpages(xc_interface *xch,
+                             uint32_t domid,
+                             bool coalesce,
+                             uint64_t mappings[3],
+                             uint64_t coalesced[2]);
+
 /**
  * This function sets or clears the requirement that an access memory
  * event listener is required on the domain.
@@ -2019,6 +2064,20 @@ int xc_vm_event_get_version(xc_interface *xch);
  * Caller has to unmap this page when done.
  */
 void *xc_monitor_enable(xc_interface *xch, uint32_t domain_id, uint32_t *port);
+struct xenforeignmemory_resource_handle;
+/*
+ * As xc_monitor_enable(), but with a ring of nr_frames pages (at most
+ * XEN_VM_EVENT_MAX_RING_FRAMES) allocated by Xen, allowing for more events
+ * in flight.  The ring comes initialised: the caller only does
+ * BACK_RING_INIT(), with a size of nr_frames * XC_PAGE_SIZE.
+ *
+ * Will return NULL on error.
+ * Caller has to unmap the ring with xenforeignmemory_unmap_resource() on
+ * xc_interface_fmem_handle(xch) and *fres when done.
+ */
+void *xc_monitor_enable_ring(xc_interface *xch, uint32_t domain_id,
+                             unsigned int nr_frames, uint32_t *port,
+                             struct xenforeignmemory_resource_handle **fres);
 int xc_monitor_disable(xc_interface *xch, uint32_t domain_id);
 int xc_monitor_resume(xc_interface *xch, uint32_t domain_id);
 /*
@@ -65,10 +65,19 @@
 #include "xc_dom.h"
 #include <stdlib.h>
 #include <unistd.h>
+#ifndef __MINIOS__
+#include <pthread.h>
+#endif
 
-/* number of pages to write at a time */
+/* number of pages to map and write at a time */
+#define DUMP_BATCH 1024
+
+/* number of pages written before dropping them from the page cache */
 #define DUMP_INCREMENT (4 * 1024)
 
+/* maximum number of threads mapping and copying guest pages */
+#define DUMP_MAX_THREADS 8
+
 /* string table */
 struct xc_core_strtab {
     char       *strings;
@@ -416,6 +425,274 @@ elfnote_dump_format_version(xc_interface *xch,
     return dump_rtn(xch, args, (char*)&format_version, sizeof(format_version));
 }
 
+/*
+ * Guest pages are copied out in batches of DUMP_BATCH pages, by up to
+ * DUMP_MAX_THREADS worker threads, into a ring of twice as many
+ * buffers.  The batches are handed to the dump callback in order, from
+ * the calling thread only.
+ */
+struct dump_batch {
+    char *mem;
+    int ready;
+};
+
+struct dump_pages {
+    xc_interface *xch;
+    uint32_t domid;
+    struct xen_dumpcore_p2m *p2m_array;
+    uint64_t *pfn_array;
+    unsigned long nr_pages;
+    unsigned long nr_batches;
+
+    struct dump_batch *batches;
+    unsigned int nr_slots;
+
+#ifndef __MINIOS__
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    unsigned long next;     /* next batch to be filled */
+    unsigned long done;     /* batches handed to the callback */
+    int stop;
+};
+
+/*
+ * Copy batch @b into @mem.  Frames which can't be mapped are dumped as
+ * zero pages and invalidated in the p2m/pfn table, as is done for pages
+ * which go away under a live dump.
+ */
+static void dump_fill_batch(struct dump_pages *dp, unsigned long b, char *mem)
+{
+    xc_interface *xch = dp->xch;
+    xen_pfn_t gmfns[DUMP_BATCH];
+    unsigned int idx[DUMP_BATCH];
+    int err[DUMP_BATCH];
+    unsigned long start = b * DUMP_BATCH;
+    unsigned int i, nr, nr_map = 0;
+    char *vaddr;
+
+    nr = min_t(unsigned long, DUMP_BATCH, dp->nr_pages - start);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        uint64_t gmfn;
+
+        if ( dp->p2m_array )
+            gmfn = dp->p2m_array[start + i].gmfn;
+        else if ( (gmfn = dp->pfn_array[start + i]) == XC_CORE_INVALID_PFN )
+            gmfn = XC_CORE_INVALID_GMFN;
+
+        /* Padding, for pages gone under a live dump. */
+        if ( gmfn == XC_CORE_INVALID_GMFN )
+        {
+            memset(mem + (size_t)i * PAGE_SIZE, 0, PAGE_SIZE);
+            continue;
+        }
+
+        gmfns[nr_map] = gmfn;
+        idx[nr_map++] = i;
+    }
+
+    if ( nr_map == 0 )
+        return;
+
+    vaddr = xenforeignmemory_map(xch->fmem, dp->domid, PROT_READ,
+                                 nr_map, gmfns, err);
+
+    for ( i = 0; i < nr_map; i++ )
+    {
+        char *dst = mem + (size_t)idx[i] * PAGE_SIZE;
+
+        if ( vaddr != NULL && !err[i] )
+        {
+            memcpy(dst, vaddr + (size_t)i * PAGE_SIZE, PAGE_SIZE);
+            continue;
+        }
+
+        memset(dst, 0, PAGE_SIZE);
+        if ( dp->p2m_array )
+        {
+            dp->p2m_array[start + idx[i]].pfn = XC_CORE_INVALID_PFN;
+            dp->p2m_array[start + idx[i]].gmfn = XC_CORE_INVALID_GMFN;
+        }
+        else
+            dp->pfn_array[start + idx[i]] = XC_CORE_INVALID_PFN;
+    }
+
+    if ( vaddr != NULL )
+        xenforeignmemory_unmap(xch->fmem, vaddr, nr_map);
+}
+
+#ifndef __MINIOS__
+static void *dump_worker(void *arg)
+{
+    struct dump_pages *dp = arg;
+    struct dump_batch *batch;
+    unsigned long b;
+
+    pthread_mutex_lock(&dp->lock);
+    for ( ; ; )
+    {
+        /* Don't run more than nr_slots batches ahead of the writer. */
+        while ( !dp->stop && dp->next < dp->nr_batches &&
+                dp->next >= dp->done + dp->nr_slots )
+            pthread_cond_wait(&dp->cond, &dp->lock);
+
+        if ( dp->stop || dp->next >= dp->nr_batches )
+            break;
+
+        b = dp->next++;
+        batch = &dp->batches[b % dp->nr_slots];
+        pthread_mutex_unlock(&dp->lock);
+
+        dump_fill_batch(dp, b, batch->mem);
+
+        pthread_mutex_lock(&dp->lock);
+        batch->ready = 1;
+        pthread_cond_broadcast(&dp->cond);
+    }
+    pthread_mutex_unlock(&dp->lock);
+
+    return NULL;
+}
+
+static unsigned int dump_nr_threads(unsigned long nr_batches)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* sysconf() failing must not turn into nr_batches threads. */
+    if ( cpus < 1 )
+        return 0;
+    if ( cpus > DUMP_MAX_THREADS )
+        cpus = DUMP_MAX_THREADS;
+    if ( (unsigned long)cpus > nr_batches )
+        cpus = nr_batches;
+
+    /* Not worth a thread with a single batch, or a single CPU. */
+    return cpus > 1 ? cpus : 0;
+}
+#endif
+
+/* Write out .xen_pages, for the frames listed in the p2m/pfn table. */
+static int dump_guest_pages(xc_interface *xch, uint32_t domid,
+                            struct xen_dumpcore_p2m *p2m_array,
+                            uint64_t *pfn_array, unsigned long nr_pages,
+                            void *args, dumpcore_rtn_t dump_rtn)
+{
+    struct dump_pages dp = {
+        .xch = xch,
+        .domid = domid,
+        .p2m_array = p2m_array,
+        .pfn_array = pfn_array,
+        .nr_pages = nr_pages,
+        .nr_batches = (nr_pages + DUMP_BATCH - 1) / DUMP_BATCH,
+    };
+    unsigned int nr_threads = 0, started = 0, i;
+#ifndef __MINIOS__
+    pthread_t threads[DUMP_MAX_THREADS];
+#endif
+    unsigned long b;
+    int sts = -1;
+
+#ifndef __MINIOS__
+    nr_threads = dump_nr_threads(dp.nr_batches);
+#endif
+    dp.nr_slots = nr_threads ? 2 * nr_threads : 1;
+
+    dp.batches = calloc(dp.nr_slots, sizeof(*dp.batches));
+    if ( dp.batches == NULL )
+    {
+        PERROR("Could not allocate dump batches");
+        return -1;
+    }
+
+    for ( i = 0; i < dp.nr_slots; i++ )
+    {
+        dp.batches[i].mem = malloc(DUMP_BATCH * PAGE_SIZE);
+        if ( dp.batches[i].mem == NULL )
+        {
+            PERROR("Could not allocate dump_mem");
+            goto out;
+        }
+    }
+
+#ifndef __MINIOS__
+    if ( nr_threads )
+    {
+        pthread_mutex_init(&dp.lock, NULL);
+        pthread_cond_init(&dp.cond, NULL);
+
+        for ( ; started < nr_threads; started++ )
+            if ( pthread_create(&threads[started], NULL, dump_worker,
+                                &dp) != 0 )
+                break;
+
+        /* Carry on with the threads we got, or none at all. */
+        if ( started < nr_threads )
+            DPRINTF("Only %u of %u dump threads started", started, nr_threads);
+        if ( !started )
+        {
+            pthread_cond_destroy(&dp.cond);
+            pthread_mutex_destroy(&dp.lock);
+        }
+    }
+#endif
+
+    for ( b = 0; b < dp.nr_batches; b++ )
+    {
+        struct dump_batch *batch = &dp.batches[b % dp.nr_slots];
+        unsigned long len = min_t(unsigned long, DUMP_BATCH,
+                                  nr_pages - b * DUMP_BATCH) * PAGE_SIZE;
+
+        if ( !started )
+        {
+            dump_fill_batch(&dp, b, batch->mem);
+            sts = dump_rtn(xch, args, batch->mem, len);
+            if ( sts != 0 )
+                goto out;
+            continue;
+        }
+
+#ifndef __MINIOS__
+        pthread_mutex_lock(&dp.lock);
+        while ( !batch->ready )
+            pthread_cond_wait(&dp.cond, &dp.lock);
+        pthread_mutex_unlock(&dp.lock);
+
+        sts = dump_rtn(xch, args, batch->mem, len);
+
+        pthread_mutex_lock(&dp.lock);
+        batch->ready = 0;
+        dp.done++;
+        if ( sts != 0 )
+            dp.stop = 1;
+        pthread_cond_broadcast(&dp.cond);
+        pthread_mutex_unlock(&dp.lock);
+
+        if ( sts != 0 )
+            goto out;
+#endif
+    }
+
+    sts = 0;
+
+ out:
+#ifndef __MINIOS__
+    if ( started )
+    {
+        for ( i = 0; i < started; i++ )
+            pthread_join(threads[i], NULL);
+        pthread_cond_destroy(&dp.cond);
+        pthread_mutex_destroy(&dp.lock);
+    }
+#endif
+    for ( i = 0; i < dp.nr_slots; i++ )
+        free(dp.batches[i].mem);
+    free(dp.batches);
+
+    return sts;
+}
+
 int
 xc_domain_dumpcore_via_callback(xc_interface *xch,
                                 uint32_t domid,
@@ -428,7 +705,6 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     struct domain_info_context *dinfo = &_dinfo;
 
     int nr_vcpus = 0;
-    char *dump_mem, *dump_mem_start = NULL;
     vcpu_guest_context_any_t *ctxt = NULL;
     struct xc_core_arch_context arch_ctxt;
     char dummy[PAGE_SIZE];
@@ -460,11 +736,6 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     Elf64_Shdr *shdr;
  
     xc_core_arch_context_init(&arch_ctxt);
-    if ( (dump_mem_start = malloc(DUMP_INCREMENT*PAGE_SIZE)) == NULL )
-    {
-        PERROR("Could not allocate dump_mem");
-        goto out;
-    }
 
     if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 )
     {
@@ -803,9 +1074,11 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     if ( sts != 0 )
         goto out;
 
-    /* dump pages: .xen_pages */
+    /*
+     * Collect the frames to dump into the p2m/pfn table first, so that
+     * .xen_pages can be filled in by batches.
+     */
     j = 0;
-    dump_mem = dump_mem_start;
     for ( map_idx = 0; map_idx < nr_memory_map; map_idx++ )
     {
         uint64_t pfn_start;
@@ -816,8 +1089,7 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         for ( i = pfn_start; i < pfn_end; i++ )
         {
             uint64_t gmfn;
-            void *vaddr;
-            
+
             if ( j >= nr_pages )
             {
                 /*
@@ -854,45 +1126,21 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
                 if ( !xc_core_arch_gpfn_may_present(&arch_ctxt, i) )
                     continue;
 
-                gmfn = i;
                 pfn_array[j] = i;
             }
 
-            vaddr = xc_map_foreign_range(
-                xch, domid, PAGE_SIZE, PROT_READ, gmfn);
-            if ( vaddr == NULL )
-                continue;
-            memcpy(dump_mem, vaddr, PAGE_SIZE);
-            munmap(vaddr, PAGE_SIZE);
-            dump_mem += PAGE_SIZE;
-            if ( (j + 1) % DUMP_INCREMENT == 0 )
-            {
-                sts = dump_rtn(
-                    xch, args, dump_mem_start, dump_mem - dump_mem_start);
-                if ( sts != 0 )
-                    goto out;
-                dump_mem = dump_mem_start;
-            }
-
             j++;
         }
     }
 
 copy_done:
-    sts = dump_rtn(xch, args, dump_mem_start, dump_mem - dump_mem_start);
-    if ( sts != 0 )
-        goto out;
     if ( j < nr_pages )
     {
         /* When live dump-mode (-L option) is specified,
          * guest domain may reduce memory. pad with zero pages.
          */
         DPRINTF("j (%ld) != nr_pages (%ld)", j, nr_pages);
-        memset(dump_mem_start, 0, PAGE_SIZE);
         for (; j < nr_pages; j++) {
-            sts = dump_rtn(xch, args, dump_mem_start, PAGE_SIZE);
-            if ( sts != 0 )
-                goto out;
             if ( !auto_translated_physmap )
             {
                 p2m_array[j].pfn = XC_CORE_INVALID_PFN;
@@ -903,6 +1151,12 @@ copy_done:
         }
     }
 
+    /* dump pages: .xen_pages */
+    sts = dump_guest_pages(xch, domid, p2m_array, pfn_array, nr_pages,
+                           args, dump_rtn);
+    if ( sts != 0 )
+        goto out;
+
     /* p2m/pfn table: .xen_p2m/.xen_pfn */
     if ( !auto_translated_physmap )
         sts = dump_rtn(
@@ -935,8 +1189,6 @@ out:
         xc_core_strtab_free(strtab);
     if ( ctxt != NULL )
         free(ctxt);
-    if ( dump_mem_start != NULL )
-        free(dump_mem_start);
     if ( live_shinfo != NULL )
         munmap(live_shinfo, PAGE_SIZE);
     xc_core_arch_context_free(&arch_ctxt);
@@ -947,25 +1199,74 @@ out:
 /* Callback args for writing to a local dump file. */
 struct dump_args {
     int     fd;
+    bool    sparse;     /* seek over zero pages (regular files only) */
+    uint64_t pending;   /* bytes written since the cache was discarded */
 };
 
-/* Callback routine for writing to a local dump file. */
+static int page_is_zero(const char *page)
+{
+    const unsigned long *p = (const unsigned long *)page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i++ )
+        if ( p[i] )
+            return 0;
+
+    return 1;
+}
+
+/*
+ * Callback routine for writing to a local dump file.  Whole pages of
+ * zeroes are seeked over rather than written, leaving holes in the file
+ * which read back as zeroes, so the dump stays a plain ELF file.  Pipes
+ * and devices can't seek, so they get the zeroes written.
+ */
 static int local_file_dump(xc_interface *xch,
                            void *args, char *buffer, unsigned int length)
 {
     struct dump_args *da = args;
+    unsigned int off = 0, len;
 
-    if ( write_exact(da->fd, buffer, length) == -1 )
+    while ( off < length )
     {
-        PERROR("Failed to write buffer");
-        return -errno;
+        for ( len = 0; da->sparse && length - off - len >= PAGE_SIZE &&
+                       page_is_zero(buffer + off + len); len += PAGE_SIZE )
+            ;
+
+        if ( len )
+        {
+            if ( lseek(da->fd, len, SEEK_CUR) == (off_t)-1 )
+            {
+                PERROR("Failed to seek past zero pages");
+                return -errno;
+            }
+            off += len;
+            continue;
+        }
+
+        if ( !da->sparse )
+            len = length - off;
+        else
+            for ( len = min_t(unsigned int, length - off, PAGE_SIZE);
+                  length - off - len >= PAGE_SIZE &&
+                  !page_is_zero(buffer + off + len); len += PAGE_SIZE )
+                ;
+
+        if ( write_exact(da->fd, buffer + off, len) == -1 )
+        {
+            PERROR("Failed to write buffer");
+            return -errno;
+        }
+        off += len;
     }
 
-    if ( length >= (DUMP_INCREMENT * PAGE_SIZE) )
+    da->pending += length;
+    if ( da->pending >= (DUMP_INCREMENT * PAGE_SIZE) )
     {
         // Now dumping pages -- make sure we discard clean pages from
         // the cache after each write
         discard_file_cache(xch, da->fd, 0 /* no flush */);
+        da->pending = 0;
     }
 
     return 0;
@@ -976,7 +1277,9 @@ xc_domain_dumpcore(xc_interface *xch,
                    uint32_t domid,
                    const char *corename)
 {
-    struct dump_args da;
+    struct dump_args da = {};
+    struct stat st;
+    off_t size;
     int sts;
 
     if ( (da.fd = open(corename, O_CREAT|O_RDWR|O_TRUNC, S_IWUSR|S_IRUSR)) < 0 )
@@ -985,9 +1288,20 @@ xc_domain_dumpcore(xc_interface *xch,
         return -errno;
     }
 
+    da.sparse = fstat(da.fd, &st) == 0 && S_ISREG(st.st_mode);
+
     sts = xc_domain_dumpcore_via_callback(
         xch, domid, &da, &local_file_dump);
 
+    /* A trailing hole needs the file extending over it. */
+    if ( sts == 0 && da.sparse &&
+         ((size = lseek(da.fd, 0, SEEK_CUR)) == (off_t)-1 ||
+          ftruncate(da.fd, size) != 0) )
+    {
+        PERROR("Could not set size of corefile %s", corename);
+        sts = -errno;
+    }
+
     /* flush and discard any remaining portion of the file from cache */
     discard_file_cache(xch, da.fd, 1/* flush first*/);
 
@@ -1332,6 +1332,33 @@ int xc_vcpu_getinfo(xc_interface *xch,
     return rc;
 }
 
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t first_domain,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfolist_t *info)
+{
+    int ret = 0;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(info, max_vcpus*sizeof(*info), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, info) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_getvcpuinfolist;
+    sysctl.u.getvcpuinfolist.first_domain = first_domain;
+    sysctl.u.getvcpuinfolist.max_vcpus    = max_vcpus;
+    set_xen_guest_handle(sysctl.u.getvcpuinfolist.buffer, info);
+
+    if ( xc_sysctl(xch, &sysctl) < 0 )
+        ret = -1;
+    else
+        ret = sysctl.u.getvcpuinfolist.num_vcpus;
+
+    xc_hypercall_bounce_post(xch, info);
+
+    return ret;
+}
+
 int xc_domain_ioport_permission(xc_interface *xch,
                                 uint32_t domid,
                                 uint32_t first_port,
@@ -2235,6 +2262,31 @@ int xc_domain_p2m_audit(xc_interface *xch,
     return rc;
 }
 
+int xc_domain_p2m_superpages(xc_interface *xch,
+                             uint32_t domid,
+                             bool coalesce,
+                             uint64_t mappings[3],
+                             uint64_t coalesced[2])
+{
+    DECLARE_DOMCTL;
+    int rc;
+
+    domctl.cmd = XEN_DOMCTL_p2m_superpages;
+    domctl.domain = domid;
+    memset(&domctl.u.p2m_superpages, 0, sizeof(domctl.u.p2m_superpages));
+    domctl.u.p2m_superpages.op = coalesce ? XEN_DOMCTL_P2M_SUPERPAGES_COALESCE
+                                          : XEN_DOMCTL_P2M_SUPERPAGES_STATS;
+    rc = do_domctl(xch, &domctl);
+
+    memcpy(mappings, domctl.u.p2m_superpages.mappings,
+           sizeof(domctl.u.p2m_superpages.mappings));
+    if ( coalesced )
+        memcpy(coalesced, domctl.u.p2m_superpages.coalesced,
+               sizeof(domctl.u.p2m_superpages.coalesced));
+
+    return rc;
+}
+
 int xc_domain_set_access_required(xc_interface *xch,
                                   uint32_t domid,
                                   unsigned int required)
@@ -28,6 +28,15 @@ void *xc_monitor_enable(xc_interface *xch, uint32_t domain_id, uint32_t *port)
                               port);
 }
 
+void *xc_monitor_enable_ring(xc_interface *xch, uint32_t domain_id,
+                             unsigned int nr_frames, uint32_t *port,
+                             struct xenforeignmemory_resource_handle **fres)
+{
+    return xc_vm_event_enable_ring(xch, domain_id,
+                                   XEN_DOMCTL_VM_EVENT_OP_MONITOR,
+                                   nr_frames, port, fres);
+}
+
 int xc_monitor_disable(xc_interface *xch, uint32_t domain_id)
 {
     return xc_vm_event_control(xch, domain_id,
@@ -419,6 +419,14 @@ int xc_vm_event_control(xc_interface *xch, uint32_t domain_id, unsigned int op,
  */
 void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
                          uint32_t *port);
+/*
+ * Enables vm_event with a ring of nr_frames pages allocated by Xen, and
+ * returns the ring mapped by way of *fres.  mode is XEN_DOMCTL_VM_EVENT_OP_*.
+ */
+void *xc_vm_event_enable_ring(xc_interface *xch, uint32_t domain_id,
+                              unsigned int mode, unsigned int nr_frames,
+                              uint32_t *port,
+                              xenforeignmemory_resource_handle **fres);
 
 int do_dm_op(xc_interface *xch, uint32_t domid, unsigned int nr_bufs, ...);
 
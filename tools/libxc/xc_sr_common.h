@@ -207,6 +207,17 @@ struct xc_sr_context
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+
+            /*
+             * Dirty pfns as obtained by XEN_DOMCTL_SHADOW_OP_CLEAN_LIST.  If
+             * dirty_in_list is set, the last set of dirty pages is in here
+             * rather than in the bitmap.
+             */
+            xc_hypercall_buffer_t dirty_list_hbuf;
+            unsigned long dirty_list_size;
+            unsigned long nr_dirty_list;
+            bool use_dirty_list;
+            bool dirty_in_list;
         } save;
 
         struct /* Restore data. */
@@ -354,8 +354,33 @@ static int suspend_domain(struct xc_sr_context *ctx)
     return 0;
 }
 
+/* Bounds on the number of entries in the dirty pfn list. */
+#define DIRTY_LIST_MIN 512
+#define DIRTY_LIST_MAX (1UL << 18)
+
 /*
- * Send a subset of pages in the guests p2m, according to the dirty bitmap.
+ * Queue a single dirty page for sending, updating progress as appropriate.
+ */
+static int add_dirty_page(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                          unsigned long *written, unsigned long entries)
+{
+    int rc = add_to_batch(ctx, pfn);
+
+    if ( rc )
+        return rc;
+
+    /* Update progress every 4MB worth of memory sent. */
+    if ( (*written & ((1U << (22 - 12)) - 1)) == 0 )
+        xc_report_progress_step(ctx->xch, *written, entries);
+
+    ++*written;
+
+    return 0;
+}
+
+/*
+ * Send a subset of pages in the guests p2m, according to the dirty bitmap,
+ * or the dirty list if the last set of dirty pages was obtained as such.
  * Used for each subsequent iteration of the live migration loop.
  *
  * Bitmap is bounded by p2m_size.
@@ -365,25 +390,36 @@ static int send_dirty_pages(struct xc_sr_context *ctx,
 {
     xc_interface *xch = ctx->xch;
     xen_pfn_t p;
-    unsigned long written;
+    unsigned long i, written = 0;
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
 
-    for ( p = 0, written = 0; p < ctx->save.p2m_size; ++p )
+    if ( ctx->save.dirty_in_list )
     {
-        if ( !test_bit(p, dirty_bitmap) )
-            continue;
-
-        rc = add_to_batch(ctx, p);
-        if ( rc )
-            return rc;
+        for ( i = 0; i < ctx->save.nr_dirty_list; ++i )
+        {
+            if ( dirty_list[i] >= ctx->save.p2m_size )
+                continue;
 
-        /* Update progress every 4MB worth of memory sent. */
-        if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
-            xc_report_progress_step(xch, written, entries);
+            rc = add_dirty_page(ctx, dirty_list[i], &written, entries);
+            if ( rc )
+                return rc;
+        }
+    }
+    else
+    {
+        for ( p = 0; p < ctx->save.p2m_size; ++p )
+        {
+            if ( !test_bit(p, dirty_bitmap) )
+                continue;
 
-        ++written;
+            rc = add_dirty_page(ctx, p, &written, entries);
+            if ( rc )
+                return rc;
+        }
     }
 
     rc = flush_batch(ctx);
@@ -408,10 +444,92 @@ static int send_all_pages(struct xc_sr_context *ctx)
                                     &ctx->save.dirty_bitmap_hbuf);
 
     bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+    ctx->save.dirty_in_list = false;
 
     return send_dirty_pages(ctx, ctx->save.p2m_size);
 }
 
+/*
+ * Move the pfns in the dirty list into the (otherwise clear) dirty bitmap.
+ */
+static void dirty_list_to_bitmap(struct xc_sr_context *ctx)
+{
+    unsigned long i;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
+
+    if ( !ctx->save.dirty_in_list )
+        return;
+
+    bitmap_clear(dirty_bitmap, ctx->save.p2m_size);
+
+    for ( i = 0; i < ctx->save.nr_dirty_list; ++i )
+        if ( dirty_list[i] < ctx->save.p2m_size )
+            set_bit(dirty_list[i], dirty_bitmap);
+
+    ctx->save.dirty_in_list = false;
+}
+
+/*
+ * Obtain and clear the guest's log-dirty state.  For a guest dirtying only
+ * few of its pages, a list of dirty pfns is far cheaper to obtain and to
+ * process than a bitmap covering the entire p2m, so the list is asked for
+ * first, falling back to the bitmap if the dirty pages don't fit.
+ */
+static int clean_logdirty(struct xc_sr_context *ctx, uint32_t mode,
+                          xc_shadow_op_stats_t *stats)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned long i;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
+
+    ctx->save.dirty_in_list = false;
+    ctx->save.nr_dirty_list = 0;
+
+    if ( ctx->save.use_dirty_list )
+    {
+        rc = xc_shadow_control(xch, ctx->domid,
+                               XEN_DOMCTL_SHADOW_OP_CLEAN_LIST,
+                               &ctx->save.dirty_list_hbuf,
+                               ctx->save.dirty_list_size, NULL, mode, stats);
+        if ( rc < 0 )
+        {
+            DPRINTF("Dirty pfn list unavailable, using the bitmap");
+            ctx->save.use_dirty_list = false;
+        }
+        else if ( rc < ctx->save.dirty_list_size )
+        {
+            ctx->save.nr_dirty_list = rc;
+            ctx->save.dirty_in_list = true;
+            return 0;
+        }
+        else
+            /* The list is full: collect the remainder in the bitmap. */
+            ctx->save.nr_dirty_list = rc;
+    }
+
+    if ( xc_shadow_control(
+             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+             HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
+             NULL, mode, stats) != ctx->save.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        return -1;
+    }
+
+    for ( i = 0; i < ctx->save.nr_dirty_list; ++i )
+        if ( dirty_list[i] < ctx->save.p2m_size )
+            set_bit(dirty_list[i], dirty_bitmap);
+
+    return 0;
+}
+
 static int enable_logdirty(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -519,6 +637,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
          precopy_policy = simple_precopy_policy;
 
     bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+    ctx->save.dirty_in_list = false;
 
     for ( ; ; )
     {
@@ -548,15 +667,9 @@ static int send_memory_live(struct xc_sr_context *ctx)
         if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
            break;
 
-        if ( xc_shadow_control(
-                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-                 &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
-                 NULL, 0, &stats) != ctx->save.p2m_size )
-        {
-            PERROR("Failed to retrieve logdirty bitmap");
-            rc = -1;
+        rc = clean_logdirty(ctx, 0, &stats);
+        if ( rc )
             goto out;
-        }
 
         policy_stats->dirty_count = stats.dirty_count;
 
@@ -638,16 +751,9 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    if ( xc_shadow_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
-             NULL, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats) !=
-         ctx->save.p2m_size )
-    {
-        PERROR("Failed to retrieve logdirty bitmap");
-        rc = -1;
+    rc = clean_logdirty(ctx, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats);
+    if ( rc )
         goto out;
-    }
 
     if ( ctx->save.live )
     {
@@ -658,6 +764,10 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     else
         xc_set_progress_prefix(xch, "Checkpointed save");
 
+    if ( ctx->save.nr_deferred_pages ||
+         (!ctx->save.live && ctx->save.checkpointed == XC_MIG_STREAM_COLO) )
+        dirty_list_to_bitmap(ctx);
+
     bitmap_or(dirty_bitmap, ctx->save.deferred_pages, ctx->save.p2m_size);
 
     if ( !ctx->save.live && ctx->save.checkpointed == XC_MIG_STREAM_COLO )
@@ -789,6 +899,8 @@ static int setup(struct xc_sr_context *ctx)
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
 
     rc = ctx->save.ops.setup(ctx);
     if ( rc )
@@ -796,6 +908,18 @@ static int setup(struct xc_sr_context *ctx)
 
     dirty_bitmap = xc_hypercall_buffer_alloc_pages(
                    xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->save.p2m_size)));
+
+    /*
+     * Size the dirty list like the bitmap, within bounds.  Failure to
+     * allocate it isn't fatal, as the bitmap can always be used instead.
+     */
+    ctx->save.dirty_list_size = min_t(unsigned long, DIRTY_LIST_MAX,
+                                      max_t(unsigned long, DIRTY_LIST_MIN,
+                                            ctx->save.p2m_size / 64));
+    dirty_list = xc_hypercall_buffer_alloc_pages(
+                 xch, dirty_list,
+                 NRPAGES(ctx->save.dirty_list_size * sizeof(*dirty_list)));
+    ctx->save.use_dirty_list = dirty_list != NULL;
     ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
                                   sizeof(*ctx->save.batch_pfns));
     ctx->save.deferred_pages = calloc(1, bitmap_size(ctx->save.p2m_size));
@@ -820,6 +944,8 @@ static void cleanup(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
 
 
     xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
@@ -830,6 +956,10 @@ static void cleanup(struct xc_sr_context *ctx)
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    if ( dirty_list )
+        xc_hypercall_buffer_free_pages(
+            xch, dirty_list,
+            NRPAGES(ctx->save.dirty_list_size * sizeof(*dirty_list)));
     free(ctx->save.deferred_pages);
     free(ctx->save.batch_pfns);
 }
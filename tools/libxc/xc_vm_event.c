@@ -20,8 +20,15 @@
  * License along with this library; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <time.h>
+
 #include "xc_private.h"
 
+/* Backing off from a contended lookup of the ring frames. */
+#define RING_MAP_MIN_DELAY_NS   100000UL        /* 100us */
+#define RING_MAP_MAX_DELAY_NS   100000000UL     /* 100ms */
+#define RING_MAP_MAX_TRIES      64
+
 int xc_vm_event_control(xc_interface *xch, uint32_t domain_id, unsigned int op,
                         unsigned int mode, uint32_t *port)
 {
@@ -32,6 +39,7 @@ int xc_vm_event_control(xc_interface *xch, uint32_t domain_id, unsigned int op,
     domctl.domain = domain_id;
     domctl.u.vm_event_op.op = op;
     domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.u.enable.nr_frames = 0;
 
     rc = do_domctl(xch, &domctl);
     if ( !rc && port )
@@ -156,6 +164,69 @@ void *xc_vm_event_enable(xc_interface *xch, uint32_t domain_id, int param,
     return ring_page;
 }
 
+void *xc_vm_event_enable_ring(xc_interface *xch, uint32_t domain_id,
+                              unsigned int mode, unsigned int nr_frames,
+                              uint32_t *port,
+                              xenforeignmemory_resource_handle **fres)
+{
+    DECLARE_DOMCTL;
+    void *ring = NULL;
+    struct timespec delay = { .tv_nsec = RING_MAP_MIN_DELAY_NS };
+    unsigned int tries = 0;
+    int saved_errno;
+
+    if ( !port || !fres || !nr_frames ||
+         nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    domctl.cmd = XEN_DOMCTL_vm_event_op;
+    domctl.domain = domain_id;
+    domctl.u.vm_event_op.op = XEN_VM_EVENT_ENABLE;
+    domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.u.enable.port = 0;
+    domctl.u.vm_event_op.u.enable.nr_frames = nr_frames;
+
+    if ( do_domctl(xch, &domctl) )
+    {
+        PERROR("Failed to enable vm_event\n");
+        return NULL;
+    }
+
+    /*
+     * Lookup fails with EAGAIN while the domctl lock is contended, which may
+     * be for a while (e.g. while a domain gets built).  Back off rather than
+     * hammer on the lock.
+     */
+    for ( ; ; )
+    {
+        *fres = xenforeignmemory_map_resource(xch->fmem, domain_id,
+                                              XENMEM_resource_vm_event, mode,
+                                              0, nr_frames, &ring,
+                                              PROT_READ | PROT_WRITE, 0);
+        if ( *fres || errno != EAGAIN || ++tries == RING_MAP_MAX_TRIES )
+            break;
+
+        nanosleep(&delay, NULL);
+        delay.tv_nsec = min(delay.tv_nsec * 2, (long)RING_MAP_MAX_DELAY_NS);
+    }
+
+    if ( !*fres )
+    {
+        saved_errno = errno;
+        PERROR("Could not map the ring pages\n");
+        xc_vm_event_control(xch, domain_id, XEN_VM_EVENT_DISABLE, mode, NULL);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    *port = domctl.u.vm_event_op.u.enable.port;
+
+    return ring;
+}
+
 int xc_vm_event_get_version(xc_interface *xch)
 {
     DECLARE_DOMCTL;
@@ -217,6 +217,31 @@ static int max_entries(struct __hash *h)
     return -1;
 }
 
+static unsigned long get_shm_baddr(void *hdr)
+{
+    /* Not in a shared memory region: pointers are process local already */
+    return 0;
+}
+
+struct __hash *__hash_alloc(uint32_t min_size)
+{
+    struct __hash *h = calloc(1, sizeof(*h));
+
+    if(h && !__hash_init(h, min_size))
+    {
+        free(h);
+        h = NULL;
+    }
+
+    return h;
+}
+
+void __hash_free(struct __hash *h)
+{
+    __hash_destroy(h, NULL, NULL);
+    free(h);
+}
+
 #else
 
 /*****************************************************************************/
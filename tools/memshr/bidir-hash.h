@@ -27,8 +27,13 @@ typedef struct vbdblk {
     uint16_t disk_id;
 } vbdblk_t;
 
+typedef struct guestpg {
+    uint64_t gfn;
+    uint32_t domain;
+} guestpg_t;
 
-#if defined FINGERPRINT_MAP || BLOCK_MAP 
+
+#if defined FINGERPRINT_MAP || BLOCK_MAP || defined PAGE_MAP
 #define DEFINE_SINGLE_MAP 
 #endif
 
@@ -111,4 +116,44 @@ static inline int blockshr_shrhnd_cmp(share_tuple_t h1, share_tuple_t h2)
 
 #endif /* BLOCK_MAP */
 
+
+/*******************************************************/
+/* Page content hash<->Guest page (dedup index)        */
+/*******************************************************/
+#if defined PAGE_MAP || !defined DEFINE_SINGLE_MAP
+
+#undef BIDIR_NAME_PREFIX
+#undef BIDIR_KEY
+#undef BIDIR_VALUE
+#undef BIDIR_KEY_T
+#undef BIDIR_VALUE_T
+
+static inline uint32_t pageshr_content_hash(uint64_t h)
+{
+    return (uint32_t)h ^ (uint32_t)(h >> 32);
+}
+
+static inline uint32_t pageshr_page_hash(guestpg_t pg)
+{
+    return (uint32_t)pg.gfn ^ ((uint32_t)pg.domain << 20);
+}
+
+static inline int pageshr_content_cmp(uint64_t h1, uint64_t h2)
+{
+    return (h1 == h2);
+}
+
+static inline int pageshr_page_cmp(guestpg_t p1, guestpg_t p2)
+{
+    return (p1.gfn == p2.gfn) && (p1.domain == p2.domain);
+}
+#define BIDIR_NAME_PREFIX       pageshr
+#define BIDIR_KEY               content
+#define BIDIR_VALUE             page
+#define BIDIR_KEY_T             uint64_t
+#define BIDIR_VALUE_T           guestpg_t
+#include "bidir-namedefs.h"
+
+#endif /* PAGE_MAP */
+
 #endif /* __BIDIR_HASH_H__ */
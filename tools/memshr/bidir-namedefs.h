@@ -47,6 +47,8 @@
 #define __value_remove          INTERNAL_NAME_TWO(BIDIR_VALUE, remove)
 #define __hash_destroy          INTERNAL_NAME_ONE(hash_destroy)
 #define __hash_iterator         INTERNAL_NAME_ONE(hash_iterator)
+#define __hash_alloc            INTERNAL_NAME_ONE(hash_alloc)
+#define __hash_free             INTERNAL_NAME_ONE(hash_free)
 
 #define __key_hash              INTERNAL_NAME_TWO(BIDIR_KEY, hash)
 #define __key_cmp               INTERNAL_NAME_TWO(BIDIR_KEY, cmp)
@@ -77,3 +79,6 @@ void           __hash_sizes(struct __hash *h,
                             uint32_t *tab_size,
                             uint32_t *max_load,
                             uint32_t *min_load);
+/* Only available for maps built with BIDIR_USE_STDMALLOC */
+struct __hash *__hash_alloc  (uint32_t min_size);
+void           __hash_free   (struct __hash *h);
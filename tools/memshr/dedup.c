@@ -0,0 +1,366 @@
+/******************************************************************************
+ *
+ * Content based page deduplication.
+ *
+ * Guest pages get hashed, and an index maps each hash to one representative
+ * page.  When a page hashes to an indexed value, the contents of both
+ * pages get compared (the hash is merely a hint), and if they match, the
+ * pages get nominated for sharing, compared once more, and the pair shared.
+ * Nomination makes the pages read-only, so a guest write after the second
+ * comparison invalidates the handle and makes the share fail rather than
+ * merge differing pages.  Nomination also insists on there being no
+ * foreign mappings of a page, which is why pages get hashed batch-wise but
+ * only nominated once the batch has been unmapped again.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <xenforeignmemory.h>
+
+#include "memshr.h"
+#include "memshr-priv.h"
+#include "bidir-hash.h"
+
+#define DEDUP_DEFAULT_BATCH     256
+#define DEDUP_INDEX_MIN_SIZE    (1U << 16)
+
+struct dedup_throttle {
+    uint32_t        rate;       /* events per second, 0 for no limit */
+    uint64_t        count;      /* events since start */
+    struct timespec start;
+};
+
+struct memshr_dedup {
+    xc_interface               *xch;
+    xenforeignmemory_handle    *fmem;
+    struct pageshr_hash        *index;
+    unsigned int                batch;
+    xen_pfn_t                  *pfns;
+    int                        *errs;
+    uint64_t                   *hashes;
+    struct dedup_throttle       scan_throttle;
+    struct dedup_throttle       share_throttle;
+    memshr_dedup_stats_t        stats;
+};
+
+static void throttle_reset(struct dedup_throttle *t)
+{
+    t->count = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/* Sleep for as long as needed to keep the average at or below the rate. */
+static void throttle(struct dedup_throttle *t, unsigned int n)
+{
+    struct timespec now, delay;
+    uint64_t due, elapsed;
+
+    t->count += n;
+    if(!t->rate)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - t->start.tv_sec) * 1000000000ULL +
+              now.tv_nsec - t->start.tv_nsec;
+    due = t->count * 1000000000ULL / t->rate;
+    if(due <= elapsed)
+        return;
+
+    delay.tv_sec  = (due - elapsed) / 1000000000ULL;
+    delay.tv_nsec = (due - elapsed) % 1000000000ULL;
+    nanosleep(&delay, NULL);
+}
+
+/*
+ * FNV-1a style hash, one 64-bit word at a time.  Collisions are harmless,
+ * as contents get compared before sharing.
+ */
+static uint64_t page_hash(const void *page)
+{
+    const uint64_t *w = page;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for(i = 0; i < XC_PAGE_SIZE / sizeof(*w); i++)
+        h = (h ^ w[i]) * 0x100000001b3ULL;
+
+    return h ^ (h >> 32);
+}
+
+/* Make pg the representative for hash h, replacing stale entries. */
+static void index_replace(memshr_dedup_t *dd, guestpg_t stale,
+                          uint64_t h, guestpg_t pg)
+{
+    pageshr_page_remove(dd->index, stale, NULL);
+    if(pageshr_insert(dd->index, h, pg) <= 0)
+        DPRINTF("Could not insert page hash into index.\n");
+}
+
+static void *map_page(memshr_dedup_t *dd, guestpg_t pg, int prot)
+{
+    xen_pfn_t pfn = pg.gfn;
+    void *map;
+    int err;
+
+    map = xenforeignmemory_map(dd->fmem, pg.domain, prot, 1,
+                               &pfn, &err);
+    if(map && err)
+    {
+        xenforeignmemory_unmap(dd->fmem, map, 1);
+        map = NULL;
+    }
+
+    return map;
+}
+
+/*
+ * Returns 1 if the pages are identical, 0 if not, and -1 if the source
+ * couldn't be mapped.
+ */
+static int same_contents(memshr_dedup_t *dd, guestpg_t src, guestpg_t pg)
+{
+    void *smap, *cmap;
+    int ret = 0;
+
+    if((smap = map_page(dd, src, PROT_READ)) == NULL)
+        return -1;
+
+    if((cmap = map_page(dd, pg, PROT_READ)) != NULL)
+    {
+        ret = !memcmp(smap, cmap, XC_PAGE_SIZE);
+        xenforeignmemory_unmap(dd->fmem, cmap, 1);
+    }
+    xenforeignmemory_unmap(dd->fmem, smap, 1);
+
+    return ret;
+}
+
+/*
+ * Make a page nominated in vain private again.  Mapping it writable
+ * unshares it, which doesn't involve a copy while nothing else shares it.
+ */
+static void drop_nomination(memshr_dedup_t *dd, guestpg_t pg)
+{
+    void *map = map_page(dd, pg, PROT_READ | PROT_WRITE);
+
+    if(map)
+        xenforeignmemory_unmap(dd->fmem, map, 1);
+}
+
+static void dedup_page(memshr_dedup_t *dd, guestpg_t pg, uint64_t h)
+{
+    uint64_t old, s_hnd, c_hnd;
+    guestpg_t src;
+    int ret;
+
+    /* Already the representative for its contents? */
+    if(pageshr_page_lookup(dd->index, pg, &old) > 0)
+    {
+        if(old == h)
+            return;
+        /* Contents changed since the last pass. */
+        pageshr_page_remove(dd->index, pg, NULL);
+    }
+
+    if(pageshr_content_lookup(dd->index, h, &src) <= 0)
+    {
+        if(pageshr_insert(dd->index, h, pg) <= 0)
+            DPRINTF("Could not insert page hash into index.\n");
+        return;
+    }
+
+    dd->stats.candidates++;
+
+    /* Pages merely colliding in their hash don't get nominated at all. */
+    ret = same_contents(dd, src, pg);
+    if(ret <= 0)
+    {
+        if(ret < 0)
+            index_replace(dd, src, h, pg);
+        else
+            dd->stats.mismatched++;
+        return;
+    }
+
+    if(xc_memshr_nominate_gfn(dd->xch, src.domain, src.gfn, &s_hnd))
+    {
+        /* The representative went away or isn't sharable any more. */
+        index_replace(dd, src, h, pg);
+        return;
+    }
+
+    if(xc_memshr_nominate_gfn(dd->xch, pg.domain, pg.gfn, &c_hnd))
+    {
+        dd->stats.failed++;
+        return;
+    }
+
+    /* Both already backed by the same shared page. */
+    if(s_hnd == c_hnd)
+        return;
+
+    /*
+     * Compare again now that both are read-only, as the guest may have
+     * written to either meanwhile.  The representative stays nominated,
+     * being what later candidates get shared with.
+     */
+    ret = same_contents(dd, src, pg);
+    if(ret <= 0)
+    {
+        drop_nomination(dd, pg);
+        if(ret < 0)
+            index_replace(dd, src, h, pg);
+        else
+            dd->stats.mismatched++;
+        return;
+    }
+
+    throttle(&dd->share_throttle, 1);
+
+    if(!xc_memshr_share_gfns(dd->xch, src.domain, src.gfn, s_hnd,
+                             pg.domain, pg.gfn, c_hnd))
+    {
+        dd->stats.merged++;
+        return;
+    }
+
+    if(errno == -XENMEM_SHARING_OP_S_HANDLE_INVALID)
+        index_replace(dd, src, h, pg);
+    else
+        dd->stats.failed++;
+}
+
+memshr_dedup_t *memshr_dedup_open(xc_interface *xch,
+                                  const memshr_dedup_opts_t *opts)
+{
+    memshr_dedup_t *dd = calloc(1, sizeof(*dd));
+
+    if(!dd)
+        return NULL;
+
+    dd->xch = xch;
+    dd->batch = opts && opts->batch ? opts->batch : DEDUP_DEFAULT_BATCH;
+    if(opts)
+    {
+        dd->scan_throttle.rate  = opts->scan_rate;
+        dd->share_throttle.rate = opts->share_rate;
+    }
+
+    dd->pfns = calloc(dd->batch, sizeof(*dd->pfns));
+    dd->errs = calloc(dd->batch, sizeof(*dd->errs));
+    dd->hashes = calloc(dd->batch, sizeof(*dd->hashes));
+    if(!dd->pfns || !dd->errs || !dd->hashes)
+        goto err;
+
+    if((dd->fmem = xenforeignmemory_open(NULL, 0)) == NULL)
+    {
+        EPRINTF("Failed to open foreign memory handle.\n");
+        goto err;
+    }
+
+    if((dd->index = pageshr_hash_alloc(DEDUP_INDEX_MIN_SIZE)) == NULL)
+    {
+        EPRINTF("Failed to allocate page hash index.\n");
+        goto err;
+    }
+
+    return dd;
+
+err:
+    memshr_dedup_close(dd);
+    return NULL;
+}
+
+void memshr_dedup_close(memshr_dedup_t *dd)
+{
+    if(!dd)
+        return;
+
+    if(dd->index)
+        pageshr_hash_free(dd->index);
+    if(dd->fmem)
+        xenforeignmemory_close(dd->fmem);
+    free(dd->pfns);
+    free(dd->errs);
+    free(dd->hashes);
+    free(dd);
+}
+
+int memshr_dedup_scan(memshr_dedup_t *dd, uint32_t domid)
+{
+    xen_pfn_t max_gpfn, gfn;
+    unsigned int i, n;
+    char *map;
+
+    if(xc_memshr_control(dd->xch, domid, 1))
+        return -1;
+
+    if(xc_domain_maximum_gpfn(dd->xch, domid, &max_gpfn) < 0)
+        return -1;
+
+    throttle_reset(&dd->scan_throttle);
+    throttle_reset(&dd->share_throttle);
+
+    for(gfn = 0; gfn <= max_gpfn; gfn += n)
+    {
+        n = dd->batch;
+        if(n > max_gpfn - gfn + 1)
+            n = max_gpfn - gfn + 1;
+
+        for(i = 0; i < n; i++)
+            dd->pfns[i] = gfn + i;
+
+        map = xenforeignmemory_map(dd->fmem, domid, PROT_READ, n,
+                                   dd->pfns, dd->errs);
+        if(!map)
+        {
+            dd->stats.skipped += n;
+            continue;
+        }
+
+        for(i = 0; i < n; i++)
+            if(!dd->errs[i])
+                dd->hashes[i] = page_hash(map + i * XC_PAGE_SIZE);
+
+        xenforeignmemory_unmap(dd->fmem, map, n);
+
+        for(i = 0; i < n; i++)
+        {
+            if(dd->errs[i])
+            {
+                dd->stats.skipped++;
+                continue;
+            }
+            dd->stats.scanned++;
+            dedup_page(dd, (guestpg_t){ .gfn = gfn + i, .domain = domid },
+                       dd->hashes[i]);
+        }
+
+        throttle(&dd->scan_throttle, n);
+    }
+
+    return 0;
+}
+
+void memshr_dedup_get_stats(memshr_dedup_t *dd, memshr_dedup_stats_t *stats)
+{
+    *stats = dd->stats;
+    pageshr_hash_sizes(dd->index, &stats->indexed, NULL, NULL, NULL, NULL);
+}
@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <xen/xen.h>
 #include <xen/grant_table.h>
+#include <xenctrl.h>
 
 typedef uint64_t xen_mfn_t;
 
@@ -48,4 +49,37 @@ extern void memshr_vbd_complete_ro_request(
                                        uint64_t sec, 
                                        int secs);
 
+/*
+ * Content based deduplication of guest memory.  Pages found identical
+ * across (and within) the scanned domains get shared.  Rates are in pages
+ * per second, 0 meaning unlimited; batch is the number of pages mapped at
+ * a time while hashing, 0 picking a default.
+ */
+typedef struct memshr_dedup memshr_dedup_t;
+
+typedef struct memshr_dedup_opts
+{
+    uint32_t scan_rate;
+    uint32_t share_rate;
+    uint32_t batch;
+} memshr_dedup_opts_t;
+
+typedef struct memshr_dedup_stats
+{
+    uint64_t scanned;       /* pages hashed */
+    uint64_t skipped;       /* pages which couldn't be mapped */
+    uint64_t candidates;    /* pages whose hash matched an indexed page */
+    uint64_t merged;        /* pages successfully shared */
+    uint64_t mismatched;    /* hash collisions caught by the comparison */
+    uint64_t failed;        /* nominate or share failures */
+    uint32_t indexed;       /* pages currently in the content index */
+} memshr_dedup_stats_t;
+
+extern memshr_dedup_t *memshr_dedup_open(xc_interface *xch,
+                                         const memshr_dedup_opts_t *opts);
+extern void memshr_dedup_close(memshr_dedup_t *dd);
+extern int memshr_dedup_scan(memshr_dedup_t *dd, uint32_t domid);
+extern void memshr_dedup_get_stats(memshr_dedup_t *dd,
+                                   memshr_dedup_stats_t *stats);
+
 #endif /* __MEMSHR_H__ */
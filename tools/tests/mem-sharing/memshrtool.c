@@ -10,10 +10,15 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <inttypes.h>
 
 #define XC_WANT_COMPAT_MAP_FOREIGN_API
 #include "xenctrl.h"
 
+#ifdef HAVE_MEMSHR
+#include "memshr.h"
+#endif
+
 static int usage(const char* prog)
 {
     printf("usage: %s <command> [args...]\n", prog);
@@ -31,6 +36,11 @@ static int usage(const char* prog)
     printf("                          - Populate a page in a domain with a shared page.\n");
     printf("  debug-gfn <domid> <gfn> - Debug a particular domain and gfn.\n");
     printf("  audit                   - Audit the sharing subsytem in Xen.\n");
+#ifdef HAVE_MEMSHR
+    printf("  dedup <scan-rate> <share-rate> <domid>...\n");
+    printf("                          - Share identical pages found in the domains,\n");
+    printf("                            rates in pages/s, 0 for unlimited.\n");
+#endif
     return 1;
 }
 
@@ -203,5 +213,51 @@ int main(int argc, const char** argv)
             return rc;
         }
     }
+#ifdef HAVE_MEMSHR
+    else if( !strcasecmp(cmd, "dedup") )
+    {
+        memshr_dedup_opts_t opts = { 0 };
+        memshr_dedup_stats_t stats;
+        memshr_dedup_t *dd;
+        int i, rc = 0;
+
+        if ( argc < 5 )
+            return usage(argv[0]);
+
+        opts.scan_rate = strtoul(argv[2], NULL, 0);
+        opts.share_rate = strtoul(argv[3], NULL, 0);
+
+        dd = memshr_dedup_open(xch, &opts);
+        if ( !dd )
+        {
+            printf("error opening dedup scanner: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for ( i = 4; i < argc; i++ )
+        {
+            domid_t domid = strtol(argv[i], NULL, 0);
+
+            rc = memshr_dedup_scan(dd, domid);
+            if ( rc < 0 )
+            {
+                printf("error scanning domain %u: %s\n", domid, strerror(errno));
+                break;
+            }
+        }
+
+        memshr_dedup_get_stats(dd, &stats);
+        memshr_dedup_close(dd);
+
+        printf("scanned %"PRIu64" skipped %"PRIu64" candidates %"PRIu64"\n",
+               stats.scanned, stats.skipped, stats.candidates);
+        printf("merged %"PRIu64" mismatched %"PRIu64" failed %"PRIu64
+               " indexed %u\n", stats.merged, stats.mismatched, stats.failed,
+               stats.indexed);
+        printf("freed pages: %ld\n", xc_sharing_freed_pages(xch));
+        if ( rc < 0 )
+            return rc;
+    }
+#endif
     return 0;
 }
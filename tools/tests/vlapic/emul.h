@@ -0,0 +1,111 @@
+/*
+ * Unit tests and benchmark for the vLAPIC destination lookup.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_VLAPIC_
+#define _TEST_VLAPIC_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#define container_of(ptr, type, member) ({                      \
+        typeof(((type *)0)->member) *mptr = (ptr);              \
+                                                                \
+        (type *)((char *)mptr - offsetof(type, member));        \
+})
+
+typedef bool bool_t;
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef int64_t s_time_t;
+typedef bool spinlock_t;
+
+struct domain;
+struct vcpu;
+struct page_info;
+struct periodic_time {};
+struct tasklet {};
+
+struct hvm_hw_lapic {
+    uint64_t             apic_base_msr;
+    uint32_t             disabled; /* VLAPIC_xx_DISABLED */
+    uint32_t             timer_divisor;
+    uint64_t             tdt_msr;
+};
+
+struct hvm_hw_lapic_regs {
+    uint8_t data[1024];
+};
+
+#define APIC_BASE_EXTD          (1 << 10)
+#define APIC_BASE_ENABLE        (1 << 11)
+#define APIC_BASE_ADDR_MASK     0x000ffffffffff000ul
+
+#include "apicdef.h"
+#include "vlapic.h"
+
+typedef struct { int counter; } atomic_t;
+#define atomic_read(v)  ((v)->counter)
+#define atomic_inc(v)   ((v)->counter++)
+#define atomic_dec(v)   ((v)->counter--)
+
+struct vcpu {
+    unsigned int vcpu_id;
+    struct domain *domain;
+    struct vcpu *next_in_list;
+    struct {
+        struct {
+            struct vlapic vlapic;
+        } hvm;
+    } arch;
+};
+
+struct domain {
+    unsigned int max_vcpus;
+    struct vcpu **vcpu;
+    struct {
+        struct {
+            atomic_t nr_vlapic_custom_id;
+            atomic_t nr_vlapic_custom_ldr;
+        } hvm;
+    } arch;
+};
+
+#define for_each_vcpu(_d, _v)                       \
+    for ( (_v) = (_d)->vcpu ? (_d)->vcpu[0] : NULL; \
+          (_v) != NULL;                             \
+          (_v) = (_v)->next_in_list )
+
+#define XENLOG_WARNING
+#define XENLOG_G_WARNING
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define gdprintk(lvl, fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define HVM_DBG_LOG(lvl, fmt, ...) ((void)0)
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,278 @@
+/*
+ * Unit tests and benchmark for the vLAPIC destination lookup.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "emul.h"
+
+#define MAX_VCPUS 288
+#define BENCH_ROUNDS 2000
+
+static struct domain dom;
+static struct vcpu vcpus[MAX_VCPUS];
+static struct vcpu *vcpu_array[MAX_VCPUS];
+static struct hvm_hw_lapic_regs regs[MAX_VCPUS];
+
+static void lapic_set_mode(struct vcpu *v, bool x2apic)
+{
+    struct vlapic *vlapic = vcpu_vlapic(v);
+
+    if ( x2apic )
+    {
+        vlapic->hw.apic_base_msr = APIC_BASE_ENABLE | APIC_BASE_EXTD;
+        vlapic_set_reg(vlapic, APIC_ID, v->vcpu_id * 2);
+        vlapic_set_reg(vlapic, APIC_LDR, VLAPIC_X2APIC_LDR(v->vcpu_id));
+    }
+    else
+    {
+        vlapic->hw.apic_base_msr = APIC_BASE_ENABLE;
+        vlapic_set_reg(vlapic, APIC_ID, SET_xAPIC_ID(v->vcpu_id * 2));
+        vlapic_set_reg(vlapic, APIC_LDR,
+                       SET_xAPIC_LOGICAL_ID(1 << (v->vcpu_id & 7)));
+        vlapic_set_reg(vlapic, APIC_DFR, APIC_DFR_FLAT);
+    }
+    vlapic_update_dest_map(vlapic);
+}
+
+static void domain_setup(unsigned int nr, bool x2apic)
+{
+    unsigned int i;
+
+    memset(&dom, 0, sizeof(dom));
+    memset(vcpus, 0, sizeof(vcpus));
+    memset(regs, 0, sizeof(regs));
+
+    dom.max_vcpus = nr;
+    dom.vcpu = vcpu_array;
+    for ( i = 0; i < nr; i++ )
+    {
+        vcpus[i].vcpu_id = i;
+        vcpus[i].domain = &dom;
+        vcpus[i].next_in_list = i + 1 < nr ? &vcpus[i + 1] : NULL;
+        vcpus[i].arch.hvm.vlapic.regs = &regs[i];
+        vcpu_array[i] = &vcpus[i];
+        lapic_set_mode(&vcpus[i], x2apic);
+    }
+}
+
+/* Destination resolution as done before, checking every vCPU. */
+static unsigned int resolve_scan(const struct vlapic *source, int short_hand,
+                                 uint32_t dest, bool dest_mode,
+                                 uint8_t *hit)
+{
+    struct vcpu *v;
+    unsigned int n = 0;
+
+    for_each_vcpu ( &dom, v )
+        if ( vlapic_match_dest(vcpu_vlapic(v), source, short_hand, dest,
+                               dest_mode) )
+        {
+            hit[v->vcpu_id] = 1;
+            n++;
+        }
+
+    return n;
+}
+
+static unsigned int resolve_lookup(const struct vlapic *source,
+                                   int short_hand, uint32_t dest,
+                                   bool dest_mode, uint8_t *hit)
+{
+    unsigned int first, mask, n = 0;
+    struct vcpu *v;
+
+    if ( !vlapic_dest_candidates(&dom, source, short_hand, dest, dest_mode,
+                                 &first, &mask) )
+        return resolve_scan(source, short_hand, dest, dest_mode, hit);
+
+    while ( (v = vlapic_next_candidate(&dom, first, &mask)) != NULL )
+        if ( vlapic_match_dest(vcpu_vlapic(v), source, short_hand, dest,
+                               dest_mode) )
+        {
+            hit[v->vcpu_id] = 1;
+            n++;
+        }
+
+    return n;
+}
+
+static void check(int short_hand, uint32_t dest, bool dest_mode,
+                  unsigned int expected)
+{
+    const struct vlapic *source = vcpu_vlapic(&vcpus[1]);
+    uint8_t scan[MAX_VCPUS] = {}, lookup[MAX_VCPUS] = {};
+    unsigned int n;
+
+    n = resolve_scan(source, short_hand, dest, dest_mode, scan);
+    if ( n != expected )
+    {
+        fprintf(stderr, "shorthand %#x dest %#x mode %u: %u matches, "
+                "expected %u\n", short_hand, dest, dest_mode, n, expected);
+        abort();
+    }
+
+    n = resolve_lookup(source, short_hand, dest, dest_mode, lookup);
+    if ( n != expected || memcmp(scan, lookup, sizeof(scan)) )
+    {
+        fprintf(stderr, "shorthand %#x dest %#x mode %u: lookup mismatch\n",
+                short_hand, dest, dest_mode);
+        abort();
+    }
+}
+
+static bool use_lookup(int short_hand, uint32_t dest, bool dest_mode)
+{
+    unsigned int first, mask;
+
+    return vlapic_dest_candidates(&dom, vcpu_vlapic(&vcpus[0]), short_hand,
+                                  dest, dest_mode, &first, &mask);
+}
+
+static uint64_t ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench(void)
+{
+    unsigned int (*resolve[])(const struct vlapic *, int, uint32_t, bool,
+                              uint8_t *) = { resolve_scan, resolve_lookup };
+    const char *name[] = { "scan", "lookup" };
+    static uint8_t hit[MAX_VCPUS];
+    unsigned int i, r, k;
+
+    domain_setup(MAX_VCPUS, true);
+    printf("%u vCPUs, x2APIC mode\n", MAX_VCPUS);
+
+    for ( k = 0; k < 2; k++ )
+    {
+        uint64_t start, unicast, multicast;
+
+        start = ns_now();
+        for ( r = 0; r < BENCH_ROUNDS; r++ )
+            for ( i = 0; i < MAX_VCPUS; i++ )
+                resolve[k](vcpu_vlapic(&vcpus[0]), APIC_DEST_NOSHORT, i * 2,
+                           false, hit);
+        unicast = ns_now() - start;
+
+        start = ns_now();
+        for ( r = 0; r < BENCH_ROUNDS; r++ )
+            for ( i = 0; i < MAX_VCPUS / 16; i++ )
+                resolve[k](vcpu_vlapic(&vcpus[0]), APIC_DEST_NOSHORT,
+                           (i << 16) | 0x5555, true, hit);
+        multicast = ns_now() - start;
+
+        printf("%-6s: physical unicast %6lu ns/IPI, logical multicast "
+               "%6lu ns/IPI\n", name[k],
+               (unsigned long)(unicast / (BENCH_ROUNDS * MAX_VCPUS)),
+               (unsigned long)(multicast / (BENCH_ROUNDS * MAX_VCPUS / 16)));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+    int c;
+
+    while ( (c = getopt(argc, argv, "b")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'b':
+            bench();
+            return 0;
+
+        default:
+            fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* x2APIC mode, IDs and LDRs derived from the vCPU ID. */
+    domain_setup(64, true);
+    for ( i = 0; i < 64; i++ )
+        check(APIC_DEST_NOSHORT, i * 2, false, 1);
+    check(APIC_DEST_NOSHORT, 5, false, 0);
+    check(APIC_DEST_NOSHORT, 200, false, 0);
+    check(APIC_DEST_NOSHORT, 0xffffffff, false, 64);
+    check(APIC_DEST_NOSHORT, 0x00000001, true, 1);
+    check(APIC_DEST_NOSHORT, 0x0003ffff, true, 16);
+    check(APIC_DEST_NOSHORT, 0x00020101, true, 2);
+    check(APIC_DEST_NOSHORT, 0x00040001, true, 0);
+    check(APIC_DEST_SELF, 0, false, 1);
+    check(APIC_DEST_ALLINC, 0, false, 64);
+    check(APIC_DEST_ALLBUT, 0, false, 63);
+    assert(use_lookup(APIC_DEST_NOSHORT, 6, false));
+    assert(use_lookup(APIC_DEST_NOSHORT, 0x10001, true));
+    assert(!use_lookup(APIC_DEST_NOSHORT, 0xffffffff, false));
+
+    /* A guest supplied APIC ID forces a full scan, until it's undone. */
+    vlapic_set_reg(vcpu_vlapic(&vcpus[3]), APIC_ID, 201);
+    vlapic_update_dest_map(vcpu_vlapic(&vcpus[3]));
+    assert(!use_lookup(APIC_DEST_NOSHORT, 6, false));
+    check(APIC_DEST_NOSHORT, 201, false, 1);
+    check(APIC_DEST_NOSHORT, 6, false, 0);
+    assert(use_lookup(APIC_DEST_NOSHORT, 0x10001, true));
+    lapic_set_mode(&vcpus[3], true);
+    assert(use_lookup(APIC_DEST_NOSHORT, 6, false));
+    check(APIC_DEST_NOSHORT, 6, false, 1);
+
+    /* A single vCPU in xAPIC mode makes logical destinations scan. */
+    lapic_set_mode(&vcpus[7], false);
+    assert(!use_lookup(APIC_DEST_NOSHORT, 0x10001, true));
+    check(APIC_DEST_NOSHORT, 0x00000080, true, 1);
+    lapic_set_mode(&vcpus[7], true);
+    assert(use_lookup(APIC_DEST_NOSHORT, 0x10001, true));
+
+    /* xAPIC mode, flat logical destinations. */
+    domain_setup(64, false);
+    for ( i = 0; i < 64; i++ )
+        check(APIC_DEST_NOSHORT, i * 2, false, 1);
+    check(APIC_DEST_NOSHORT, 0xff, false, 64);
+    check(APIC_DEST_NOSHORT, 0x01, true, 8);
+    check(APIC_DEST_NOSHORT, 0xff, true, 64);
+    assert(use_lookup(APIC_DEST_NOSHORT, 6, false));
+    assert(!use_lookup(APIC_DEST_NOSHORT, 0x01, true));
+
+    /* More vCPUs than 8-bit xAPIC IDs can tell apart. */
+    domain_setup(MAX_VCPUS, false);
+    assert(!use_lookup(APIC_DEST_NOSHORT, 6, false));
+    check(APIC_DEST_NOSHORT, 6, false, 3);
+    check(APIC_DEST_NOSHORT, 0xff, false, MAX_VCPUS);
+
+    /* And the same in x2APIC mode. */
+    domain_setup(MAX_VCPUS, true);
+    for ( i = 0; i < MAX_VCPUS; i++ )
+        check(APIC_DEST_NOSHORT, i * 2, false, 1);
+    check(APIC_DEST_NOSHORT, 0x0011ffff, true, 16);
+    check(APIC_DEST_NOSHORT, 0x00120001, true, 0);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
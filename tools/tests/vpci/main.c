@@ -16,6 +16,9 @@
  * License along with this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <time.h>
+
 #include "emul.h"
 
 /* Single vcpu (current), and single domain with a single PCI device. */
@@ -141,6 +144,68 @@ void multiwrite4_check(unsigned int reg)
     multiread4_check(reg, val);
 }
 
+#define BENCH_ITERATIONS 1000000
+
+static uint64_t ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_access(const char *desc, unsigned int reg, unsigned int size)
+{
+    uint64_t start, read_ns, write_ns;
+    volatile uint32_t sink;
+    unsigned int i;
+
+    start = ns_now();
+    for ( i = 0; i < BENCH_ITERATIONS; i++ )
+        VPCI_READ(reg, size, sink);
+    read_ns = ns_now() - start;
+
+    start = ns_now();
+    for ( i = 0; i < BENCH_ITERATIONS; i++ )
+        VPCI_WRITE(reg, size, i);
+    write_ns = ns_now() - start;
+
+    printf("%-24s reg %#05x size %u: read %6.1fns write %6.1fns\n",
+           desc, reg, size, (double)read_ns / BENCH_ITERATIONS,
+           (double)write_ns / BENCH_ITERATIONS);
+    (void)sink;
+}
+
+/*
+ * Measure the cost of config space accesses with a densely populated
+ * extended config space: a 4 byte handler every other dword.
+ */
+static void bench(void)
+{
+    static uint32_t regs[PCI_CFG_SPACE_EXP_SIZE / 8];
+    unsigned int i;
+
+    for ( i = 0; i < PCI_CFG_SPACE_EXP_SIZE / 8; i++ )
+        VPCI_ADD_REG(vpci_read32, vpci_write32, i * 8, 4, regs[i]);
+
+    /* Sanity check the layout before timing anything. */
+    VPCI_WRITE_CHECK(PCI_CFG_SPACE_EXP_SIZE - 8, 4, 0x12345678);
+    VPCI_READ_CHECK(PCI_CFG_SPACE_EXP_SIZE - 4, 4, 0xffffffff);
+
+    printf("%u handlers, %u iterations per access\n",
+           PCI_CFG_SPACE_EXP_SIZE / 8, BENCH_ITERATIONS);
+    bench_access("first handler", 0, 4);
+    bench_access("middle handler", PCI_CFG_SPACE_EXP_SIZE / 2, 4);
+    bench_access("last handler", PCI_CFG_SPACE_EXP_SIZE - 8, 4);
+    bench_access("last handler, partial", PCI_CFG_SPACE_EXP_SIZE - 6, 2);
+    bench_access("unhandled", PCI_CFG_SPACE_EXP_SIZE - 4, 4);
+
+    for ( i = 0; i < PCI_CFG_SPACE_EXP_SIZE / 8; i++ )
+        VPCI_REMOVE_REG(i * 8, 4);
+    VPCI_READ_CHECK(0, 4, 0xffffffff);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -160,6 +225,12 @@ main(int argc, char **argv)
     INIT_LIST_HEAD(&vpci.handlers);
     spin_lock_init(&vpci.lock);
 
+    if ( argc > 1 && !strcmp(argv[1], "-b") )
+    {
+        bench();
+        return 0;
+    }
+
     VPCI_ADD_REG(vpci_read32, vpci_write32, 0, 4, r0);
     VPCI_READ_CHECK(0, 4, r0);
     VPCI_WRITE_CHECK(0, 4, 0xbcbcbcbc);
@@ -4,6 +4,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <time.h>
 
 asm ( ".pushsection .test, \"ax\", @progbits; .popsection" );
 
@@ -24,6 +25,15 @@ asm ( ".pushsection .test, \"ax\", @progbits; .popsection" );
 
 #define verbose false /* Switch to true for far more logging. */
 
+static unsigned long long ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static void blowfish_set_regs(struct cpu_user_regs *regs)
 {
     regs->eax = 2;
@@ -417,6 +427,151 @@ static struct x86_emulate_ops emulops = {
 #define EFLAGS_ALWAYS_SET (X86_EFLAGS_IF | X86_EFLAGS_MBS)
 #define EFLAGS_MASK (X86_EFLAGS_ARITH_MASK | EFLAGS_ALWAYS_SET)
 
+/*
+ * Benchmark mode: time representative instructions and the test blobs,
+ * without and with decode cache.  Output is CSV, one line per class and
+ * decode cache setting, suitable for tracking across releases.
+ */
+#define BENCH_ITERS 20000
+
+static const struct {
+    const char *name;
+    uint8_t insn[8];
+    unsigned int reps;
+    bool (*check_cpu)(void);
+} bench_insns[] = {
+    /* movl 0x10(%eax),%ecx */
+    { "mmio-load",         { 0x8b, 0x48, 0x10 } },
+    /* movl %ecx,0x10(%eax) */
+    { "mmio-store",        { 0x89, 0x48, 0x10 } },
+    /* movzwl 0x10(%eax),%ecx */
+    { "mmio-load-movzw",   { 0x0f, 0xb7, 0x48, 0x10 } },
+    /* rep movsb */
+    { "rep-movsb",         { 0xf3, 0xa4 }, 16 },
+    /* rep stosl */
+    { "rep-stosl",         { 0xf3, 0xab }, 16 },
+    /* movdqu 0x10(%eax),%xmm0 */
+    { "sse2-movdqu-load",  { 0xf3, 0x0f, 0x6f, 0x40, 0x10 }, 0,
+      simd_check_sse2 },
+    /* movdqu %xmm0,0x10(%eax) */
+    { "sse2-movdqu-store", { 0xf3, 0x0f, 0x7f, 0x40, 0x10 }, 0,
+      simd_check_sse2 },
+    /* vmovdqu 0x20(%eax),%ymm0 */
+    { "avx-vmovdqu-load",  { 0xc5, 0xfe, 0x6f, 0x40, 0x20 }, 0,
+      simd_check_avx },
+};
+
+static void bench_print(const char *class, bool cached,
+                        unsigned long insns, unsigned long long ns)
+{
+    if ( !insns )
+        printf("%s,%d,0,%llu,-\n", class, cached, ns);
+    else
+        printf("%s,%d,%lu,%llu,%llu.%02llu\n", class, cached, insns, ns,
+               ns / insns, (ns * 100 / insns) % 100);
+}
+
+static int bench(struct x86_emulate_ctxt *ctxt, char *instr,
+                 unsigned int *res, bool stack_exec)
+{
+    struct cpu_user_regs *regs = ctxt->regs;
+    struct x86_emulate_decode_cache *cache = x86_emulate_decode_cache_alloc();
+    unsigned int i, j, k;
+    int rc = X86EMUL_OKAY;
+
+    if ( !cache )
+        return 1;
+
+    printf("# class,decode_cache,insns,ns,ns_per_insn\n");
+
+    for ( i = 0; i < ARRAY_SIZE(bench_insns); ++i )
+    {
+        /* SIMD insns get emulated via stubs on the stack. */
+        if ( bench_insns[i].check_cpu &&
+             (!stack_exec || !bench_insns[i].check_cpu()) )
+            continue;
+
+        memcpy(instr, bench_insns[i].insn, sizeof(bench_insns[i].insn));
+
+        for ( k = 0; k < 2; ++k )
+        {
+            unsigned long long start;
+
+            ctxt->decode_cache = k ? cache : NULL;
+            memset(regs, 0, sizeof(*regs));
+
+            start = ns_now();
+            for ( j = 0; j < BENCH_ITERS; ++j )
+            {
+                regs->eflags = 0x200;
+                regs->eip    = (unsigned long)instr;
+                regs->eax    = (unsigned long)res;
+                regs->ecx    = bench_insns[i].reps;
+                regs->esi    = (unsigned long)res;
+                regs->edi    = (unsigned long)res + MMAP_SZ / 2;
+                do {
+                    rc = x86_emulate(ctxt, &emulops);
+                } while ( rc == X86EMUL_OKAY &&
+                          regs->eip == (unsigned long)instr );
+                if ( rc != X86EMUL_OKAY )
+                    break;
+            }
+            bench_print(bench_insns[i].name, k, j, ns_now() - start);
+        }
+    }
+
+    for ( i = 0; i < ARRAY_SIZE(blobs); ++i )
+    {
+        if ( (blobs[i].check_cpu && !blobs[i].check_cpu()) ||
+             !blobs[i].size )
+            continue;
+
+        memcpy(res, blobs[i].code, blobs[i].size);
+        ctxt->lma = blobs[i].bitness == 64;
+        ctxt->addr_size = ctxt->sp_size = blobs[i].bitness;
+
+        for ( k = 0; k < 2; ++k )
+        {
+            unsigned long long start;
+            char name[64];
+
+            ctxt->decode_cache = k ? cache : NULL;
+            memset(regs, 0, sizeof(*regs));
+            if ( blobs[i].set_regs )
+                blobs[i].set_regs(regs);
+            regs->eip = (unsigned long)res;
+            regs->esp = (unsigned long)res + MMAP_SZ - 4;
+            if ( ctxt->addr_size == 64 )
+            {
+                *(uint32_t *)(unsigned long)regs->esp = 0;
+                regs->esp -= 4;
+            }
+            *(uint32_t *)(unsigned long)regs->esp = 0x12345678;
+            regs->eflags = 2;
+            rc = X86EMUL_OKAY;
+
+            start = ns_now();
+            for ( j = 0; regs->eip >= (unsigned long)res &&
+                         regs->eip < (unsigned long)res + blobs[i].size;
+                  ++j )
+                if ( (rc = x86_emulate(ctxt, &emulops)) != X86EMUL_OKAY )
+                    break;
+            /* Emulation failures are reported by the test run proper. */
+            snprintf(name, sizeof(name), "%s/%u",
+                     blobs[i].name, blobs[i].bitness);
+            bench_print(name, k, rc == X86EMUL_OKAY ? j : 0,
+                        ns_now() - start);
+        }
+    }
+
+    ctxt->lma = sizeof(void *) == 8;
+    ctxt->addr_size = ctxt->sp_size = 8 * sizeof(void *);
+    ctxt->decode_cache = NULL;
+    x86_emulate_decode_cache_free(cache);
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     struct x86_emulate_ctxt ctxt;
@@ -434,6 +589,7 @@ int main(int argc, char **argv)
 
     ctxt.regs = &regs;
     ctxt.force_writeback = 0;
+    ctxt.decode_cache = NULL;
     ctxt.vendor    = X86_VENDOR_UNKNOWN;
     ctxt.lma       = sizeof(void *) == 8;
     ctxt.addr_size = 8 * sizeof(void *);
@@ -453,6 +609,9 @@ int main(int argc, char **argv)
     if ( !stack_exec )
         printf("Warning: Stack could not be made executable (%d).\n", errno);
 
+    if ( argc > 1 && !strcmp(argv[1], "--bench") )
+        return bench(&ctxt, instr, res, stack_exec);
+
  rmw_restart:
     printf("%-40s", "Testing addl %ecx,(%eax)...");
     instr[0] = 0x01; instr[1] = 0x08;
@@ -715,6 +874,49 @@ int main(int argc, char **argv)
         goto rmw_restart;
     }
 
+    printf("%-40s", "Testing decode cache...");
+    if ( !(ctxt.decode_cache = x86_emulate_decode_cache_alloc()) )
+        goto fail;
+    /* movl 4(%eax,%ebx,2),%ecx */
+    instr[0] = 0x8b; instr[1] = 0x4c; instr[2] = 0x58; instr[3] = 0x04;
+    res[1] = 0x11111111;
+    res[2] = 0x22222222;
+    res[3] = 0x33333333;
+    res[4] = 0x44444444;
+    /* Filled by the 2nd (repeated) miss, hit by the 3rd run. */
+    for ( i = 0; i < 3; ++i )
+    {
+        regs.eflags = 0x200;
+        regs.eip    = (unsigned long)&instr[0];
+        regs.eax    = (unsigned long)res;
+        regs.ebx    = i * 2;
+        regs.ecx    = 0;
+        rc = x86_emulate(&ctxt, &emulops);
+        if ( (rc != X86EMUL_OKAY) ||
+             (regs.ecx != res[1 + i]) ||
+             (regs.eip != (unsigned long)&instr[4]) )
+            goto fail;
+    }
+    /* Modified code must not hit: movl 8(%eax,%ebx,2),%ecx */
+    instr[3] = 0x08;
+    regs.eip    = (unsigned long)&instr[0];
+    regs.ebx    = 4;
+    rc = x86_emulate(&ctxt, &emulops);
+    if ( (rc != X86EMUL_OKAY) ||
+         (regs.ecx != res[4]) ||
+         (regs.eip != (unsigned long)&instr[4]) )
+        goto fail;
+    {
+        unsigned long hits, misses;
+
+        x86_emulate_decode_cache_stats(ctxt.decode_cache, &hits, &misses);
+        if ( hits != 1 || misses != 3 )
+            goto fail;
+    }
+    x86_emulate_decode_cache_free(ctxt.decode_cache);
+    ctxt.decode_cache = NULL;
+    printf("okay\n");
+
     printf("%-40s", "Testing rep movsw...");
     instr[0] = 0xf3; instr[1] = 0x66; instr[2] = 0xa5;
     *res        = 0x22334455;
@@ -240,3 +240,13 @@ void emul_test_put_fpu(
 }
 
 #include "x86_emulate/x86_emulate.c"
+
+struct x86_emulate_decode_cache *x86_emulate_decode_cache_alloc(void)
+{
+    return calloc(1, sizeof(struct x86_emulate_decode_cache));
+}
+
+void x86_emulate_decode_cache_free(struct x86_emulate_decode_cache *cache)
+{
+    free(cache);
+}
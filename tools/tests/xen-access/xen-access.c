@@ -40,6 +40,7 @@
 
 #include <xenctrl.h>
 #include <xenevtchn.h>
+#include <xenforeignmemory.h>
 #include <xen/vm_event.h>
 
 #include <xen-tools/libs.h>
@@ -69,6 +70,8 @@ typedef struct vm_event {
     vm_event_back_ring_t back_ring;
     uint32_t evtchn_port;
     void *ring_page;
+    unsigned int ring_frames; /* 0 for the single page ring */
+    xenforeignmemory_resource_handle *fres;
 } vm_event_t;
 
 typedef struct xenaccess {
@@ -136,7 +139,10 @@ int xenaccess_teardown(xc_interface *xch, xenaccess_t *xenaccess)
         return 0;
 
     /* Tear down domain xenaccess in Xen */
-    if ( xenaccess->vm_event.ring_page )
+    if ( xenaccess->vm_event.fres )
+        xenforeignmemory_unmap_resource(xc_interface_fmem_handle(xch),
+                                        xenaccess->vm_event.fres);
+    else if ( xenaccess->vm_event.ring_page )
         munmap(xenaccess->vm_event.ring_page, XC_PAGE_SIZE);
 
     if ( mem_access_enable )
@@ -187,7 +193,8 @@ int xenaccess_teardown(xc_interface *xch, xenaccess_t *xenaccess)
     return 0;
 }
 
-xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
+xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id,
+                            unsigned int ring_frames)
 {
     xenaccess_t *xenaccess = 0;
     xc_interface *xch;
@@ -211,7 +218,16 @@ xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
     xenaccess->vm_event.domain_id = domain_id;
 
     /* Enable mem_access */
-    xenaccess->vm_event.ring_page =
+    xenaccess->vm_event.ring_frames = ring_frames;
+    if ( ring_frames )
+        xenaccess->vm_event.ring_page =
+            xc_monitor_enable_ring(xenaccess->xc_handle,
+                                   xenaccess->vm_event.domain_id,
+                                   ring_frames,
+                                   &xenaccess->vm_event.evtchn_port,
+                                   &xenaccess->vm_event.fres);
+    else
+        xenaccess->vm_event.ring_page =
             xc_monitor_enable(xenaccess->xc_handle,
                               xenaccess->vm_event.domain_id,
                               &xenaccess->vm_event.evtchn_port);
@@ -253,11 +269,12 @@ xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
     evtchn_bind = 1;
     xenaccess->vm_event.port = rc;
 
-    /* Initialise ring */
-    SHARED_RING_INIT((vm_event_sring_t *)xenaccess->vm_event.ring_page);
+    /* Initialise ring (Xen initialises the rings it allocates) */
+    if ( !ring_frames )
+        SHARED_RING_INIT((vm_event_sring_t *)xenaccess->vm_event.ring_page);
     BACK_RING_INIT(&xenaccess->vm_event.back_ring,
                    (vm_event_sring_t *)xenaccess->vm_event.ring_page,
-                   XC_PAGE_SIZE);
+                   XC_PAGE_SIZE * (ring_frames ?: 1));
 
     /* Get max_gpfn */
     rc = xc_domain_maximum_gpfn(xenaccess->xc_handle,
@@ -358,7 +375,7 @@ static void put_response(vm_event_t *vm_event, vm_event_response_t *rsp)
 
 void usage(char* progname)
 {
-    fprintf(stderr, "Usage: %s [-m] <domain_id> write|exec", progname);
+    fprintf(stderr, "Usage: %s [-m] [-r <frames>] <domain_id> write|exec", progname);
 #if defined(__i386__) || defined(__x86_64__)
             fprintf(stderr, "|breakpoint|altp2m_write|altp2m_exec|debug|cpuid|desc_access|write_ctrlreg_cr4|altp2m_write_no_gpt");
 #elif defined(__arm__) || defined(__aarch64__)
@@ -368,7 +385,8 @@ void usage(char* progname)
             "\n"
             "Logs first page writes, execs, or breakpoint traps that occur on the domain.\n"
             "\n"
-            "-m requires this program to run, or else the domain may pause\n");
+            "-m requires this program to run, or else the domain may pause\n"
+            "-r uses a ring of <frames> pages allocated by Xen\n");
 }
 
 int main(int argc, char *argv[])
@@ -395,15 +413,22 @@ int main(int argc, char *argv[])
     int write_ctrlreg_cr4 = 0;
     int altp2m_write_no_gpt = 0;
     uint16_t altp2m_view_id = 0;
+    unsigned int ring_frames = 0;
 
     char* progname = argv[0];
     argv++;
     argc--;
 
-    if ( argc == 3 && argv[0][0] == '-' )
+    while ( argc > 2 && argv[0][0] == '-' )
     {
         if ( !strcmp(argv[0], "-m") )
             required = 1;
+        else if ( !strcmp(argv[0], "-r") && argc > 3 )
+        {
+            ring_frames = atoi(argv[1]);
+            argv++;
+            argc--;
+        }
         else
         {
             usage(progname);
@@ -487,7 +512,7 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    xenaccess = xenaccess_init(&xch, domain_id);
+    xenaccess = xenaccess_init(&xch, domain_id, ring_frames);
     if ( xenaccess == NULL )
     {
         ERROR("Error initialising xenaccess");
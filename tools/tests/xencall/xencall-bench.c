@@ -0,0 +1,172 @@
+/*
+ * xencall-bench.c
+ *
+ * Measure the cost of allocating and freeing hypercall buffers, with
+ * several threads sharing one xencall handle.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xencall.h>
+
+#include <xen-tools/libs.h>
+
+#define MAX_THREADS 256
+
+static xencall_handle *xcall;
+static unsigned int iterations = 10000;
+static size_t nr_pages;
+static pthread_barrier_t barrier;
+
+static uint64_t ns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bench_thread(void *arg)
+{
+    uint64_t *nsec = arg, start;
+    unsigned int i;
+
+    pthread_barrier_wait(&barrier);
+
+    start = ns_now();
+    for ( i = 0; i < iterations; i++ )
+    {
+        void *p = xencall_alloc_buffer_pages(xcall, nr_pages);
+
+        if ( !p )
+        {
+            perror("xencall_alloc_buffer_pages");
+            exit(1);
+        }
+        xencall_free_buffer_pages(xcall, p, nr_pages);
+    }
+    *nsec = ns_now() - start;
+
+    return NULL;
+}
+
+static void bench(unsigned int nr_threads)
+{
+    pthread_t threads[MAX_THREADS];
+    uint64_t nsec[MAX_THREADS], sum = 0;
+    unsigned int i;
+
+    pthread_barrier_init(&barrier, NULL, nr_threads);
+
+    for ( i = 0; i < nr_threads; i++ )
+        if ( pthread_create(&threads[i], NULL, bench_thread, &nsec[i]) )
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+
+    for ( i = 0; i < nr_threads; i++ )
+    {
+        pthread_join(threads[i], NULL);
+        sum += nsec[i];
+    }
+
+    pthread_barrier_destroy(&barrier);
+
+    printf("%5zu pages %3u threads: %8"PRIu64" ns per alloc/free\n",
+           nr_pages, nr_threads, sum / ((uint64_t)nr_threads * iterations));
+}
+
+static void usage(int ret)
+{
+    FILE *out;
+
+    out = ret ? stderr : stdout;
+
+    fprintf(out, "usage: xencall-bench [<options>]\n");
+    fprintf(out, "  <options> are:\n");
+    fprintf(out, "  -i|--iterations <i>  allocations per thread (default 10000)\n");
+    fprintf(out, "  -p|--pages <p>       buffer size in pages (default 1, 4, 16, 64 and 1024)\n");
+    fprintf(out, "  -t|--threads <t>     number of threads (default 1, 2, 4, 8 and 16)\n");
+    fprintf(out, "  -H|--huge            open the handle with XENCALL_OPENFLAG_HUGE_BUFFERS\n");
+    fprintf(out, "  -h|--help            print this usage information\n");
+    exit(ret);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"iterations", required_argument, NULL, 'i'},
+        {"pages",      required_argument, NULL, 'p'},
+        {"threads",    required_argument, NULL, 't'},
+        {"huge",       no_argument,       NULL, 'H'},
+        {"help",       no_argument,       NULL, 'h'},
+        {NULL,         0,                 NULL, 0}
+    };
+    static const size_t default_pages[] = { 1, 4, 16, 64, 1024 };
+    static const unsigned int default_threads[] = { 1, 2, 4, 8, 16 };
+    unsigned int flags = 0, threads = 0, p, t;
+    size_t pages = 0;
+    int opt;
+
+    while ( (opt = getopt_long(argc, argv, "i:p:t:Hh", options,
+                               NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'p':
+            pages = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'H':
+            flags |= XENCALL_OPENFLAG_HUGE_BUFFERS;
+            break;
+        case 'h':
+            usage(0);
+            break;
+        }
+    }
+    if ( optind != argc || !iterations || threads > MAX_THREADS )
+        usage(1);
+
+    xcall = xencall_open(NULL, flags);
+    if ( !xcall )
+    {
+        fprintf(stderr, "Could not open xencall handle\n");
+        return 2;
+    }
+
+    for ( p = 0; p < (pages ? 1 : ARRAY_SIZE(default_pages)); p++ )
+    {
+        nr_pages = pages ?: default_pages[p];
+        for ( t = 0; t < (threads ? 1 : ARRAY_SIZE(default_threads)); t++ )
+            bench(threads ?: default_threads[t]);
+    }
+
+    xencall_close(xcall);
+
+    return 0;
+}
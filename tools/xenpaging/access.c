@@ -0,0 +1,193 @@
+/******************************************************************************
+ *
+ * Guest access sampling for the paging policy.
+ *
+ * Pages get their access revoked via mem_access a while before the policy
+ * considers them for eviction.  A guest access in between raises an event
+ * on the monitor ring, upon which access is restored and the policy gets
+ * told the page is in use.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "policy.h"
+
+
+int access_sampling_init(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct vm_event *monitor = &paging->monitor;
+    int rc;
+
+    monitor->domain_id = paging->vm_event.domain_id;
+    monitor->ring_page = xc_monitor_enable(xch, monitor->domain_id,
+                                           &monitor->evtchn_port);
+    if ( !monitor->ring_page )
+    {
+        if ( errno == EBUSY )
+            ERROR("access sampling needs the monitor ring, which is in use");
+        else
+            PERROR("Error enabling the monitor ring");
+        return -1;
+    }
+
+    /* Events for both rings arrive on the same handle */
+    monitor->xce_handle = paging->vm_event.xce_handle;
+    rc = xenevtchn_bind_interdomain(monitor->xce_handle, monitor->domain_id,
+                                    monitor->evtchn_port);
+    if ( rc < 0 )
+    {
+        PERROR("Failed to bind monitor event channel");
+        xc_monitor_disable(xch, monitor->domain_id);
+        munmap(monitor->ring_page, PAGE_SIZE);
+        monitor->ring_page = NULL;
+        return -1;
+    }
+    monitor->port = rc;
+
+    SHARED_RING_INIT((vm_event_sring_t *)monitor->ring_page);
+    BACK_RING_INIT(&monitor->back_ring,
+                   (vm_event_sring_t *)monitor->ring_page,
+                   PAGE_SIZE);
+
+    return 0;
+}
+
+void access_sampling_teardown(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct vm_event *monitor = &paging->monitor;
+
+    if ( !monitor->ring_page )
+        return;
+
+    /* Give the guest full access back, then release any waiting vcpus */
+    if ( xc_set_mem_access(xch, monitor->domain_id, XENMEM_access_rwx,
+                           0, paging->max_pages) < 0 )
+        PERROR("Error restoring page access");
+    access_sampling_process(paging);
+
+    if ( xc_monitor_disable(xch, monitor->domain_id) < 0 )
+        PERROR("Error disabling the monitor ring");
+    munmap(monitor->ring_page, PAGE_SIZE);
+    monitor->ring_page = NULL;
+
+    if ( xenevtchn_unbind(monitor->xce_handle, monitor->port) < 0 )
+        PERROR("Error unbinding monitor event port");
+    monitor->port = -1;
+}
+
+/* Revoke access to a range of gfns, so that the next access gets noticed */
+int access_sampling_arm(struct xenpaging *paging, unsigned long first,
+                        unsigned long nr)
+{
+    xc_interface *xch = paging->xc_handle;
+    int rc;
+
+    rc = xc_set_mem_access(xch, paging->monitor.domain_id, XENMEM_access_n,
+                           first, nr);
+    if ( rc < 0 )
+        PERROR("Error sampling gfns %lx-%lx", first, first + nr - 1);
+
+    return rc;
+}
+
+/* Restore access to a gfn known to be in use */
+int access_sampling_restore(struct xenpaging *paging, unsigned long gfn)
+{
+    xc_interface *xch = paging->xc_handle;
+    int rc;
+
+    rc = xc_set_mem_access(xch, paging->monitor.domain_id, XENMEM_access_rwx,
+                           gfn, 1);
+    if ( rc < 0 )
+        PERROR("Error restoring access to gfn %lx", gfn);
+
+    return rc;
+}
+
+/*
+ * Handle pending monitor events.  Access gets restored for a whole batch
+ * of requests with one hypercall before the vcpus are resumed, again with
+ * a single notification.
+ */
+int access_sampling_process(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct vm_event *monitor = &paging->monitor;
+    vm_event_request_t req;
+    vm_event_response_t rsp[XENPAGING_BATCH_SIZE];
+    uint64_t gfns[XENPAGING_BATCH_SIZE];
+    uint8_t access[XENPAGING_BATCH_SIZE];
+    int i, num, nr_gfns, rc = 0;
+
+    while ( RING_HAS_UNCONSUMED_REQUESTS(&monitor->back_ring) )
+    {
+        num = nr_gfns = 0;
+
+        while ( num < XENPAGING_BATCH_SIZE &&
+                RING_HAS_UNCONSUMED_REQUESTS(&monitor->back_ring) )
+        {
+            get_request(monitor, &req);
+
+            memset(&rsp[num], 0, sizeof(rsp[num]));
+            rsp[num].version = VM_EVENT_INTERFACE_VERSION;
+            rsp[num].vcpu_id = req.vcpu_id;
+            rsp[num].flags = req.flags & VM_EVENT_FLAG_VCPU_PAUSED;
+            rsp[num].reason = req.reason;
+            num++;
+
+            if ( req.reason != VM_EVENT_REASON_MEM_ACCESS )
+                continue;
+
+            gfns[nr_gfns] = req.u.mem_access.gfn;
+            access[nr_gfns] = XENMEM_access_rwx;
+            nr_gfns++;
+
+            policy_notify_accessed(req.u.mem_access.gfn);
+        }
+
+        /* Resume the vcpus even on error, they would be stuck otherwise */
+        if ( nr_gfns &&
+             xc_set_mem_access_multi(xch, monitor->domain_id, access, gfns,
+                                     nr_gfns) < 0 )
+        {
+            PERROR("Error restoring access to sampled gfns");
+            rc = -1;
+        }
+
+        for ( i = 0; i < num; i++ )
+            put_response(monitor, &rsp[i]);
+
+        if ( xenevtchn_notify(monitor->xce_handle, monitor->port) < 0 )
+        {
+            PERROR("Error notifying the monitor ring");
+            rc = -1;
+        }
+    }
+
+    return rc;
+}
+
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
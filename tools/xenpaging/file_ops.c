@@ -19,23 +19,24 @@
  */
 
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <xc_private.h>
 
-static int file_op(int fd, void *page, int i,
+static int file_op(int fd, void *page, int i, int nr,
                    ssize_t (*fn)(int, void *, size_t))
 {
     off_t offset = i;
-    int total = 0;
-    int bytes;
+    size_t total = 0;
+    ssize_t bytes;
 
     offset = lseek(fd, offset << PAGE_SHIFT, SEEK_SET);
     if ( offset == (off_t)-1 )
         return -1;
 
-    while ( total < PAGE_SIZE )
+    while ( total < (size_t)nr << PAGE_SHIFT )
     {
-        bytes = fn(fd, page + total, PAGE_SIZE - total);
+        bytes = fn(fd, page + total, ((size_t)nr << PAGE_SHIFT) - total);
         if ( bytes <= 0 )
             return -1;
 
@@ -45,6 +46,29 @@ static int file_op(int fd, void *page, int i,
     return 0;
 }
 
+/*
+ * Process a batch of pages, with page n of the buffer belonging to slot
+ * slots[n].  Runs of consecutive slots are transferred with one call.
+ */
+static int file_op_batch(int fd, void *pages, const int *slots, int num,
+                         ssize_t (*fn)(int, void *, size_t))
+{
+    int i, run;
+
+    for ( i = 0; i < num; i += run )
+    {
+        for ( run = 1; i + run < num; run++ )
+            if ( slots[i + run] != slots[i] + run )
+                break;
+
+        if ( file_op(fd, pages + ((size_t)i << PAGE_SHIFT), slots[i], run,
+                     fn) < 0 )
+            return -1;
+    }
+
+    return 0;
+}
+
 static ssize_t my_write(int fd, void *buf, size_t count)
 {
     return write(fd, buf, count);
@@ -52,14 +76,39 @@ static ssize_t my_write(int fd, void *buf, size_t count)
 
 int read_page(int fd, void *page, int i)
 {
-    return file_op(fd, page, i, &read);
+    return file_op(fd, page, i, 1, &read);
 }
 
 int write_page(int fd, void *page, int i)
 {
-    return file_op(fd, page, i, &my_write);
+    return file_op(fd, page, i, 1, &my_write);
 }
 
+int read_pages(int fd, void *pages, const int *slots, int num)
+{
+    return file_op_batch(fd, pages, slots, num, &read);
+}
+
+int write_pages(int fd, void *pages, const int *slots, int num)
+{
+    return file_op_batch(fd, pages, slots, num, &my_write);
+}
+
+/* Start reading the given slots in the background; a hint only. */
+void readahead_pages(int fd, const int *slots, int num)
+{
+    int i, run;
+
+    for ( i = 0; i < num; i += run )
+    {
+        for ( run = 1; i + run < num; run++ )
+            if ( slots[i + run] != slots[i] + run )
+                break;
+
+        posix_fadvise(fd, (off_t)slots[i] << PAGE_SHIFT,
+                      (off_t)run << PAGE_SHIFT, POSIX_FADV_WILLNEED);
+    }
+}
 
 /*
  * Local variables:
@@ -26,6 +26,9 @@
 
 int read_page(int fd, void *page, int i);
 int write_page(int fd, void *page, int i);
+int read_pages(int fd, void *pages, const int *slots, int num);
+int write_pages(int fd, void *pages, const int *slots, int num);
+void readahead_pages(int fd, const int *slots, int num);
 
 
 #endif
@@ -24,6 +24,9 @@
 
 
 #define DEFAULT_MRU_SIZE (1024 * 16)
+/* Distance the sampling hand keeps ahead of the eviction hand */
+#define DEFAULT_SAMPLE_LEAD (1024 * 16)
+#define SAMPLE_CHUNK 1024
 
 
 static unsigned long *mru;
@@ -35,6 +38,14 @@ static unsigned int unconsumed_cleared;
 static unsigned long current_gfn;
 static unsigned long max_pages;
 
+/* Access sampling state, see sample_ahead() */
+static int sample_access;
+static unsigned long *referenced;
+static unsigned long sample_gfn;
+static unsigned long sample_nr;
+static unsigned long sample_lead;
+static unsigned long last_gfn;
+
 
 int policy_init(struct xenpaging *paging)
 {
@@ -71,11 +82,70 @@ int policy_init(struct xenpaging *paging)
     /* Start in the middle to avoid paging during BIOS startup */
     current_gfn = max_pages / 2;
 
+    if ( paging->sample_access )
+    {
+        /* Allocate bitmap for pages accessed since they were sampled */
+        referenced = bitmap_alloc(max_pages);
+        if ( !referenced )
+            goto out;
+
+        sample_access = 1;
+        sample_lead = DEFAULT_SAMPLE_LEAD;
+        if ( sample_lead > max_pages / 2 )
+            sample_lead = max_pages / 2;
+        sample_gfn = last_gfn = current_gfn;
+    }
+
     rc = 0;
  out:
     return rc;
 }
 
+/*
+ * Two handed clock: the sampling hand revokes access to gfns sample_lead
+ * gfns ahead of the eviction hand.  Guest accesses in between mark a gfn
+ * as referenced, so only gfns which went untouched for that long reach the
+ * eviction hand as candidates.
+ */
+static void sample_ahead(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned long moved, nr;
+
+    moved = (current_gfn + max_pages - last_gfn) % max_pages;
+    last_gfn = current_gfn;
+
+    /* Eviction hand overtook the sampling hand, restart right ahead of it */
+    if ( moved > sample_nr )
+    {
+        sample_gfn = current_gfn;
+        sample_nr = 0;
+    }
+    else
+        sample_nr -= moved;
+
+    while ( sample_nr < sample_lead )
+    {
+        nr = sample_lead - sample_nr;
+        if ( nr > SAMPLE_CHUNK )
+            nr = SAMPLE_CHUNK;
+        if ( nr > max_pages - sample_gfn )
+            nr = max_pages - sample_gfn;
+
+        if ( access_sampling_arm(paging, sample_gfn, nr) < 0 )
+        {
+            ERROR("Disabling access sampling");
+            sample_access = 0;
+            return;
+        }
+
+        sample_gfn += nr;
+        if ( sample_gfn >= max_pages )
+            sample_gfn = 0;
+        sample_nr += nr;
+    }
+}
+
 unsigned long policy_choose_victim(struct xenpaging *paging)
 {
     xc_interface *xch = paging->xc_handle;
@@ -91,6 +161,9 @@ unsigned long policy_choose_victim(struct xenpaging *paging)
         if ( current_gfn >= max_pages )
             current_gfn = 0;
 
+        if ( sample_access )
+            sample_ahead(paging);
+
         if ( (current_gfn & (BITS_PER_LONG - 1)) == 0 )
         {
             /* All gfns busy */
@@ -110,6 +183,10 @@ unsigned long policy_choose_victim(struct xenpaging *paging)
         if ( test_bit(current_gfn, unconsumed) )
             continue;
 
+        /* gfn accessed since it was sampled, give it another round */
+        if ( sample_access && test_and_clear_bit(current_gfn, referenced) )
+            continue;
+
         /* gfn found */
         break;
     }
@@ -174,6 +251,12 @@ void policy_notify_dropped(unsigned long gfn)
     clear_bit(gfn, bitmap);
 }
 
+void policy_notify_accessed(unsigned long gfn)
+{
+    if ( referenced && gfn < max_pages )
+        set_bit(gfn, referenced);
+}
+
 
 /*
  * Local variables:
@@ -178,17 +178,17 @@ static int xenpaging_get_tot_pages(struct xenpaging *paging)
     return domain_info.tot_pages;
 }
 
-static void *init_page(void)
+static void *init_page(int num)
 {
     void *buffer;
 
     /* Allocated page memory */
-    errno = posix_memalign(&buffer, PAGE_SIZE, PAGE_SIZE);
+    errno = posix_memalign(&buffer, PAGE_SIZE, num * PAGE_SIZE);
     if ( errno != 0 )
         return NULL;
 
     /* Lock buffer in memory so it can't be paged out */
-    if ( mlock(buffer, PAGE_SIZE) < 0 )
+    if ( mlock(buffer, num * PAGE_SIZE) < 0 )
     {
         free(buffer);
         buffer = NULL;
@@ -208,6 +208,9 @@ static void usage(void)
     printf(" -f <file>      --pagefile=<file>        pagefile to use. This option is required.\n");
     printf(" -m <max_memkb> --max_memkb=<max_memkb>  maximum amount of memory to handle.\n");
     printf(" -r <num>       --mru_size=<num>         number of paged-in pages to keep in memory.\n");
+    printf(" -a <num>       --readahead=<num>        page in up to <num> neighbouring gfns on a fault, power of 2, 0 disables.\n");
+    printf(" -s             --sample                 sample guest accesses to keep hot pages in memory.\n");
+    printf("                                         Requires the monitor ring of the domain.\n");
     printf(" -v             --verbose                enable debug output.\n");
     printf(" -h             --help                   this output.\n");
 }
@@ -215,13 +218,15 @@ static void usage(void)
 static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
 {
     int ch;
-    static const char sopts[] = "hvd:f:m:r:";
+    static const char sopts[] = "hvsd:f:m:r:a:";
     static const struct option lopts[] = {
         {"help", 0, NULL, 'h'},
         {"verbose", 0, NULL, 'v'},
         {"domain", 1, NULL, 'd'},
         {"pagefile", 1, NULL, 'f'},
         {"mru_size", 1, NULL, 'm'},
+        {"readahead", 1, NULL, 'a'},
+        {"sample", 0, NULL, 's'},
         { }
     };
 
@@ -242,6 +247,12 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
         case 'r':
             paging->policy_mru_size = atoi(optarg);
             break;
+        case 'a':
+            paging->readahead = atoi(optarg);
+            break;
+        case 's':
+            paging->sample_access = 1;
+            break;
         case 'v':
             paging->debug = 1;
             break;
@@ -269,6 +280,14 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
         return 1;
     }
 
+    if ( paging->readahead < 0 || paging->readahead > XENPAGING_BATCH_SIZE ||
+         (paging->readahead & (paging->readahead - 1)) )
+    {
+        printf("Readahead must be a power of 2 up to %d!\n",
+               XENPAGING_BATCH_SIZE);
+        return 1;
+    }
+
     return 0;
 }
 
@@ -287,6 +306,8 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
     if ( !paging )
         goto err;
 
+    paging->readahead = XENPAGING_READAHEAD_DEFAULT;
+
     /* Get cmdline options and domain_id */
     if ( xenpaging_getopts(paging, argc, argv) )
         goto err;
@@ -418,6 +439,10 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
                    (vm_event_sring_t *)paging->vm_event.ring_page,
                    PAGE_SIZE);
 
+    /* Set up the monitor ring to sample accesses with */
+    if ( paging->sample_access && access_sampling_init(paging) )
+        goto err;
+
     /* Now that the ring is set, remove it from the guest's physmap */
     if ( xc_domain_decrease_reservation_exact(xch, 
                     paging->vm_event.domain_id, 1, 0, &ring_pfn) )
@@ -466,13 +491,20 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
         goto err;
     }
 
-    paging->paging_buffer = init_page();
+    paging->paging_buffer = init_page(1);
     if ( !paging->paging_buffer )
     {
         PERROR("Creating page aligned load buffer");
         goto err;
     }
 
+    paging->batch_buffer = init_page(XENPAGING_BATCH_SIZE);
+    if ( !paging->batch_buffer )
+    {
+        PERROR("Creating page aligned readahead buffer");
+        goto err;
+    }
+
     /* Open file */
     paging->fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
     if ( paging->fd < 0 )
@@ -486,6 +518,8 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
  err:
     if ( paging )
     {
+        if ( xch )
+            access_sampling_teardown(paging);
         if ( paging->xs_handle )
             xs_close(paging->xs_handle);
         if ( xch )
@@ -495,6 +529,11 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
             munlock(paging->paging_buffer, PAGE_SIZE);
             free(paging->paging_buffer);
         }
+        if ( paging->batch_buffer )
+        {
+            munlock(paging->batch_buffer, XENPAGING_BATCH_SIZE * PAGE_SIZE);
+            free(paging->batch_buffer);
+        }
 
         if ( paging->vm_event.ring_page )
         {
@@ -521,6 +560,9 @@ static void xenpaging_teardown(struct xenpaging *paging)
     xs_unwatch(paging->xs_handle, watch_target_tot_pages, "");
     xs_unwatch(paging->xs_handle, "@releaseDomain", watch_token);
 
+    /* Stop sampling before the paging ring goes away */
+    access_sampling_teardown(paging);
+
     paging->xc_handle = NULL;
     /* Tear down domain paging in Xen */
     munmap(paging->vm_event.ring_page, PAGE_SIZE);
@@ -553,7 +595,7 @@ static void xenpaging_teardown(struct xenpaging *paging)
     xc_interface_close(xch);
 }
 
-static void get_request(struct vm_event *vm_event, vm_event_request_t *req)
+void get_request(struct vm_event *vm_event, vm_event_request_t *req)
 {
     vm_event_back_ring_t *back_ring;
     RING_IDX req_cons;
@@ -570,7 +612,7 @@ static void get_request(struct vm_event *vm_event, vm_event_request_t *req)
     back_ring->sring->req_event = req_cons + 1;
 }
 
-static void put_response(struct vm_event *vm_event, vm_event_response_t *rsp)
+void put_response(struct vm_event *vm_event, vm_event_response_t *rsp)
 {
     vm_event_back_ring_t *back_ring;
     RING_IDX rsp_prod;
@@ -587,107 +629,56 @@ static void put_response(struct vm_event *vm_event, vm_event_response_t *rsp)
     RING_PUSH_RESPONSES(back_ring);
 }
 
-/* Evict a given gfn
- * Returns < 0 on fatal error
- * Returns 0 on successful evict
- * Returns > 0 if gfn can not be evicted
- */
-static int xenpaging_evict_page(struct xenpaging *paging, unsigned long gfn, int slot)
+/* Return a pagefile slot no longer in use to the free slot stack */
+static void release_slot(struct xenpaging *paging, int slot)
 {
-    xc_interface *xch = paging->xc_handle;
-    void *page;
-    xen_pfn_t victim = gfn;
-    int ret;
-
-    DECLARE_DOMCTL;
-
-    /* Nominate page */
-    ret = xc_mem_paging_nominate(xch, paging->vm_event.domain_id, gfn);
-    if ( ret < 0 )
-    {
-        /* unpageable gfn is indicated by EBUSY */
-        if ( errno == EBUSY )
-            ret = 1;
-        else
-            PERROR("Error nominating page %lx", gfn);
-        goto out;
-    }
-
-    /* Map page */
-    page = xc_map_foreign_pages(xch, paging->vm_event.domain_id, PROT_READ, &victim, 1);
-    if ( page == NULL )
-    {
-        PERROR("Error mapping page %lx", gfn);
-        ret = -1;
-        goto out;
-    }
-
-    /* Copy page */
-    ret = write_page(paging->fd, page, slot);
-    if ( ret < 0 )
-    {
-        PERROR("Error copying page %lx", gfn);
-        munmap(page, PAGE_SIZE);
-        ret = -1;
-        goto out;
-    }
-
-    /* Release page */
-    munmap(page, PAGE_SIZE);
-
-    /* Tell Xen to evict page */
-    ret = xc_mem_paging_evict(xch, paging->vm_event.domain_id, gfn);
-    if ( ret < 0 )
-    {
-        /* A gfn in use is indicated by EBUSY */
-        if ( errno == EBUSY )
-        {
-                ret = 1;
-                DPRINTF("Nominated page %lx busy", gfn);
-        } else
-            PERROR("Error evicting page %lx", gfn);
-        goto out;
-    }
-
-    DPRINTF("evict_page > gfn %lx pageslot %d\n", gfn, slot);
-    /* Notify policy of page being paged out */
-    policy_notify_paged_out(gfn);
+    paging->slot_to_gfn[slot] = 0;
+    paging->free_slot_stack[paging->stack_count++] = slot;
+}
 
-    /* Update index */
-    paging->slot_to_gfn[slot] = gfn;
-    paging->gfn_to_slot[gfn] = slot;
+/* Get a free pagefile slot, preferring known free slots over scanning */
+static int get_free_slot(struct xenpaging *paging, int *scan)
+{
+    if ( paging->stack_count > 0 )
+        return paging->free_slot_stack[--paging->stack_count];
 
-    /* Record number of evicted pages */
-    paging->num_paged_out++;
+    for ( ; *scan < paging->max_pages; (*scan)++ )
+        if ( !paging->slot_to_gfn[*scan] )
+            return (*scan)++;
 
-    ret = 0;
+    return -1;
+}
 
- out:
-    return ret;
+/* Update the bookkeeping for a gfn which is backed by guest memory again */
+static void xenpaging_paged_in(struct xenpaging *paging, unsigned long gfn)
+{
+    /*
+     * Do not add gfn to mru list if the target is lower than mru size.
+     * This allows page-out of these gfns if the target grows again.
+     */
+    if (paging->num_paged_out > paging->policy_mru_size)
+        policy_notify_paged_in(gfn);
+    else
+        policy_notify_paged_in_nomru(gfn);
+
+    /* Record number of resumed pages */
+    paging->num_paged_out--;
 }
 
-static int xenpaging_resume_page(struct xenpaging *paging, vm_event_response_t *rsp, int notify_policy)
+static void xenpaging_resume_page(struct xenpaging *paging, vm_event_response_t *rsp, int notify_policy)
 {
     /* Put the page info on the ring */
+    rsp->version = VM_EVENT_INTERFACE_VERSION;
     put_response(&paging->vm_event, rsp);
 
     /* Notify policy of page being paged in */
     if ( notify_policy )
-    {
-        /*
-         * Do not add gfn to mru list if the target is lower than mru size.
-         * This allows page-out of these gfns if the target grows again.
-         */
-        if (paging->num_paged_out > paging->policy_mru_size)
-            policy_notify_paged_in(rsp->u.mem_paging.gfn);
-        else
-            policy_notify_paged_in_nomru(rsp->u.mem_paging.gfn);
-
-       /* Record number of resumed pages */
-       paging->num_paged_out--;
-    }
+        xenpaging_paged_in(paging, rsp->u.mem_paging.gfn);
+}
 
-    /* Tell Xen page is ready */
+/* Tell Xen responses are ready, once for all pages resumed in one go */
+static int xenpaging_notify(struct xenpaging *paging)
+{
     return xenevtchn_notify(paging->vm_event.xce_handle, paging->vm_event.port);
 }
 
@@ -732,6 +723,82 @@ static int xenpaging_populate_page(struct xenpaging *paging, unsigned long gfn,
     return ret;
 }
 
+/*
+ * Collect the paged out gfns in the readahead window around gfn, and hint
+ * the kernel to start reading their slots.  Returns the number found.
+ */
+static int readahead_collect(struct xenpaging *paging, unsigned long gfn,
+                             unsigned long *gfns, int *slots)
+{
+    unsigned long first, g;
+    int num = 0;
+
+    if ( !paging->readahead )
+        return 0;
+
+    first = gfn & ~(unsigned long)(paging->readahead - 1);
+    for ( g = first; g < first + paging->readahead && g < paging->max_pages; g++ )
+    {
+        if ( g == gfn || !test_bit(g, paging->bitmap) )
+            continue;
+
+        gfns[num] = g;
+        slots[num] = paging->gfn_to_slot[g];
+        num++;
+    }
+
+    if ( num )
+        readahead_pages(paging->fd, slots, num);
+
+    return num;
+}
+
+/*
+ * Page in gfns the guest did not ask for yet.  Once loaded they are
+ * immediately accessible; a request raced with this finds them already
+ * populated.  Failures are not fatal, the gfn stays paged out.
+ */
+static int readahead_populate(struct xenpaging *paging, unsigned long *gfns,
+                              int *slots, int num)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned long gfn;
+    int i, slot;
+
+    if ( read_pages(paging->fd, paging->batch_buffer, slots, num) < 0 )
+    {
+        PERROR("Error reading ahead");
+        return -1;
+    }
+
+    for ( i = 0; i < num; i++ )
+    {
+        gfn = gfns[i];
+        slot = slots[i];
+
+        /* Already paged in by a request handled meanwhile */
+        if ( !test_bit(gfn, paging->bitmap) || paging->gfn_to_slot[gfn] != slot )
+            continue;
+
+        if ( xc_mem_paging_load(xch, paging->vm_event.domain_id, gfn,
+                                paging->batch_buffer + i * PAGE_SIZE) < 0 )
+        {
+            /* Most likely dropped, leave it to the request handling */
+            DPRINTF("readahead of gfn %lx failed: %d\n", gfn, errno);
+            if ( errno == ENOMEM )
+                break;
+            continue;
+        }
+
+        DPRINTF("readahead < gfn %lx pageslot %d\n", gfn, slot);
+        clear_bit(gfn, paging->bitmap);
+        xenpaging_paged_in(paging, gfn);
+        release_slot(paging, slot);
+    }
+
+    return 0;
+}
+
 /* Trigger a page-in for a batch of pages */
 static void resume_pages(struct xenpaging *paging, int num_pages)
 {
@@ -753,12 +820,12 @@ static void resume_pages(struct xenpaging *paging, int num_pages)
         page_in_trigger();
 }
 
-/* Evict one gfn and write it to the given slot
+/* Choose a gfn and nominate it for eviction
  * Returns < 0 on fatal error
- * Returns 0 on successful evict
+ * Returns 0 on successful nomination
  * Returns > 0 if no gfn can be evicted
  */
-static int evict_victim(struct xenpaging *paging, int slot)
+static int nominate_victim(struct xenpaging *paging, unsigned long *victim)
 {
     xc_interface *xch = paging->xc_handle;
     unsigned long gfn;
@@ -781,70 +848,157 @@ static int evict_victim(struct xenpaging *paging, int slot)
                 xenpaging_mem_paging_flush_ioemu_cache(paging);
                 num_paged_out = paging->num_paged_out;
             }
-            ret = ENOSPC;
-            goto out;
+            return ENOSPC;
         }
 
         if ( interrupted )
-        {
-            ret = EINTR;
-            goto out;
-        }
+            return EINTR;
 
-        ret = xenpaging_evict_page(paging, gfn, slot);
+        ret = xc_mem_paging_nominate(xch, paging->vm_event.domain_id, gfn);
         if ( ret < 0 )
-            goto out;
+        {
+            /* unpageable gfn is indicated by EBUSY */
+            if ( errno != EBUSY )
+            {
+                PERROR("Error nominating page %lx", gfn);
+                return -1;
+            }
+        }
     }
     while ( ret );
 
-    if ( test_and_set_bit(gfn, paging->bitmap) )
-        ERROR("Page %lx has been evicted before", gfn);
-
-    ret = 0;
-
- out:
-    return ret;
+    *victim = gfn;
+    return 0;
 }
 
-/* Evict a batch of pages and write them to a free slot in the paging file
+/* Evict a batch of nominated gfns, writing them to the paging file with as
+ * few calls as the slot layout allows
  * Returns < 0 on fatal error
- * Returns 0 if no gfn can be evicted
- * Returns > 0 on successful evict
+ * Returns the number of evicted gfns otherwise
  */
-static int evict_pages(struct xenpaging *paging, int num_pages)
+static int evict_batch(struct xenpaging *paging, xen_pfn_t *gfns, int *slots,
+                       int num)
 {
     xc_interface *xch = paging->xc_handle;
-    int rc, slot, num = 0;
+    int errs[XENPAGING_BATCH_SIZE];
+    void *page;
+    int i, ret, evicted = 0;
+
+    /* Map pages */
+    page = xc_map_foreign_bulk(xch, paging->vm_event.domain_id, PROT_READ,
+                               gfns, errs, num);
+    if ( page == NULL )
+    {
+        PERROR("Error mapping %d pages from %"PRI_xen_pfn, num, gfns[0]);
+        return -1;
+    }
 
-    /* Reuse known free slots */
-    while ( paging->stack_count > 0 && num < num_pages )
+    for ( i = 0; i < num; i++ )
     {
-        slot = paging->free_slot_stack[--paging->stack_count];
-        rc = evict_victim(paging, slot);
-        if ( rc )
+        if ( errs[i] )
         {
-            num = rc < 0 ? -1 : num;
-            return num;
+            errno = -errs[i];
+            PERROR("Error mapping page %"PRI_xen_pfn, gfns[i]);
+            munmap(page, num * PAGE_SIZE);
+            return -1;
         }
-        num++;
     }
 
-    /* Scan all slots slots for remainders */
-    for ( slot = 0; slot < paging->max_pages && num < num_pages; slot++ )
+    /* Copy pages */
+    ret = write_pages(paging->fd, page, slots, num);
+
+    /* Release pages */
+    munmap(page, num * PAGE_SIZE);
+
+    if ( ret < 0 )
+    {
+        PERROR("Error copying %d pages from %"PRI_xen_pfn, num, gfns[0]);
+        return -1;
+    }
+
+    for ( i = 0; i < num; i++ )
     {
-        /* Slot is allocated */
-        if ( paging->slot_to_gfn[slot] )
+        /* Tell Xen to evict page */
+        ret = xc_mem_paging_evict(xch, paging->vm_event.domain_id, gfns[i]);
+        if ( ret < 0 )
+        {
+            /* A gfn in use is indicated by EBUSY */
+            if ( errno != EBUSY )
+            {
+                PERROR("Error evicting page %"PRI_xen_pfn, gfns[i]);
+                return -1;
+            }
+
+            DPRINTF("Nominated page %"PRI_xen_pfn" busy", gfns[i]);
+            release_slot(paging, slots[i]);
             continue;
+        }
+
+        DPRINTF("evict_page > gfn %"PRI_xen_pfn" pageslot %d\n", gfns[i], slots[i]);
+        /* Notify policy of page being paged out */
+        policy_notify_paged_out(gfns[i]);
+
+        /* Update index */
+        paging->slot_to_gfn[slots[i]] = gfns[i];
+        paging->gfn_to_slot[gfns[i]] = slots[i];
+
+        /* Record number of evicted pages */
+        paging->num_paged_out++;
+
+        if ( test_and_set_bit(gfns[i], paging->bitmap) )
+            ERROR("Page %"PRI_xen_pfn" has been evicted before", gfns[i]);
+
+        evicted++;
+    }
 
-        rc = evict_victim(paging, slot);
-        if ( rc )
+    return evicted;
+}
+
+/* Evict a batch of pages and write them to a free slot in the paging file
+ * Returns < 0 on fatal error
+ * Returns 0 if no gfn can be evicted
+ * Returns > 0 on successful evict
+ */
+static int evict_pages(struct xenpaging *paging, int num_pages)
+{
+    xen_pfn_t gfns[XENPAGING_BATCH_SIZE];
+    int slots[XENPAGING_BATCH_SIZE];
+    unsigned long gfn;
+    int rc, n, scan = 0, num = 0, exhausted = 0;
+
+    while ( num < num_pages && !exhausted )
+    {
+        /* Nominate a batch of victims, each with a free slot */
+        for ( n = 0; n < XENPAGING_BATCH_SIZE && num + n < num_pages; n++ )
         {
-            num = rc < 0 ? -1 : num;
-            break;
+            slots[n] = get_free_slot(paging, &scan);
+            if ( slots[n] < 0 )
+            {
+                exhausted = 1;
+                break;
+            }
+
+            rc = nominate_victim(paging, &gfn);
+            if ( rc )
+            {
+                release_slot(paging, slots[n]);
+                if ( rc < 0 )
+                    return -1;
+                exhausted = 1;
+                break;
+            }
+            gfns[n] = gfn;
         }
 
-        num++;
+        if ( !n )
+            break;
+
+        rc = evict_batch(paging, gfns, slots, n);
+        if ( rc < 0 )
+            return -1;
+        num += rc;
     }
+
     return num;
 }
 
@@ -854,6 +1008,9 @@ int main(int argc, char *argv[])
     struct xenpaging *paging;
     vm_event_request_t req;
     vm_event_response_t rsp;
+    unsigned long ra_gfns[XENPAGING_BATCH_SIZE];
+    int ra_slots[XENPAGING_BATCH_SIZE];
+    int ra_num, resumed;
     int num, prev_num = 0;
     int slot;
     int tot_pages;
@@ -899,6 +1056,14 @@ int main(int argc, char *argv[])
             DPRINTF("Got event from Xen\n");
         }
 
+        if ( paging->sample_access && access_sampling_process(paging) < 0 )
+        {
+            rc = 1;
+            goto out;
+        }
+
+        ra_num = resumed = 0;
+
         while ( RING_HAS_UNCONSUMED_REQUESTS(&paging->vm_event.back_ring) )
         {
             /* Indicate possible error */
@@ -936,12 +1101,25 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
+                    /* Start reading neighbours while the fault is served */
+                    if ( ra_num + paging->readahead <= XENPAGING_BATCH_SIZE )
+                        ra_num += readahead_collect(paging, req.u.mem_paging.gfn,
+                                                    ra_gfns + ra_num,
+                                                    ra_slots + ra_num);
+
                     /* Populate the page */
                     if ( xenpaging_populate_page(paging, req.u.mem_paging.gfn, slot) < 0 )
                     {
                         ERROR("Error populating page %"PRIx64"", req.u.mem_paging.gfn);
                         goto out;
                     }
+
+                    /* The page is evidently in use, spare the vcpu another exit */
+                    if ( paging->sample_access )
+                    {
+                        access_sampling_restore(paging, req.u.mem_paging.gfn);
+                        policy_notify_accessed(req.u.mem_paging.gfn);
+                    }
                 }
 
                 /* Prepare the response */
@@ -949,17 +1127,11 @@ int main(int argc, char *argv[])
                 rsp.vcpu_id = req.vcpu_id;
                 rsp.flags = req.flags;
 
-                if ( xenpaging_resume_page(paging, &rsp, 1) < 0 )
-                {
-                    PERROR("Error resuming page %"PRIx64"", req.u.mem_paging.gfn);
-                    goto out;
-                }
+                xenpaging_resume_page(paging, &rsp, 1);
+                resumed++;
 
                 /* Clear this pagefile slot */
-                paging->slot_to_gfn[slot] = 0;
-
-                /* Record this free slot */
-                paging->free_slot_stack[paging->stack_count++] = slot;
+                release_slot(paging, slot);
             }
             else
             {
@@ -979,15 +1151,24 @@ int main(int argc, char *argv[])
                     rsp.vcpu_id = req.vcpu_id;
                     rsp.flags = req.flags;
 
-                    if ( xenpaging_resume_page(paging, &rsp, 0) < 0 )
-                    {
-                        PERROR("Error resuming page %"PRIx64"", req.u.mem_paging.gfn);
-                        goto out;
-                    }
+                    xenpaging_resume_page(paging, &rsp, 0);
+                    resumed++;
                 }
             }
         }
 
+        /* Tell Xen all pages are ready */
+        if ( resumed && xenpaging_notify(paging) < 0 )
+        {
+            PERROR("Error resuming %d pages", resumed);
+            rc = 1;
+            goto out;
+        }
+
+        /* With the faulting vcpus running again, bring in their neighbours */
+        if ( ra_num )
+            readahead_populate(paging, ra_gfns, ra_slots, ra_num);
+
         /* If interrupted, write all pages back into the guest */
         if ( interrupted == SIGTERM || interrupted == SIGINT )
         {
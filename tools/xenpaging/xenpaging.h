@@ -33,6 +33,10 @@
 
 #define XENPAGING_PAGEIN_QUEUE_SIZE 64
 
+/* Upper bound for pages evicted or read ahead with one batch */
+#define XENPAGING_BATCH_SIZE 64
+#define XENPAGING_READAHEAD_DEFAULT 8
+
 struct vm_event {
     domid_t domain_id;
     xenevtchn_handle *xce_handle;
@@ -52,14 +56,22 @@ struct xenpaging {
     int *gfn_to_slot;
 
     void *paging_buffer;
+    /* XENPAGING_BATCH_SIZE pages, used for readahead */
+    void *batch_buffer;
 
     struct vm_event vm_event;
+    /* Monitor ring delivering mem_access events for access sampling */
+    struct vm_event monitor;
     int fd;
     /* number of pages for which data structures were allocated */
     int max_pages;
     int num_paged_out;
     int target_tot_pages;
     int policy_mru_size;
+    /* size of the gfn window paged in around a fault, 0 to disable */
+    int readahead;
+    /* sample guest accesses to keep hot pages from being evicted */
+    int sample_access;
     int use_poll_timeout;
     int debug;
     int stack_count;
@@ -70,6 +82,17 @@ struct xenpaging {
 extern void create_page_in_thread(struct xenpaging *paging);
 extern void page_in_trigger(void);
 
+extern void get_request(struct vm_event *vm_event, vm_event_request_t *req);
+extern void put_response(struct vm_event *vm_event, vm_event_response_t *rsp);
+
+extern int access_sampling_init(struct xenpaging *paging);
+extern void access_sampling_teardown(struct xenpaging *paging);
+extern int access_sampling_arm(struct xenpaging *paging, unsigned long first,
+                               unsigned long nr);
+extern int access_sampling_restore(struct xenpaging *paging,
+                                   unsigned long gfn);
+extern int access_sampling_process(struct xenpaging *paging);
+
 #endif // __XEN_PAGING_H__
 
 
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "xenstat_priv.h"
 
@@ -76,6 +77,9 @@ static xenstat_collector collectors[] = {
 
 #define NUM_COLLECTORS (sizeof(collectors)/sizeof(xenstat_collector))
 
+/* Minimum number of VCPUs to collect information about per hypercall */
+#define VCPU_CHUNK_SIZE 256
+
 /*
  * libxenstat API
  */
@@ -122,6 +126,7 @@ void xenstat_uninit(xenstat_handle * handle)
 {
 	unsigned int i;
 	if (handle) {
+		xenstat_free_node(handle->prev_sample);
 		for (i = 0; i < NUM_COLLECTORS; i++)
 			collectors[i].uninit(handle);
 		xc_interface_close(handle->xc_handle);
@@ -306,6 +311,175 @@ void xenstat_free_node(xenstat_node * node)
 	}
 }
 
+/* Copy the cumulative counters of a node, for computing the next delta */
+static xenstat_node *xenstat_copy_counters(xenstat_node * node)
+{
+	xenstat_node *copy;
+	unsigned int i;
+
+	copy = calloc(1, sizeof(xenstat_node));
+	if (copy == NULL)
+		return NULL;
+
+	copy->flags = node->flags;
+	copy->domains = calloc(node->num_domains ? node->num_domains : 1,
+			       sizeof(xenstat_domain));
+	if (copy->domains == NULL) {
+		free(copy);
+		return NULL;
+	}
+	copy->num_domains = node->num_domains;
+
+	/* The arrays are allocated one byte larger, as malloc(0) is not
+	 * portable. */
+	for (i = 0; i < node->num_domains; i++) {
+		xenstat_domain *from = &node->domains[i];
+		xenstat_domain *to = &copy->domains[i];
+
+		to->id = from->id;
+		to->cpu_ns = from->cpu_ns;
+		if (from->vcpus != NULL) {
+			to->vcpus = malloc(from->num_vcpus *
+					   sizeof(xenstat_vcpu) + 1);
+			if (to->vcpus == NULL)
+				goto err;
+			memcpy(to->vcpus, from->vcpus,
+			       from->num_vcpus * sizeof(xenstat_vcpu));
+			to->num_vcpus = from->num_vcpus;
+		}
+		if (from->networks != NULL) {
+			to->networks = malloc(from->num_networks *
+					      sizeof(xenstat_network) + 1);
+			if (to->networks == NULL)
+				goto err;
+			memcpy(to->networks, from->networks,
+			       from->num_networks * sizeof(xenstat_network));
+			to->num_networks = from->num_networks;
+		}
+		if (from->vbds != NULL) {
+			to->vbds = malloc(from->num_vbds *
+					  sizeof(xenstat_vbd) + 1);
+			if (to->vbds == NULL)
+				goto err;
+			memcpy(to->vbds, from->vbds,
+			       from->num_vbds * sizeof(xenstat_vbd));
+			to->num_vbds = from->num_vbds;
+		}
+	}
+
+	return copy;
+err:
+	xenstat_free_node(copy);
+	return NULL;
+}
+
+static inline unsigned long long delta(unsigned long long cur,
+				       unsigned long long prev)
+{
+	/* A counter going backwards has been reset in between */
+	return cur >= prev ? cur - prev : cur;
+}
+
+#define DELTA(cur, prev, field) \
+	((cur)->field = (prev) ? delta((cur)->field, (prev)->field) : 0)
+
+static void xenstat_domain_delta(xenstat_domain *cur,
+				 const xenstat_domain *prev)
+{
+	unsigned int i, j;
+
+	DELTA(cur, prev, cpu_ns);
+
+	for (i = 0; cur->vcpus != NULL && i < cur->num_vcpus; i++) {
+		const xenstat_vcpu *p = NULL;
+
+		if (prev && prev->vcpus != NULL && i < prev->num_vcpus)
+			p = &prev->vcpus[i];
+		DELTA(&cur->vcpus[i], p, ns);
+	}
+
+	for (i = 0; cur->networks != NULL && i < cur->num_networks; i++) {
+		xenstat_network *c = &cur->networks[i];
+		const xenstat_network *p = NULL;
+
+		for (j = 0; prev && j < prev->num_networks; j++)
+			if (prev->networks[j].id == c->id) {
+				p = &prev->networks[j];
+				break;
+			}
+		DELTA(c, p, rbytes);
+		DELTA(c, p, rpackets);
+		DELTA(c, p, rerrs);
+		DELTA(c, p, rdrop);
+		DELTA(c, p, tbytes);
+		DELTA(c, p, tpackets);
+		DELTA(c, p, terrs);
+		DELTA(c, p, tdrop);
+	}
+
+	for (i = 0; cur->vbds != NULL && i < cur->num_vbds; i++) {
+		xenstat_vbd *c = &cur->vbds[i];
+		const xenstat_vbd *p = NULL;
+
+		for (j = 0; prev && j < prev->num_vbds; j++)
+			if (prev->vbds[j].back_type == c->back_type &&
+			    prev->vbds[j].dev == c->dev) {
+				p = &prev->vbds[j];
+				break;
+			}
+		DELTA(c, p, oo_reqs);
+		DELTA(c, p, rd_reqs);
+		DELTA(c, p, wr_reqs);
+		DELTA(c, p, rd_sects);
+		DELTA(c, p, wr_sects);
+	}
+}
+
+#undef DELTA
+
+xenstat_node *xenstat_get_node_delta(xenstat_handle * handle,
+				     unsigned int flags)
+{
+	xenstat_node *node, *raw, *prev = handle->prev_sample;
+	struct timespec now;
+	unsigned int i, j = 0;
+
+	node = xenstat_get_node(handle, flags);
+	if (node == NULL)
+		return NULL;
+
+	raw = xenstat_copy_counters(node);
+	if (raw == NULL) {
+		xenstat_free_node(node);
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (prev != NULL)
+		node->delta_ns =
+			(now.tv_sec - handle->prev_time.tv_sec) * 1000000000ULL
+			+ now.tv_nsec - handle->prev_time.tv_nsec;
+
+	/* Both lists of domains are sorted by domain ID */
+	for (i = 0; i < node->num_domains; i++) {
+		xenstat_domain *domain = &node->domains[i];
+
+		while (prev != NULL && j < prev->num_domains &&
+		       prev->domains[j].id < domain->id)
+			j++;
+		xenstat_domain_delta(domain,
+				     prev != NULL && j < prev->num_domains &&
+				     prev->domains[j].id == domain->id
+				     ? &prev->domains[j] : NULL);
+	}
+
+	xenstat_free_node(prev);
+	handle->prev_sample = raw;
+	handle->prev_time = now;
+
+	return node;
+}
+
 xenstat_domain *xenstat_node_domain(xenstat_node * node, unsigned int domid)
 {
 	unsigned int i;
@@ -363,6 +537,12 @@ unsigned long long xenstat_node_cpu_hz(xenstat_node * node)
 	return node->cpu_hz;
 }
 
+/* Get the interval covered by a delta node */
+unsigned long long xenstat_node_delta_ns(xenstat_node * node)
+{
+	return node->delta_ns;
+}
+
 /* Get the domain ID for this domain */
 unsigned xenstat_domain_id(xenstat_domain * domain)
 {
@@ -480,22 +660,119 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /*
  * VCPU functions
  */
+/* Collect information about the VCPUs of all domains with as few
+ * hypercalls as possible.  Returns -1 if the hypervisor doesn't support
+ * this, 0 on fatal errors and 1 on success. */
+static int xenstat_collect_vcpus_bulk(xenstat_node * node)
+{
+	xc_vcpuinfolist_t *info;
+	unsigned int i, max = 0, first_domain = 0;
+	unsigned char *seen;
+	int new_vcpus;
+
+	for (i = 0; i < node->num_domains; i++)
+		max += node->domains[i].num_vcpus;
+	if (max < VCPU_CHUNK_SIZE)
+		max = VCPU_CHUNK_SIZE;
+
+	seen = calloc(node->num_domains + 1, 1);
+	info = malloc(max * sizeof(*info));
+	if (seen == NULL || info == NULL)
+		goto fatal;
+
+	do {
+		unsigned int n;
+
+		new_vcpus = xc_vcpu_getinfolist(node->handle->xc_handle,
+						first_domain, max, info);
+		if (new_vcpus < 0) {
+			xc_vcpuinfolist_t *tmp;
+
+			if (errno == ENOMEM)
+				goto fatal;
+			if (errno != ENOBUFS) {
+				/* Not supported, or not permitted */
+				free(info);
+				free(seen);
+				return -1;
+			}
+
+			/* A domain with more VCPUs than space left */
+			max *= 2;
+			tmp = realloc(info, max * sizeof(*info));
+			if (tmp == NULL)
+				goto fatal;
+			info = tmp;
+			continue;
+		}
+
+		/* Entries are sorted by domain ID, like node->domains */
+		for (n = 0, i = 0; n < new_vcpus; n++) {
+			xenstat_domain *domain;
+
+			while (i < node->num_domains &&
+			       node->domains[i].id < info[n].domid)
+				i++;
+			if (i == node->num_domains)
+				break;
+			domain = &node->domains[i];
+			if (domain->id != info[n].domid ||
+			    info[n].vcpu >= domain->num_vcpus)
+				continue;
+
+			domain->vcpus[info[n].vcpu].online = info[n].online;
+			domain->vcpus[info[n].vcpu].ns = info[n].cpu_time;
+			seen[i] = 1;
+		}
+
+		if (new_vcpus > 0)
+			first_domain = info[new_vcpus - 1].domid + 1;
+	} while (new_vcpus != 0 && node->num_domains &&
+		 first_domain <= node->domains[node->num_domains - 1].id);
+
+	/* Domains without VCPUs reported are in transition - remove them */
+	for (i = node->num_domains; i-- > 0; )
+		if (!seen[i]) {
+			free(node->domains[i].vcpus);
+			free(node->domains[i].name);
+			xenstat_prune_domain(node, i);
+		}
+
+	free(info);
+	free(seen);
+	return 1;
+
+fatal:
+	free(info);
+	free(seen);
+	return 0;
+}
+
 /* Collect information about VCPUs */
 static int xenstat_collect_vcpus(xenstat_node * node)
 {
 	unsigned int i, vcpu, inc_index;
+	int rc;
+
+	for (i = 0; i < node->num_domains; i++) {
+		node->domains[i].vcpus = calloc(node->domains[i].num_vcpus + 1,
+						sizeof(xenstat_vcpu));
+		if (node->domains[i].vcpus == NULL)
+			return 0;
+	}
+
+	if (!node->handle->no_vcpuinfolist) {
+		rc = xenstat_collect_vcpus_bulk(node);
+		if (rc >= 0)
+			return rc;
+		node->handle->no_vcpuinfolist = 1;
+	}
 
 	/* Fill in VCPU information */
 	for (i = 0; i < node->num_domains; i+=inc_index) {
 		inc_index = 1; /* default is to increment to next domain */
 
-		node->domains[i].vcpus = malloc(node->domains[i].num_vcpus
-						* sizeof(xenstat_vcpu));
-		if (node->domains[i].vcpus == NULL)
-			return 0;
-	
 		for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
-			/* FIXME: need to be using a more efficient mechanism*/
 			xc_vcpuinfo_t info;
 
 			if (xc_vcpu_getinfo(node->handle->xc_handle,
@@ -507,6 +784,8 @@ static int xenstat_collect_vcpus(xenstat_node * node)
 				else {
 					/* domain is in transition - remove
 					   from list */
+					free(node->domains[i].vcpus);
+					free(node->domains[i].name);
 					xenstat_prune_domain(node, i);
 
 					/* remember not to increment index! */
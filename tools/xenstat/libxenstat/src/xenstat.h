@@ -48,6 +48,15 @@ void xenstat_uninit(xenstat_handle * handle);
 /* Get all available information about a node */
 xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags);
 
+/* Get all available information about a node, like xenstat_get_node(),
+ * but with the cumulative counters (domain and VCPU CPU time, network and
+ * VBD statistics) replaced by how much they grew since the previous call
+ * of this function on the same handle.  Counters of domains, VCPUs and
+ * devices not present in the previous sample, and all counters of the first
+ * sample, read as zero. */
+xenstat_node *xenstat_get_node_delta(xenstat_handle * handle,
+				     unsigned int flags);
+
 /* Free the information */
 void xenstat_free_node(xenstat_node * node);
 
@@ -84,6 +93,10 @@ unsigned int xenstat_node_num_cpus(xenstat_node * node);
 /* Get information about the CPU speed */
 unsigned long long xenstat_node_cpu_hz(xenstat_node * node);
 
+/* Get the time between the samples a node from xenstat_get_node_delta()
+ * was computed from, in nanoseconds (zero for any other node) */
+unsigned long long xenstat_node_delta_ns(xenstat_node * node);
+
 /*
  * Domain functions - extract information from a xenstat_domain
  */
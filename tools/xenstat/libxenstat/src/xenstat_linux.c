@@ -34,9 +34,40 @@
 
 #define SYSFS_VBD_PATH "/sys/bus/xen-backend/devices"
 
+/* Interface names seen in /proc/net/dev, and the VIF they belong to */
+struct iface_info {
+	char name[16];
+	int is_vif;
+	unsigned int domid;
+	unsigned int netid;
+};
+
+/* VBD backend devices found in sysfs */
+struct vbd_info {
+	char name[64];
+	unsigned int back_type;
+	unsigned int domid;
+	unsigned int dev;
+};
+
 struct priv_data {
 	FILE *procnetdev;
 	DIR *sysfsvbd;
+
+	/*
+	 * Which interfaces and VBDs belong to which domain only changes when
+	 * backends come and go, so it is looked up again only after the
+	 * backend directory in xenstore changed.
+	 */
+	int watching;			/* 1: watch set, -1: watch failed */
+	unsigned int generation;	/* Bumped when backends change */
+	unsigned int iface_generation;
+	unsigned int vbd_generation;
+	char bridge[16];
+	struct iface_info *ifaces;
+	unsigned int num_ifaces;
+	struct vbd_info *vbds;
+	unsigned int num_vbds;
 };
 
 static struct priv_data *
@@ -45,16 +76,38 @@ get_priv_data(xenstat_handle *handle)
 	if (handle->priv != NULL)
 		return handle->priv;
 
-	handle->priv = malloc(sizeof(struct priv_data));
+	handle->priv = calloc(1, sizeof(struct priv_data));
 	if (handle->priv == NULL)
 		return (NULL);
 
-	((struct priv_data *)handle->priv)->procnetdev = NULL;
-	((struct priv_data *)handle->priv)->sysfsvbd = NULL;
-
 	return handle->priv;
 }
 
+/* Find out whether the backends changed since the last call */
+static void check_backends(xenstat_handle *handle, struct priv_data *priv)
+{
+	char **vec;
+	int changed = 0;
+
+	if (priv->watching == 0) {
+		priv->watching = xs_watch(handle->xshandle, "backend",
+					  "xenstat") ? 1 : -1;
+		changed = 1;
+	}
+
+	/* Without a watch, look everything up again on every call */
+	if (priv->watching < 0)
+		changed = 1;
+	else
+		while ((vec = xs_check_watch(handle->xshandle)) != NULL) {
+			free(vec);
+			changed = 1;
+		}
+
+	if (changed)
+		priv->generation++;
+}
+
 /* Expected format of /proc/net/dev */
 static const char PROCNETDEV_HEADER[] =
     "Inter-|   Receive                                                |"
@@ -100,7 +153,8 @@ int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsign
 	int ret;
 	char *tmp;
 	int i = 0, x = 0, col = 0;
-	regex_t r;
+	static regex_t r;
+	static int compiled;
 	regmatch_t matches[19];
 	int num = 19;
 
@@ -145,9 +199,13 @@ int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsign
 	if (txComp != NULL)
 		*txComp = 0;
 
-	if ((ret = regcomp(&r, regex, REG_EXTENDED))) {
-		regfree(&r);
-		return ret;
+	/* Compiling the expression is more expensive than using it */
+	if (!compiled) {
+		if ((ret = regcomp(&r, regex, REG_EXTENDED))) {
+			regfree(&r);
+			return ret;
+		}
+		compiled = 1;
 	}
 
 	tmp = (char *)malloc( sizeof(char) );
@@ -231,7 +289,6 @@ int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsign
 	}
 
 	free(tmp);
-	regfree(&r);
 
 	return 0;
 }
@@ -259,11 +316,47 @@ static int get_iface_domid_network(const char *iface, unsigned int *domid_p, uns
 	return 0;
 }
 
+/* Look up the domid and network number of an interface, using the
+ * results of earlier lookups.  hint is where the interface is expected to
+ * be in the cache, as /proc/net/dev lists interfaces in a stable order. */
+static int lookup_iface(struct priv_data *priv, const char *iface,
+			unsigned int hint, unsigned int *domid_p,
+			unsigned int *netid_p)
+{
+	struct iface_info *info = NULL, *tmp;
+	unsigned int i;
+
+	if (hint < priv->num_ifaces &&
+	    strcmp(priv->ifaces[hint].name, iface) == 0)
+		info = &priv->ifaces[hint];
+	for (i = 0; info == NULL && i < priv->num_ifaces; i++)
+		if (strcmp(priv->ifaces[i].name, iface) == 0)
+			info = &priv->ifaces[i];
+
+	if (info == NULL) {
+		tmp = realloc(priv->ifaces,
+			      (priv->num_ifaces + 1) * sizeof(*tmp));
+		if (tmp == NULL)
+			return get_iface_domid_network(iface, domid_p, netid_p);
+		priv->ifaces = tmp;
+		info = &priv->ifaces[priv->num_ifaces++];
+		strncpy(info->name, iface, sizeof(info->name) - 1);
+		info->name[sizeof(info->name) - 1] = '\0';
+		info->is_vif = get_iface_domid_network(iface, &info->domid,
+						       &info->netid);
+	}
+
+	*domid_p = info->domid;
+	*netid_p = info->netid;
+	return info->is_vif;
+}
+
 /* Collect information about networks */
 int xenstat_collect_networks(xenstat_node * node)
 {
 	/* Helper variables for parseNetDevLine() function defined above */
 	int i;
+	unsigned int nr;
 	char line[512] = { 0 }, iface[16] = { 0 }, devBridge[16] = { 0 }, devNoBridge[16] = { 0 };
 	unsigned long long rxBytes, rxPackets, rxErrs, rxDrops, txBytes, txPackets, txErrs, txDrops;
 
@@ -298,15 +391,21 @@ int xenstat_collect_networks(xenstat_node * node)
 	}
 
 	/* Fill in networks */
-	/* FIXME: optimize this */
 	fseek(priv->procnetdev, sizeof(PROCNETDEV_HEADER) - 1,
 	      SEEK_SET);
 
-	/* We get the bridge devices for use with bonding interface to get bonding interface stats */
-	getBridge("vir", devBridge, sizeof(devBridge));
+	check_backends(node->handle, priv);
+	if (priv->iface_generation != priv->generation) {
+		priv->num_ifaces = 0;
+		priv->bridge[0] = '\0';
+		/* We get the bridge devices for use with bonding interface to get bonding interface stats */
+		getBridge("vir", priv->bridge, sizeof(priv->bridge));
+		priv->iface_generation = priv->generation;
+	}
+	strcpy(devBridge, priv->bridge);
 	snprintf(devNoBridge, 16, "p%s", devBridge);
 
-	while (fgets(line, 512, priv->procnetdev)) {
+	for (nr = 0; fgets(line, 512, priv->procnetdev); nr++) {
 		xenstat_domain *domain;
 		xenstat_network net;
 		unsigned int domid;
@@ -335,7 +434,7 @@ int xenstat_collect_networks(xenstat_node * node)
 			}
 		}
 		else /* Otherwise we need to preserve old behaviour */
-		if (get_iface_domid_network(iface, &domid, &net.id)) {
+		if (lookup_iface(priv, iface, nr, &domid, &net.id)) {
 
 			net.tbytes = txBytes;
 			net.tpackets = txPackets;
@@ -383,6 +482,8 @@ void xenstat_uninit_networks(xenstat_handle * handle)
 	struct priv_data *priv = get_priv_data(handle);
 	if (priv != NULL && priv->procnetdev != NULL)
 		fclose(priv->procnetdev);
+	if (priv != NULL)
+		free(priv->ifaces);
 }
 
 static int read_attributes_vbd(const char *vbd_directory, const char *what, char *ret, int cap)
@@ -401,11 +502,52 @@ static int read_attributes_vbd(const char *vbd_directory, const char *what, char
 	return num_read;
 }
 
+/* Find the VBD backend devices in sysfs */
+static int discover_vbds(struct priv_data *priv)
+{
+	struct dirent *dp;
+	struct vbd_info *tmp;
+
+	priv->num_vbds = 0;
+	rewinddir(priv->sysfsvbd);
+
+	for(dp = readdir(priv->sysfsvbd); dp != NULL ;
+	    dp = readdir(priv->sysfsvbd)) {
+		struct vbd_info info;
+		char buf[256];
+		int ret;
+
+		ret = sscanf(dp->d_name, "%3s-%u-%u", buf, &info.domid, &info.dev);
+		if (ret != 3)
+			continue;
+		if (!(strstr(buf, "vbd")) && !(strstr(buf, "tap")))
+			continue;
+		if (strlen(dp->d_name) >= sizeof(info.name))
+			continue;
+
+		if (strcmp(buf,"vbd") == 0)
+			info.back_type = 1;
+		else if (strcmp(buf,"tap") == 0)
+			info.back_type = 2;
+		else
+			info.back_type = 0;
+		strcpy(info.name, dp->d_name);
+
+		tmp = realloc(priv->vbds, (priv->num_vbds + 1) * sizeof(*tmp));
+		if (tmp == NULL)
+			return 0;
+		priv->vbds = tmp;
+		priv->vbds[priv->num_vbds++] = info;
+	}
+
+	return 1;
+}
+
 /* Collect information about VBDs */
 int xenstat_collect_vbds(xenstat_node * node)
 {
-	struct dirent *dp;
 	struct priv_data *priv = get_priv_data(node->handle);
+	unsigned int i;
 
 	if (priv == NULL) {
 		perror("Allocation error");
@@ -423,35 +565,31 @@ int xenstat_collect_vbds(xenstat_node * node)
 	/* Get qdisk statistics */
 	read_attributes_qdisk(node);
 
-	rewinddir(priv->sysfsvbd);
+	check_backends(node->handle, priv);
+	if (priv->vbd_generation != priv->generation) {
+		if (!discover_vbds(priv)) {
+			perror("Allocation error");
+			priv->num_vbds = 0;
+			return 0;
+		}
+		priv->vbd_generation = priv->generation;
+	}
 
-	for(dp = readdir(priv->sysfsvbd); dp != NULL ;
-	    dp = readdir(priv->sysfsvbd)) {
+	for (i = 0; i < priv->num_vbds; i++) {
+		const struct vbd_info *info = &priv->vbds[i];
 		xenstat_domain *domain;
-		xenstat_vbd vbd;
-		unsigned int domid;
-		int ret;
+		xenstat_vbd vbd = {
+			.back_type = info->back_type,
+			.dev = info->dev,
+		};
 		char buf[256];
 
-		ret = sscanf(dp->d_name, "%3s-%u-%u", buf, &domid, &vbd.dev);
-		if (ret != 3)
-			continue;
-		if (!(strstr(buf, "vbd")) && !(strstr(buf, "tap")))
-			continue;
-
-		if (strcmp(buf,"vbd") == 0)
-			vbd.back_type = 1;
-		else if (strcmp(buf,"tap") == 0)
-			vbd.back_type = 2;
-		else
-			vbd.back_type = 0;
-
-		domain = xenstat_node_domain(node, domid);
+		domain = xenstat_node_domain(node, info->domid);
 		if (domain == NULL) {
 			fprintf(stderr,
-				"Found interface %s-%u-%u but domain %u"
+				"Found interface %s but domain %u"
 				" does not exist.\n",
-				buf, domid, vbd.dev, domid);
+				info->name, info->domid);
 			continue;
 		}
 
@@ -460,16 +598,16 @@ int xenstat_collect_vbds(xenstat_node * node)
 
 			vbd.error = 0;
 
-			if ((read_attributes_vbd(dp->d_name, "statistics/oo_req", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.oo_reqs)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/rd_req", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.rd_reqs)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/wr_req", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.wr_reqs)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/rd_sect", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.wr_sects)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/wr_sect", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.wr_sects)) != 1))
+			if ((read_attributes_vbd(info->name, "statistics/oo_req", buf, 256)<=0) ||
+				(sscanf(buf, "%llu", &vbd.oo_reqs) != 1) ||
+				(read_attributes_vbd(info->name, "statistics/rd_req", buf, 256)<=0) ||
+				(sscanf(buf, "%llu", &vbd.rd_reqs) != 1) ||
+				(read_attributes_vbd(info->name, "statistics/wr_req", buf, 256)<=0) ||
+				(sscanf(buf, "%llu", &vbd.wr_reqs) != 1) ||
+				(read_attributes_vbd(info->name, "statistics/rd_sect", buf, 256)<=0) ||
+				(sscanf(buf, "%llu", &vbd.rd_sects) != 1) ||
+				(read_attributes_vbd(info->name, "statistics/wr_sect", buf, 256)<=0) ||
+				(sscanf(buf, "%llu", &vbd.wr_sects) != 1))
 			{
 				vbd.error = 1;
 			}
@@ -493,4 +631,6 @@ void xenstat_uninit_vbds(xenstat_handle * handle)
 	struct priv_data *priv = get_priv_data(handle);
 	if (priv != NULL && priv->sysfsvbd != NULL)
 		closedir(priv->sysfsvbd);
+	if (priv != NULL)
+		free(priv->vbds);
 }
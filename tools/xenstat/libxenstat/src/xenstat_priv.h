@@ -24,6 +24,7 @@
 #define XENSTAT_PRIV_H
 
 #include <sys/types.h>
+#include <time.h>
 #include <xenstore.h>
 #include "xenstat.h"
 
@@ -38,6 +39,9 @@ struct xenstat_handle {
 	int page_size;
 	void *priv;
 	char xen_version[VERSION_SIZE]; /* xen version running on this node */
+	int no_vcpuinfolist;		/* XEN_SYSCTL_getvcpuinfolist unusable */
+	xenstat_node *prev_sample;	/* Raw counters of the previous delta */
+	struct timespec prev_time;	/* ... and when they were sampled */
 };
 
 struct xenstat_node {
@@ -50,6 +54,7 @@ struct xenstat_node {
 	unsigned int num_domains;
 	xenstat_domain *domains;	/* Array of length num_domains */
 	long freeable_mb;
+	unsigned long long delta_ns;	/* Interval covered by a delta node */
 };
 
 struct xenstat_tmem {
@@ -1562,6 +1562,7 @@ enum {
     MEM_POD_POPULATE = 16,
     MEM_POD_ZERO_RECLAIM,
     MEM_POD_SUPERPAGE_SPLINTER,
+    MEM_POD_STALL,
     MEM_MAX
 };
 
@@ -1574,6 +1575,7 @@ char *mem_name[MEM_MAX] = {
     [MEM_POD_POPULATE]           = "pod-populate",
     [MEM_POD_ZERO_RECLAIM]       = "pod-zero-reclaim",
     [MEM_POD_SUPERPAGE_SPLINTER] = "pod-superpage-splinter",
+    [MEM_POD_STALL]              = "pod-stall",
 };
 
 /* Per-unit information. */
@@ -1737,6 +1739,8 @@ struct domain_data {
         int reclaim_context_order[POD_RECLAIM_CONTEXT_MAX][POD_ORDER_MAX];
         /* FIXME: Do a full cycle summary */
         int populate_order[POD_ORDER_MAX];
+        int stall_count;
+        unsigned long long stall_ns, stall_max_ns;
     } pod;
 };
 
@@ -8074,6 +8078,9 @@ void mem_summary_domain(struct domain_data *d) {
             printf("   [%d] %d\n", i,
                    d->pod.populate_order[i]);
     }
+    if ( d->pod.stall_count )
+        printf("  Stalls: %d, total %lluns, max %lluns\n",
+               d->pod.stall_count, d->pod.stall_ns, d->pod.stall_max_ns);
     printf("  Reclaim order:\n");
     for(i=0; i<4; i++)
     {
@@ -8215,6 +8222,38 @@ void mem_pod_superpage_splinter_process(struct pcpu_info *p)
     }
 }
 
+void mem_pod_stall_process(struct pcpu_info *p)
+{
+    struct record_info *ri = &p->ri;
+
+    struct {
+        uint64_t gfn, ns;
+        int d:16,order:16;
+    } *r = (typeof(r))ri->d;
+
+    if ( opt.dump_all )
+    {
+        printf(" %s pod_stall d%d o%d g %llx %lluns\n",
+               ri->dump_header,
+               r->d, r->order,
+               (unsigned long long)r->gfn, (unsigned long long)r->ns);
+    }
+
+    if ( opt.summary_info )
+    {
+        struct vcpu_data *v = p->current;
+        struct domain_data *d;
+
+        if ( v && (d=v->d) )
+        {
+            d->pod.stall_count++;
+            d->pod.stall_ns += r->ns;
+            if ( r->ns > d->pod.stall_max_ns )
+                d->pod.stall_max_ns = r->ns;
+        }
+    }
+}
+
 void mem_page_grant(struct pcpu_info *p)
 {
     struct record_info *ri = &p->ri;
@@ -8297,6 +8336,9 @@ void mem_process(struct pcpu_info *p) {
     case MEM_POD_SUPERPAGE_SPLINTER:
         mem_pod_superpage_splinter_process(p);
         break;
+    case MEM_POD_STALL:
+        mem_pod_stall_process(p);
+        break;
     default:
         if(opt.dump_all) {
             dump_generic(stdout, ri);
@@ -1250,6 +1250,28 @@ long arch_do_domctl(
         break;
 #endif /* P2M_AUDIT */
 
+#ifdef CONFIG_HVM
+    case XEN_DOMCTL_p2m_superpages:
+        if ( d == currd )
+        {
+            ret = -EPERM;
+            break;
+        }
+
+        ret = p2m_superpages_domctl(d, &domctl->u.p2m_superpages);
+        if ( ret == -ERESTART )
+        {
+            if ( __copy_to_guest(u_domctl, domctl, 1) )
+                ret = -EFAULT;
+            else
+                ret = hypercall_create_continuation(__HYPERVISOR_domctl,
+                                                    "h", u_domctl);
+            break;
+        }
+        copyback = true;
+        break;
+#endif
+
     case XEN_DOMCTL_set_broken_page_p2m:
     {
         p2m_type_t pt;
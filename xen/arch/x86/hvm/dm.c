@@ -267,6 +267,9 @@ static int set_mem_type(struct domain *d,
             return -EINVAL;
     }
 
+    /* Have the p2m flush TLBs once, rather than for every page. */
+    p2m_batch_begin(d);
+
     while ( iter < data->nr )
     {
         unsigned long pfn = data->first_pfn + iter;
@@ -277,7 +280,8 @@ static int set_mem_type(struct domain *d,
         {
             put_gfn(d, pfn);
             p2m_mem_paging_populate(d, pfn);
-            return -EAGAIN;
+            rc = -EAGAIN;
+            break;
         }
 
         if ( p2m_is_shared(t) )
@@ -309,6 +313,8 @@ static int set_mem_type(struct domain *d,
         }
     }
 
+    p2m_batch_end(d);
+
     return rc;
 }
 
@@ -362,6 +368,8 @@ static int dm_op(const struct dmop_args *op_args)
         [XEN_DMOP_remote_shutdown]                  = sizeof(struct xen_dm_op_remote_shutdown),
         [XEN_DMOP_relocate_memory]                  = sizeof(struct xen_dm_op_relocate_memory),
         [XEN_DMOP_pin_memory_cacheattr]             = sizeof(struct xen_dm_op_pin_memory_cacheattr),
+        [XEN_DMOP_map_posted_io_range]              = sizeof(struct xen_dm_op_ioreq_server_range),
+        [XEN_DMOP_unmap_posted_io_range]            = sizeof(struct xen_dm_op_ioreq_server_range),
     };
 
     rc = rcu_lock_remote_domain_by_id(op_args->domid, &d);
@@ -452,7 +460,7 @@ static int dm_op(const struct dmop_args *op_args)
             break;
 
         rc = hvm_map_io_range_to_ioreq_server(d, data->id, data->type,
-                                              data->start, data->end);
+                                              data->start, data->end, false);
         break;
     }
 
@@ -466,7 +474,37 @@ static int dm_op(const struct dmop_args *op_args)
             break;
 
         rc = hvm_unmap_io_range_from_ioreq_server(d, data->id, data->type,
-                                                  data->start, data->end);
+                                                  data->start, data->end,
+                                                  false);
+        break;
+    }
+
+    case XEN_DMOP_map_posted_io_range:
+    {
+        const struct xen_dm_op_ioreq_server_range *data =
+            &op.u.map_posted_io_range;
+
+        rc = -EINVAL;
+        if ( data->pad )
+            break;
+
+        rc = hvm_map_io_range_to_ioreq_server(d, data->id, data->type,
+                                              data->start, data->end, true);
+        break;
+    }
+
+    case XEN_DMOP_unmap_posted_io_range:
+    {
+        const struct xen_dm_op_ioreq_server_range *data =
+            &op.u.unmap_posted_io_range;
+
+        rc = -EINVAL;
+        if ( data->pad )
+            break;
+
+        rc = hvm_unmap_io_range_from_ioreq_server(d, data->id, data->type,
+                                                  data->start, data->end,
+                                                  true);
         break;
     }
 
@@ -11,6 +11,7 @@
 
 #include <xen/init.h>
 #include <xen/lib.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/paging.h>
 #include <xen/trace.h>
@@ -27,6 +28,24 @@
 #include <asm/hvm/svm/svm.h>
 #include <asm/vm_event.h>
 
+/*
+ * Upper bound on the size of a single REP MOVS/STOS transfer to or from
+ * emulated MMIO: rather than splitting such transfers at every page
+ * boundary, hand up to this many pages to the device model (or internal
+ * handler) in one go.
+ */
+#define HVMEMUL_BULK_PAGES 16
+
+/*
+ * Upper bound on the reps of a REP MOVS/STOS between RAM locations, which
+ * gets bounced through a buffer allocated in Xen.
+ */
+#define HVMEMUL_BOUNCE_REPS 4096
+
+/* Xen command-line option to cache the last decoded insn per vCPU */
+static bool __read_mostly opt_emul_decode_cache = true;
+boolean_param("hvm-emul-decode-cache", opt_emul_decode_cache);
+
 static void hvmtrace_io_assist(const ioreq_t *p)
 {
     unsigned int size, event;
@@ -120,6 +139,56 @@ static const struct hvm_io_handler ioreq_server_handler = {
     .ops = &ioreq_server_ops
 };
 
+/*
+ * Extend a rep MMIO access truncated to @count reps at the first GFN
+ * boundary across further GFNs, as long as these are emulated MMIO as well
+ * and the whole access still gets routed to the same internal handler and
+ * ioreq server.
+ */
+static unsigned long hvmemul_rep_mmio_count(const ioreq_t *p,
+                                            unsigned long count)
+{
+    struct domain *currd = current->domain;
+    unsigned long gfn = paddr_to_pfn(p->addr);
+    const struct hvm_ioreq_server *s;
+    ioreq_t q = *p;
+    unsigned int i;
+    p2m_type_t p2mt;
+
+    /* Reps must not straddle GFNs. */
+    if ( count >= p->count || (p->addr & (p->size - 1)) )
+        return count;
+
+    get_gfn_query_unlocked(currd, gfn, &p2mt);
+    if ( p2mt != p2m_mmio_dm )
+        return count;
+
+    q.count = count;
+    s = hvm_select_ioreq_server(currd, &q);
+
+    for ( i = 1; i < HVMEMUL_BULK_PAGES && count < p->count; i++ )
+    {
+        unsigned long next = p->df ? gfn - i : gfn + i;
+
+        get_gfn_query_unlocked(currd, next, &p2mt);
+        if ( p2mt != p2m_mmio_dm ||
+             !hvm_mmio_same_handler(p->addr, pfn_to_paddr(next)) )
+            break;
+
+        q.count = min_t(unsigned long, count + PAGE_SIZE / p->size,
+                        p->count);
+        if ( hvm_select_ioreq_server(currd, &q) != s )
+            break;
+
+        count = q.count;
+    }
+
+    if ( i > 1 )
+        perfc_incr(hvmemul_bulk_mmio);
+
+    return count;
+}
+
 static int hvmemul_do_io(
     bool_t is_mmio, paddr_t addr, unsigned long *reps, unsigned int size,
     uint8_t dir, bool_t df, bool_t data_is_addr, uintptr_t data)
@@ -191,6 +260,8 @@ static int hvmemul_do_io(
      * Make sure that we truncate rep MMIO at any GFN boundary. This is
      * necessary to ensure that the correct device model is targetted
      * or that we correctly handle a rep op spanning MMIO and RAM.
+     * Contiguous emulated MMIO with a single target is dealt with in
+     * one go though.
      */
     if ( unlikely(p.count > 1) && p.type == IOREQ_TYPE_COPY )
     {
@@ -200,8 +271,8 @@ static int hvmemul_do_io(
         if ( tail < p.size ) /* single rep spans GFN */
             p.count = 1;
         else
-            p.count = min(p.count,
-                          (p.df ? (off + p.size) : tail) / p.size);
+            p.count = hvmemul_rep_mmio_count(
+                &p, min(p.count, (p.df ? (off + p.size) : tail) / p.size));
     }
     ASSERT(p.count);
 
@@ -385,6 +456,25 @@ static int hvmemul_acquire_page(unsigned long gmfn, struct page_info **page)
     return X86EMUL_OKAY;
 }
 
+/* Like hvmemul_acquire_page(), but quietly failing for anything but RAM. */
+static bool hvmemul_acquire_ram_page(unsigned long gmfn,
+                                     struct page_info **page)
+{
+    p2m_type_t p2mt;
+
+    if ( check_get_page_from_gfn(current->domain, _gfn(gmfn), false, &p2mt,
+                                 page) )
+        return false;
+
+    if ( !p2m_is_ram(p2mt) )
+    {
+        put_page(*page);
+        return false;
+    }
+
+    return true;
+}
+
 static inline void hvmemul_release_page(struct page_info *page)
 {
     put_page(page);
@@ -397,7 +487,7 @@ static int hvmemul_do_io_addr(
     struct vcpu *v = current;
     unsigned long ram_gmfn = paddr_to_pfn(ram_gpa);
     unsigned int page_off = ram_gpa & (PAGE_SIZE - 1);
-    struct page_info *ram_page[2];
+    struct page_info *ram_page[HVMEMUL_BULK_PAGES];
     unsigned int nr_pages = 0;
     unsigned long count;
     int rc;
@@ -432,6 +522,25 @@ static int hvmemul_do_io_addr(
         nr_pages++;
         count = 1;
     }
+    else if ( count < *reps )
+    {
+        /*
+         * Grab further pages for a larger transfer.  They are known to be
+         * physically contiguous (see above), but may not be RAM.
+         */
+        while ( nr_pages < ARRAY_SIZE(ram_page) &&
+                hvmemul_acquire_ram_page(df ? ram_gmfn - nr_pages
+                                             : ram_gmfn + nr_pages,
+                                          &ram_page[nr_pages]) )
+            nr_pages++;
+
+        if ( nr_pages > 1 )
+            count = min_t(unsigned long,
+                          *reps,
+                          df ?
+                          (page_off + (nr_pages - 1) * PAGE_SIZE) / size + 1 :
+                          (nr_pages * PAGE_SIZE - page_off) / size);
+    }
 
     rc = hvmemul_do_io(is_mmio, addr, &count, size, dir, df, 1,
                        ram_gpa);
@@ -715,8 +824,11 @@ static int hvmemul_linear_to_phys(
     /*
      * Clip repetitions to a sensible maximum. This avoids extensive looping in
      * this function while still amortising the cost of I/O trap-and-emulate.
+     * Callers not doing I/O clip further to HVMEMUL_BOUNCE_REPS.
      */
-    *reps = min_t(unsigned long, *reps, 4096);
+    *reps = min_t(unsigned long, *reps,
+                  max_t(unsigned long, HVMEMUL_BOUNCE_REPS,
+                        HVMEMUL_BULK_PAGES * PAGE_SIZE / bytes_per_rep));
 
     /* With no paging it's easy: linear == physical. */
     if ( !(curr->arch.hvm.guest_cr[0] & X86_CR0_PG) )
@@ -1796,6 +1908,7 @@ static int hvmemul_rep_movs(
     }
 
     /* RAM-to-RAM copy: emulate as equivalent of memmove(dgpa, sgpa, bytes). */
+    *reps = min_t(unsigned long, *reps, HVMEMUL_BOUNCE_REPS);
     bytes = *reps * bytes_per_rep;
 
     /* Adjust source address for reverse copy. */
@@ -1911,6 +2024,7 @@ static int hvmemul_rep_stos(
 
     default:
         /* Allocate temporary buffer. */
+        *reps = min_t(unsigned long, *reps, HVMEMUL_BOUNCE_REPS);
         for ( ; ; )
         {
             bytes = *reps * bytes_per_rep;
@@ -2594,6 +2708,20 @@ void hvm_emulate_init_once(
     hvmemul_ctxt->ctxt.regs = regs;
     hvmemul_ctxt->ctxt.vendor = curr->domain->arch.cpuid->x86_vendor;
     hvmemul_ctxt->ctxt.force_writeback = true;
+    hvmemul_ctxt->ctxt.decode_cache = curr->arch.hvm.hvm_io.decode_cache;
+}
+
+void hvm_emulate_vcpu_init(struct vcpu *v)
+{
+    /* The cache is an optimisation only, so failure to allocate is benign. */
+    if ( opt_emul_decode_cache )
+        v->arch.hvm.hvm_io.decode_cache = x86_emulate_decode_cache_alloc();
+}
+
+void hvm_emulate_vcpu_destroy(struct vcpu *v)
+{
+    x86_emulate_decode_cache_free(v->arch.hvm.hvm_io.decode_cache);
+    v->arch.hvm.hvm_io.decode_cache = NULL;
 }
 
 void hvm_emulate_init_per_insn(
@@ -592,6 +592,7 @@ int hvm_domain_initialise(struct domain *d)
     spin_lock_init(&d->arch.hvm.uc_lock);
     spin_lock_init(&d->arch.hvm.write_map.lock);
     rwlock_init(&d->arch.hvm.mmcfg_lock);
+    rwlock_init(&d->arch.hvm.msix_lock);
     INIT_LIST_HEAD(&d->arch.hvm.write_map.list);
     INIT_LIST_HEAD(&d->arch.hvm.g2m_ioport_list);
     INIT_LIST_HEAD(&d->arch.hvm.mmcfg_regions);
@@ -1494,8 +1495,7 @@ int hvm_vcpu_initialise(struct vcpu *v)
 
     hvm_asid_flush_vcpu(v);
 
-    spin_lock_init(&v->arch.hvm.tm_lock);
-    INIT_LIST_HEAD(&v->arch.hvm.tm_list);
+    pt_vcpu_init(v); /* teardown: pt_vcpu_destroy */
 
     rc = hvm_vcpu_cacheattr_init(v); /* teardown: vcpu_cacheattr_destroy */
     if ( rc != 0 )
@@ -1516,6 +1516,8 @@ int hvm_vcpu_initialise(struct vcpu *v)
 
     v->arch.hvm.inject_event.vector = HVM_EVENT_VECTOR_UNSET;
 
+    hvm_emulate_vcpu_init(v); /* teardown: hvm_emulate_vcpu_destroy */
+
     rc = setup_compat_arg_xlat(v); /* teardown: free_compat_arg_xlat() */
     if ( rc != 0 )
         goto fail4;
@@ -1547,12 +1549,14 @@ int hvm_vcpu_initialise(struct vcpu *v)
  fail5:
     free_compat_arg_xlat(v);
  fail4:
+    hvm_emulate_vcpu_destroy(v);
     hvm_funcs.vcpu_destroy(v);
  fail3:
     vlapic_destroy(v);
  fail2:
     hvm_vcpu_cacheattr_destroy(v);
  fail1:
+    pt_vcpu_destroy(v);
     return rc;
 }
 
@@ -1569,10 +1573,13 @@ void hvm_vcpu_destroy(struct vcpu *v)
 
     free_compat_arg_xlat(v);
 
+    hvm_emulate_vcpu_destroy(v);
+
     tasklet_kill(&v->arch.hvm.assert_evtchn_irq_tasklet);
     hvm_funcs.vcpu_destroy(v);
 
     vlapic_destroy(v);
+    pt_vcpu_destroy(v);
 
     hvm_vcpu_cacheattr_destroy(v);
 }
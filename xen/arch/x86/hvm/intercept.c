@@ -29,6 +29,7 @@
 #include <io_ports.h>
 #include <xen/event.h>
 #include <xen/iommu.h>
+#include <xen/perfc.h>
 
 static bool_t hvm_mmio_accept(const struct hvm_io_handler *handler,
                               const ioreq_t *p)
@@ -120,6 +121,9 @@ int hvm_process_io_intercept(const struct hvm_io_handler *handler,
     uint64_t data;
     uint64_t addr;
 
+    if ( p->data_is_ptr && p->count > 1 && ops->rep )
+        return ops->rep(handler, p);
+
     if ( p->dir == IOREQ_READ )
     {
         for ( i = 0; i < p->count; i++ )
@@ -213,12 +217,30 @@ int hvm_process_io_intercept(const struct hvm_io_handler *handler,
 
 static const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p)
 {
-    struct domain *curr_d = current->domain;
+    struct vcpu *curr = current;
+    struct domain *curr_d = curr->domain;
+    struct hvm_io_handler_hint *hint = &curr->arch.hvm.hvm_io.handler_hint;
     unsigned int i;
 
     BUG_ON((p->type != IOREQ_TYPE_PIO) &&
            (p->type != IOREQ_TYPE_COPY));
 
+    /*
+     * Guests tend to hit the same port or MMIO address over and over
+     * (doorbells, status registers, REP loops).  Try the handler which
+     * accepted the identical access last time before walking the whole
+     * array.  Handlers are only ever appended and ->accept() is still
+     * consulted, so a stale hint merely costs one extra call.
+     */
+    if ( hint->handler && hint->type == p->type && hint->addr == p->addr &&
+         hint->size == p->size && hint->handler->ops->accept(hint->handler, p) )
+    {
+        perfc_incr(hvm_io_handler_hint_hit);
+        return hint->handler;
+    }
+
+    perfc_incr(hvm_io_handler_hint_miss);
+
     for ( i = 0; i < curr_d->arch.hvm.io_handler_count; i++ )
     {
         const struct hvm_io_handler *handler =
@@ -229,7 +251,14 @@ static const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p)
             continue;
 
         if ( ops->accept(handler, p) )
+        {
+            hint->type = p->type;
+            hint->size = p->size;
+            hint->addr = p->addr;
+            hint->handler = handler;
+
             return handler;
+        }
     }
 
     return NULL;
@@ -320,7 +349,7 @@ void relocate_portio_handler(struct domain *d, unsigned int old_port,
     }
 }
 
-bool_t hvm_mmio_internal(paddr_t gpa)
+static const struct hvm_io_handler *hvm_mmio_handler(paddr_t gpa)
 {
     const struct hvm_io_handler *handler;
     const struct hvm_io_ops *ops;
@@ -334,13 +363,24 @@ bool_t hvm_mmio_internal(paddr_t gpa)
     handler = hvm_find_io_handler(&p);
 
     if ( handler == NULL )
-        return 0;
+        return NULL;
 
     ops = handler->ops;
     if ( ops->complete != NULL )
         ops->complete(handler);
 
-    return 1;
+    return handler;
+}
+
+bool_t hvm_mmio_internal(paddr_t gpa)
+{
+    return hvm_mmio_handler(gpa) != NULL;
+}
+
+/* Are both addresses handled by the same (or no) internal handler? */
+bool hvm_mmio_same_handler(paddr_t gpa1, paddr_t gpa2)
+{
+    return hvm_mmio_handler(gpa1) == hvm_mmio_handler(gpa2);
 }
 
 /*
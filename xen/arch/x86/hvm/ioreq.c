@@ -26,10 +26,12 @@
 #include <xen/domain.h>
 #include <xen/event.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/vpci.h>
 
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/ioreq.h>
+#include <asm/hvm/support.h>
 #include <asm/hvm/vmx/vmx.h>
 
 #include <public/hvm/ioreq.h>
@@ -69,6 +71,17 @@ static struct hvm_ioreq_server *get_ioreq_server(const struct domain *d,
             continue; \
         else
 
+/*
+ * Invalidate the per-vCPU server selection hints.  To be called with the
+ * ioreq server lock held, after any change which may alter the result of
+ * hvm_select_ioreq_server().
+ */
+static void invalidate_ioreq_server_hints(struct domain *d)
+{
+    smp_wmb();
+    d->arch.hvm.ioreq_server.generation++;
+}
+
 static ioreq_t *get_ioreq(struct hvm_ioreq_server *s, struct vcpu *v)
 {
     shared_iopage_t *p = s->ioreq.va;
@@ -653,7 +666,12 @@ static void hvm_ioreq_server_free_rangesets(struct hvm_ioreq_server *s)
     unsigned int i;
 
     for ( i = 0; i < NR_IO_RANGE_TYPES; i++ )
+    {
         rangeset_destroy(s->range[i]);
+        rangeset_destroy(s->posted[i]);
+    }
+
+    s->bufioreq_posted = false;
 }
 
 static int hvm_ioreq_server_alloc_rangesets(struct hvm_ioreq_server *s,
@@ -684,6 +702,25 @@ static int hvm_ioreq_server_alloc_rangesets(struct hvm_ioreq_server *s,
             goto fail;
 
         rangeset_limit(s->range[i], MAX_NR_IO_RANGES);
+
+        if ( i == XEN_DMOP_IO_RANGE_PCI )
+            continue;
+
+        rc = asprintf(&name, "ioreq_server %d posted %s", id,
+                      (i == XEN_DMOP_IO_RANGE_PORT) ? "port" : "memory");
+        if ( rc )
+            goto fail;
+
+        s->posted[i] = rangeset_new(s->target, name,
+                                    RANGESETF_prettyprint_hex);
+
+        xfree(name);
+
+        rc = -ENOMEM;
+        if ( !s->posted[i] )
+            goto fail;
+
+        rangeset_limit(s->posted[i], MAX_NR_IO_RANGES);
     }
 
     return 0;
@@ -885,6 +922,7 @@ int hvm_destroy_ioreq_server(struct domain *d, ioservid_t id)
      */
     hvm_ioreq_server_deinit(s);
     set_ioreq_server(d, id, NULL);
+    invalidate_ioreq_server_hints(d);
 
     domain_unpause(d);
 
@@ -996,9 +1034,24 @@ int hvm_get_ioreq_server_frame(struct domain *d, ioservid_t id,
     return rc;
 }
 
+static struct rangeset *get_ioreq_server_rangeset(struct hvm_ioreq_server *s,
+                                                  uint32_t type, bool posted)
+{
+    switch ( type )
+    {
+    case XEN_DMOP_IO_RANGE_PORT:
+    case XEN_DMOP_IO_RANGE_MEMORY:
+    case XEN_DMOP_IO_RANGE_PCI:
+        return posted ? s->posted[type] : s->range[type];
+
+    default:
+        return NULL;
+    }
+}
+
 int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
                                      uint32_t type, uint64_t start,
-                                     uint64_t end)
+                                     uint64_t end, bool posted)
 {
     struct hvm_ioreq_server *s;
     struct rangeset *r;
@@ -1019,28 +1072,27 @@ int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
     if ( s->emulator != current->domain )
         goto out;
 
-    switch ( type )
-    {
-    case XEN_DMOP_IO_RANGE_PORT:
-    case XEN_DMOP_IO_RANGE_MEMORY:
-    case XEN_DMOP_IO_RANGE_PCI:
-        r = s->range[type];
-        break;
-
-    default:
-        r = NULL;
-        break;
-    }
+    r = get_ioreq_server_rangeset(s, type, posted);
 
     rc = -EINVAL;
     if ( !r )
         goto out;
 
+    rc = -EOPNOTSUPP;
+    if ( posted && s->bufioreq_handling != HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+        goto out;
+
     rc = -EEXIST;
     if ( rangeset_overlaps_range(r, start, end) )
         goto out;
 
     rc = rangeset_add_range(r, start, end);
+    if ( !rc )
+    {
+        if ( posted )
+            s->bufioreq_posted = true;
+        invalidate_ioreq_server_hints(d);
+    }
 
  out:
     spin_unlock_recursive(&d->arch.hvm.ioreq_server.lock);
@@ -1050,7 +1102,7 @@ int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
 
 int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
                                          uint32_t type, uint64_t start,
-                                         uint64_t end)
+                                         uint64_t end, bool posted)
 {
     struct hvm_ioreq_server *s;
     struct rangeset *r;
@@ -1071,18 +1123,7 @@ int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
     if ( s->emulator != current->domain )
         goto out;
 
-    switch ( type )
-    {
-    case XEN_DMOP_IO_RANGE_PORT:
-    case XEN_DMOP_IO_RANGE_MEMORY:
-    case XEN_DMOP_IO_RANGE_PCI:
-        r = s->range[type];
-        break;
-
-    default:
-        r = NULL;
-        break;
-    }
+    r = get_ioreq_server_rangeset(s, type, posted);
 
     rc = -EINVAL;
     if ( !r )
@@ -1093,6 +1134,19 @@ int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
         goto out;
 
     rc = rangeset_remove_range(r, start, end);
+    if ( !rc )
+    {
+        /* Back to notifying every buffered ioreq once nothing is posted. */
+        if ( posted &&
+             rangeset_is_empty(s->posted[XEN_DMOP_IO_RANGE_PORT]) &&
+             rangeset_is_empty(s->posted[XEN_DMOP_IO_RANGE_MEMORY]) )
+        {
+            spin_lock(&s->bufioreq_lock);
+            s->bufioreq_posted = false;
+            spin_unlock(&s->bufioreq_lock);
+        }
+        invalidate_ioreq_server_hints(d);
+    }
 
  out:
     spin_unlock_recursive(&d->arch.hvm.ioreq_server.lock);
@@ -1173,6 +1227,8 @@ int hvm_set_ioreq_server_state(struct domain *d, ioservid_t id,
     else
         hvm_ioreq_server_disable(s);
 
+    invalidate_ioreq_server_hints(d);
+
     domain_unpause(d);
 
     rc = 0;
@@ -1253,17 +1309,23 @@ void hvm_destroy_all_ioreq_servers(struct domain *d)
         xfree(s);
     }
 
+    invalidate_ioreq_server_hints(d);
+
     spin_unlock_recursive(&d->arch.hvm.ioreq_server.lock);
 }
 
 struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
                                                  ioreq_t *p)
 {
+    struct hvm_ioreq_server_hint *hint =
+        &current->arch.hvm.hvm_io.ioreq_server_hint;
     struct hvm_ioreq_server *s;
     uint32_t cf8;
     uint8_t type;
-    uint64_t addr;
-    unsigned int id;
+    uint64_t addr, start, end;
+    unsigned int id, generation;
+
+    ASSERT(d == current->domain);
 
     if ( p->type != IOREQ_TYPE_COPY && p->type != IOREQ_TYPE_PIO )
         return NULL;
@@ -1304,6 +1366,41 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
         addr = p->addr;
     }
 
+    switch ( type )
+    {
+    case XEN_DMOP_IO_RANGE_PORT:
+        start = addr;
+        end = start + p->size - 1;
+        break;
+
+    case XEN_DMOP_IO_RANGE_MEMORY:
+        start = hvm_mmio_first_byte(p);
+        end = hvm_mmio_last_byte(p);
+        break;
+
+    default:
+        ASSERT(type == XEN_DMOP_IO_RANGE_PCI);
+        start = end = addr >> 32;
+        break;
+    }
+
+    /*
+     * Re-use the previous selection if nothing has changed since it was
+     * made.  Pairs with the barrier in invalidate_ioreq_server_hints().
+     */
+    generation = read_atomic(&d->arch.hvm.ioreq_server.generation);
+    smp_rmb();
+
+    s = hint->server;
+    if ( s && hint->generation == generation && hint->type == type &&
+         hint->start == start && hint->end == end )
+    {
+        perfc_incr(ioreq_server_hint_hit);
+        goto found;
+    }
+
+    perfc_incr(ioreq_server_hint_miss);
+
     FOR_EACH_IOREQ_SERVER(d, id, s)
     {
         struct rangeset *r;
@@ -1315,43 +1412,87 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
 
         switch ( type )
         {
-            unsigned long start, end;
-
         case XEN_DMOP_IO_RANGE_PORT:
-            start = addr;
-            end = start + p->size - 1;
-            if ( rangeset_contains_range(r, start, end) )
-                return s;
-
-            break;
-
         case XEN_DMOP_IO_RANGE_MEMORY:
-            start = hvm_mmio_first_byte(p);
-            end = hvm_mmio_last_byte(p);
-
             if ( rangeset_contains_range(r, start, end) )
-                return s;
+                goto hit;
 
             break;
 
         case XEN_DMOP_IO_RANGE_PCI:
-            if ( rangeset_contains_singleton(r, addr >> 32) )
-            {
-                p->type = IOREQ_TYPE_PCI_CONFIG;
-                p->addr = addr;
-                return s;
-            }
+            if ( rangeset_contains_singleton(r, start) )
+                goto hit;
 
             break;
         }
     }
 
     return NULL;
+
+ hit:
+    hint->generation = generation;
+    hint->type = type;
+    hint->start = start;
+    hint->end = end;
+    hint->server = s;
+
+ found:
+    if ( type == XEN_DMOP_IO_RANGE_PCI )
+    {
+        p->type = IOREQ_TYPE_PCI_CONFIG;
+        p->addr = addr;
+    }
+
+    return s;
+}
+
+/*
+ * Publish @nr buffered ring slots filled in beyond write_pointer and kick
+ * the emulator if necessary.  Must be called with bufioreq_lock held.
+ */
+static void hvm_commit_buffered_ioreqs(struct hvm_ioreq_server *s,
+                                       unsigned int nr)
+{
+    buffered_iopage_t *pg = s->bufioreq.va;
+    unsigned int wp = pg->ptrs.write_pointer, i = 0;
+    bool notify = true;
+
+    /* Make the buf_ioreq_t-s visible /before/ write_pointer. */
+    smp_wmb();
+    pg->ptrs.write_pointer = wp + nr;
+
+    /*
+     * An emulator which opted into posted writes re-checks write_pointer
+     * after publishing read_pointer, so it only needs an event if it had
+     * caught up with everything queued before this batch.
+     */
+    if ( s->bufioreq_posted )
+    {
+        smp_mb();
+        notify = read_atomic(&pg->ptrs.read_pointer) == wp;
+    }
+
+    /* Canonicalize read/write pointers to prevent their overflow. */
+    while ( (s->bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC) &&
+            i++ < IOREQ_BUFFER_SLOT_NUM &&
+            pg->ptrs.read_pointer >= IOREQ_BUFFER_SLOT_NUM )
+    {
+        union bufioreq_pointers old = pg->ptrs, new;
+        unsigned int n = old.read_pointer / IOREQ_BUFFER_SLOT_NUM;
+
+        new.read_pointer = old.read_pointer - n * IOREQ_BUFFER_SLOT_NUM;
+        new.write_pointer = old.write_pointer - n * IOREQ_BUFFER_SLOT_NUM;
+        cmpxchg(&pg->ptrs.full, old.full, new.full);
+    }
+
+    if ( notify )
+        notify_via_xen_event_channel(s->target, s->bufioreq_evtchn);
+    else
+        perfc_incr(bufioreq_notify_suppressed);
 }
 
 static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
 {
-    struct domain *d = current->domain;
     struct hvm_ioreq_page *iorp;
     buffered_iopage_t *pg;
     buf_ioreq_t bp = { .data = p->data,
@@ -1419,26 +1560,123 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
         pg->buf_ioreq[(pg->ptrs.write_pointer+1) % IOREQ_BUFFER_SLOT_NUM] = bp;
     }
 
-    /* Make the ioreq_t visible /before/ write_pointer. */
-    smp_wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    hvm_commit_buffered_ioreqs(s, qw ? 2 : 1);
+    spin_unlock(&s->bufioreq_lock);
 
-    /* Canonicalize read/write pointers to prevent their overflow. */
-    while ( (s->bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC) &&
-            qw++ < IOREQ_BUFFER_SLOT_NUM &&
-            pg->ptrs.read_pointer >= IOREQ_BUFFER_SLOT_NUM )
+    return X86EMUL_OKAY;
+}
+
+static bool hvm_ioreq_is_posted(const struct hvm_ioreq_server *s,
+                                const ioreq_t *p)
+{
+    if ( !s->bufioreq_posted || p->dir != IOREQ_WRITE )
+        return false;
+
+    switch ( p->type )
     {
-        union bufioreq_pointers old = pg->ptrs, new;
-        unsigned int n = old.read_pointer / IOREQ_BUFFER_SLOT_NUM;
+    case IOREQ_TYPE_PIO:
+        return rangeset_contains_range(s->posted[XEN_DMOP_IO_RANGE_PORT],
+                                       p->addr, p->addr + p->size - 1);
+
+    case IOREQ_TYPE_COPY:
+        return rangeset_contains_range(s->posted[XEN_DMOP_IO_RANGE_MEMORY],
+                                       hvm_mmio_first_byte(p),
+                                       hvm_mmio_last_byte(p));
+    }
 
-        new.read_pointer = old.read_pointer - n * IOREQ_BUFFER_SLOT_NUM;
-        new.write_pointer = old.write_pointer - n * IOREQ_BUFFER_SLOT_NUM;
-        cmpxchg(&pg->ptrs.full, old.full, new.full);
+    return false;
+}
+
+/* REP iterations with data in guest memory queued in one go. */
+#define POSTED_MAX_DATA_REPS 32
+
+/*
+ * Queue a write, including all of its REP iterations, to a posted range on
+ * the buffered ring.  Returns X86EMUL_UNHANDLEABLE, leaving the caller to
+ * send a synchronous request instead, if it can't be queued as a whole.
+ */
+static int hvm_send_posted_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
+{
+    buffered_iopage_t *pg = s->bufioreq.va;
+    uint64_t buf[POSTED_MAX_DATA_REPS];
+    int step = p->df ? -p->size : p->size;
+    unsigned int i, wp, size;
+
+    BUILD_BUG_ON(sizeof(struct buf_ioreq_ext) != sizeof(buf_ioreq_t));
+
+    if ( !pg || p->count > IOREQ_BUFFER_SLOT_NUM / 2 ||
+         (p->data_is_ptr && p->count > ARRAY_SIZE(buf)) )
+        return X86EMUL_UNHANDLEABLE;
+
+    switch ( p->size )
+    {
+    case 1: size = 0; break;
+    case 2: size = 1; break;
+    case 4: size = 2; break;
+    case 8: size = 3; break;
+    default:
+        return X86EMUL_UNHANDLEABLE;
     }
 
-    notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    /*
+     * Fetch the data before taking bufioreq_lock, so as not to nest the p2m
+     * and paging locks inside it.
+     */
+    for ( i = 0; p->data_is_ptr && i < p->count; i++ )
+    {
+        buf[i] = 0;
+        switch ( hvm_copy_from_guest_phys(&buf[i], p->data + step * (int)i,
+                                          p->size) )
+        {
+        case HVMTRANS_okay:
+            break;
+        case HVMTRANS_bad_gfn_to_mfn:
+            buf[i] = ~0;
+            break;
+        default:
+            return X86EMUL_UNHANDLEABLE;
+        }
+    }
+
+    spin_lock(&s->bufioreq_lock);
+
+    wp = pg->ptrs.write_pointer;
+    if ( (wp - pg->ptrs.read_pointer) > (IOREQ_BUFFER_SLOT_NUM - 2 * p->count) )
+    {
+        spin_unlock(&s->bufioreq_lock);
+        return X86EMUL_UNHANDLEABLE;
+    }
+
+    /* Fill the slots first; nothing is visible until the commit below. */
+    for ( i = 0; i < p->count; i++ )
+    {
+        uint64_t addr = p->addr, data = p->data;
+        buf_ioreq_t bp = { .type = p->type,
+                           .pad = 1,
+                           .dir = IOREQ_WRITE,
+                           .size = size };
+        struct buf_ioreq_ext *ext;
+
+        if ( p->type == IOREQ_TYPE_COPY )
+            addr += step * (int)i;
+
+        if ( p->data_is_ptr )
+            data = buf[i];
+
+        bp.addr = addr & 0xfffff;
+        bp.data = data;
+        pg->buf_ioreq[wp++ % IOREQ_BUFFER_SLOT_NUM] = bp;
+
+        ext = (void *)&pg->buf_ioreq[wp++ % IOREQ_BUFFER_SLOT_NUM];
+        ext->addr_hi = addr >> 20;
+        ext->data_hi = data >> 32;
+    }
+
+    hvm_commit_buffered_ioreqs(s, 2 * p->count);
     spin_unlock(&s->bufioreq_lock);
 
+    perfc_add(ioreq_posted_writes, p->count);
+
     return X86EMUL_OKAY;
 }
 
@@ -1454,6 +1692,10 @@ int hvm_send_ioreq(struct hvm_ioreq_server *s, ioreq_t *proto_p,
     if ( buffered )
         return hvm_send_buffered_ioreq(s, proto_p);
 
+    if ( hvm_ioreq_is_posted(s, proto_p) &&
+         hvm_send_posted_ioreq(s, proto_p) == X86EMUL_OKAY )
+        return X86EMUL_OKAY;
+
     if ( unlikely(!vcpu_start_shutdown_deferral(curr)) )
         return X86EMUL_RETRY;
 
@@ -530,14 +530,18 @@ static bool_t stdvga_mem_accept(const struct hvm_io_handler *handler,
 
     spin_lock(&s->lock);
 
-    if ( p->dir == IOREQ_WRITE && p->count > 1 )
+    if ( p->dir == IOREQ_WRITE && p->count > 1 &&
+         (!p->data_is_ptr || !s->bounce ||
+          !stdvga_cache_is_enabled(s) || !s->stdvga) )
     {
         /*
          * We cannot return X86EMUL_UNHANDLEABLE on anything other then the
          * first cycle of an I/O. So, since we cannot guarantee to always be
          * able to send buffered writes, we have to reject any multi-cycle
          * I/O and, since we are rejecting an I/O, we must invalidate the
-         * cache.
+         * cache.  The exception are bulk (REP MOVS) writes, which get
+         * applied to the cache and then forwarded as a whole (see
+         * stdvga_mem_rep()).
          * Single-cycle write transactions are accepted even if the cache is
          * not active since we can assert, when in stdvga mode, that writes
          * to VRAM have no side effect and thus we can try to buffer them.
@@ -547,7 +551,9 @@ static bool_t stdvga_mem_accept(const struct hvm_io_handler *handler,
         goto reject;
     }
     else if ( p->dir == IOREQ_READ &&
-              (!stdvga_cache_is_enabled(s) || !s->stdvga) )
+              (!stdvga_cache_is_enabled(s) || !s->stdvga ||
+               /* Bulk reads need the bounce buffer as well. */
+               (p->count > 1 && p->data_is_ptr && !s->bounce)) )
         goto reject;
 
     /* s->lock intentionally held */
@@ -565,11 +571,78 @@ static void stdvga_mem_complete(const struct hvm_io_handler *handler)
     spin_unlock(&s->lock);
 }
 
+/*
+ * Handle a whole REP MOVS to or from VRAM in one step, in chunks of the
+ * bounce buffer's size.  Reps are processed in their architectural order, as
+ * reads update the latch.  Writes, having been applied to the cache, get
+ * forwarded to the device model as a single request.
+ */
+static int stdvga_mem_rep(const struct hvm_io_handler *handler, ioreq_t *p)
+{
+    struct hvm_hw_stdvga *s = &current->domain->arch.hvm.stdvga;
+    unsigned int size = p->size, n, i, j, off;
+    unsigned long done;
+    int step = p->df ? -size : size;
+    paddr_t ram;
+
+    for ( done = 0; done < p->count; done += n )
+    {
+        n = min_t(unsigned long, p->count - done, PAGE_SIZE / size);
+        ram = p->df ? p->data - (done + n - 1) * size : p->data + done * size;
+
+        if ( p->dir == IOREQ_WRITE )
+        {
+            switch ( hvm_copy_from_guest_phys(s->bounce, ram, n * size) )
+            {
+            case HVMTRANS_okay:
+                break;
+            case HVMTRANS_bad_gfn_to_mfn:
+                memset(s->bounce, 0xff, n * size);
+                break;
+            default:
+                domain_crash(current->domain);
+                return X86EMUL_UNHANDLEABLE;
+            }
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            uint64_t addr = p->addr + step * (long)(done + i);
+
+            off = (p->df ? n - 1 - i : i) * size;
+            for ( j = 0; j < size; j++ )
+                if ( p->dir == IOREQ_WRITE )
+                    stdvga_mem_writeb(addr + j, s->bounce[off + j]);
+                else
+                    s->bounce[off + j] = stdvga_mem_readb(addr + j);
+        }
+
+        if ( p->dir == IOREQ_READ )
+        {
+            switch ( hvm_copy_to_guest_phys(ram, s->bounce, n * size,
+                                            current) )
+            {
+            case HVMTRANS_okay:
+            case HVMTRANS_bad_gfn_to_mfn:
+                /* Drop the write as real hardware would. */
+                break;
+            default:
+                domain_crash(current->domain);
+                return X86EMUL_UNHANDLEABLE;
+            }
+        }
+    }
+
+    /* Have the device model see the writes as a single request. */
+    return p->dir == IOREQ_WRITE ? X86EMUL_UNHANDLEABLE : X86EMUL_OKAY;
+}
+
 static const struct hvm_io_ops stdvga_mem_ops = {
     .accept = stdvga_mem_accept,
     .read = stdvga_mem_read,
     .write = stdvga_mem_write,
-    .complete = stdvga_mem_complete
+    .complete = stdvga_mem_complete,
+    .rep = stdvga_mem_rep,
 };
 
 void stdvga_init(struct domain *d)
@@ -593,6 +666,9 @@ void stdvga_init(struct domain *d)
         clear_domain_page(page_to_mfn(pg));
     }
 
+    /* Without a bounce buffer bulk transfers simply get rejected. */
+    s->bounce = xmalloc_bytes(PAGE_SIZE);
+
     if ( i == ARRAY_SIZE(s->vram_page) )
     {
         struct hvm_io_handler *handler;
@@ -628,6 +704,8 @@ void stdvga_deinit(struct domain *d)
         free_domheap_page(s->vram_page[i]);
         s->vram_page[i] = NULL;
     }
+
+    XFREE(s->bounce);
 }
 
 /*
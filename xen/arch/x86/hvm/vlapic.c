@@ -207,72 +207,6 @@ uint32_t vlapic_set_ppr(struct vlapic *vlapic)
    return ppr;
 }
 
-static bool_t vlapic_match_logical_addr(const struct vlapic *vlapic,
-                                        uint32_t mda)
-{
-    bool_t result = 0;
-    uint32_t logical_id = vlapic_get_reg(vlapic, APIC_LDR);
-
-    if ( vlapic_x2apic_mode(vlapic) )
-        return ((logical_id >> 16) == (mda >> 16)) &&
-               (uint16_t)(logical_id & mda);
-
-    logical_id = GET_xAPIC_LOGICAL_ID(logical_id);
-    mda = (uint8_t)mda;
-
-    switch ( vlapic_get_reg(vlapic, APIC_DFR) )
-    {
-    case APIC_DFR_FLAT:
-        if ( logical_id & mda )
-            result = 1;
-        break;
-    case APIC_DFR_CLUSTER:
-        if ( ((logical_id >> 4) == (mda >> 0x4)) && (logical_id & mda & 0xf) )
-            result = 1;
-        break;
-    default:
-        printk(XENLOG_G_WARNING "%pv: bad LAPIC DFR value %08x\n",
-               const_vlapic_vcpu(vlapic),
-               vlapic_get_reg(vlapic, APIC_DFR));
-        break;
-    }
-
-    return result;
-}
-
-bool_t vlapic_match_dest(
-    const struct vlapic *target, const struct vlapic *source,
-    int short_hand, uint32_t dest, bool_t dest_mode)
-{
-    HVM_DBG_LOG(DBG_LEVEL_VLAPIC, "target %p, source %p, dest %#x, "
-                "dest_mode %#x, short_hand %#x",
-                target, source, dest, dest_mode, short_hand);
-
-    switch ( short_hand )
-    {
-    case APIC_DEST_NOSHORT:
-        if ( dest_mode )
-            return vlapic_match_logical_addr(target, dest);
-        return (dest == _VLAPIC_ID(target, 0xffffffff)) ||
-               (dest == VLAPIC_ID(target));
-
-    case APIC_DEST_SELF:
-        return (target == source);
-
-    case APIC_DEST_ALLINC:
-        return 1;
-
-    case APIC_DEST_ALLBUT:
-        return (target != source);
-
-    default:
-        gdprintk(XENLOG_WARNING, "Bad dest shorthand value %x\n", short_hand);
-        break;
-    }
-
-    return 0;
-}
-
 static void vlapic_init_sipi_one(struct vcpu *target, uint32_t icr)
 {
     vcpu_pause(target);
@@ -393,21 +327,49 @@ struct vlapic *vlapic_lowest_prio(
     uint32_t ppr, target_ppr = UINT_MAX;
     struct vlapic *vlapic, *target = NULL;
     struct vcpu *v;
+    unsigned int first, mask, pass;
 
     if ( unlikely(!d->vcpu) || unlikely((v = d->vcpu[old]) == NULL) )
         return NULL;
 
-    do {
-        v = v->next_in_list ? : d->vcpu[0];
-        vlapic = vcpu_vlapic(v);
-        if ( vlapic_match_dest(vlapic, source, short_hand, dest, dest_mode) &&
-             vlapic_enabled(vlapic) &&
-             ((ppr = vlapic_get_ppr(vlapic)) < target_ppr) )
+    if ( vlapic_dest_candidates(d, source, short_hand, dest, dest_mode,
+                                &first, &mask) )
+    {
+        /* Same order as below: the vCPUs after 'old' first, then the rest. */
+        for ( pass = 0; pass < 2; pass++ )
         {
-            target = vlapic;
-            target_ppr = ppr;
+            unsigned int m = mask;
+
+            while ( (v = vlapic_next_candidate(d, first, &m)) != NULL )
+            {
+                vlapic = vcpu_vlapic(v);
+                if ( (v->vcpu_id > old) == !pass &&
+                     vlapic_match_dest(vlapic, source, short_hand, dest,
+                                       dest_mode) &&
+                     vlapic_enabled(vlapic) &&
+                     ((ppr = vlapic_get_ppr(vlapic)) < target_ppr) )
+                {
+                    target = vlapic;
+                    target_ppr = ppr;
+                }
+            }
         }
-    } while ( v->vcpu_id != old );
+    }
+    else
+    {
+        do {
+            v = v->next_in_list ? : d->vcpu[0];
+            vlapic = vcpu_vlapic(v);
+            if ( vlapic_match_dest(vlapic, source, short_hand, dest,
+                                   dest_mode) &&
+                 vlapic_enabled(vlapic) &&
+                 ((ppr = vlapic_get_ppr(vlapic)) < target_ppr) )
+            {
+                target = vlapic;
+                target_ppr = ppr;
+            }
+        } while ( v->vcpu_id != old );
+    }
 
     if ( target != NULL )
         hvm_domain_irq(d)->round_robin_prev_vcpu =
@@ -534,16 +496,27 @@ void vlapic_ipi(
         }
         /* fall through */
     default: {
+        const struct domain *d = vlapic_domain(vlapic);
         struct vcpu *v;
         bool_t batch = is_multicast_dest(vlapic, short_hand, dest, dest_mode);
+        unsigned int first, mask;
 
         if ( batch )
             cpu_raise_softirq_batch_begin();
-        for_each_vcpu ( vlapic_domain(vlapic), v )
+        if ( vlapic_dest_candidates(d, vlapic, short_hand, dest, dest_mode,
+                                    &first, &mask) )
         {
-            if ( vlapic_match_dest(vcpu_vlapic(v), vlapic,
-                                   short_hand, dest, dest_mode) )
-                vlapic_accept_irq(v, icr_low);
+            while ( (v = vlapic_next_candidate(d, first, &mask)) != NULL )
+                if ( vlapic_match_dest(vcpu_vlapic(v), vlapic,
+                                       short_hand, dest, dest_mode) )
+                    vlapic_accept_irq(v, icr_low);
+        }
+        else
+        {
+            for_each_vcpu ( d, v )
+                if ( vlapic_match_dest(vcpu_vlapic(v), vlapic,
+                                       short_hand, dest, dest_mode) )
+                    vlapic_accept_irq(v, icr_low);
         }
         if ( batch )
             cpu_raise_softirq_batch_finish();
@@ -785,6 +758,7 @@ void vlapic_reg_write(struct vcpu *v, unsigned int reg, uint32_t val)
     {
     case APIC_ID:
         vlapic_set_reg(vlapic, APIC_ID, val);
+        vlapic_update_dest_map(vlapic);
         break;
 
     case APIC_TASKPRI:
@@ -797,6 +771,7 @@ void vlapic_reg_write(struct vcpu *v, unsigned int reg, uint32_t val)
 
     case APIC_LDR:
         vlapic_set_reg(vlapic, APIC_LDR, val & APIC_LDR_MASK);
+        vlapic_update_dest_map(vlapic);
         break;
 
     case APIC_DFR:
@@ -1066,10 +1041,9 @@ static const struct hvm_mmio_ops vlapic_mmio_ops = {
 static void set_x2apic_id(struct vlapic *vlapic)
 {
     u32 id = vlapic_vcpu(vlapic)->vcpu_id;
-    u32 ldr = ((id & ~0xf) << 12) | (1 << (id & 0xf));
 
     vlapic_set_reg(vlapic, APIC_ID, id * 2);
-    vlapic_set_reg(vlapic, APIC_LDR, ldr);
+    vlapic_set_reg(vlapic, APIC_LDR, VLAPIC_X2APIC_LDR(id));
 }
 
 int guest_wrmsr_apic_base(struct vcpu *v, uint64_t value)
@@ -1155,6 +1129,7 @@ int guest_wrmsr_apic_base(struct vcpu *v, uint64_t value)
 
     if ( vlapic_x2apic_mode(vlapic) )
         set_x2apic_id(vlapic);
+    vlapic_update_dest_map(vlapic);
 
     vmx_vlapic_msr_changed(vlapic_vcpu(vlapic));
 
@@ -1408,6 +1383,8 @@ static void vlapic_do_init(struct vlapic *vlapic)
     vlapic_set_reg(vlapic, APIC_SPIV, 0xff);
     vlapic->hw.disabled |= VLAPIC_SW_DISABLED;
 
+    vlapic_update_dest_map(vlapic);
+
     TRACE_0D(TRC_HVM_EMUL_LAPIC_STOP_TIMER);
     destroy_periodic_time(&vlapic->pt);
 }
@@ -1504,6 +1481,8 @@ static void lapic_load_fixup(struct vlapic *vlapic)
         vlapic_set_reg(vlapic, APIC_ID, id);
         vlapic_set_reg(vlapic, APIC_LDR, vlapic->loaded.ldr);
     }
+
+    vlapic_update_dest_map(vlapic);
 }
 
 static int lapic_load_hidden(struct domain *d, hvm_domain_context_t *h)
@@ -1640,6 +1619,11 @@ void vlapic_destroy(struct vcpu *v)
     tasklet_kill(&vlapic->init_sipi.tasklet);
     TRACE_0D(TRC_HVM_EMUL_LAPIC_STOP_TIMER);
     destroy_periodic_time(&vlapic->pt);
+    if ( vlapic->custom_id )
+        atomic_dec(&v->domain->arch.hvm.nr_vlapic_custom_id);
+    if ( vlapic->custom_ldr )
+        atomic_dec(&v->domain->arch.hvm.nr_vlapic_custom_ldr);
+    vlapic->custom_id = vlapic->custom_ldr = false;
     unmap_domain_page_global(vlapic->regs);
     free_domheap_page(vlapic->regs_page);
 }
@@ -0,0 +1,200 @@
+/*
+ * vlapic_dest.c: vLAPIC interrupt destination matching.
+ *
+ * Matching a destination against every vCPU makes each IPI and MSI cost
+ * O(vCPUs), which adds up quickly in large guests.  Unless the guest
+ * rewrote them, APIC IDs and x2APIC LDRs are derived from the vCPU ID, so
+ * for guests using that layout the vCPUs a destination can match can be
+ * worked out directly.  The domain keeps count of the vLAPICs that deviate
+ * from it, and destinations are resolved by a full scan while any do.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <asm/apic.h>
+#include <asm/atomic.h>
+#include <asm/hvm/support.h>
+#include <asm/hvm/vlapic.h>
+
+static bool_t vlapic_match_logical_addr(const struct vlapic *vlapic,
+                                        uint32_t mda)
+{
+    bool_t result = 0;
+    uint32_t logical_id = vlapic_get_reg(vlapic, APIC_LDR);
+
+    if ( vlapic_x2apic_mode(vlapic) )
+        return ((logical_id >> 16) == (mda >> 16)) &&
+               (uint16_t)(logical_id & mda);
+
+    logical_id = GET_xAPIC_LOGICAL_ID(logical_id);
+    mda = (uint8_t)mda;
+
+    switch ( vlapic_get_reg(vlapic, APIC_DFR) )
+    {
+    case APIC_DFR_FLAT:
+        if ( logical_id & mda )
+            result = 1;
+        break;
+    case APIC_DFR_CLUSTER:
+        if ( ((logical_id >> 4) == (mda >> 0x4)) && (logical_id & mda & 0xf) )
+            result = 1;
+        break;
+    default:
+        printk(XENLOG_G_WARNING "%pv: bad LAPIC DFR value %08x\n",
+               const_vlapic_vcpu(vlapic),
+               vlapic_get_reg(vlapic, APIC_DFR));
+        break;
+    }
+
+    return result;
+}
+
+bool_t vlapic_match_dest(
+    const struct vlapic *target, const struct vlapic *source,
+    int short_hand, uint32_t dest, bool_t dest_mode)
+{
+    HVM_DBG_LOG(DBG_LEVEL_VLAPIC, "target %p, source %p, dest %#x, "
+                "dest_mode %#x, short_hand %#x",
+                target, source, dest, dest_mode, short_hand);
+
+    switch ( short_hand )
+    {
+    case APIC_DEST_NOSHORT:
+        if ( dest_mode )
+            return vlapic_match_logical_addr(target, dest);
+        return (dest == _VLAPIC_ID(target, 0xffffffff)) ||
+               (dest == VLAPIC_ID(target));
+
+    case APIC_DEST_SELF:
+        return (target == source);
+
+    case APIC_DEST_ALLINC:
+        return 1;
+
+    case APIC_DEST_ALLBUT:
+        return (target != source);
+
+    default:
+        gdprintk(XENLOG_WARNING, "Bad dest shorthand value %x\n", short_hand);
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * Re-evaluate whether a vLAPIC uses the APIC ID and x2APIC LDR derived from
+ * its vCPU ID.  Needs calling whenever either register or the x2APIC mode
+ * changes, by the vCPU itself or with it paused.
+ */
+void vlapic_update_dest_map(struct vlapic *vlapic)
+{
+    const struct vcpu *v = vlapic_vcpu(vlapic);
+    struct domain *d = v->domain;
+    bool custom_id = VLAPIC_ID(vlapic) != v->vcpu_id * 2;
+    bool custom_ldr = !vlapic_x2apic_mode(vlapic) ||
+                      vlapic_get_reg(vlapic, APIC_LDR) !=
+                      VLAPIC_X2APIC_LDR(v->vcpu_id);
+
+    if ( custom_id != vlapic->custom_id )
+    {
+        vlapic->custom_id = custom_id;
+        if ( custom_id )
+            atomic_inc(&d->arch.hvm.nr_vlapic_custom_id);
+        else
+            atomic_dec(&d->arch.hvm.nr_vlapic_custom_id);
+    }
+
+    if ( custom_ldr != vlapic->custom_ldr )
+    {
+        vlapic->custom_ldr = custom_ldr;
+        if ( custom_ldr )
+            atomic_inc(&d->arch.hvm.nr_vlapic_custom_ldr);
+        else
+            atomic_dec(&d->arch.hvm.nr_vlapic_custom_ldr);
+    }
+}
+
+/*
+ * Work out which vCPUs a destination can possibly match.  Returns false if
+ * every vCPU needs checking.  Otherwise the candidates are the vCPUs with
+ * IDs *first + n for every bit n set in *mask, to be fetched with
+ * vlapic_next_candidate(), and still to be checked with vlapic_match_dest().
+ */
+bool vlapic_dest_candidates(
+    const struct domain *d, const struct vlapic *source,
+    int short_hand, uint32_t dest, bool_t dest_mode,
+    unsigned int *first, unsigned int *mask)
+{
+    switch ( short_hand )
+    {
+    case APIC_DEST_NOSHORT:
+        break;
+
+    case APIC_DEST_SELF:
+        *first = const_vlapic_vcpu(source)->vcpu_id;
+        *mask = 1;
+        return true;
+
+    default:
+        return false;
+    }
+
+    if ( !dest_mode )
+    {
+        /* Broadcasts, to all xAPIC or all x2APIC mode vLAPICs respectively. */
+        if ( dest == 0xff || dest == 0xffffffff ||
+             atomic_read(&d->arch.hvm.nr_vlapic_custom_id) )
+            return false;
+
+        /* APIC IDs are even, odd IDs can't match anything. */
+        *first = dest / 2;
+        *mask = !(dest & 1);
+        return true;
+    }
+
+    /* xAPIC mode logical destinations depend on the guest's LDR and DFR. */
+    if ( atomic_read(&d->arch.hvm.nr_vlapic_custom_ldr) )
+        return false;
+
+    /* x2APIC cluster in bits 31:16, one bit per cluster member in 15:0. */
+    *first = (dest >> 16) * 16;
+    *mask = (uint16_t)dest;
+    return true;
+}
+
+struct vcpu *vlapic_next_candidate(const struct domain *d, unsigned int first,
+                                   unsigned int *mask)
+{
+    while ( *mask )
+    {
+        unsigned int id = first + ffs(*mask) - 1;
+
+        *mask &= *mask - 1;
+        if ( id < d->max_vcpus && d->vcpu[id] )
+            return d->vcpu[id];
+    }
+
+    return NULL;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
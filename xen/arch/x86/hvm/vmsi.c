@@ -69,6 +69,7 @@ int vmsi_deliver(
 {
     struct vlapic *target;
     struct vcpu *v;
+    unsigned int first, mask;
 
     switch ( delivery_mode )
     {
@@ -84,6 +85,17 @@ int vmsi_deliver(
         return -ESRCH;
 
     case dest_Fixed:
+        if ( vlapic_dest_candidates(d, NULL, 0, dest, dest_mode,
+                                    &first, &mask) )
+        {
+            while ( (v = vlapic_next_candidate(d, first, &mask)) != NULL )
+                if ( vlapic_match_dest(vcpu_vlapic(v), NULL,
+                                       0, dest, dest_mode) )
+                    vmsi_inj_irq(vcpu_vlapic(v), vector,
+                                 trig_mode, delivery_mode);
+            break;
+        }
+
         for_each_vcpu ( d, v )
             if ( vlapic_match_dest(vcpu_vlapic(v), NULL,
                                    0, dest, dest_mode) )
@@ -3,6 +3,13 @@
  *
  * Copyright (c) 2006, Xiaowei Yang, Intel Corporation.
  *
+ * Each vCPU keeps its active timers on tm_list, sorted with the timers
+ * having interrupts pending first, followed by the rest in order of their
+ * next deadline.  A single Xen timer per vCPU is armed for the earliest of
+ * those deadlines.  VM entry only needs to look at the head of the list,
+ * and missed ticks get accounted lazily: when an interrupt gets acknowledged,
+ * or when timers stopped by pt_save_timer() get restarted.
+ *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms and conditions of the GNU General Public License,
  * version 2, as published by the Free Software Foundation.
@@ -16,6 +23,7 @@
  * this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <xen/perfc.h>
 #include <xen/time.h>
 #include <asm/hvm/support.h>
 #include <asm/hvm/vpt.h>
@@ -171,6 +179,70 @@ static void pt_unlock(struct periodic_time *pt)
     spin_unlock(&pt->vcpu->arch.hvm.tm_lock);
 }
 
+/* Insert a timer on its vCPU's list, keeping the list sorted. */
+static void pt_insert(struct periodic_time *pt)
+{
+    struct list_head *head = &pt->vcpu->arch.hvm.tm_list, *pos;
+
+    ASSERT(spin_is_locked(&pt->vcpu->arch.hvm.tm_lock));
+
+    if ( pt->pending_intr_nr )
+    {
+        list_add(&pt->list, head);
+        return;
+    }
+
+    list_for_each ( pos, head )
+    {
+        const struct periodic_time *p = list_entry(pos, struct periodic_time,
+                                                   list);
+
+        if ( !p->pending_intr_nr && p->scheduled > pt->scheduled )
+            break;
+    }
+    list_add_tail(&pt->list, pos);
+}
+
+/* (Re)program the vCPU's timer for the earliest deadline still to expire. */
+static void pt_arm(struct vcpu *v)
+{
+    struct periodic_time *pt;
+
+    ASSERT(spin_is_locked(&v->arch.hvm.tm_lock));
+
+    list_for_each_entry ( pt, &v->arch.hvm.tm_list, list )
+    {
+        if ( pt->pending_intr_nr ||
+             (v->arch.hvm.tm_frozen && !pt->do_not_freeze) )
+            continue;
+
+        if ( pt->scheduled != v->arch.hvm.tm_deadline )
+        {
+            perfc_incr(vpt_timer_set);
+            v->arch.hvm.tm_deadline = pt->scheduled;
+            set_timer(&v->arch.hvm.tm_timer, pt->scheduled);
+        }
+        return;
+    }
+
+    if ( v->arch.hvm.tm_deadline )
+    {
+        v->arch.hvm.tm_deadline = 0;
+        stop_timer(&v->arch.hvm.tm_timer);
+    }
+}
+
+/* Re-sort a timer after its deadline or pending count changed. */
+static void pt_requeue(struct periodic_time *pt)
+{
+    if ( !pt->on_list )
+        return;
+
+    list_del(&pt->list);
+    pt_insert(pt);
+    pt_arm(pt->vcpu);
+}
+
 static void pt_process_missed_ticks(struct periodic_time *pt)
 {
     s_time_t missed_ticks, now = NOW();
@@ -212,17 +284,14 @@ static void pt_thaw_time(struct vcpu *v)
 
 void pt_save_timer(struct vcpu *v)
 {
-    struct list_head *head = &v->arch.hvm.tm_list;
-    struct periodic_time *pt;
-
     if ( v->pause_flags & VPF_blocked )
         return;
 
     spin_lock(&v->arch.hvm.tm_lock);
 
-    list_for_each_entry ( pt, head, list )
-        if ( !pt->do_not_freeze )
-            stop_timer(&pt->timer);
+    /* Only timers marked do_not_freeze keep running. */
+    v->arch.hvm.tm_frozen = true;
+    pt_arm(v);
 
     pt_freeze_time(v);
 
@@ -231,20 +300,32 @@ void pt_save_timer(struct vcpu *v)
 
 void pt_restore_timer(struct vcpu *v)
 {
-    struct list_head *head = &v->arch.hvm.tm_list;
-    struct periodic_time *pt;
+    struct periodic_time *pt, *temp;
+    LIST_HEAD(armed);
+
+    /*
+     * Only pt_save_timer() stops timers.  While they run, expiries get
+     * noticed by pt_timer_fn() and later ones by pt_irq_fired().
+     */
+    if ( !v->arch.hvm.tm_frozen )
+        return;
 
     spin_lock(&v->arch.hvm.tm_lock);
 
-    list_for_each_entry ( pt, head, list )
+    list_for_each_entry_safe ( pt, temp, &v->arch.hvm.tm_list, list )
+        if ( !pt->pending_intr_nr )
+            list_move_tail(&pt->list, &armed);
+
+    list_for_each_entry_safe ( pt, temp, &armed, list )
     {
-        if ( pt->pending_intr_nr == 0 )
-        {
-            pt_process_missed_ticks(pt);
-            set_timer(&pt->timer, pt->scheduled);
-        }
+        list_del(&pt->list);
+        pt_process_missed_ticks(pt);
+        pt_insert(pt);
     }
 
+    v->arch.hvm.tm_frozen = false;
+    pt_arm(v);
+
     pt_thaw_time(v);
 
     spin_unlock(&v->arch.hvm.tm_lock);
@@ -252,17 +333,41 @@ void pt_restore_timer(struct vcpu *v)
 
 static void pt_timer_fn(void *data)
 {
-    struct periodic_time *pt = data;
+    struct vcpu *v = data;
+    struct list_head *head = &v->arch.hvm.tm_list;
+    struct periodic_time *pt, *temp;
+    s_time_t now = NOW();
+    bool kick = false;
 
-    pt_lock(pt);
+    perfc_incr(vpt_timer_fired);
 
-    pt->pending_intr_nr++;
-    pt->scheduled += pt->period;
-    pt->do_not_freeze = 0;
+    spin_lock(&v->arch.hvm.tm_lock);
 
-    vcpu_kick(pt->vcpu);
+    v->arch.hvm.tm_deadline = 0;
 
-    pt_unlock(pt);
+    list_for_each_entry_safe ( pt, temp, head, list )
+    {
+        if ( pt->pending_intr_nr ||
+             (v->arch.hvm.tm_frozen && !pt->do_not_freeze) )
+            continue;
+        if ( pt->scheduled > now )
+            break;
+
+        pt->pending_intr_nr++;
+        pt->scheduled += pt->period;
+        pt->do_not_freeze = 0;
+
+        /* Timers with pending interrupts sort first. */
+        list_move(&pt->list, head);
+        kick = true;
+    }
+
+    pt_arm(v);
+
+    spin_unlock(&v->arch.hvm.tm_lock);
+
+    if ( kick )
+        vcpu_kick(v);
 }
 
 static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
@@ -282,7 +387,7 @@ static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
         pt->last_plt_gtime = hvm_get_guest_time(v);
         pt_process_missed_ticks(pt);
         pt->pending_intr_nr = 0; /* 'collapse' all missed ticks */
-        set_timer(&pt->timer, pt->scheduled);
+        pt_requeue(pt);
     }
     else
     {
@@ -290,8 +395,7 @@ static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
         if ( --pt->pending_intr_nr == 0 )
         {
             pt_process_missed_ticks(pt);
-            if ( pt->pending_intr_nr == 0 )
-                set_timer(&pt->timer, pt->scheduled);
+            pt_requeue(pt);
         }
     }
 
@@ -314,24 +418,25 @@ int pt_update_irq(struct vcpu *v)
     max_lag = -1ULL;
     list_for_each_entry_safe ( pt, temp, head, list )
     {
-        if ( pt->pending_intr_nr )
+        /* Timers with pending interrupts sort first. */
+        if ( !pt->pending_intr_nr )
+            break;
+
+        /* RTC code takes care of disabling the timer itself. */
+        if ( (pt->irq != RTC_IRQ || !pt->priv) && pt_irq_masked(pt) &&
+             /* Level interrupts should be asserted even if masked. */
+             !pt->level )
         {
-            /* RTC code takes care of disabling the timer itself. */
-            if ( (pt->irq != RTC_IRQ || !pt->priv) && pt_irq_masked(pt) &&
-                 /* Level interrupts should be asserted even if masked. */
-                 !pt->level )
-            {
-                /* suspend timer emulation */
-                list_del(&pt->list);
-                pt->on_list = 0;
-            }
-            else
+            /* suspend timer emulation */
+            list_del(&pt->list);
+            pt->on_list = 0;
+        }
+        else
+        {
+            if ( (pt->last_plt_gtime + pt->period) < max_lag )
             {
-                if ( (pt->last_plt_gtime + pt->period) < max_lag )
-                {
-                    max_lag = pt->last_plt_gtime + pt->period;
-                    earliest_pt = pt;
-                }
+                max_lag = pt->last_plt_gtime + pt->period;
+                earliest_pt = pt;
             }
         }
     }
@@ -423,7 +528,9 @@ static struct periodic_time *is_pt_irq(
 
     list_for_each_entry ( pt, head, list )
     {
-        if ( pt->pending_intr_nr && pt->irq_issued &&
+        if ( !pt->pending_intr_nr )
+            break;
+        if ( pt->irq_issued &&
              (intack.vector == pt_irq_vector(pt, intack.source)) )
             return pt;
     }
@@ -462,15 +569,19 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
 
 void pt_migrate(struct vcpu *v)
 {
-    struct list_head *head = &v->arch.hvm.tm_list;
-    struct periodic_time *pt;
-
-    spin_lock(&v->arch.hvm.tm_lock);
+    migrate_timer(&v->arch.hvm.tm_timer, v->processor);
+}
 
-    list_for_each_entry ( pt, head, list )
-        migrate_timer(&pt->timer, v->processor);
+void pt_vcpu_init(struct vcpu *v)
+{
+    spin_lock_init(&v->arch.hvm.tm_lock);
+    INIT_LIST_HEAD(&v->arch.hvm.tm_list);
+    init_timer(&v->arch.hvm.tm_timer, pt_timer_fn, v, v->processor);
+}
 
-    spin_unlock(&v->arch.hvm.tm_lock);
+void pt_vcpu_destroy(struct vcpu *v)
+{
+    kill_timer(&v->arch.hvm.tm_timer);
 }
 
 void create_periodic_time(
@@ -534,10 +645,8 @@ void create_periodic_time(
     pt->priv = data;
 
     pt->on_list = 1;
-    list_add(&pt->list, &v->arch.hvm.tm_list);
-
-    init_timer(&pt->timer, pt_timer_fn, pt, v->processor);
-    set_timer(&pt->timer, pt->scheduled);
+    pt_insert(pt);
+    pt_arm(v);
 
     spin_unlock(&v->arch.hvm.tm_lock);
 }
@@ -553,13 +662,11 @@ void destroy_periodic_time(struct periodic_time *pt)
         list_del(&pt->list);
     pt->on_list = 0;
     pt->pending_intr_nr = 0;
-    pt_unlock(pt);
-
     /*
-     * pt_timer_fn() can run until this kill_timer() returns. We must do this
-     * outside pt_lock() otherwise we can deadlock with pt_timer_fn().
+     * The vCPU's timer may be left armed for this timer's deadline, in which
+     * case pt_timer_fn() finds nothing due and re-arms for the next one.
      */
-    kill_timer(&pt->timer);
+    pt_unlock(pt);
 }
 
 static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
@@ -583,9 +690,8 @@ static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
     if ( on_list )
     {
         pt->on_list = 1;
-        list_add(&pt->list, &v->arch.hvm.tm_list);
-
-        migrate_timer(&pt->timer, v->processor);
+        pt_insert(pt);
+        pt_arm(v);
     }
     spin_unlock(&v->arch.hvm.tm_lock);
 }
@@ -627,7 +733,7 @@ static void pt_resume(struct periodic_time *pt)
     if ( pt->pending_intr_nr && !pt->on_list )
     {
         pt->on_list = 1;
-        list_add(&pt->list, &pt->vcpu->arch.hvm.tm_list);
+        pt_insert(pt);
         vcpu_kick(pt->vcpu);
     }
     pt_unlock(pt);
@@ -3747,6 +3747,64 @@ long do_mmuext_op(
     return rc;
 }
 
+/*
+ * Guests typically update many entries of one L1 table in a single batch,
+ * e.g. when (un)mapping a range.  With the request at *i applied to the
+ * locked L1 table page at va, also apply the requests directly following it
+ * which target the same page, without dropping and re-taking the page
+ * reference, mapping and lock for each of them.  The run ends at the first
+ * request needing anything else (another page, command or XSM check), which
+ * is left to the generic path.  On return *i and *ureqs refer to the last
+ * request consumed, and the result of that request is returned.
+ */
+static int mmu_update_l1_run(
+    XEN_GUEST_HANDLE_PARAM(mmu_update_t) *ureqs, unsigned int *i,
+    unsigned int count, uint64_t ptr, void *va, unsigned long mfn,
+    uint32_t xsm_checked, struct vcpu *v, struct domain *pg_owner)
+{
+    struct mmu_update req;
+    unsigned int cmd;
+    int rc = 0;
+
+    while ( *i + 1 < count && !hypercall_preempt_check() )
+    {
+        uint32_t xsm_needed = xsm_checked | XSM_MMU_NORMAL_UPDATE;
+
+        if ( unlikely(__copy_from_guest_offset(&req, *ureqs, 1, 1) != 0) )
+            break;
+
+        cmd = req.ptr & (sizeof(l1_pgentry_t)-1);
+        if ( cmd != MMU_NORMAL_PT_UPDATE && cmd != MMU_PT_UPDATE_PRESERVE_AD &&
+             cmd != MMU_PT_UPDATE_NO_TRANSLATE )
+            break;
+
+        req.ptr -= cmd;
+        if ( (req.ptr ^ ptr) & PAGE_MASK )
+            break;
+
+        if ( get_pte_flags(req.val) & _PAGE_PRESENT )
+        {
+            xsm_needed |= XSM_MMU_UPDATE_READ;
+            if ( get_pte_flags(req.val) & _PAGE_RW )
+                xsm_needed |= XSM_MMU_UPDATE_WRITE;
+        }
+        if ( xsm_needed != xsm_checked )
+            break;
+
+        guest_handle_add_offset(*ureqs, 1);
+        ++*i;
+        perfc_incr(mmu_update_batched);
+
+        rc = mod_l1_entry(_p(((unsigned long)va & PAGE_MASK) +
+                             (req.ptr & ~PAGE_MASK)),
+                          l1e_from_intpte(req.val), mfn, cmd, v, pg_owner);
+        if ( rc )
+            break;
+    }
+
+    return rc;
+}
+
 long do_mmu_update(
     XEN_GUEST_HANDLE_PARAM(mmu_update_t) ureqs,
     unsigned int count,
@@ -3904,6 +3962,9 @@ long do_mmu_update(
                 case PGT_l1_page_table:
                     rc = mod_l1_entry(va, l1e_from_intpte(req.val), mfn,
                                       cmd, v, pg_owner);
+                    if ( !rc )
+                        rc = mmu_update_l1_run(&ureqs, &i, count, req.ptr, va,
+                                               mfn, xsm_checked, v, pg_owner);
                     break;
 
                 case PGT_l2_page_table:
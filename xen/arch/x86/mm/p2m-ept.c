@@ -1068,6 +1068,179 @@ static void ept_memory_type_changed(struct p2m_domain *p2m)
         ept_sync_domain(p2m);
 }
 
+/*
+ * Check whether the 512 entries of the given table could be replaced by a
+ * single superpage entry one level up: they all need to be present leaf
+ * entries of an ordinary RAM type mapping contiguous and suitably aligned
+ * memory, with identical attributes (ignoring A/D) and no re-calculation
+ * pending, and the effective memory type needs to be uniform across the
+ * range.  Returns the superpage entry to use in *new if so.
+ */
+static bool ept_coalesce_entries(struct p2m_domain *p2m,
+                                 const ept_entry_t *table,
+                                 unsigned int level, unsigned long gfn,
+                                 ept_entry_t *new)
+{
+    const ept_entry_t ad = { .a = 1, .d = 1 };
+    ept_entry_t first = atomic_read_ept_entry(&table[0]);
+    unsigned long trunk = 1UL << (level * EPT_TABLE_ORDER);
+    unsigned int i;
+    uint8_t ipat;
+
+    if ( !is_epte_valid(&first) || !is_epte_present(&first) ||
+         is_epte_superpage(&first) != (level > 0) ||
+         first.recalc || first.emt == MTRR_NUM_TYPES ||
+         (first.sa_p2mt != p2m_ram_rw && first.sa_p2mt != p2m_ram_ro) ||
+         (first.mfn & ((trunk << EPT_TABLE_ORDER) - 1)) )
+        return false;
+
+    for ( i = 1; i < EPT_PAGETABLE_ENTRIES; i++ )
+    {
+        ept_entry_t e = atomic_read_ept_entry(&table[i]);
+        ept_entry_t expect = first;
+
+        expect.mfn += i * trunk;
+        if ( (e.epte ^ expect.epte) & ~ad.epte )
+            return false;
+    }
+
+    if ( epte_get_entry_emt(p2m->domain, gfn, _mfn(first.mfn),
+                            (level + 1) * EPT_TABLE_ORDER, &ipat,
+                            0) != first.emt ||
+         ipat != first.ipat )
+        return false;
+
+    *new = first;
+    new->sp = 1;
+    ept_p2m_type_to_flags(p2m, new, new->sa_p2mt, new->access);
+
+    return true;
+}
+
+/*
+ * Account the leaf entries of the 1GiB region containing the given GFN,
+ * re-coalescing 2M and then 1G superpages first if requested.  Page tables
+ * no longer in use are freed once stale translations have been flushed.
+ */
+static int ept_superpages(struct p2m_domain *p2m, unsigned long gfn,
+                          bool coalesce, struct xen_domctl_p2m_superpages *sp)
+{
+    struct domain *d = p2m->domain;
+    ept_entry_t *table, *l1t, e, new;
+    unsigned int i, j, level;
+    struct page_info *pg;
+    PAGE_LIST_HEAD(freed);
+    int rc;
+
+    ASSERT(p2m_locked_by_me(p2m));
+
+    gfn &= ~((1UL << PAGE_ORDER_1G) - 1);
+
+    table = map_domain_page(pagetable_get_mfn(p2m_get_pagetable(p2m)));
+
+    for ( level = p2m->ept.wl; ; level-- )
+    {
+        ept_entry_t *entry = table + ((gfn >> (level * EPT_TABLE_ORDER)) &
+                                      (EPT_PAGETABLE_ENTRIES - 1));
+
+        e = atomic_read_ept_entry(entry);
+        if ( !is_epte_valid(&e) || !is_epte_present(&e) )
+            goto out;
+
+        /* Don't lose a re-calculation pending for the subtree. */
+        if ( e.emt == MTRR_NUM_TYPES )
+            coalesce = false;
+
+        if ( level == 2 )
+            break;
+
+        unmap_domain_page(table);
+        table = map_domain_page(_mfn(e.mfn));
+    }
+
+    if ( is_epte_superpage(&e) )
+    {
+        sp->mappings[2]++;
+        goto out;
+    }
+
+    l1t = map_domain_page(_mfn(e.mfn));
+
+    for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+    {
+        ept_entry_t l1e = atomic_read_ept_entry(&l1t[i]);
+        ept_entry_t *l0t;
+
+        if ( !is_epte_valid(&l1e) || !is_epte_present(&l1e) )
+            continue;
+
+        if ( is_epte_superpage(&l1e) )
+        {
+            sp->mappings[1]++;
+            continue;
+        }
+
+        l0t = map_domain_page(_mfn(l1e.mfn));
+
+        if ( coalesce && hap_has_2mb && l1e.emt != MTRR_NUM_TYPES &&
+             ept_coalesce_entries(p2m, l0t, 0,
+                                  gfn + (i << EPT_TABLE_ORDER), &new) )
+        {
+            rc = atomic_write_ept_entry(p2m, &l1t[i], new, 1);
+            ASSERT(rc == 0);
+
+            pg = mfn_to_page(_mfn(l1e.mfn));
+            page_list_del(pg, &p2m->pages);
+            page_list_add_tail(pg, &freed);
+
+            sp->mappings[1]++;
+            sp->coalesced[0]++;
+        }
+        else
+        {
+            for ( j = 0; j < EPT_PAGETABLE_ENTRIES; j++ )
+                if ( is_epte_valid(&l0t[j]) && is_epte_present(&l0t[j]) )
+                    sp->mappings[0]++;
+        }
+
+        unmap_domain_page(l0t);
+    }
+
+    if ( coalesce && hap_has_1gb &&
+         ept_coalesce_entries(p2m, l1t, 1, gfn, &new) )
+    {
+        ept_entry_t *entry = table + ((gfn >> (2 * EPT_TABLE_ORDER)) &
+                                      (EPT_PAGETABLE_ENTRIES - 1));
+
+        rc = atomic_write_ept_entry(p2m, entry, new, 2);
+        ASSERT(rc == 0);
+
+        pg = mfn_to_page(_mfn(e.mfn));
+        page_list_del(pg, &p2m->pages);
+        page_list_add_tail(pg, &freed);
+
+        sp->mappings[1] -= EPT_PAGETABLE_ENTRIES;
+        sp->mappings[2]++;
+        sp->coalesced[1]++;
+    }
+
+    unmap_domain_page(l1t);
+
+ out:
+    unmap_domain_page(table);
+
+    if ( !page_list_empty(&freed) )
+    {
+        ept_sync_domain(p2m);
+        p2m_tlb_flush_sync(p2m);
+
+        while ( (pg = page_list_remove_head(&freed)) != NULL )
+            d->arch.paging.free_page(d, pg);
+    }
+
+    return 0;
+}
+
 static void __ept_sync_domain(void *info)
 {
     /*
@@ -1223,6 +1396,7 @@ int ept_p2m_init(struct p2m_domain *p2m)
     p2m->change_entry_type_range = ept_change_entry_type_range;
     p2m->memory_type_changed = ept_memory_type_changed;
     p2m->audit_p2m = NULL;
+    p2m->superpages = ept_superpages;
     p2m->tlb_flush = ept_tlb_flush;
 
     /* Set the memory type used when accessing EPT paging structures. */
@@ -382,6 +382,12 @@ int p2m_pod_empty_cache(struct domain *d)
     BUG_ON(!d->is_dying);
     spin_barrier(&p2m->pod.lock.lock);
 
+    /*
+     * Populates schedule the reclaim tasklet with the PoD lock held, so
+     * after the barrier no further scheduling can occur.
+     */
+    tasklet_kill(&p2m->pod.reclaim_tasklet);
+
     lock_page_alloc(p2m);
 
     while ( (page = page_list_remove_head(&p2m->pod.super)) )
@@ -684,6 +690,27 @@ void p2m_pod_dump_data(struct domain *d)
            p2m->pod.entry_count, p2m->pod.count);
 }
 
+/* Number of leading words looked at before bothering to unmap a page. */
+#define POD_QUICK_CHECK_WORDS 16
+
+/*
+ * Check (part of) a page for being all zero.  Several words get OR-ed
+ * together per iteration, so that there's one well predicted branch per
+ * cache line rather than one per word.
+ */
+static bool pod_range_is_zero(const unsigned long *p, unsigned int words)
+{
+    unsigned int i;
+
+    ASSERT(!(words & 7));
+
+    for ( i = 0; i < words; i += 8 )
+        if ( p[i] | p[i + 1] | p[i + 2] | p[i + 3] |
+             p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7] )
+            return false;
+
+    return true;
+}
 
 /*
  * Search for all-zero superpages to be reclaimed as superpages for the
@@ -698,7 +725,6 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     unsigned long * map = NULL;
     int ret=0, reset = 0;
     unsigned long i, n;
-    unsigned int j;
     int max_ref = 1;
     struct domain *d = p2m->domain;
 
@@ -767,18 +793,15 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     /* Now, do a quick check to see if it may be zero before unmapping. */
     for ( i = 0; i < SUPERPAGE_PAGES; i++ )
     {
+        bool zero;
+
         /* Quick zero-check */
         map = map_domain_page(mfn_add(mfn0, i));
-
-        for ( j = 0; j < 16; j++ )
-            if ( *(map + j) != 0 )
-                break;
-
+        zero = pod_range_is_zero(map, POD_QUICK_CHECK_WORDS);
         unmap_domain_page(map);
 
-        if ( j < 16 )
+        if ( !zero )
             goto out;
-
     }
 
     /* Try to remove the page, restoring old mapping if it fails. */
@@ -807,14 +830,7 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     for ( i = 0; i < SUPERPAGE_PAGES; i++ )
     {
         map = map_domain_page(mfn_add(mfn0, i));
-
-        for ( j = 0; j < (PAGE_SIZE / sizeof(*map)); j++ )
-            if ( *(map+j) != 0 )
-            {
-                reset = 1;
-                break;
-            }
-
+        reset = !pod_range_is_zero(map, PAGE_SIZE / sizeof(*map));
         unmap_domain_page(map);
 
         if ( reset )
@@ -873,7 +889,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
     p2m_type_t types[POD_SWEEP_STRIDE];
     unsigned long *map[POD_SWEEP_STRIDE];
     struct domain *d = p2m->domain;
-    unsigned int i, j, max_ref = 1;
+    unsigned int i, max_ref = 1;
 
     BUG_ON(count > POD_SWEEP_STRIDE);
 
@@ -913,9 +929,8 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
             continue;
 
         /* Quick zero-check */
-        for ( j = 0; j < 16; j++ )
-            if ( *(map[i] + j) != 0 )
-                goto skip;
+        if ( !pod_range_is_zero(map[i], POD_QUICK_CHECK_WORDS) )
+            goto skip;
 
         /* Try to remove the page, restoring old mapping if it fails. */
         if ( p2m_set_entry(p2m, gfns[i], INVALID_MFN, PAGE_ORDER_4K,
@@ -953,12 +968,12 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
     /* Now check each page for real */
     for ( i = 0; i < count; i++ )
     {
+        bool zero;
+
         if ( !map[i] )
             continue;
 
-        for ( j = 0; j < (PAGE_SIZE / sizeof(*map[i])); j++ )
-            if ( *(map[i] + j) != 0 )
-                break;
+        zero = pod_range_is_zero(map[i], PAGE_SIZE / sizeof(*map[i]));
 
         unmap_domain_page(map[i]);
 
@@ -968,7 +983,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
          * See comment in p2m_pod_zero_check_superpage() re gnttab
          * check timing.
          */
-        if ( j < (PAGE_SIZE / sizeof(*map[i])) )
+        if ( !zero )
         {
             /*
              * If the previous p2m_set_entry call succeeded, this one shouldn't
@@ -1022,6 +1037,7 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
 {
     gfn_t gfns[POD_SWEEP_STRIDE];
     unsigned long i, j = 0, start, limit;
+    gfn_t last_sp = INVALID_GFN;
     p2m_type_t t;
 
 
@@ -1031,7 +1047,6 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     start = gfn_x(p2m->pod.reclaim_single);
     limit = (start > POD_SWEEP_LIMIT) ? (start - POD_SWEEP_LIMIT) : 0;
 
-    /* FIXME: Figure out how to avoid superpages */
     /*
      * NOTE: Promote to globally locking the p2m. This will get complicated
      * in a fine-grained scenario. If we lock each gfn individually we must be
@@ -1041,7 +1056,31 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     for ( i = gfn_x(p2m->pod.reclaim_single); i > 0 ; i-- )
     {
         p2m_access_t a;
-        (void)p2m->get_entry(p2m, _gfn(i), &t, &a, 0, NULL, NULL);
+        unsigned int cur_order;
+
+        (void)p2m->get_entry(p2m, _gfn(i), &t, &a, 0, &cur_order, NULL);
+
+        /*
+         * Try to reclaim superpages as a whole.  Ones which aren't zero get
+         * skipped rather than shattered for the sake of a few 4k pages,
+         * unless we've run past our limit without finding anything.
+         */
+        if ( p2m_is_ram(t) && cur_order >= PAGE_ORDER_2M )
+        {
+            gfn_t sp = _gfn(i & ~(SUPERPAGE_PAGES - 1));
+
+            if ( !gfn_eq(sp, last_sp) )
+            {
+                last_sp = sp;
+                if ( p2m_pod_zero_check_superpage(p2m, sp) || i >= limit )
+                {
+                    /* The loop decrement moves past the superpage. */
+                    i = gfn_x(sp) ?: 1;
+                    goto next;
+                }
+            }
+        }
+
         if ( p2m_is_ram(t) )
         {
             gfns[j] = _gfn(i);
@@ -1053,6 +1092,8 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
                 j = 0;
             }
         }
+
+ next:
         /*
          * Stop if we're past our limit and we have found *something*.
          *
@@ -1111,6 +1152,38 @@ static void pod_eager_reclaim(struct p2m_domain *p2m)
     } while ( (p2m->pod.count == 0) && (i < ARRAY_SIZE(mrp->list)) );
 }
 
+/*
+ * Reclaim in the background once the cache gets this low, so that guests
+ * with outstanding PoD entries don't all have to go through the emergency
+ * sweep when faulting.
+ */
+#define POD_RECLAIM_WATERMARK SUPERPAGE_PAGES
+
+static void pod_reclaim_tasklet(unsigned long data)
+{
+    struct p2m_domain *p2m = (struct p2m_domain *)data;
+
+    /* Same lock order as on the p2m_pod_demand_populate() path. */
+    p2m_lock(p2m);
+    pod_lock(p2m);
+
+    if ( !p2m->domain->is_dying &&
+         p2m->pod.entry_count > p2m->pod.count )
+    {
+        pod_eager_reclaim(p2m);
+
+        /*
+         * With some cache left, this sweeps no further than
+         * POD_SWEEP_LIMIT and doesn't splinter superpages.
+         */
+        if ( p2m->pod.count < POD_RECLAIM_WATERMARK )
+            p2m_pod_emergency_sweep(p2m);
+    }
+
+    pod_unlock(p2m);
+    p2m_unlock(p2m);
+}
+
 static void pod_eager_record(struct p2m_domain *p2m, gfn_t gfn,
                              unsigned int order)
 {
@@ -1132,6 +1205,7 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, gfn_t gfn,
     gfn_t gfn_aligned = _gfn((gfn_x(gfn) >> order) << order);
     mfn_t mfn;
     unsigned long i;
+    s_time_t stall = 0;
 
     ASSERT(gfn_locked_by_me(p2m, gfn));
     pod_lock(p2m);
@@ -1167,14 +1241,37 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, gfn_t gfn,
 
     /* Only reclaim if we're in actual need of more cache. */
     if ( p2m->pod.entry_count > p2m->pod.count )
+    {
+        stall = NOW();
+
         pod_eager_reclaim(p2m);
 
-    /*
-     * Only sweep if we're actually out of memory.  Doing anything else
-     * causes unnecessary time and fragmentation of superpages in the p2m.
-     */
-    if ( p2m->pod.count == 0 )
-        p2m_pod_emergency_sweep(p2m);
+        /*
+         * Only sweep if we're actually out of memory.  Doing anything else
+         * causes unnecessary time and fragmentation of superpages in the
+         * p2m.  (With entries outstanding, an empty cache implies we got
+         * here.)
+         */
+        if ( p2m->pod.count == 0 )
+            p2m_pod_emergency_sweep(p2m);
+
+        stall = NOW() - stall;
+    }
+
+    if ( stall && tb_init_done )
+    {
+        struct {
+            u64 gfn, ns;
+            int d:16,order:16;
+        } t;
+
+        t.gfn = gfn_x(gfn);
+        t.ns = stall;
+        t.d = d->domain_id;
+        t.order = order;
+
+        __trace_var(TRC_MEM_POD_STALL, 0, sizeof(t), &t);
+    }
 
     /* If the sweep failed, give up. */
     if ( p2m->pod.count == 0 )
@@ -1212,6 +1309,10 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, gfn_t gfn,
 
     pod_eager_record(p2m, gfn_aligned, order);
 
+    if ( p2m->pod.count < POD_RECLAIM_WATERMARK &&
+         p2m->pod.entry_count > p2m->pod.count )
+        tasklet_schedule(&p2m->pod.reclaim_tasklet);
+
     if ( tb_init_done )
     {
         struct {
@@ -1338,4 +1439,7 @@ void p2m_pod_init(struct p2m_domain *p2m)
 
     for ( i = 0; i < ARRAY_SIZE(p2m->pod.mrp.list); ++i )
         p2m->pod.mrp.list[i] = gfn_x(INVALID_GFN);
+
+    tasklet_init(&p2m->pod.reclaim_tasklet, pod_reclaim_tasklet,
+                 (unsigned long)p2m);
 }
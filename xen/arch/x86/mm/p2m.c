@@ -461,6 +461,7 @@ void p2m_tlb_flush_sync(struct p2m_domain *p2m)
 {
     if ( p2m->need_flush ) {
         p2m->need_flush = 0;
+        perfc_incr(p2m_tlb_flush);
         p2m->tlb_flush(p2m);
     }
 }
@@ -470,12 +471,129 @@ void p2m_tlb_flush_sync(struct p2m_domain *p2m)
  */
 void p2m_unlock_and_tlb_flush(struct p2m_domain *p2m)
 {
-    if ( p2m->need_flush ) {
+    if ( p2m->need_flush && current->arch.p2m_batch != p2m ) {
         p2m->need_flush = 0;
         mm_write_unlock(&p2m->lock);
+        perfc_incr(p2m_tlb_flush);
         p2m->tlb_flush(p2m);
-    } else
+    } else {
+        if ( p2m->need_flush )
+            perfc_incr(p2m_tlb_flush_deferred);
         mm_write_unlock(&p2m->lock);
+    }
+}
+
+/*
+ * Batch updates to a domain's host p2m: until p2m_batch_end(), the TLB
+ * flush needed by an update made by the current vCPU doesn't get issued
+ * when the p2m lock is dropped, but only once at the end of the batch.
+ * Updates made by others are unaffected (and will flush on our behalf if
+ * they need to flush anyway).  The batch being per-vCPU rather than
+ * per-pCPU, it stays intact should the vCPU block (e.g. waiting for a
+ * vm_event ring slot) and get rescheduled elsewhere in the middle.
+ *
+ * Deferring the flush past the dropping of the lock is fine as far as
+ * pages being freed to the domheap go, as the allocator will flush stale
+ * translations before handing them out again.  Callers must end the batch
+ * before the results of the updates need to be in effect, i.e. before
+ * returning to the guest or to the caller of the hypercall (including
+ * for preemption).
+ */
+void p2m_batch_begin(struct domain *d)
+{
+    ASSERT(!current->arch.p2m_batch);
+
+    current->arch.p2m_batch = p2m_get_hostp2m(d);
+}
+
+void p2m_batch_end(struct domain *d)
+{
+    struct p2m_domain *p2m = current->arch.p2m_batch;
+
+    ASSERT(p2m == p2m_get_hostp2m(d));
+
+    current->arch.p2m_batch = NULL;
+
+    /* Issue the flush if still pending. */
+    p2m_lock(p2m);
+    p2m_unlock(p2m);
+}
+
+/*
+ * Walk the host p2m one 1GiB region at a time, gathering the number of
+ * leaf mappings of each size and, if asked to, replacing runs of small
+ * mappings which could equally be expressed as a superpage.
+ */
+long p2m_superpages_domctl(struct domain *d,
+                           struct xen_domctl_p2m_superpages *sp)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn = sp->gfn & ~((1UL << PAGE_ORDER_1G) - 1);
+    unsigned long end;
+    bool coalesce;
+    long rc = 0;
+
+    switch ( sp->op )
+    {
+    case XEN_DOMCTL_P2M_SUPERPAGES_STATS:
+        coalesce = false;
+        break;
+
+    case XEN_DOMCTL_P2M_SUPERPAGES_COALESCE:
+        coalesce = true;
+        break;
+
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    if ( sp->pad )
+        return -EINVAL;
+
+    if ( !p2m->superpages )
+        return -EOPNOTSUPP;
+
+    if ( coalesce )
+    {
+        /*
+         * Superpages would only get shattered again by log-dirty tracking,
+         * and page tables shared with the IOMMU would need its TLB flushed
+         * as well.
+         */
+        if ( paging_mode_log_dirty(d) )
+            return -EBUSY;
+        if ( iommu_use_hap_pt(d) )
+            return -EOPNOTSUPP;
+
+        domain_pause(d);
+    }
+
+    end = p2m->max_mapped_pfn;
+
+    while ( gfn <= end )
+    {
+        p2m_lock(p2m);
+        rc = p2m->superpages(p2m, gfn, coalesce, sp);
+        p2m_unlock(p2m);
+
+        if ( rc )
+            break;
+
+        gfn += 1UL << PAGE_ORDER_1G;
+
+        if ( gfn <= end && hypercall_preempt_check() )
+        {
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    sp->gfn = gfn;
+
+    if ( coalesce )
+        domain_unpause(d);
+
+    return rc;
 }
 
 mfn_t __get_gfn_type_access(struct p2m_domain *p2m, unsigned long gfn_l,
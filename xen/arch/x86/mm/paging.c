@@ -28,6 +28,7 @@
 #include <asm/event.h>
 #include <asm/hvm/nestedhvm.h>
 #include <xen/numa.h>
+#include <xen/vmap.h>
 #include <xsm/xsm.h>
 #include <public/sched.h> /* SHUTDOWN_suspend */
 
@@ -107,16 +108,32 @@ static void paging_free_log_dirty_page(struct domain *d, mfn_t mfn)
     d->arch.paging.free_page(d, mfn_to_page(mfn));
 }
 
+/* Detach the dirty PFN ring, for the caller to free after unlocking. */
+static unsigned long *paging_detach_log_dirty_ring(struct domain *d)
+{
+    unsigned long *ring = d->arch.paging.log_dirty.ring;
+
+    ASSERT(paging_locked_by_me(d));
+
+    d->arch.paging.log_dirty.ring = NULL;
+    d->arch.paging.log_dirty.ring_overflow = true;
+
+    return ring;
+}
+
 static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
 {
     mfn_t *l4, *l3, *l2;
+    unsigned long *ring = NULL;
     int i4, i3, i2;
 
     paging_lock(d);
 
     if ( !mfn_valid(d->arch.paging.log_dirty.top) )
     {
+        ring = paging_detach_log_dirty_ring(d);
         paging_unlock(d);
+        vfree(ring);
         return 0;
     }
 
@@ -194,6 +211,7 @@ static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
 
         ASSERT(d->arch.paging.log_dirty.allocs == 0);
         d->arch.paging.log_dirty.failed_allocs = 0;
+        ring = paging_detach_log_dirty_ring(d);
 
         rc = -d->arch.paging.preempt.log_dirty.done;
         d->arch.paging.preempt.dom = NULL;
@@ -206,11 +224,14 @@ static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
 
     paging_unlock(d);
 
+    vfree(ring);
+
     return rc;
 }
 
 int paging_log_dirty_enable(struct domain *d, bool_t log_global)
 {
+    unsigned long *ring = NULL, *old;
     int ret;
 
     if ( has_iommu_pt(d) && log_global )
@@ -225,10 +246,29 @@ int paging_log_dirty_enable(struct domain *d, bool_t log_global)
     if ( paging_mode_log_dirty(d) )
         return -EINVAL;
 
+    /*
+     * Only global log-dirty mode has its dirty pages collected through
+     * XEN_DOMCTL_SHADOW_OP_CLEAN_LIST.  Without a ring, that operation falls
+     * back to walking the radix tree.
+     */
+    if ( log_global )
+        ring = vmalloc(LOGDIRTY_RING_ENTRIES * sizeof(*ring));
+
     domain_pause(d);
+
+    paging_lock(d);
+    old = d->arch.paging.log_dirty.ring;
+    d->arch.paging.log_dirty.ring = ring;
+    d->arch.paging.log_dirty.ring_head = 0;
+    d->arch.paging.log_dirty.ring_tail = 0;
+    d->arch.paging.log_dirty.ring_overflow = !ring;
+    paging_unlock(d);
+
     ret = d->arch.paging.log_dirty.ops->enable(d, log_global);
     domain_unpause(d);
 
+    vfree(old);
+
     return ret;
 }
 
@@ -322,10 +362,20 @@ void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
     unmap_domain_page(l1);
     if ( changed )
     {
+        struct log_dirty_domain *ld = &d->arch.paging.log_dirty;
+
         PAGING_DEBUG(LOGDIRTY,
                      "d%d: marked mfn %" PRI_mfn " (pfn %" PRI_pfn ")\n",
                      d->domain_id, mfn_x(mfn), pfn_x(pfn));
-        d->arch.paging.log_dirty.dirty_count++;
+        ld->dirty_count++;
+
+        if ( !ld->ring_overflow )
+        {
+            if ( ld->ring_tail < LOGDIRTY_RING_ENTRIES )
+                ld->ring[ld->ring_tail++] = pfn_x(pfn);
+            else
+                ld->ring_overflow = true;
+        }
     }
 
 out:
@@ -540,6 +590,15 @@ static int paging_log_dirty_op(struct domain *d,
         {
             d->arch.paging.log_dirty.fault_count = 0;
             d->arch.paging.log_dirty.dirty_count = 0;
+
+            /*
+             * The ring may now hold PFNs no longer marked dirty, while PFNs
+             * beyond sc->pages, or marked while we were preempted, may be
+             * missing from it.  Have the next CLEAN_LIST walk the tree.
+             */
+            d->arch.paging.log_dirty.ring_head = 0;
+            d->arch.paging.log_dirty.ring_tail = 0;
+            d->arch.paging.log_dirty.ring_overflow = true;
         }
     }
     else
@@ -586,6 +645,291 @@ static int paging_log_dirty_op(struct domain *d,
     return rv;
 }
 
+/*
+ * Report the PFNs recorded in the dirty ring, clearing them in the radix
+ * tree.  PFNs whose bit was cleared already (by an earlier CLEAN, or by an
+ * earlier entry for the same PFN) are skipped.
+ */
+static int paging_log_dirty_drain_ring(struct domain *d,
+                                       XEN_GUEST_HANDLE_PARAM(uint8) list,
+                                       unsigned long max, unsigned long *done)
+{
+    struct log_dirty_domain *ld = &d->arch.paging.log_dirty;
+    mfn_t *l4 = paging_map_log_dirty_bitmap(d);
+    unsigned int n = 0;
+    int rv = 0;
+
+    while ( *done < max && ld->ring_head < ld->ring_tail )
+    {
+        uint64_t pfn = ld->ring[ld->ring_head];
+        mfn_t mfn, *node;
+        unsigned long *l1;
+        bool dirty;
+
+        mfn = l4 ? l4[L4_LOGDIRTY_IDX(_pfn(pfn))] : INVALID_MFN;
+        if ( mfn_valid(mfn) )
+        {
+            node = map_domain_page(mfn);
+            mfn = node[L3_LOGDIRTY_IDX(_pfn(pfn))];
+            unmap_domain_page(node);
+        }
+        if ( mfn_valid(mfn) )
+        {
+            node = map_domain_page(mfn);
+            mfn = node[L2_LOGDIRTY_IDX(_pfn(pfn))];
+            unmap_domain_page(node);
+        }
+        if ( !mfn_valid(mfn) )
+        {
+            ld->ring_head++;
+            continue;
+        }
+
+        l1 = map_domain_page(mfn);
+        dirty = test_bit(L1_LOGDIRTY_IDX(_pfn(pfn)), l1);
+        if ( dirty && copy_to_guest_offset(list, *done * sizeof(pfn),
+                                           (uint8_t *)&pfn, sizeof(pfn)) )
+            rv = -EFAULT;
+        else if ( dirty )
+        {
+            __clear_bit(L1_LOGDIRTY_IDX(_pfn(pfn)), l1);
+            ++*done;
+        }
+        unmap_domain_page(l1);
+
+        if ( rv )
+            break;
+
+        ld->ring_head++;
+
+        if ( !(++n & 0xff) && ld->ring_head < ld->ring_tail &&
+             hypercall_preempt_check() )
+        {
+            rv = -ERESTART;
+            break;
+        }
+    }
+
+    if ( l4 )
+        unmap_domain_page(l4);
+
+    if ( ld->ring_head == ld->ring_tail )
+        ld->ring_head = ld->ring_tail = 0;
+
+    return rv;
+}
+
+/*
+ * Report all PFNs marked in the radix tree, clearing them as they get
+ * reported.  Used when the dirty ring overflowed.
+ */
+static int paging_log_dirty_walk_list(struct domain *d,
+                                      XEN_GUEST_HANDLE_PARAM(uint8) list,
+                                      unsigned long max, unsigned long *done)
+{
+    mfn_t *l4, *l3, *l2;
+    unsigned long *l1;
+    unsigned int i4, i3, i2, i1;
+    int rv = 0;
+
+    l4 = paging_map_log_dirty_bitmap(d);
+    if ( !l4 )
+        return 0;
+
+    i4 = d->arch.paging.preempt.log_dirty.i4;
+    i3 = d->arch.paging.preempt.log_dirty.i3;
+
+    for ( ; !rv && *done < max && i4 < LOGDIRTY_NODE_ENTRIES; i4++, i3 = 0 )
+    {
+        if ( !mfn_valid(l4[i4]) )
+            continue;
+
+        l3 = map_domain_page(l4[i4]);
+        for ( ; !rv && *done < max && i3 < LOGDIRTY_NODE_ENTRIES; i3++ )
+        {
+            if ( !mfn_valid(l3[i3]) )
+                continue;
+
+            l2 = map_domain_page(l3[i3]);
+            for ( i2 = 0; !rv && *done < max && i2 < LOGDIRTY_NODE_ENTRIES;
+                  i2++ )
+            {
+                if ( !mfn_valid(l2[i2]) )
+                    continue;
+
+                l1 = map_domain_page(l2[i2]);
+                for ( i1 = find_first_bit(l1, PAGE_SIZE * 8);
+                      i1 < PAGE_SIZE * 8 && *done < max;
+                      i1 = find_next_bit(l1, PAGE_SIZE * 8, i1 + 1) )
+                {
+                    uint64_t pfn = LOGDIRTY_PFN(i4, i3, i2, i1);
+
+                    if ( copy_to_guest_offset(list, *done * sizeof(pfn),
+                                              (uint8_t *)&pfn, sizeof(pfn)) )
+                    {
+                        rv = -EFAULT;
+                        break;
+                    }
+                    __clear_bit(i1, l1);
+                    ++*done;
+                }
+                unmap_domain_page(l1);
+            }
+            unmap_domain_page(l2);
+
+            if ( !rv && *done < max && i3 < LOGDIRTY_NODE_ENTRIES - 1 &&
+                 hypercall_preempt_check() )
+            {
+                d->arch.paging.preempt.log_dirty.i4 = i4;
+                d->arch.paging.preempt.log_dirty.i3 = i3 + 1;
+                rv = -ERESTART;
+            }
+        }
+        unmap_domain_page(l3);
+
+        if ( !rv && *done < max && i4 < LOGDIRTY_NODE_ENTRIES - 1 &&
+             hypercall_preempt_check() )
+        {
+            d->arch.paging.preempt.log_dirty.i4 = i4 + 1;
+            d->arch.paging.preempt.log_dirty.i3 = 0;
+            rv = -ERESTART;
+        }
+    }
+
+    unmap_domain_page(l4);
+
+    return rv;
+}
+
+/*
+ * Report dirty PFNs as a list rather than a bitmap, clearing them in the
+ * radix tree.  Unless the dirty ring overflowed, the cost of this is
+ * proportional to the number of pages dirtied rather than to the size of
+ * the guest.  If more than sc->pages PFNs are dirty, the remaining ones
+ * stay marked for a subsequent call to pick up.
+ */
+static int paging_log_dirty_list_op(struct domain *d,
+                                    struct xen_domctl_shadow_op *sc,
+                                    bool resuming)
+{
+    struct log_dirty_domain *ld = &d->arch.paging.log_dirty;
+    unsigned long done;
+    bool walk, drained;
+    int rv;
+
+    if ( !resuming )
+    {
+        if ( is_hvm_domain(d) &&
+             (sc->mode & XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL) )
+            hvm_mapped_guest_frames_mark_dirty(d);
+
+        domain_pause(d);
+        p2m_flush_hardware_cached_dirty(d);
+    }
+
+    paging_lock(d);
+
+    if ( !d->arch.paging.preempt.dom )
+    {
+        memset(&d->arch.paging.preempt.log_dirty, 0,
+               sizeof(d->arch.paging.preempt.log_dirty));
+
+        /*
+         * When walking the tree, start collecting PFNs in the ring afresh:
+         * everything marked before gets reported by the walk, and anything
+         * marked from now on ends up in the ring.
+         */
+        if ( ld->ring_overflow && ld->ring )
+        {
+            d->arch.paging.preempt.log_dirty.walk = 1;
+            ld->ring_head = ld->ring_tail = 0;
+            ld->ring_overflow = false;
+        }
+        else
+            d->arch.paging.preempt.log_dirty.walk = ld->ring_overflow;
+    }
+    else if ( d->arch.paging.preempt.dom != current->domain ||
+              d->arch.paging.preempt.op != sc->op )
+    {
+        paging_unlock(d);
+        ASSERT(!resuming);
+        domain_unpause(d);
+        return -EBUSY;
+    }
+
+    sc->stats.fault_count = ld->fault_count;
+    sc->stats.dirty_count = ld->dirty_count;
+
+    if ( unlikely(ld->failed_allocs) )
+    {
+        printk(XENLOG_WARNING
+               "%u failed page allocs while logging dirty pages of d%d\n",
+               ld->failed_allocs, d->domain_id);
+        rv = -ENOMEM;
+        goto out;
+    }
+
+    walk = d->arch.paging.preempt.log_dirty.walk;
+    done = d->arch.paging.preempt.log_dirty.done;
+
+    if ( walk )
+        rv = paging_log_dirty_walk_list(d, sc->dirty_bitmap, sc->pages, &done);
+    else
+        rv = paging_log_dirty_drain_ring(d, sc->dirty_bitmap, sc->pages,
+                                         &done);
+
+    if ( rv == -ERESTART )
+    {
+        d->arch.paging.preempt.dom = current->domain;
+        d->arch.paging.preempt.op = sc->op;
+        d->arch.paging.preempt.log_dirty.done = done;
+        paging_unlock(d);
+        return rv;
+    }
+
+    if ( rv )
+    {
+        /* PFNs may have been dropped from the ring without being reported. */
+        ld->ring_overflow = true;
+        goto out;
+    }
+
+    d->arch.paging.preempt.dom = NULL;
+
+    if ( walk )
+    {
+        drained = done < sc->pages;
+        if ( !drained )
+            /* PFNs not reported yet aren't in the ring. */
+            ld->ring_overflow = true;
+    }
+    else
+        drained = !ld->ring_tail && !ld->ring_overflow;
+
+    if ( drained )
+    {
+        ld->fault_count = 0;
+        ld->dirty_count = 0;
+    }
+
+    paging_unlock(d);
+
+    sc->pages = done;
+
+    /* Safe because the domain is paused. */
+    ld->ops->clean(d);
+    domain_unpause(d);
+
+    return 0;
+
+ out:
+    d->arch.paging.preempt.dom = NULL;
+    paging_unlock(d);
+    domain_unpause(d);
+
+    return rv;
+}
+
 void paging_log_dirty_range(struct domain *d,
                            unsigned long begin_pfn,
                            unsigned long nr,
@@ -739,6 +1083,12 @@ int paging_domctl(struct domain *d, struct xen_domctl_shadow_op *sc,
         if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
             return -EINVAL;
         return paging_log_dirty_op(d, sc, resuming);
+
+    case XEN_DOMCTL_SHADOW_OP_CLEAN_LIST:
+        if ( (sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL) ||
+             guest_handle_is_null(sc->dirty_bitmap) )
+            return -EINVAL;
+        return paging_log_dirty_list_op(d, sc, resuming);
     }
 
     /* Here, dispatch domctl to the appropriate paging code */
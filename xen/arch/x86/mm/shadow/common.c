@@ -44,6 +44,11 @@ static int sh_enable_log_dirty(struct domain *, bool log_global);
 static int sh_disable_log_dirty(struct domain *);
 static void sh_clean_dirty_bitmap(struct domain *);
 
+#if (SHADOW_OPTIMIZATIONS & SHOPT_OUT_OF_SYNC)
+/* Sizes of the per-vcpu out-of-sync hash (prime, please) */
+static const unsigned int oos_pool_sizes[] = { 3, 5, SHADOW_OOS_PAGES };
+#endif
+
 /* Set up the shadow-specific parts of a domain struct at start of day.
  * Called for every domain from arch_domain_create() */
 int shadow_domain_init(struct domain *d, unsigned int domcr_flags)
@@ -87,6 +92,7 @@ void shadow_vcpu_init(struct vcpu *v)
         for ( j = 0; j < SHADOW_OOS_FIXUPS; j++ )
             v->arch.paging.shadow.oos_fixup[i].smfn[j] = INVALID_MFN;
     }
+    v->arch.paging.shadow.oos_nr = oos_pool_sizes[0];
 #endif
 
     v->arch.paging.mode = is_pv_vcpu(v) ?
@@ -256,8 +262,64 @@ void shadow_continue_emulation(struct sh_emulate_ctxt *sh_ctxt,
  * We keep a hash per vcpu, because we want as much as possible to do
  * the re-sync on the save vcpu we did the unsync on, so the VA hint
  * will be valid.
+ *
+ * The hash starts small, as every guest TLB flush resyncs all of it, and
+ * grows when pages get evicted before the guest flushes its TLB, i.e. when
+ * the guest's working set of pagetables doesn't fit.  It shrinks again
+ * after a run of flushes finding it mostly empty.  Resizing only happens
+ * right after resyncing all of a vcpu's pages, while its hash is empty.
  */
 
+/* Evictions between two resyncs that make the hash grow. */
+#define OOS_GROW_EVICTIONS   2
+/* Consecutive mostly empty resyncs that make the hash shrink. */
+#define OOS_SHRINK_RESYNCS   64
+
+/* Slot of gmfn in v's out-of-sync hash, or -1 if it isn't there. */
+static int oos_find(const struct vcpu *v, mfn_t gmfn)
+{
+    const mfn_t *oos = v->arch.paging.shadow.oos;
+    unsigned int nr = v->arch.paging.shadow.oos_nr;
+    unsigned int idx = mfn_x(gmfn) % nr;
+
+    if ( mfn_eq(oos[idx], gmfn) )
+        return idx;
+    idx = (idx + 1) % nr;
+
+    return mfn_eq(oos[idx], gmfn) ? idx : -1;
+}
+
+/* Pick the size of v's (just emptied) out-of-sync hash. */
+static void oos_resize(struct vcpu *v, unsigned int used)
+{
+    struct shadow_vcpu *sv = &v->arch.paging.shadow;
+    unsigned int i = 0;
+
+    while ( oos_pool_sizes[i] != sv->oos_nr )
+        i++;
+
+    if ( sv->oos_evictions >= OOS_GROW_EVICTIONS &&
+         i + 1 < ARRAY_SIZE(oos_pool_sizes) )
+    {
+        sv->oos_nr = oos_pool_sizes[i + 1];
+        sv->oos_idle = 0;
+        perfc_incr(shadow_oos_grow);
+    }
+    else if ( !sv->oos_evictions && i && used <= oos_pool_sizes[i - 1] / 2 )
+    {
+        if ( ++sv->oos_idle >= OOS_SHRINK_RESYNCS )
+        {
+            sv->oos_nr = oos_pool_sizes[i - 1];
+            sv->oos_idle = 0;
+            perfc_incr(shadow_oos_shrink);
+        }
+    }
+    else
+        sv->oos_idle = 0;
+
+    sv->oos_evictions = 0;
+}
+
 static void sh_oos_audit(struct domain *d)
 {
     unsigned int idx, expected_idx, expected_idx_alt;
@@ -266,14 +328,16 @@ static void sh_oos_audit(struct domain *d)
 
     for_each_vcpu(d, v)
     {
+        unsigned int nr = v->arch.paging.shadow.oos_nr;
+
         for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
         {
             mfn_t *oos = v->arch.paging.shadow.oos;
             if ( !mfn_valid(oos[idx]) )
                 continue;
 
-            expected_idx = mfn_x(oos[idx]) % SHADOW_OOS_PAGES;
-            expected_idx_alt = ((expected_idx + 1) % SHADOW_OOS_PAGES);
+            expected_idx = mfn_x(oos[idx]) % nr;
+            expected_idx_alt = ((expected_idx + 1) % nr);
             if ( idx != expected_idx && idx != expected_idx_alt )
             {
                 printk("%s: idx %x contains gmfn %lx, expected at %x or %x.\n",
@@ -307,20 +371,13 @@ static void sh_oos_audit(struct domain *d)
 #if SHADOW_AUDIT & SHADOW_AUDIT_ENTRIES
 void oos_audit_hash_is_present(struct domain *d, mfn_t gmfn)
 {
-    int idx;
     struct vcpu *v;
-    mfn_t *oos;
 
     ASSERT(mfn_is_out_of_sync(gmfn));
 
     for_each_vcpu(d, v)
     {
-        oos = v->arch.paging.shadow.oos;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-
-        if ( mfn_eq(oos[idx], gmfn) )
+        if ( oos_find(v, gmfn) >= 0 )
             return;
     }
 
@@ -378,7 +435,6 @@ void oos_fixup_add(struct domain *d, mfn_t gmfn,
                    mfn_t smfn,  unsigned long off)
 {
     int idx, next;
-    mfn_t *oos;
     struct oos_fixup *oos_fixup;
     struct vcpu *v;
 
@@ -386,12 +442,9 @@ void oos_fixup_add(struct domain *d, mfn_t gmfn,
 
     for_each_vcpu(d, v)
     {
-        oos = v->arch.paging.shadow.oos;
         oos_fixup = v->arch.paging.shadow.oos_fixup;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-        if ( mfn_eq(oos[idx], gmfn) )
+        idx = oos_find(v, gmfn);
+        if ( idx >= 0 )
         {
             int i;
             for ( i = 0; i < SHADOW_OOS_FIXUPS; i++ )
@@ -523,26 +576,28 @@ static void oos_hash_add(struct vcpu *v, mfn_t gmfn)
     mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
     struct oos_fixup *oos_fixup = v->arch.paging.shadow.oos_fixup;
     struct oos_fixup fixup = { .next = 0 };
+    unsigned int nr = v->arch.paging.shadow.oos_nr;
 
     for (i = 0; i < SHADOW_OOS_FIXUPS; i++ )
         fixup.smfn[i] = INVALID_MFN;
 
-    idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
+    idx = mfn_x(gmfn) % nr;
     oidx = idx;
 
     if ( mfn_valid(oos[idx])
-         && (mfn_x(oos[idx]) % SHADOW_OOS_PAGES) == idx )
+         && (mfn_x(oos[idx]) % nr) == idx )
     {
         /* Punt the current occupant into the next slot */
         SWAP(oos[idx], gmfn);
         SWAP(oos_fixup[idx], fixup);
         swap = 1;
-        idx = (idx + 1) % SHADOW_OOS_PAGES;
+        idx = (idx + 1) % nr;
     }
     if ( mfn_valid(oos[idx]) )
    {
         /* Crush the current occupant. */
         _sh_resync(v, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
+        v->arch.paging.shadow.oos_evictions++;
         perfc_incr(shadow_unsync_evict);
     }
     oos[idx] = gmfn;
@@ -562,20 +617,16 @@ static void oos_hash_add(struct vcpu *v, mfn_t gmfn)
 static void oos_hash_remove(struct domain *d, mfn_t gmfn)
 {
     int idx;
-    mfn_t *oos;
     struct vcpu *v;
 
     SHADOW_PRINTK("d%d gmfn %lx\n", d->domain_id, mfn_x(gmfn));
 
     for_each_vcpu(d, v)
     {
-        oos = v->arch.paging.shadow.oos;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-        if ( mfn_eq(oos[idx], gmfn) )
+        idx = oos_find(v, gmfn);
+        if ( idx >= 0 )
         {
-            oos[idx] = INVALID_MFN;
+            v->arch.paging.shadow.oos[idx] = INVALID_MFN;
             return;
         }
     }
@@ -588,21 +639,13 @@ static void oos_hash_remove(struct domain *d, mfn_t gmfn)
 mfn_t oos_snapshot_lookup(struct domain *d, mfn_t gmfn)
 {
     int idx;
-    mfn_t *oos;
-    mfn_t *oos_snapshot;
     struct vcpu *v;
 
     for_each_vcpu(d, v)
     {
-        oos = v->arch.paging.shadow.oos;
-        oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-        if ( mfn_eq(oos[idx], gmfn) )
-        {
-            return oos_snapshot[idx];
-        }
+        idx = oos_find(v, gmfn);
+        if ( idx >= 0 )
+            return v->arch.paging.shadow.oos_snapshot[idx];
     }
 
     printk(XENLOG_ERR "gmfn %"PRI_mfn" was OOS but not in hash table\n",
@@ -614,24 +657,16 @@ mfn_t oos_snapshot_lookup(struct domain *d, mfn_t gmfn)
 void sh_resync(struct domain *d, mfn_t gmfn)
 {
     int idx;
-    mfn_t *oos;
-    mfn_t *oos_snapshot;
-    struct oos_fixup *oos_fixup;
     struct vcpu *v;
 
     for_each_vcpu(d, v)
     {
-        oos = v->arch.paging.shadow.oos;
-        oos_fixup = v->arch.paging.shadow.oos_fixup;
-        oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-
-        if ( mfn_eq(oos[idx], gmfn) )
+        idx = oos_find(v, gmfn);
+        if ( idx >= 0 )
         {
-            _sh_resync(v, gmfn, &oos_fixup[idx], oos_snapshot[idx]);
-            oos[idx] = INVALID_MFN;
+            _sh_resync(v, gmfn, &v->arch.paging.shadow.oos_fixup[idx],
+                       v->arch.paging.shadow.oos_snapshot[idx]);
+            v->arch.paging.shadow.oos[idx] = INVALID_MFN;
             return;
         }
     }
@@ -666,6 +701,7 @@ static int sh_skip_sync(struct vcpu *v, mfn_t gl1mfn)
 void sh_resync_all(struct vcpu *v, int skip, int this, int others)
 {
     int idx;
+    unsigned int used = 0;
     struct vcpu *other;
     mfn_t *oos = v->arch.paging.shadow.oos;
     mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
@@ -678,15 +714,20 @@ void sh_resync_all(struct vcpu *v, int skip, int this, int others)
     if ( !this )
         goto resync_others;
 
+    perfc_incr(shadow_resync_all);
+
     /* First: resync all of this vcpu's oos pages */
-    for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
+    for ( idx = 0; idx < v->arch.paging.shadow.oos_nr; idx++ )
         if ( mfn_valid(oos[idx]) )
         {
             /* Write-protect and sync contents */
             _sh_resync(v, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
             oos[idx] = INVALID_MFN;
+            used++;
         }
 
+    oos_resize(v, used);
+
  resync_others:
     if ( !others )
         return;
@@ -701,7 +742,7 @@ void sh_resync_all(struct vcpu *v, int skip, int this, int others)
         oos_fixup = other->arch.paging.shadow.oos_fixup;
         oos_snapshot = other->arch.paging.shadow.oos_snapshot;
 
-        for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
+        for ( idx = 0; idx < other->arch.paging.shadow.oos_nr; idx++ )
         {
             if ( !mfn_valid(oos[idx]) )
                 continue;
@@ -1443,20 +1484,28 @@ static unsigned int shadow_get_allocation(struct domain *d)
 /**************************************************************************/
 /* Hash table for storing the guest->shadow mappings.
  * The table itself is an array of pointers to shadows; the shadows are then
- * threaded on a singly-linked list of shadows with the same hash value */
-
-#define SHADOW_HASH_BUCKETS 251
-/* Other possibly useful primes are 509, 1021, 2039, 4093, 8191, 16381 */
+ * threaded on a singly-linked list of shadows with the same hash value.
+ * The table starts small and gets rehashed into the next size up whenever
+ * the chains get longer than SHADOW_HASH_LOAD entries on average, so that
+ * lookups only touch a couple of page_info structures however many shadows
+ * a domain has (e.g. a big PV guest in log-dirty mode).  It is only shrunk
+ * again by tearing it down. */
+
+static const unsigned int sh_hash_sizes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521
+};
+#define SHADOW_HASH_LOAD 2
 
 /* Hash function that takes a gfn or mfn, plus another byte of type info */
 typedef u32 key_t;
-static inline key_t sh_hash(unsigned long n, unsigned int t)
+static inline key_t sh_hash(unsigned long n, unsigned int t,
+                            unsigned int buckets)
 {
     unsigned char *p = (unsigned char *)&n;
     key_t k = t;
     int i;
     for ( i = 0; i < sizeof(n) ; i++ ) k = (u32)p[i] + (k<<6) + (k<<16) - k;
-    return k % SHADOW_HASH_BUCKETS;
+    return k % buckets;
 }
 
 /* Before we get to the mechanism, define a pair of audit functions
@@ -1481,7 +1530,8 @@ static void sh_hash_audit_bucket(struct domain *d, int bucket)
         /* Wrong page of a multi-page shadow? */
         BUG_ON( !sp->u.sh.head );
         /* Wrong bucket? */
-        BUG_ON( sh_hash(__backpointer(sp), sp->u.sh.type) != bucket );
+        BUG_ON( sh_hash(__backpointer(sp), sp->u.sh.type,
+                        d->arch.paging.shadow.hash_buckets) != bucket );
         /* Duplicate entry? */
         for ( x = next_shadow(sp); x; x = next_shadow(x) )
             BUG_ON( x->v.sh.back == sp->v.sh.back &&
@@ -1539,7 +1589,7 @@ static void sh_hash_audit(struct domain *d)
     if ( !(SHADOW_AUDIT & SHADOW_AUDIT_HASH_FULL) || !SHADOW_AUDIT_ENABLE )
         return;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         sh_hash_audit_bucket(d, i);
     }
@@ -1554,9 +1604,11 @@ static int shadow_hash_alloc(struct domain *d)
     ASSERT(paging_locked_by_me(d));
     ASSERT(!d->arch.paging.shadow.hash_table);
 
-    table = xzalloc_array(struct page_info *, SHADOW_HASH_BUCKETS);
+    table = xzalloc_array(struct page_info *, sh_hash_sizes[0]);
     if ( !table ) return 1;
     d->arch.paging.shadow.hash_table = table;
+    d->arch.paging.shadow.hash_buckets = sh_hash_sizes[0];
+    d->arch.paging.shadow.hash_entries = 0;
     return 0;
 }
 
@@ -1569,6 +1621,51 @@ static void shadow_hash_teardown(struct domain *d)
 
     xfree(d->arch.paging.shadow.hash_table);
     d->arch.paging.shadow.hash_table = NULL;
+    d->arch.paging.shadow.hash_buckets = 0;
+    d->arch.paging.shadow.hash_entries = 0;
+}
+
+/* Move all entries into a bigger table, if one can be had. */
+static void shadow_hash_grow(struct domain *d)
+{
+    struct page_info **old = d->arch.paging.shadow.hash_table, **table;
+    unsigned int i, old_buckets = d->arch.paging.shadow.hash_buckets;
+    unsigned int buckets = 0;
+
+    ASSERT(paging_locked_by_me(d));
+    ASSERT(!d->arch.paging.shadow.hash_walking);
+
+    for ( i = 0; i + 1 < ARRAY_SIZE(sh_hash_sizes); i++ )
+        if ( sh_hash_sizes[i] == old_buckets )
+        {
+            buckets = sh_hash_sizes[i + 1];
+            break;
+        }
+    if ( !buckets )
+        return;
+
+    /* Failing to grow is harmless: the chains just stay long. */
+    table = xzalloc_array(struct page_info *, buckets);
+    if ( !table )
+        return;
+
+    for ( i = 0; i < old_buckets; i++ )
+        while ( old[i] )
+        {
+            struct page_info *sp = old[i];
+            key_t key = sh_hash(__backpointer(sp), sp->u.sh.type, buckets);
+
+            old[i] = next_shadow(sp);
+            set_next_shadow(sp, table[key]);
+            table[key] = sp;
+        }
+
+    d->arch.paging.shadow.hash_table = table;
+    d->arch.paging.shadow.hash_buckets = buckets;
+    xfree(old);
+
+    perfc_incr(shadow_hash_resize);
+    sh_hash_audit(d);
 }
 
 
@@ -1578,6 +1675,7 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
 {
     struct page_info *sp, *prev;
     key_t key;
+    unsigned int depth = 0;
 
     ASSERT(paging_locked_by_me(d));
     ASSERT(d->arch.paging.shadow.hash_table);
@@ -1586,7 +1684,7 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_lookups);
-    key = sh_hash(n, t);
+    key = sh_hash(n, t, d->arch.paging.shadow.hash_buckets);
     sh_hash_audit_bucket(d, key);
 
     sp = d->arch.paging.shadow.hash_table[key];
@@ -1595,6 +1693,7 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
     {
         if ( __backpointer(sp) == n && sp->u.sh.type == t )
         {
+            perfc_incra(shadow_hash_chain, min(depth, 7u));
             /* Pull-to-front if 'sp' isn't already the head item */
             if ( unlikely(sp != d->arch.paging.shadow.hash_table[key]) )
             {
@@ -1619,8 +1718,10 @@ mfn_t shadow_hash_lookup(struct domain *d, unsigned long n, unsigned int t)
         }
         prev = sp;
         sp = next_shadow(sp);
+        depth++;
     }
 
+    perfc_incra(shadow_hash_chain, min(depth, 7u));
     perfc_incr(shadow_hash_lookup_miss);
     return INVALID_MFN;
 }
@@ -1639,7 +1740,7 @@ void shadow_hash_insert(struct domain *d, unsigned long n, unsigned int t,
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_inserts);
-    key = sh_hash(n, t);
+    key = sh_hash(n, t, d->arch.paging.shadow.hash_buckets);
     sh_hash_audit_bucket(d, key);
 
     /* Insert this shadow at the top of the bucket */
@@ -1648,6 +1749,12 @@ void shadow_hash_insert(struct domain *d, unsigned long n, unsigned int t,
     d->arch.paging.shadow.hash_table[key] = sp;
 
     sh_hash_audit_bucket(d, key);
+
+    /* Can't rehash while someone is walking the hash chains. */
+    if ( ++d->arch.paging.shadow.hash_entries >
+         d->arch.paging.shadow.hash_buckets * SHADOW_HASH_LOAD &&
+         !d->arch.paging.shadow.hash_walking )
+        shadow_hash_grow(d);
 }
 
 void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
@@ -1664,7 +1771,7 @@ void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
     sh_hash_audit(d);
 
     perfc_incr(shadow_hash_deletes);
-    key = sh_hash(n, t);
+    key = sh_hash(n, t, d->arch.paging.shadow.hash_buckets);
     sh_hash_audit_bucket(d, key);
 
     sp = mfn_to_page(smfn);
@@ -1688,6 +1795,7 @@ void shadow_hash_delete(struct domain *d, unsigned long n, unsigned int t,
         }
     }
     set_next_shadow(sp, NULL);
+    d->arch.paging.shadow.hash_entries--;
 
     sh_hash_audit_bucket(d, key);
 }
@@ -1721,7 +1829,7 @@ static void hash_vcpu_foreach(struct vcpu *v, unsigned int callback_mask,
     ASSERT(d->arch.paging.shadow.hash_walking == 0);
     d->arch.paging.shadow.hash_walking = 1;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         /* WARNING: This is not safe against changes to the hash table.
          * The callback *must* return non-zero if it has inserted or
@@ -1768,7 +1876,7 @@ static void hash_domain_foreach(struct domain *d,
     ASSERT(d->arch.paging.shadow.hash_walking == 0);
     d->arch.paging.shadow.hash_walking = 1;
 
-    for ( i = 0; i < SHADOW_HASH_BUCKETS; i++ )
+    for ( i = 0; i < d->arch.paging.shadow.hash_buckets; i++ )
     {
         /* WARNING: This is not safe against changes to the hash table.
          * The callback *must* return non-zero if it has inserted or
@@ -24,6 +24,8 @@
 #include <xen/nospec.h>
 #include <xen/trace.h>
 
+#include <asm/pv/shim.h>
+
 #define HYPERCALL(x)                                                \
     [ __HYPERVISOR_ ## x ] = { (hypercall_fn_t *) do_ ## x,         \
                                (hypercall_fn_t *) do_ ## x }
@@ -230,6 +232,9 @@ void pv_hypercall(struct cpu_user_regs *regs)
     perfc_incr(hypercalls);
 }
 
+#define mc_handle(type, arg) \
+    ((XEN_GUEST_HANDLE_PARAM(type)) { (void *)(arg) })
+
 enum mc_disposition arch_do_multicall_call(struct mc_state *state)
 {
     struct vcpu *curr = current;
@@ -240,13 +245,51 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
         struct multicall_entry *call = &state->call;
 
         op = call->op;
-        if ( (op < ARRAY_SIZE(pv_hypercall_table)) &&
-             pv_hypercall_table[op].native )
-            call->result = pv_hypercall_table[op].native(
-                call->args[0], call->args[1], call->args[2],
-                call->args[3], call->args[4], call->args[5]);
-        else
-            call->result = -ENOSYS;
+        switch ( op )
+        {
+        /*
+         * Call the hypercalls PV guests commonly batch directly, rather than
+         * indirectly through the hypercall table.
+         */
+        case __HYPERVISOR_update_va_mapping:
+            call->result = do_update_va_mapping(call->args[0], call->args[1],
+                                                call->args[2]);
+            break;
+
+        case __HYPERVISOR_mmu_update:
+            call->result = do_mmu_update(
+                mc_handle(mmu_update_t, call->args[0]), call->args[1],
+                mc_handle(uint, call->args[2]), call->args[3]);
+            break;
+
+        case __HYPERVISOR_mmuext_op:
+            call->result = do_mmuext_op(
+                mc_handle(mmuext_op_t, call->args[0]), call->args[1],
+                mc_handle(uint, call->args[2]), call->args[3]);
+            break;
+
+#ifdef CONFIG_GRANT_TABLE
+        case __HYPERVISOR_grant_table_op:
+            /* The shim substitutes its own handler in the table. */
+            if ( !pv_shim )
+            {
+                call->result = do_grant_table_op(
+                    call->args[0], mc_handle(void, call->args[1]),
+                    call->args[2]);
+                break;
+            }
+            /* fall through */
+#endif
+        default:
+            if ( (op < ARRAY_SIZE(pv_hypercall_table)) &&
+                 pv_hypercall_table[op].native )
+                call->result = pv_hypercall_table[op].native(
+                    call->args[0], call->args[1], call->args[2],
+                    call->args[3], call->args[4], call->args[5]);
+            else
+                call->result = -ENOSYS;
+            break;
+        }
     }
 #ifdef CONFIG_COMPAT
     else
@@ -270,6 +313,8 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
              ? mc_continue : mc_preempt;
 }
 
+#undef mc_handle
+
 void hypercall_page_initialise_ring3_kernel(void *hypercall_page)
 {
     void *p = hypercall_page;
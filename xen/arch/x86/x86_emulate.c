@@ -11,6 +11,7 @@
 
 #include <xen/domain_page.h>
 #include <xen/event.h>
+#include <xen/xmalloc.h>
 #include <asm/x86_emulate.h>
 #include <asm/processor.h> /* current_cpu_info */
 #include <asm/xstate.h>
@@ -44,6 +45,16 @@
 
 #include "x86_emulate/x86_emulate.c"
 
+struct x86_emulate_decode_cache *x86_emulate_decode_cache_alloc(void)
+{
+    return xzalloc(struct x86_emulate_decode_cache);
+}
+
+void x86_emulate_decode_cache_free(struct x86_emulate_decode_cache *cache)
+{
+    xfree(cache);
+}
+
 int x86emul_read_xcr(unsigned int reg, uint64_t *val,
                      struct x86_emulate_ctxt *ctxt)
 {
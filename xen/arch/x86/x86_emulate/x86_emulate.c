@@ -793,6 +793,15 @@ struct x86_emulate_state {
 #define imm1 ea.val
 #define imm2 ea.orig_val
 
+    /*
+     * GPRs (EA_NO_GPR if none) contributing to a memory operand's
+     * effective address, and whether it is rIP-relative.  Allows
+     * re-computing the address from a cached decode.
+     */
+    uint8_t ea_base, ea_index, ea_scale;
+#define EA_NO_GPR 0xff
+    bool ea_pc_rel;
+
     unsigned long ip;
     struct cpu_user_regs *regs;
 
@@ -2717,6 +2726,7 @@ x86_decode(
     ea.type = OP_NONE;
     ea.mem.seg = x86_seg_ds;
     ea.reg = PTR_POISON;
+    state->ea_base = state->ea_index = EA_NO_GPR;
     state->regs = ctxt->regs;
     state->ip = ctxt->regs->r(ip);
 
@@ -3084,32 +3094,44 @@ x86_decode(
             {
             case 0:
                 ea.mem.off = state->regs->bx + state->regs->si;
+                state->ea_base = 3;
+                state->ea_index = 6;
                 break;
             case 1:
                 ea.mem.off = state->regs->bx + state->regs->di;
+                state->ea_base = 3;
+                state->ea_index = 7;
                 break;
             case 2:
                 ea.mem.seg = x86_seg_ss;
                 ea.mem.off = state->regs->bp + state->regs->si;
+                state->ea_base = 5;
+                state->ea_index = 6;
                 break;
             case 3:
                 ea.mem.seg = x86_seg_ss;
                 ea.mem.off = state->regs->bp + state->regs->di;
+                state->ea_base = 5;
+                state->ea_index = 7;
                 break;
             case 4:
                 ea.mem.off = state->regs->si;
+                state->ea_base = 6;
                 break;
             case 5:
                 ea.mem.off = state->regs->di;
+                state->ea_base = 7;
                 break;
             case 6:
                 if ( modrm_mod == 0 )
                     break;
                 ea.mem.seg = x86_seg_ss;
                 ea.mem.off = state->regs->bp;
+                state->ea_base = 5;
                 break;
             case 7:
                 ea.mem.off = state->regs->bx;
+                state->ea_base = 3;
                 break;
             }
             switch ( modrm_mod )
@@ -3141,6 +3163,8 @@ x86_decode(
                 {
                     ea.mem.off = *decode_gpr(state->regs, state->sib_index);
                     ea.mem.off <<= state->sib_scale;
+                    state->ea_index = state->sib_index;
+                    state->ea_scale = state->sib_scale;
                 }
                 if ( (modrm_mod == 0) && ((sib_base & 7) == 5) )
                     ea.mem.off += insn_fetch_type(int32_t);
@@ -3148,6 +3172,7 @@ x86_decode(
                 {
                     ea.mem.seg  = x86_seg_ss;
                     ea.mem.off += state->regs->r(sp);
+                    state->ea_base = 4;
                     if ( !ext && (b == 0x8f) )
                         /* POP <rm> computes its EA post increment. */
                         ea.mem.off += ((mode_64bit() && (op_bytes == 4))
@@ -3157,15 +3182,20 @@ x86_decode(
                 {
                     ea.mem.seg  = x86_seg_ss;
                     ea.mem.off += state->regs->r(bp);
+                    state->ea_base = 5;
                 }
                 else
+                {
                     ea.mem.off += *decode_gpr(state->regs, sib_base);
+                    state->ea_base = sib_base;
+                }
             }
             else
             {
                 generate_exception_if(d & vSIB, EXC_UD);
                 modrm_rm |= (rex_prefix & 1) << 3;
                 ea.mem.off = *decode_gpr(state->regs, modrm_rm);
+                state->ea_base = modrm_rm;
                 if ( (modrm_rm == 5) && (modrm_mod != 0) )
                     ea.mem.seg = x86_seg_ss;
             }
@@ -3175,6 +3205,7 @@ x86_decode(
                 if ( (modrm_rm & 7) != 5 )
                     break;
                 ea.mem.off = insn_fetch_type(int32_t);
+                state->ea_base = EA_NO_GPR;
                 pc_rel = mode_64bit();
                 break;
             case 1:
@@ -3273,6 +3304,7 @@ x86_decode(
             ea.mem.off += state->ip;
 
         ea.mem.off = truncate_ea(ea.mem.off);
+        state->ea_pc_rel = pc_rel;
     }
 
     /*
@@ -3370,6 +3402,169 @@ x86_decode(
 #undef insn_fetch_bytes
 #undef insn_fetch_type
 
+/*
+ * Single entry cache of a recently decoded instruction.  A cached decode is
+ * re-used only for the same rIP and default address size, and only when the
+ * bytes at CS:rIP still match the cached ones (so modified code is always
+ * re-decoded).  The register dependent part of a memory operand's effective
+ * address is stored separately and re-computed on every hit.
+ */
+struct x86_emulate_decode_cache {
+    struct x86_emulate_state state;
+    unsigned long ip;
+    /* rIP of the last miss, to only fill on repeated misses. */
+    unsigned long miss_ip;
+    unsigned int opcode;
+    unsigned int addr_size;
+    /* Constant part of the memory operand's effective address. */
+    unsigned long ea_off;
+    uint8_t len;
+    uint8_t insn[MAX_INST_LEN];
+    unsigned long hits, misses;
+};
+
+static bool decode_cacheable(const struct x86_emulate_state *state,
+                             const struct x86_emulate_ctxt *ctxt)
+{
+    /*
+     * Only legacy encoded one- and two-byte opcodes are cached: decoding of
+     * VEX/EVEX/XOP encodings (including telling them apart from LES, LDS,
+     * BOUND, and POP) and of CR8 accesses depends on state other than the
+     * instruction bytes.
+     */
+    if ( (ctxt->opcode & X86EMUL_OPC_ENCODING_MASK) != X86EMUL_OPC_LEGACY_ )
+        return false;
+
+    switch ( ext )
+    {
+    case ext_none:
+        switch ( ctxt->opcode & 0xff )
+        {
+        case 0x62: case 0x8f: case 0xc4: case 0xc5:
+            return false;
+        }
+        return true;
+
+    case ext_0f:
+        switch ( ctxt->opcode & 0xff )
+        {
+        case 0x20: case 0x22:
+            return false;
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static unsigned long decode_cache_ea_regs(const struct x86_emulate_state *state,
+                                          struct cpu_user_regs *regs)
+{
+    unsigned long off = 0;
+
+    if ( state->ea_base != EA_NO_GPR )
+        off += *decode_gpr(regs, state->ea_base);
+    if ( state->ea_index != EA_NO_GPR )
+        off += *decode_gpr(regs, state->ea_index) << state->ea_scale;
+    if ( state->ea_pc_rel )
+        off += state->ip;
+
+    return off;
+}
+
+static bool decode_cache_lookup(
+    struct x86_emulate_decode_cache *cache,
+    struct x86_emulate_state *state,
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    uint8_t insn[MAX_INST_LEN];
+    unsigned long ip = ctxt->regs->r(ip);
+
+    if ( !cache->len || cache->ip != ip ||
+         cache->addr_size != ctxt->addr_size )
+        goto miss;
+
+    if ( ops->insn_fetch(x86_seg_cs, ip, insn, cache->len,
+                         ctxt) != X86EMUL_OKAY )
+    {
+        /* Let the full decode deal with (and report) the fault. */
+        x86_emul_reset_event(ctxt);
+        goto miss;
+    }
+
+    if ( memcmp(insn, cache->insn, cache->len) )
+        goto miss;
+
+    *state = cache->state;
+    state->regs = ctxt->regs;
+    state->ip = ip + cache->len;
+    if ( ea.type == OP_MEM )
+        ea.mem.off = truncate_ea(cache->ea_off +
+                                        decode_cache_ea_regs(state,
+                                                             ctxt->regs));
+    ctxt->opcode = cache->opcode;
+    cache->hits++;
+
+    return true;
+
+ miss:
+    cache->misses++;
+
+    return false;
+}
+
+static void decode_cache_fill(
+    struct x86_emulate_decode_cache *cache,
+    const struct x86_emulate_state *state,
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    unsigned long ip = ctxt->regs->r(ip);
+    unsigned int len = state->ip - ip;
+
+    /*
+     * Only cache an insn once it was seen twice in a row, to keep overhead
+     * low for a stream of distinct insns (which would never hit anyway).
+     */
+    if ( cache->miss_ip != ip )
+    {
+        cache->miss_ip = ip;
+        return;
+    }
+
+    cache->len = 0;
+
+    if ( !decode_cacheable(state, ctxt) || len > sizeof(cache->insn) )
+        return;
+
+    /* The bytes were just fetched, so this is expected to succeed. */
+    if ( ops->insn_fetch(x86_seg_cs, ip, cache->insn, len,
+                         ctxt) != X86EMUL_OKAY )
+    {
+        x86_emul_reset_event(ctxt);
+        return;
+    }
+
+    cache->state = *state;
+    cache->ip = ip;
+    cache->opcode = ctxt->opcode;
+    cache->addr_size = ctxt->addr_size;
+    if ( ea.type == OP_MEM )
+        cache->ea_off = ea.mem.off -
+                        decode_cache_ea_regs(state, ctxt->regs);
+    cache->len = len;
+}
+
+void x86_emulate_decode_cache_stats(
+    const struct x86_emulate_decode_cache *cache,
+    unsigned long *hits, unsigned long *misses)
+{
+    *hits = cache->hits;
+    *misses = cache->misses;
+}
+
 /* Undo DEBUG wrapper. */
 #undef x86_emulate
 
@@ -3410,9 +3605,16 @@ x86_emulate(
                            (_regs.eflags & X86_EFLAGS_VIP)),
                           EXC_GP, 0);
 
-    rc = x86_decode(&state, ctxt, ops);
-    if ( rc != X86EMUL_OKAY )
-        return rc;
+    if ( !ctxt->decode_cache ||
+         !decode_cache_lookup(ctxt->decode_cache, &state, ctxt, ops) )
+    {
+        rc = x86_decode(&state, ctxt, ops);
+        if ( rc != X86EMUL_OKAY )
+            return rc;
+
+        if ( ctxt->decode_cache )
+            decode_cache_fill(ctxt->decode_cache, &state, ctxt, ops);
+    }
 
     /* Sync rIP to post decode value. */
     _regs.r(ip) = state.ip;
@@ -511,6 +511,9 @@ struct x86_emulate_ctxt
     /* Caller data that can be used by x86_emulate_ops' routines. */
     void *data;
 
+    /* Optional cache of the last decoded insn (NULL: always decode). */
+    struct x86_emulate_decode_cache *decode_cache;
+
     /*
      * Input/output state:
      */
@@ -673,6 +676,16 @@ x86emul_unhandleable_rw(
     unsigned int bytes,
     struct x86_emulate_ctxt *ctxt);
 
+/*
+ * Decode cache to be hooked up via x86_emulate_ctxt.decode_cache, typically
+ * one per vCPU.  Allocation is provided by the respective environment.
+ */
+struct x86_emulate_decode_cache *x86_emulate_decode_cache_alloc(void);
+void x86_emulate_decode_cache_free(struct x86_emulate_decode_cache *cache);
+void x86_emulate_decode_cache_stats(
+    const struct x86_emulate_decode_cache *cache,
+    unsigned long *hits, unsigned long *misses);
+
 #ifdef __XEN__
 
 struct x86_emulate_state *
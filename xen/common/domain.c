@@ -411,6 +411,9 @@ struct domain *domain_create(domid_t domid,
         d->nr_pirqs = min(d->nr_pirqs, nr_irqs);
 
         radix_tree_init(&d->pirq_tree);
+#ifdef CONFIG_HAS_VPCI
+        radix_tree_init(&d->vpci_devs);
+#endif
     }
 
     if ( (err = arch_domain_create(d, config)) != 0 )
@@ -941,6 +944,9 @@ static void complete_domain_destroy(struct rcu_head *head)
     evtchn_destroy_final(d);
 
     radix_tree_destroy(&d->pirq_tree, free_pirq_struct);
+#ifdef CONFIG_HAS_VPCI
+    radix_tree_destroy(&d->vpci_devs, NULL);
+#endif
 
     xfree(d->vcpu);
 
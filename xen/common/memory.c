@@ -24,6 +24,7 @@
 #include <xen/mem_access.h>
 #include <xen/trace.h>
 #include <xen/grant_table.h>
+#include <xen/vm_event.h>
 #include <asm/current.h>
 #include <asm/hardirq.h>
 #include <asm/p2m.h>
@@ -424,6 +425,8 @@ static void decrease_reservation(struct memop_args *a)
          a->extent_order > max_order(current->domain) )
         return;
 
+    p2m_batch_begin(a->domain);
+
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
         unsigned long pod_done;
@@ -482,6 +485,7 @@ static void decrease_reservation(struct memop_args *a)
     }
 
  out:
+    p2m_batch_end(a->domain);
     a->nr_done = i;
 }
 
@@ -834,6 +838,8 @@ int xenmem_add_to_physmap(struct domain *d, struct xen_add_to_physmap *xatp,
     if ( has_iommu_pt(d) )
        this_cpu(iommu_dont_flush_iotlb) = 1;
 
+    p2m_batch_begin(d);
+
     while ( xatp->size > done )
     {
         rc = xenmem_add_to_physmap_one(d, XENMAPSPACE_gmfn, extra,
@@ -852,6 +858,8 @@ int xenmem_add_to_physmap(struct domain *d, struct xen_add_to_physmap *xatp,
         }
     }
 
+    p2m_batch_end(d);
+
     if ( has_iommu_pt(d) )
     {
         int ret;
@@ -876,6 +884,8 @@ static int xenmem_add_to_physmap_batch(struct domain *d,
                                        struct xen_add_to_physmap_batch *xatpb,
                                        unsigned int extent)
 {
+    int ret = 0;
+
     if ( xatpb->size < extent )
         return -EILSEQ;
 
@@ -884,6 +894,8 @@ static int xenmem_add_to_physmap_batch(struct domain *d,
          !guest_handle_subrange_okay(xatpb->errs, extent, xatpb->size - 1) )
         return -EFAULT;
 
+    p2m_batch_begin(d);
+
     while ( xatpb->size > extent )
     {
         xen_ulong_t idx;
@@ -894,21 +906,32 @@ static int xenmem_add_to_physmap_batch(struct domain *d,
                                                extent, 1)) ||
              unlikely(__copy_from_guest_offset(&gpfn, xatpb->gpfns,
                                                extent, 1)) )
-            return -EFAULT;
+        {
+            ret = -EFAULT;
+            break;
+        }
 
         rc = xenmem_add_to_physmap_one(d, xatpb->space,
                                        xatpb->u,
                                        idx, _gfn(gpfn));
 
         if ( unlikely(__copy_to_guest_offset(xatpb->errs, extent, &rc, 1)) )
-            return -EFAULT;
+        {
+            ret = -EFAULT;
+            break;
+        }
 
         /* Check for continuation if it's not the last iteration. */
         if ( xatpb->size > ++extent && hypercall_preempt_check() )
-            return extent;
+        {
+            ret = extent;
+            break;
+        }
     }
 
-    return 0;
+    p2m_batch_end(d);
+
+    return ret;
 }
 
 static int construct_memop_from_reservation(
@@ -1096,6 +1119,11 @@ static int acquire_resource(
                                  mfn_list);
         break;
 
+    case XENMEM_resource_vm_event:
+        rc = vm_event_get_ring_frames(d, xmar.id, xmar.frame, xmar.nr_frames,
+                                      mfn_list);
+        break;
+
     default:
         rc = arch_acquire_resource(d, xmar.type, xmar.id, xmar.frame,
                                    xmar.nr_frames, mfn_list, &xmar.flags);
@@ -32,14 +32,23 @@ static void trace_multicall_call(multicall_entry_t *call)
     __trace_multicall_call(call);
 }
 
+/*
+ * Entries are copied in from, and their results back out to, guest memory
+ * a batch at a time rather than one by one.  Callers must therefore not
+ * rely on sub-calls modifying the entries following them.
+ */
+#define MULTICALL_BATCH 8
+
 ret_t
 do_multicall(
     XEN_GUEST_HANDLE_PARAM(multicall_entry_t) call_list, uint32_t nr_calls)
 {
     struct vcpu *curr = current;
     struct mc_state *mcs = &curr->mc_state;
-    uint32_t         i;
+    struct multicall_entry batch[MULTICALL_BATCH];
+    uint32_t         i, j = 0, nr = 0;
     int              rc = 0;
+    bool             preempt = false;
     enum mc_disposition disp = mc_continue;
 
     if ( unlikely(__test_and_set_bit(_MCSF_in_multicall, &mcs->flags)) )
@@ -51,17 +60,40 @@ do_multicall(
     if ( unlikely(!guest_handle_okay(call_list, nr_calls)) )
         rc = -EFAULT;
 
+    /*
+     * call_list refers to batch[0], and the results of batch[0 ... j - 1]
+     * are still to be written back.
+     */
     for ( i = 0; !rc && disp == mc_continue && i < nr_calls; i++ )
     {
         if ( i && hypercall_preempt_check() )
-            goto preempted;
-
-        if ( unlikely(__copy_from_guest(&mcs->call, call_list, 1)) )
         {
-            rc = -EFAULT;
+            preempt = true;
             break;
         }
 
+        if ( j == nr )
+        {
+            if ( unlikely(__copy_to_guest(call_list, batch, j)) )
+            {
+                rc = -EFAULT;
+                j = 0;
+                break;
+            }
+            guest_handle_add_offset(call_list, j);
+            j = 0;
+
+            nr = min_t(uint32_t, nr_calls - i, MULTICALL_BATCH);
+            if ( unlikely(__copy_from_guest(batch, call_list, nr)) )
+            {
+                rc = -EFAULT;
+                break;
+            }
+            perfc_incr(multicall_batches);
+        }
+
+        mcs->call = batch[j];
+
         trace_multicall_call(&mcs->call);
 
         disp = arch_do_multicall_call(mcs);
@@ -74,47 +106,52 @@ do_multicall(
         ASSERT_NOT_IN_ATOMIC();
 
 #ifndef NDEBUG
-        {
-            /*
-             * Deliberately corrupt the contents of the multicall structure.
-             * The caller must depend only on the 'result' field on return.
-             */
-            struct multicall_entry corrupt;
-            memset(&corrupt, 0xAA, sizeof(corrupt));
-            (void)__copy_to_guest(call_list, &corrupt, 1);
-        }
+        /*
+         * Deliberately corrupt the contents of the multicall structure.
+         * The caller must depend only on the 'result' field on return.
+         */
+        memset(&batch[j], 0xAA, sizeof(batch[j]));
 #endif
+        batch[j].result = mcs->call.result;
 
         if ( unlikely(disp == mc_exit) )
-        {
-            if ( __copy_field_to_guest(call_list, &mcs->call, result) )
-                /* nothing, best effort only */;
             rc = mcs->call.result;
-        }
-        else if ( unlikely(__copy_field_to_guest(call_list, &mcs->call,
-                                                 result)) )
-            rc = -EFAULT;
         else if ( curr->hcall_preempted )
         {
             /* Translate sub-call continuation to guest layout */
             xlat_multicall_entry(mcs);
 
-            /* Copy the sub-call continuation. */
-            if ( likely(!__copy_to_guest(call_list, &mcs->call, 1)) )
+            /* Copy the sub-call continuation, and the results before it. */
+            batch[j] = mcs->call;
+            if ( likely(!__copy_to_guest(call_list, batch, j + 1)) )
+            {
+                guest_handle_add_offset(call_list, j);
                 goto preempted;
+            }
             else
                 hypercall_cancel_continuation(curr);
             rc = -EFAULT;
+            j = 0;
+            break;
         }
-        else
-            guest_handle_add_offset(call_list, 1);
+
+        j++;
+    }
+
+    if ( j )
+    {
+        if ( unlikely(__copy_to_guest(call_list, batch, j)) &&
+             disp != mc_exit ) /* best effort only */
+            rc = -EFAULT;
+        guest_handle_add_offset(call_list, j);
     }
 
-    if ( unlikely(disp == mc_preempt) && i < nr_calls )
+    if ( !rc && (preempt || (unlikely(disp == mc_preempt) && i < nr_calls)) )
         goto preempted;
 
     perfc_incr(calls_to_multicall);
     perfc_add(calls_from_multicall, i);
+    perfc_incra(multicall_sizes, min(fls(i), 7));
     mcs->flags = 0;
     return rc;
 
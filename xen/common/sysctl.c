@@ -114,6 +114,73 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_getvcpuinfolist:
+    {
+        struct xen_sysctl_getvcpuinfolist *list = &op->u.getvcpuinfolist;
+        struct domain *d;
+        struct vcpu *v;
+        uint32_t num_vcpus = 0;
+
+        rcu_read_lock(&domlist_read_lock);
+
+        for_each_domain ( d )
+        {
+            unsigned int nr = 0;
+
+            if ( d->domain_id < list->first_domain )
+                continue;
+
+            /* What XEN_DOMCTL_getvcpuinfo would provide; skip if denied. */
+            if ( xsm_domctl(XSM_OTHER, d, XEN_DOMCTL_getvcpuinfo) )
+                continue;
+
+            for_each_vcpu ( d, v )
+                nr++;
+            if ( nr > list->max_vcpus - num_vcpus )
+            {
+                if ( !num_vcpus )
+                    ret = -ENOBUFS;
+                break;
+            }
+
+            for_each_vcpu ( d, v )
+            {
+                struct xen_sysctl_vcpuinfo info = {
+                    .domid = d->domain_id,
+                    .vcpu = v->vcpu_id,
+                };
+                struct vcpu_runstate_info runstate;
+
+                vcpu_runstate_get(v, &runstate);
+
+                info.online   = !(v->pause_flags & VPF_down);
+                info.blocked  = !!(v->pause_flags & VPF_blocked);
+                info.running  = v->is_running;
+                info.cpu_time = runstate.time[RUNSTATE_running];
+                info.cpu      = v->processor;
+
+                if ( copy_to_guest_offset(list->buffer, num_vcpus, &info, 1) )
+                {
+                    ret = -EFAULT;
+                    break;
+                }
+
+                num_vcpus++;
+            }
+
+            if ( ret )
+                break;
+        }
+
+        rcu_read_unlock(&domlist_read_lock);
+
+        if ( ret != 0 )
+            break;
+
+        list->num_vcpus = num_vcpus;
+    }
+    break;
+
 #ifdef CONFIG_PERF_COUNTERS
     case XEN_SYSCTL_perfc_op:
         ret = perfc_control(&op->u.perfc_op);
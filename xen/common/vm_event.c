@@ -22,6 +22,7 @@
 
 #include <xen/sched.h>
 #include <xen/event.h>
+#include <xen/vmap.h>
 #include <xen/wait.h>
 #include <xen/vm_event.h>
 #include <xen/mem_access.h>
@@ -39,6 +40,84 @@
 #define vm_event_ring_lock(_ved)       spin_lock(&(_ved)->ring_lock)
 #define vm_event_ring_unlock(_ved)     spin_unlock(&(_ved)->ring_lock)
 
+/* Responses handled before waking vCPUs waiting for ring space */
+#define VM_EVENT_RESUME_BATCH 32
+
+static void vm_event_free_ring(struct vm_event_domain *ved)
+{
+    unsigned int i;
+
+    if ( !ved->ring_pages )
+    {
+        destroy_ring_for_helper(&ved->ring_page, ved->ring_pg_struct);
+        return;
+    }
+
+    if ( ved->ring_page )
+        vunmap(ved->ring_page);
+    ved->ring_page = NULL;
+
+    for ( i = 0; i < ved->nr_ring_pages; i++ )
+    {
+        struct page_info *page = ved->ring_pages[i];
+
+        if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+            put_page(page);
+        put_page_and_type(page);
+    }
+
+    xfree(ved->ring_pages);
+    ved->ring_pages = NULL;
+    ved->nr_ring_pages = 0;
+}
+
+/*
+ * Allocate a ring of nr_frames pages.  The pages are owned by the domain
+ * (without counting towards its allocation), so that the helper can map
+ * them, but they are never part of its physmap.
+ */
+static int vm_event_alloc_ring(struct domain *d, struct vm_event_domain *ved,
+                               unsigned int nr_frames)
+{
+    mfn_t mfns[XEN_VM_EVENT_MAX_RING_FRAMES];
+    unsigned int i;
+
+    ved->ring_pages = xzalloc_array(struct page_info *, nr_frames);
+    if ( !ved->ring_pages )
+        return -ENOMEM;
+
+    for ( i = 0; i < nr_frames; i++ )
+    {
+        struct page_info *page = alloc_domheap_page(d, MEMF_no_refcount);
+
+        if ( !page )
+            goto fail;
+
+        if ( !get_page_and_type(page, d, PGT_writable_page) )
+        {
+            if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+                put_page(page);
+            goto fail;
+        }
+
+        ved->ring_pages[ved->nr_ring_pages++] = page;
+        mfns[i] = page_to_mfn(page);
+    }
+
+    ved->ring_page = vmap(mfns, nr_frames);
+    if ( !ved->ring_page )
+        goto fail;
+
+    memset(ved->ring_page, 0, nr_frames * PAGE_SIZE);
+    SHARED_RING_INIT((vm_event_sring_t *)ved->ring_page);
+
+    return 0;
+
+ fail:
+    vm_event_free_ring(ved);
+    return -ENOMEM;
+}
+
 static int vm_event_enable(
     struct domain *d,
     struct xen_domctl_vm_event_op *vec,
@@ -49,6 +128,10 @@ static int vm_event_enable(
 {
     int rc;
     unsigned long ring_gfn = d->arch.hvm.params[param];
+    unsigned int nr_frames = vec->u.enable.nr_frames;
+
+    if ( nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
+        return -EINVAL;
 
     if ( !*ved )
         *ved = xzalloc(struct vm_event_domain);
@@ -63,7 +146,7 @@ static int vm_event_enable(
 
     /* The parameter defaults to zero, and it should be
      * set to something */
-    if ( ring_gfn == 0 )
+    if ( !nr_frames && ring_gfn == 0 )
         return -ENOSYS;
 
     vm_event_ring_lock_init(*ved);
@@ -74,8 +157,11 @@ static int vm_event_enable(
     if ( rc < 0 )
         goto err;
 
-    rc = prepare_ring_for_helper(d, ring_gfn, &(*ved)->ring_pg_struct,
-                                 &(*ved)->ring_page);
+    if ( nr_frames )
+        rc = vm_event_alloc_ring(d, *ved, nr_frames);
+    else
+        rc = prepare_ring_for_helper(d, ring_gfn, &(*ved)->ring_pg_struct,
+                                     &(*ved)->ring_page);
     if ( rc < 0 )
         goto err;
 
@@ -93,7 +179,7 @@ static int vm_event_enable(
     /* Prepare ring buffer */
     FRONT_RING_INIT(&(*ved)->front_ring,
                     (vm_event_sring_t *)(*ved)->ring_page,
-                    PAGE_SIZE);
+                    (nr_frames ?: 1) * PAGE_SIZE);
 
     /* Save the pause flag for this particular ring. */
     (*ved)->pause_flag = pause_flag;
@@ -105,8 +191,7 @@ static int vm_event_enable(
     return 0;
 
  err:
-    destroy_ring_for_helper(&(*ved)->ring_page,
-                            (*ved)->ring_pg_struct);
+    vm_event_free_ring(*ved);
     vm_event_ring_unlock(*ved);
     xfree(*ved);
     *ved = NULL;
@@ -221,8 +306,7 @@ static int vm_event_disable(struct domain *d, struct vm_event_domain **ved)
             }
         }
 
-        destroy_ring_for_helper(&(*ved)->ring_page,
-                                (*ved)->ring_pg_struct);
+        vm_event_free_ring(*ved);
 
         vm_event_cleanup_domain(d);
 
@@ -324,22 +408,18 @@ void vm_event_put_request(struct domain *d,
     notify_via_xen_event_channel(d, ved->xen_port);
 }
 
-int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
-                          vm_event_response_t *rsp)
+/* Take a response off the ring.  Must be called with the ring lock held. */
+static bool vm_event_pull_response(struct vm_event_domain *ved,
+                                   vm_event_response_t *rsp)
 {
     vm_event_front_ring_t *front_ring;
     RING_IDX rsp_cons;
 
-    vm_event_ring_lock(ved);
-
     front_ring = &ved->front_ring;
     rsp_cons = front_ring->rsp_cons;
 
     if ( !RING_HAS_UNCONSUMED_RESPONSES(front_ring) )
-    {
-        vm_event_ring_unlock(ved);
-        return 0;
-    }
+        return false;
 
     /* Copy response */
     memcpy(rsp, RING_GET_RESPONSE(front_ring, rsp_cons), sizeof(*rsp));
@@ -349,13 +429,95 @@ int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
     front_ring->rsp_cons = rsp_cons;
     front_ring->sring->rsp_event = rsp_cons + 1;
 
+    return true;
+}
+
+int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
+                          vm_event_response_t *rsp)
+{
+    bool found;
+
+    vm_event_ring_lock(ved);
+
+    found = vm_event_pull_response(ved, rsp);
+
     /* Kick any waiters -- since we've just consumed an event,
      * there may be additional space available in the ring. */
-    vm_event_wake(d, ved);
+    if ( found )
+        vm_event_wake(d, ved);
 
     vm_event_ring_unlock(ved);
 
-    return 1;
+    return found;
+}
+
+/*
+ * Act on a single response.  Returns the vCPU to unpause, if any.
+ */
+static struct vcpu *vm_event_handle_response(struct domain *d,
+                                             vm_event_response_t *rsp)
+{
+    struct vcpu *v;
+
+    if ( rsp->version != VM_EVENT_INTERFACE_VERSION )
+    {
+        printk(XENLOG_G_WARNING "vm_event interface version mismatch\n");
+        return NULL;
+    }
+
+    /* Validate the vcpu_id in the response. */
+    if ( (rsp->vcpu_id >= d->max_vcpus) || !d->vcpu[rsp->vcpu_id] )
+        return NULL;
+
+    v = d->vcpu[rsp->vcpu_id];
+
+    /*
+     * In some cases the response type needs extra handling, so here
+     * we call the appropriate handlers.
+     */
+
+    /* Check flags which apply only when the vCPU is paused */
+    if ( atomic_read(&v->vm_event_pause_count) )
+    {
+#ifdef CONFIG_HAS_MEM_PAGING
+        if ( rsp->reason == VM_EVENT_REASON_MEM_PAGING )
+            p2m_mem_paging_resume(d, rsp);
+#endif
+
+        /*
+         * Check emulation flags in the arch-specific handler only, as it
+         * has to set arch-specific flags when supported, and to avoid
+         * bitmask overhead when it isn't supported.
+         */
+        vm_event_emulate_check(v, rsp);
+
+        /*
+         * Check in arch-specific handler to avoid bitmask overhead when
+         * not supported.
+         */
+        vm_event_register_write_resume(v, rsp);
+
+        /*
+         * Check in arch-specific handler to avoid bitmask overhead when
+         * not supported.
+         */
+        vm_event_toggle_singlestep(d, v, rsp);
+
+        /* Check for altp2m switch */
+        if ( rsp->flags & VM_EVENT_FLAG_ALTERNATE_P2M )
+            p2m_altp2m_check(v, rsp->altp2m_idx);
+
+        if ( rsp->flags & VM_EVENT_FLAG_SET_REGISTERS )
+            vm_event_set_registers(v, rsp);
+
+        if ( rsp->flags & VM_EVENT_FLAG_GET_NEXT_INTERRUPT )
+            vm_event_monitor_next_interrupt(v);
+
+        if ( rsp->flags & VM_EVENT_FLAG_VCPU_PAUSED )
+            return v;
+    }
+
+    return NULL;
 }
 
 /*
@@ -363,12 +525,19 @@ int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
  * if required. Based on the response type, here we can also call custom
  * handlers.
  *
+ * Responses are handled in batches: waiters for ring space get woken, and
+ * the vCPUs the responses were for unpaused, once per batch rather than
+ * once per response.
+ *
  * Note: responses are handled the same way regardless of which ring they
  * arrive on.
  */
 void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
 {
     vm_event_response_t rsp;
+    struct vcpu *unpause[VM_EVENT_RESUME_BATCH];
+    unsigned int i, nr_rsp, nr_unpause;
+    bool more = true;
 
     /*
      * vm_event_resume() runs in either XEN_DOMCTL_VM_EVENT_OP_*, or
@@ -381,67 +550,37 @@ void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
     ASSERT(d != current->domain);
 
     /* Pull all responses off the ring. */
-    while ( vm_event_get_response(d, ved, &rsp) )
+    while ( more )
     {
-        struct vcpu *v;
+        nr_unpause = 0;
 
-        if ( rsp.version != VM_EVENT_INTERFACE_VERSION )
+        for ( nr_rsp = 0; nr_rsp < VM_EVENT_RESUME_BATCH; nr_rsp++ )
         {
-            printk(XENLOG_G_WARNING "vm_event interface version mismatch\n");
-            continue;
-        }
+            struct vcpu *v;
 
-        /* Validate the vcpu_id in the response. */
-        if ( (rsp.vcpu_id >= d->max_vcpus) || !d->vcpu[rsp.vcpu_id] )
-            continue;
+            vm_event_ring_lock(ved);
+            more = vm_event_pull_response(ved, &rsp);
+            vm_event_ring_unlock(ved);
 
-        v = d->vcpu[rsp.vcpu_id];
+            if ( !more )
+                break;
 
-        /*
-         * In some cases the response type needs extra handling, so here
-         * we call the appropriate handlers.
-         */
+            v = vm_event_handle_response(d, &rsp);
+            if ( v )
+                unpause[nr_unpause++] = v;
+        }
 
-        /* Check flags which apply only when the vCPU is paused */
-        if ( atomic_read(&v->vm_event_pause_count) )
+        if ( nr_rsp )
         {
-#ifdef CONFIG_HAS_MEM_PAGING
-            if ( rsp.reason == VM_EVENT_REASON_MEM_PAGING )
-                p2m_mem_paging_resume(d, &rsp);
-#endif
-
-            /*
-             * Check emulation flags in the arch-specific handler only, as it
-             * has to set arch-specific flags when supported, and to avoid
-             * bitmask overhead when it isn't supported.
-             */
-            vm_event_emulate_check(v, &rsp);
-
-            /*
-             * Check in arch-specific handler to avoid bitmask overhead when
-             * not supported.
-             */
-            vm_event_register_write_resume(v, &rsp);
-
-            /*
-             * Check in arch-specific handler to avoid bitmask overhead when
-             * not supported.
-             */
-            vm_event_toggle_singlestep(d, v, &rsp);
-
-            /* Check for altp2m switch */
-            if ( rsp.flags & VM_EVENT_FLAG_ALTERNATE_P2M )
-                p2m_altp2m_check(v, rsp.altp2m_idx);
-
-            if ( rsp.flags & VM_EVENT_FLAG_SET_REGISTERS )
-                vm_event_set_registers(v, &rsp);
-
-            if ( rsp.flags & VM_EVENT_FLAG_GET_NEXT_INTERRUPT )
-                vm_event_monitor_next_interrupt(v);
-
-            if ( rsp.flags & VM_EVENT_FLAG_VCPU_PAUSED )
-                vm_event_vcpu_unpause(v);
+            /* Kick any waiters -- since we've just consumed events,
+             * there may be additional space available in the ring. */
+            vm_event_ring_lock(ved);
+            vm_event_wake(d, ved);
+            vm_event_ring_unlock(ved);
         }
+
+        for ( i = 0; i < nr_unpause; i++ )
+            vm_event_vcpu_unpause(unpause[i]);
     }
 }
 
@@ -785,6 +924,74 @@ int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec,
     return rc;
 }
 
+/*
+ * Look up the frames of a ring allocated by Xen, for the helper to map via
+ * XENMEM_acquire_resource.  Synchronises with enabling and disabling of the
+ * ring by way of the domctl lock.
+ */
+int vm_event_get_ring_frames(struct domain *d, unsigned int mode,
+                             unsigned long frame, unsigned int nr_frames,
+                             xen_pfn_t mfn_list[])
+{
+    struct vm_event_domain *ved;
+    unsigned int i;
+    int rc;
+
+    rc = xsm_vm_event_control(XSM_PRIV, d, mode, XEN_VM_EVENT_ENABLE);
+    if ( rc )
+        return rc;
+
+    if ( !domctl_lock_acquire() )
+        return -EAGAIN;
+
+    switch ( mode )
+    {
+#ifdef CONFIG_HAS_MEM_PAGING
+    case XEN_DOMCTL_VM_EVENT_OP_PAGING:
+        ved = d->vm_event_paging;
+        break;
+#endif
+
+    case XEN_DOMCTL_VM_EVENT_OP_MONITOR:
+        ved = d->vm_event_monitor;
+        break;
+
+#ifdef CONFIG_HAS_MEM_SHARING
+    case XEN_DOMCTL_VM_EVENT_OP_SHARING:
+        ved = d->vm_event_share;
+        break;
+#endif
+
+    default:
+        rc = -EINVAL;
+        goto out;
+    }
+
+    rc = -ENOENT;
+    if ( !vm_event_check_ring(ved) )
+        goto out;
+
+    /* Rings set up at a guest frame are mapped by way of that frame. */
+    rc = -EOPNOTSUPP;
+    if ( !ved->ring_pages )
+        goto out;
+
+    rc = -EINVAL;
+    if ( frame >= ved->nr_ring_pages ||
+         nr_frames > ved->nr_ring_pages - frame )
+        goto out;
+
+    for ( i = 0; i < nr_frames; i++ )
+        mfn_list[i] = mfn_x(page_to_mfn(ved->ring_pages[frame + i]));
+
+    rc = 0;
+
+ out:
+    domctl_lock_release();
+
+    return rc;
+}
+
 void vm_event_vcpu_pause(struct vcpu *v)
 {
     ASSERT(v == current);
@@ -35,15 +35,16 @@ static unsigned int pfn_to_pde_idx(unsigned long pfn, unsigned int level)
     return idx;
 }
 
-static unsigned int clear_iommu_pte_present(unsigned long l1_mfn,
-                                            unsigned long dfn)
+static unsigned int clear_iommu_pte_present(unsigned long pt_mfn,
+                                            unsigned long dfn,
+                                            unsigned int level)
 {
     uint64_t *table, *pte;
     unsigned int flush_flags;
 
-    table = map_domain_page(_mfn(l1_mfn));
+    table = map_domain_page(_mfn(pt_mfn));
 
-    pte = (table + pfn_to_pde_idx(dfn, 1));
+    pte = (table + pfn_to_pde_idx(dfn, level));
 
     flush_flags = get_field_from_reg_u32(*pte, IOMMU_PTE_PRESENT_MASK,
                                          IOMMU_PTE_PRESENT_SHIFT) ?
@@ -338,12 +339,12 @@ uint64_t amd_iommu_get_address_from_pte(void *pte)
     return ptr;
 }
 
-/* Walk io page tables and build level page tables if necessary
- * {Re, un}mapping super page frames causes re-allocation of io
- * page tables.
+/* Walk io page tables down to the target level and build level page
+ * tables if necessary.  {Re, un}mapping part of a super page frame causes
+ * re-allocation of io page tables.
  */
 static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
-                              unsigned long pt_mfn[])
+                              unsigned int target, unsigned long pt_mfn[])
 {
     uint64_t *pde, *next_table_vaddr;
     unsigned long  next_table_mfn;
@@ -358,13 +359,15 @@ static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
 
     next_table_mfn = mfn_x(page_to_mfn(table));
 
-    if ( level == 1 )
+    ASSERT(target >= 1 && target <= level);
+
+    if ( level == target )
     {
         pt_mfn[level] = next_table_mfn;
         return 0;
     }
 
-    while ( level > 1 )
+    while ( level > target )
     {
         unsigned int next_level = level - 1;
         pt_mfn[level] = next_table_mfn;
@@ -383,6 +386,15 @@ static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
             int i;
             unsigned long mfn, pfn;
             unsigned int page_sz;
+            /* The pieces inherit the super page's permissions. */
+            bool iw = get_field_from_reg_u32(
+                          ((uint32_t *)pde)[1],
+                          IOMMU_PTE_IO_WRITE_PERMISSION_MASK,
+                          IOMMU_PTE_IO_WRITE_PERMISSION_SHIFT);
+            bool ir = get_field_from_reg_u32(
+                          ((uint32_t *)pde)[1],
+                          IOMMU_PTE_IO_READ_PERMISSION_MASK,
+                          IOMMU_PTE_IO_READ_PERMISSION_SHIFT);
 
             page_sz = 1 << (PTE_PER_TABLE_SHIFT * (next_level - 1));
             pfn =  dfn & ~((1 << (PTE_PER_TABLE_SHIFT * next_level)) - 1);
@@ -404,7 +416,7 @@ static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
             for ( i = 0; i < PTE_PER_TABLE_SIZE; i++ )
             {
                 set_iommu_pte_present(next_table_mfn, pfn, mfn, next_level,
-                                      !!IOMMUF_writable, !!IOMMUF_readable);
+                                      iw, ir);
                 mfn += page_sz;
                 pfn += page_sz;
              }
@@ -440,11 +452,102 @@ static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
         level--;
     }
 
-    /* mfn of level 1 page table */
+    /* mfn of target level page table */
     pt_mfn[level] = next_table_mfn;
     return 0;
 }
 
+/*
+ * Install a leaf entry at the given level (a super page one above level 1).
+ * Where a page table sits in place of the entry, or the page tables don't
+ * reach up to that level, the entries one level down get set instead:
+ * freeing the table would need to wait for the IOTLB flush the caller does
+ * later.
+ */
+static int set_iommu_leaf(struct domain *d, unsigned long dfn,
+                          unsigned long mfn, unsigned int level,
+                          unsigned int flags, unsigned int *flush_flags)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    unsigned long pt_mfn[7], step;
+    uint64_t *table;
+    uint32_t *pde;
+    unsigned int i;
+    bool in_way = level > hd->arch.paging_mode;
+    int rc = 0;
+
+    if ( !in_way )
+    {
+        memset(pt_mfn, 0, sizeof(pt_mfn));
+
+        if ( iommu_pde_from_dfn(d, dfn, level, pt_mfn) ||
+             (pt_mfn[level] == 0) )
+            return -EFAULT;
+
+        table = map_domain_page(_mfn(pt_mfn[level]));
+        pde = (uint32_t *)(table + pfn_to_pde_idx(dfn, level));
+        in_way = level > 1 && iommu_is_pte_present(pde) &&
+                 iommu_next_level(pde);
+        if ( !in_way )
+            *flush_flags |= set_iommu_pde_present(pde, mfn, 0,
+                                                  flags & IOMMUF_writable,
+                                                  flags & IOMMUF_readable);
+        unmap_domain_page(table);
+
+        if ( !in_way )
+            return 0;
+    }
+
+    step = 1ul << (PTE_PER_TABLE_SHIFT * (level - 2));
+    for ( i = 0; i < PTE_PER_TABLE_SIZE && !rc; i++ )
+        rc = set_iommu_leaf(d, dfn + i * step, mfn + i * step, level - 1,
+                            flags, flush_flags);
+
+    return rc;
+}
+
+/* Counterpart of set_iommu_leaf(). */
+static int clear_iommu_leaf(struct domain *d, unsigned long dfn,
+                            unsigned int level, unsigned int *flush_flags)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    unsigned long pt_mfn[7], step;
+    uint64_t *table;
+    uint32_t *pde;
+    unsigned int i;
+    bool in_way = level > hd->arch.paging_mode;
+    int rc = 0;
+
+    if ( !in_way )
+    {
+        memset(pt_mfn, 0, sizeof(pt_mfn));
+
+        if ( iommu_pde_from_dfn(d, dfn, level, pt_mfn) ||
+             (pt_mfn[level] == 0) )
+            return -EFAULT;
+
+        table = map_domain_page(_mfn(pt_mfn[level]));
+        pde = (uint32_t *)(table + pfn_to_pde_idx(dfn, level));
+        in_way = level > 1 && iommu_is_pte_present(pde) &&
+                 iommu_next_level(pde);
+        unmap_domain_page(table);
+
+        if ( !in_way )
+        {
+            /* mark PTE as 'page not present' */
+            *flush_flags |= clear_iommu_pte_present(pt_mfn[level], dfn,
+                                                    level);
+            return 0;
+        }
+    }
+
+    step = 1ul << (PTE_PER_TABLE_SHIFT * (level - 2));
+    for ( i = 0; i < PTE_PER_TABLE_SIZE && !rc; i++ )
+        rc = clear_iommu_leaf(d, dfn + i * step, level - 1, flush_flags);
+
+    return rc;
+}
+
 static int update_paging_mode(struct domain *d, unsigned long dfn)
 {
     uint16_t bdf;
@@ -544,13 +647,10 @@ int amd_iommu_map_page(struct domain *d, dfn_t dfn, mfn_t mfn,
 {
     struct domain_iommu *hd = dom_iommu(d);
     int rc;
-    unsigned long pt_mfn[7];
 
     if ( iommu_use_hap_pt(d) )
         return 0;
 
-    memset(pt_mfn, 0, sizeof(pt_mfn));
-
     spin_lock(&hd->arch.mapping_lock);
 
     rc = amd_iommu_alloc_root(hd);
@@ -577,36 +677,31 @@ int amd_iommu_map_page(struct domain *d, dfn_t dfn, mfn_t mfn,
         }
     }
 
-    if ( iommu_pde_from_dfn(d, dfn_x(dfn), pt_mfn) || (pt_mfn[1] == 0) )
+    rc = set_iommu_leaf(d, dfn_x(dfn), mfn_x(mfn),
+                        IOMMUF_get_order(flags) / PTE_PER_TABLE_SHIFT + 1,
+                        flags, flush_flags);
+    if ( rc )
     {
         spin_unlock(&hd->arch.mapping_lock);
         AMD_IOMMU_DEBUG("Invalid IO pagetable entry dfn = %"PRI_dfn"\n",
                         dfn_x(dfn));
         domain_crash(d);
-        return -EFAULT;
+        return rc;
     }
 
-    /* Install 4k mapping */
-    *flush_flags |= set_iommu_pte_present(pt_mfn[1], dfn_x(dfn), mfn_x(mfn),
-                                          1, (flags & IOMMUF_writable),
-                                          (flags & IOMMUF_readable));
-
     spin_unlock(&hd->arch.mapping_lock);
 
     return 0;
 }
 
-int amd_iommu_unmap_page(struct domain *d, dfn_t dfn,
+int amd_iommu_unmap_page(struct domain *d, dfn_t dfn, unsigned int order,
                          unsigned int *flush_flags)
 {
-    unsigned long pt_mfn[7];
     struct domain_iommu *hd = dom_iommu(d);
 
     if ( iommu_use_hap_pt(d) )
         return 0;
 
-    memset(pt_mfn, 0, sizeof(pt_mfn));
-
     spin_lock(&hd->arch.mapping_lock);
 
     if ( !hd->arch.root_table )
@@ -632,7 +727,8 @@ int amd_iommu_unmap_page(struct domain *d, dfn_t dfn,
         }
     }
 
-    if ( iommu_pde_from_dfn(d, dfn_x(dfn), pt_mfn) || (pt_mfn[1] == 0) )
+    if ( clear_iommu_leaf(d, dfn_x(dfn), order / PTE_PER_TABLE_SHIFT + 1,
+                          flush_flags) )
     {
         spin_unlock(&hd->arch.mapping_lock);
         AMD_IOMMU_DEBUG("Invalid IO pagetable entry dfn = %"PRI_dfn"\n",
@@ -641,9 +737,6 @@ int amd_iommu_unmap_page(struct domain *d, dfn_t dfn,
         return -EFAULT;
     }
 
-    /* mark PTE as 'page not present' */
-    *flush_flags |= clear_iommu_pte_present(pt_mfn[1], dfn_x(dfn));
-
     spin_unlock(&hd->arch.mapping_lock);
 
     return 0;
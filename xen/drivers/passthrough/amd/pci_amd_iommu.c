@@ -571,6 +571,8 @@ static void amd_dump_p2m_table(struct domain *d)
 }
 
 static const struct iommu_ops __initconstrel amd_iommu_ops = {
+    .page_sizes = PAGE_SIZE_4K | (PAGE_SIZE_4K << PAGE_ORDER_2M) |
+                  (PAGE_SIZE_4K << PAGE_ORDER_1G),
     .init = amd_iommu_domain_init,
     .hwdom_init = amd_iommu_hwdom_init,
     .add_device = amd_iommu_add_device,
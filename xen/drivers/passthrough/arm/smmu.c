@@ -2766,6 +2766,7 @@ static int __must_check arm_smmu_map_page(struct domain *d, dfn_t dfn,
 }
 
 static int __must_check arm_smmu_unmap_page(struct domain *d, dfn_t dfn,
+                                            unsigned int order,
                                             unsigned int *flush_flags)
 {
 	/*
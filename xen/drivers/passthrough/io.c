@@ -21,6 +21,7 @@
 #include <xen/iommu.h>
 #include <xen/cpu.h>
 #include <xen/irq.h>
+#include <xen/perfc.h>
 #include <asm/hvm/irq.h>
 #include <asm/hvm/support.h>
 #include <asm/io_apic.h>
@@ -275,6 +276,80 @@ static struct vcpu *vector_hashing_dest(const struct domain *d,
     return dest;
 }
 
+/*
+ * Edge triggered MSIs with a single, physically addressed, destination vCPU
+ * can be injected straight from the interrupt handler instead of going
+ * through the dpci softirq, unless the IOMMU posts them.  The target is kept
+ * in gmsi.direct as a single word, so the handler can fetch it without the
+ * event_lock.  Updates clear it first, and only publish the new target once
+ * the rest of the binding (including dpci_msi_vectors) is in place.
+ */
+#define GMSI_DIRECT_VALID       (1u << 31)
+#define GMSI_DIRECT_VCPU_MASK   0x7fff0000
+#define GMSI_DIRECT_DEST_MASK   0x0000ff00
+#define GMSI_DIRECT_VEC_MASK    0x000000ff
+
+static uint32_t gmsi_direct(const struct domain *d,
+                            const struct hvm_pirq_dpci *pirq_dpci)
+{
+    uint32_t gflags = pirq_dpci->gmsi.gflags;
+    int dest_vcpu_id = pirq_dpci->gmsi.dest_vcpu_id;
+
+    if ( iommu_intpost || dest_vcpu_id < 0 ||
+         (gflags & (XEN_DOMCTL_VMSI_X86_DM_MASK |
+                    XEN_DOMCTL_VMSI_X86_TRIG_MASK)) )
+        return 0;
+
+    switch ( MASK_EXTR(gflags, XEN_DOMCTL_VMSI_X86_DELIV_MASK) )
+    {
+    case dest_Fixed:
+    case dest_LowestPrio:
+        break;
+
+    default:
+        return 0;
+    }
+
+    /* Single vCPU guests get dest_vcpu_id 0 even without a match. */
+    if ( !vlapic_match_dest(vcpu_vlapic(d->vcpu[dest_vcpu_id]), NULL, 0,
+                            MASK_EXTR(gflags, XEN_DOMCTL_VMSI_X86_DEST_ID_MASK),
+                            false) )
+        return 0;
+
+    return GMSI_DIRECT_VALID |
+           MASK_INSR(dest_vcpu_id, GMSI_DIRECT_VCPU_MASK) |
+           MASK_INSR(MASK_EXTR(gflags, XEN_DOMCTL_VMSI_X86_DEST_ID_MASK),
+                     GMSI_DIRECT_DEST_MASK) |
+           MASK_INSR(pirq_dpci->gmsi.gvec, GMSI_DIRECT_VEC_MASK);
+}
+
+static int set_msi_vector(struct domain *d, struct hvm_pirq_dpci *pirq_dpci,
+                          void *arg)
+{
+    unsigned long *vectors = arg;
+
+    if ( pirq_dpci->flags & HVM_IRQ_DPCI_GUEST_MSI )
+        __set_bit(pirq_dpci->gmsi.gvec, vectors);
+
+    return 0;
+}
+
+/* Recompute the vectors whose EOIs hvm_dpci_msi_eoi() needs to handle. */
+static void pt_update_msi_vectors(struct domain *d)
+{
+    DECLARE_BITMAP(vectors, NR_VECTORS);
+
+    ASSERT(spin_is_locked(&d->event_lock));
+
+    bitmap_zero(vectors, NR_VECTORS);
+    pt_pirq_iterate(d, set_msi_vector, vectors);
+    /*
+     * Bits of vectors still in use are set in both the old and new bitmaps,
+     * so a concurrent reader can't observe them clear.
+     */
+    bitmap_copy(hvm_domain_irq(d)->dpci_msi_vectors, vectors, NR_VECTORS);
+}
+
 int pt_irq_create_bind(
     struct domain *d, const struct xen_domctl_bind_pt_irq *pt_irq_bind)
 {
@@ -406,6 +481,10 @@ int pt_irq_create_bind(
             if ( pirq_dpci->gmsi.gvec != pt_irq_bind->u.msi.gvec ||
                  pirq_dpci->gmsi.gflags != gflags )
             {
+                /* Stop injecting the old vector straight from the handler. */
+                write_atomic(&pirq_dpci->gmsi.direct, 0);
+                smp_wmb();
+
                 /* Directly clear pending EOIs before enabling new MSI info. */
                 pirq_guest_eoi(info);
 
@@ -422,6 +501,9 @@ int pt_irq_create_bind(
 
         dest_vcpu_id = hvm_girq_dest_2_vcpu_id(d, dest, dest_mode);
         pirq_dpci->gmsi.dest_vcpu_id = dest_vcpu_id;
+        pt_update_msi_vectors(d);
+        smp_wmb();
+        write_atomic(&pirq_dpci->gmsi.direct, gmsi_direct(d, pirq_dpci));
         spin_unlock(&d->event_lock);
 
         pirq_dpci->gmsi.posted = false;
@@ -739,6 +821,8 @@ int pt_irq_destroy_bind(
         if ( pt_irq_need_timer(pirq_dpci->flags) )
             kill_timer(&pirq_dpci->timer);
         pirq_dpci->flags = 0;
+        write_atomic(&pirq_dpci->gmsi.direct, 0);
+        pt_update_msi_vectors(d);
         /*
          * See comment in pt_irq_create_bind's PT_IRQ_TYPE_MSI before the
          * call to pt_pirq_softirq_reset.
@@ -814,6 +898,7 @@ int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
 {
     struct hvm_irq_dpci *dpci = domain_get_irq_dpci(d);
     struct hvm_pirq_dpci *pirq_dpci = pirq_dpci(pirq);
+    uint32_t direct;
 
     ASSERT(is_hvm_domain(d));
 
@@ -821,8 +906,34 @@ int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
          !pirq_dpci || !(pirq_dpci->flags & HVM_IRQ_DPCI_MAPPED) )
         return 0;
 
+    /*
+     * See gmsi_direct().  Guests having bound the pirq to an event channel
+     * get it delivered by hvm_dirq_assist().
+     */
+    direct = read_atomic(&pirq_dpci->gmsi.direct);
+    if ( direct && !hvm_domain_use_pirq(d, pirq) )
+    {
+        struct vcpu *v = d->vcpu[MASK_EXTR(direct, GMSI_DIRECT_VCPU_MASK)];
+
+        /*
+         * The target was resolved at bind time.  Should the guest have since
+         * changed the APIC ID or mode of the vCPU, leave the destination to
+         * vmsi_deliver_pirq().
+         */
+        if ( vlapic_match_dest(vcpu_vlapic(v), NULL, 0,
+                               MASK_EXTR(direct, GMSI_DIRECT_DEST_MASK),
+                               false) )
+        {
+            vlapic_set_irq(vcpu_vlapic(v),
+                           MASK_EXTR(direct, GMSI_DIRECT_VEC_MASK), 0);
+            perfc_incr(dpci_direct_inject);
+            return 1;
+        }
+    }
+
     pirq_dpci->masked = 1;
     raise_softirq_for(pirq_dpci);
+    perfc_incr(dpci_softirq);
     return 1;
 }
 
@@ -873,6 +984,13 @@ void hvm_dpci_msi_eoi(struct domain *d, int vector)
          (!hvm_domain_irq(d)->dpci && !is_hardware_domain(d)) )
        return;
 
+    /* Most EOIs are for emulated devices, timers or IPIs. */
+    if ( !test_bit(vector, hvm_domain_irq(d)->dpci_msi_vectors) )
+    {
+        perfc_incr(dpci_msi_eoi_skipped);
+        return;
+    }
+
     spin_lock(&d->event_lock);
     pt_pirq_iterate(d, _hvm_dpci_msi_eoi, (void *)(long)vector);
     spin_unlock(&d->event_lock);
@@ -288,24 +288,44 @@ void iommu_domain_destroy(struct domain *d)
     arch_iommu_domain_destroy(d);
 }
 
-int iommu_map(struct domain *d, dfn_t dfn, mfn_t mfn,
-              unsigned int page_order, unsigned int flags,
-              unsigned int *flush_flags)
+/*
+ * Largest page order supported by the IOMMU which both dfn and mfn are
+ * aligned to, and which doesn't exceed nr pages.
+ */
+static unsigned int mapping_order(const struct domain_iommu *hd,
+                                  dfn_t dfn, mfn_t mfn, unsigned long nr)
+{
+    unsigned long res = dfn_x(dfn) | mfn_x(mfn);
+    unsigned long sizes = hd->platform_ops->page_sizes >> PAGE_SHIFT;
+    unsigned int i, order = 0;
+
+    for ( i = 1; i < BITS_PER_LONG && (sizes >> i); i++ )
+        if ( (sizes & (1ul << i)) && nr >= (1ul << i) &&
+             !(res & ((1ul << i) - 1)) )
+            order = i;
+
+    return order;
+}
+
+int iommu_map_pages(struct domain *d, dfn_t dfn, mfn_t mfn,
+                    unsigned long page_count, unsigned int flags,
+                    unsigned int *flush_flags)
 {
     const struct domain_iommu *hd = dom_iommu(d);
-    unsigned long i;
+    unsigned long i, j;
+    unsigned int order;
     int rc = 0;
 
     if ( !iommu_enabled || !hd->platform_ops )
         return 0;
 
-    ASSERT(IS_ALIGNED(dfn_x(dfn), (1ul << page_order)));
-    ASSERT(IS_ALIGNED(mfn_x(mfn), (1ul << page_order)));
-
-    for ( i = 0; i < (1ul << page_order); i++ )
+    for ( i = 0; i < page_count; i += 1ul << order )
     {
+        order = mapping_order(hd, dfn_add(dfn, i), mfn_add(mfn, i),
+                              page_count - i);
         rc = hd->platform_ops->map_page(d, dfn_add(dfn, i), mfn_add(mfn, i),
-                                        flags, flush_flags);
+                                        flags | IOMMUF_order(order),
+                                        flush_flags);
 
         if ( likely(!rc) )
             continue;
@@ -316,11 +336,15 @@ int iommu_map(struct domain *d, dfn_t dfn, mfn_t mfn,
                    d->domain_id, dfn_x(dfn_add(dfn, i)),
                    mfn_x(mfn_add(mfn, i)), rc);
 
-        while ( i-- )
+        /* Undo what got mapped, in the same chunks it got mapped in. */
+        for ( j = 0; j < i; j += 1ul << order )
+        {
+            order = mapping_order(hd, dfn_add(dfn, j), mfn_add(mfn, j), i - j);
             /* if statement to satisfy __must_check */
-            if ( hd->platform_ops->unmap_page(d, dfn_add(dfn, i),
+            if ( hd->platform_ops->unmap_page(d, dfn_add(dfn, j), order,
                                               flush_flags) )
                 continue;
+        }
 
         if ( !is_hardware_domain(d) )
             domain_crash(d);
@@ -331,6 +355,17 @@ int iommu_map(struct domain *d, dfn_t dfn, mfn_t mfn,
     return rc;
 }
 
+int iommu_map(struct domain *d, dfn_t dfn, mfn_t mfn,
+              unsigned int page_order, unsigned int flags,
+              unsigned int *flush_flags)
+{
+    ASSERT(IS_ALIGNED(dfn_x(dfn), (1ul << page_order)));
+    ASSERT(IS_ALIGNED(mfn_x(mfn), (1ul << page_order)));
+
+    return iommu_map_pages(d, dfn, mfn, 1ul << page_order, flags,
+                           flush_flags);
+}
+
 int iommu_legacy_map(struct domain *d, dfn_t dfn, mfn_t mfn,
                      unsigned int page_order, unsigned int flags)
 {
@@ -349,22 +384,24 @@ int iommu_legacy_map(struct domain *d, dfn_t dfn, mfn_t mfn,
     return rc;
 }
 
-int iommu_unmap(struct domain *d, dfn_t dfn, unsigned int page_order,
-                unsigned int *flush_flags)
+int iommu_unmap_pages(struct domain *d, dfn_t dfn, unsigned long page_count,
+                      unsigned int *flush_flags)
 {
     const struct domain_iommu *hd = dom_iommu(d);
     unsigned long i;
+    unsigned int order;
     int rc = 0;
 
     if ( !iommu_enabled || !hd->platform_ops )
         return 0;
 
-    ASSERT(IS_ALIGNED(dfn_x(dfn), (1ul << page_order)));
-
-    for ( i = 0; i < (1ul << page_order); i++ )
+    for ( i = 0; i < page_count; i += 1ul << order )
     {
-        int err = hd->platform_ops->unmap_page(d, dfn_add(dfn, i),
-                                               flush_flags);
+        int err;
+
+        order = mapping_order(hd, dfn_add(dfn, i), _mfn(0), page_count - i);
+        err = hd->platform_ops->unmap_page(d, dfn_add(dfn, i), order,
+                                           flush_flags);
 
         if ( likely(!err) )
             continue;
@@ -387,6 +424,14 @@ int iommu_unmap(struct domain *d, dfn_t dfn, unsigned int page_order,
     return rc;
 }
 
+int iommu_unmap(struct domain *d, dfn_t dfn, unsigned int page_order,
+                unsigned int *flush_flags)
+{
+    ASSERT(IS_ALIGNED(dfn_x(dfn), (1ul << page_order)));
+
+    return iommu_unmap_pages(d, dfn, 1ul << page_order, flush_flags);
+}
+
 int iommu_legacy_unmap(struct domain *d, dfn_t dfn, unsigned int page_order)
 {
     unsigned int flush_flags = 0;
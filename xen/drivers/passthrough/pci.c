@@ -848,6 +848,8 @@ int pci_remove_device(u16 seg, u8 bus, u8 devfn)
         if ( pdev->bus == bus && pdev->devfn == devfn )
         {
             ret = iommu_remove_device(pdev);
+            if ( pdev->vpci )
+                vpci_remove_device(pdev);
             if ( pdev->domain )
                 list_del(&pdev->domain_list);
             pci_cleanup_msi(pdev);
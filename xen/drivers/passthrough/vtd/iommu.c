@@ -249,17 +249,69 @@ static u64 bus_to_context_maddr(struct iommu *iommu, u8 bus)
     return maddr;
 }
 
-static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
+/*
+ * Split the superpage entry pte at the given level into a table of entries
+ * one level down.  The translation doesn't change, but the entry does.
+ */
+static u64 split_dma_superpage(struct domain *domain, struct dma_pte *pte,
+                               unsigned int level, unsigned int *flush_flags)
+{
+    struct acpi_drhd_unit *drhd;
+    struct pci_dev *pdev;
+    struct dma_pte *split, old = *pte;
+    u64 table_maddr;
+    unsigned int i;
+
+    pdev = pci_get_pdev_by_domain(domain, -1, -1, -1);
+    drhd = acpi_find_matched_drhd_unit(pdev);
+    table_maddr = alloc_pgtable_maddr(drhd, 1);
+    if ( !table_maddr )
+        return 0;
+
+    split = map_vtd_domain_page(table_maddr);
+    for ( i = 0; i < PTE_NUM; i++ )
+    {
+        split[i].val = old.val & ~(PADDR_MASK & PAGE_MASK_4K);
+        if ( level == 2 )
+            split[i].val &= ~DMA_PTE_SP;
+        dma_set_pte_addr(split[i],
+                         dma_pte_addr(old) + offset_level_address(i, level - 1));
+    }
+    iommu_flush_cache_page(split, 1);
+    unmap_vtd_domain_page(split);
+
+    dma_clear_pte(*pte);
+    dma_set_pte_addr(*pte, table_maddr);
+    dma_set_pte_readable(*pte);
+    dma_set_pte_writable(*pte);
+    iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
+
+    if ( flush_flags )
+        *flush_flags |= IOMMU_FLUSHF_modified;
+
+    return table_maddr;
+}
+
+/*
+ * Return the address of the page table at level target (1 being the 4k leaf
+ * level) covering addr, or 0 if it isn't there (and !alloc) or can't be
+ * allocated.  Superpages covering addr above the target level get split.
+ */
+static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr,
+                                  unsigned int target,
+                                  unsigned int *flush_flags, bool alloc)
 {
     struct acpi_drhd_unit *drhd;
     struct pci_dev *pdev;
     struct domain_iommu *hd = dom_iommu(domain);
     int addr_width = agaw_to_width(hd->arch.agaw);
     struct dma_pte *parent, *pte = NULL;
-    int level = agaw_to_level(hd->arch.agaw);
+    unsigned int level = agaw_to_level(hd->arch.agaw);
     int offset;
     u64 pte_maddr = 0;
 
+    ASSERT(target >= 1 && target <= level);
+
     addr &= (((u64)1) << addr_width) - 1;
     ASSERT(spin_is_locked(&hd->arch.mapping_lock));
     if ( hd->arch.pgd_maddr == 0 )
@@ -274,8 +326,11 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
             goto out;
     }
 
+    if ( level == target )
+        return hd->arch.pgd_maddr;
+
     parent = (struct dma_pte *)map_vtd_domain_page(hd->arch.pgd_maddr);
-    while ( level > 1 )
+    while ( level > target )
     {
         offset = address_level_offset(addr, level);
         pte = &parent[offset];
@@ -302,8 +357,14 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
             dma_set_pte_writable(*pte);
             iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
         }
+        else if ( dma_pte_superpage(*pte) )
+        {
+            pte_maddr = split_dma_superpage(domain, pte, level, flush_flags);
+            if ( !pte_maddr )
+                break;
+        }
 
-        if ( level == 2 )
+        if ( level - 1 == target )
             break;
 
         unmap_vtd_domain_page(parent);
@@ -316,6 +377,34 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
     return pte_maddr;
 }
 
+/*
+ * Look up the leaf entry translating addr, which may be a superpage entry,
+ * returning its level in *level.  The entry is clear if there's none.
+ */
+static struct dma_pte dma_pte_lookup(struct domain *domain, u64 addr,
+                                     unsigned int *level)
+{
+    struct domain_iommu *hd = dom_iommu(domain);
+    struct dma_pte *parent, pte = {};
+    u64 pt_maddr = hd->arch.pgd_maddr;
+
+    ASSERT(spin_is_locked(&hd->arch.mapping_lock));
+
+    for ( *level = agaw_to_level(hd->arch.agaw); pt_maddr; --*level )
+    {
+        parent = map_vtd_domain_page(pt_maddr);
+        pte = parent[address_level_offset(addr, *level)];
+        unmap_vtd_domain_page(parent);
+
+        if ( *level == 1 || !dma_pte_present(pte) || dma_pte_superpage(pte) )
+            break;
+
+        pt_maddr = dma_pte_addr(pte);
+    }
+
+    return pte;
+}
+
 static void iommu_flush_write_buffer(struct iommu *iommu)
 {
     u32 val;
@@ -584,6 +673,21 @@ static int __must_check iommu_flush_all(void)
     return rc;
 }
 
+/*
+ * Smallest order of a naturally aligned block of pages covering the range,
+ * i.e. the address mask to use for a single page selective flush of it.
+ */
+static unsigned int flush_order(unsigned long dfn, unsigned int page_count)
+{
+    unsigned long last = dfn + page_count - 1;
+    unsigned int order = 0;
+
+    while ( order < BITS_PER_LONG - 1 && (dfn >> order) != (last >> order) )
+        order++;
+
+    return order;
+}
+
 static int __must_check iommu_flush_iotlb(struct domain *d, dfn_t dfn,
                                           bool_t dma_old_pte_present,
                                           unsigned int page_count)
@@ -594,6 +698,19 @@ static int __must_check iommu_flush_iotlb(struct domain *d, dfn_t dfn,
     bool_t flush_dev_iotlb;
     int iommu_domid;
     int rc = 0;
+    unsigned int order = 0;
+
+    /*
+     * A range gets flushed with a single PSI covering it, which falls back
+     * to a domain selective flush when exceeding the IOMMU's address mask.
+     */
+    if ( page_count > 1 && !dfn_eq(dfn, INVALID_DFN) )
+    {
+        if ( dfn_x(dfn) + page_count - 1 < dfn_x(dfn) )
+            dfn = INVALID_DFN;
+        else
+            order = flush_order(dfn_x(dfn), page_count);
+    }
 
     /*
      * No need pcideves_lock here because we have flush
@@ -611,13 +728,12 @@ static int __must_check iommu_flush_iotlb(struct domain *d, dfn_t dfn,
         if ( iommu_domid == -1 )
             continue;
 
-        if ( page_count != 1 || dfn_eq(dfn, INVALID_DFN) )
+        if ( !page_count || dfn_eq(dfn, INVALID_DFN) )
             rc = iommu_flush_iotlb_dsi(iommu, iommu_domid,
                                        0, flush_dev_iotlb);
         else
             rc = iommu_flush_iotlb_psi(iommu, iommu_domid,
-                                       dfn_to_daddr(dfn),
-                                       PAGE_ORDER_4K,
+                                       dfn_to_daddr(dfn), order,
                                        !dma_old_pte_present,
                                        flush_dev_iotlb);
 
@@ -648,42 +764,70 @@ static int __must_check iommu_flush_iotlb_all(struct domain *d)
     return iommu_flush_iotlb(d, INVALID_DFN, 0, 0);
 }
 
-/* clear one page's page table */
-static int __must_check dma_pte_clear_one(struct domain *domain, u64 addr,
-                                          unsigned int *flush_flags)
+/*
+ * Clear the entry at the given level translating addr.  Where a page table
+ * sits in place of the entry, its entries get cleared instead: freeing the
+ * table would need to wait for the IOTLB flush the caller does later.
+ */
+static int __must_check dma_pte_clear(struct domain *domain, u64 addr,
+                                      unsigned int level,
+                                      unsigned int *flush_flags)
 {
-    struct domain_iommu *hd = dom_iommu(domain);
-    struct dma_pte *page = NULL, *pte = NULL;
+    struct dma_pte *page, *pte, old;
+    unsigned int i, cur;
     u64 pg_maddr;
     int rc = 0;
 
-    spin_lock(&hd->arch.mapping_lock);
-    /* get last level pte */
-    pg_maddr = addr_to_dma_page_maddr(domain, addr, 0);
+    pg_maddr = addr_to_dma_page_maddr(domain, addr, level, flush_flags, false);
     if ( pg_maddr == 0 )
     {
-        spin_unlock(&hd->arch.mapping_lock);
-        return 0;
+        /* Failing to split a superpage is the only error. */
+        old = dma_pte_lookup(domain, addr, &cur);
+        return dma_pte_present(old) && cur > level ? -ENOMEM : 0;
     }
 
     page = (struct dma_pte *)map_vtd_domain_page(pg_maddr);
-    pte = page + address_level_offset(addr, 1);
+    pte = page + address_level_offset(addr, level);
+    old = *pte;
 
-    if ( !dma_pte_present(*pte) )
+    if ( !dma_pte_present(old) )
     {
-        spin_unlock(&hd->arch.mapping_lock);
         unmap_vtd_domain_page(page);
         return 0;
     }
 
+    if ( level > 1 && !dma_pte_superpage(old) )
+    {
+        unmap_vtd_domain_page(page);
+        for ( i = 0; i < PTE_NUM && !rc; i++ )
+            rc = dma_pte_clear(domain,
+                               addr + offset_level_address(i, level - 1),
+                               level - 1, flush_flags);
+        return rc;
+    }
+
     dma_clear_pte(*pte);
     *flush_flags |= IOMMU_FLUSHF_modified;
 
-    spin_unlock(&hd->arch.mapping_lock);
     iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
 
     unmap_vtd_domain_page(page);
 
+    return 0;
+}
+
+/* clear one page's page table */
+static int __must_check dma_pte_clear_one(struct domain *domain, u64 addr,
+                                          unsigned int order,
+                                          unsigned int *flush_flags)
+{
+    struct domain_iommu *hd = dom_iommu(domain);
+    int rc;
+
+    spin_lock(&hd->arch.mapping_lock);
+    rc = dma_pte_clear(domain, addr, order / LEVEL_STRIDE + 1, flush_flags);
+    spin_unlock(&hd->arch.mapping_lock);
+
     return rc;
 }
 
@@ -715,7 +859,7 @@ static void iommu_free_page_table(struct page_info *pg)
         if ( !dma_pte_present(*pte) )
             continue;
 
-        if ( next_level >= 1 )
+        if ( next_level >= 1 && !dma_pte_superpage(*pte) )
             iommu_free_pagetable(dma_pte_addr(*pte), next_level);
 
         dma_clear_pte(*pte);
@@ -1403,7 +1547,7 @@ int domain_context_mapping_one(
         /* Ensure we have pagetables allocated down to leaf PTE. */
         if ( hd->arch.pgd_maddr == 0 )
         {
-            addr_to_dma_page_maddr(domain, 0, 1);
+            addr_to_dma_page_maddr(domain, 0, 1, NULL, true);
             if ( hd->arch.pgd_maddr == 0 )
             {
             nomem:
@@ -1776,40 +1920,45 @@ static void iommu_domain_teardown(struct domain *d)
     spin_unlock(&hd->arch.mapping_lock);
 }
 
-static int __must_check intel_iommu_map_page(struct domain *d, dfn_t dfn,
-                                             mfn_t mfn, unsigned int flags,
-                                             unsigned int *flush_flags)
+/*
+ * Install a leaf entry at the given level (a superpage one above level 1).
+ * Where a page table sits in place of the entry, its entries get set
+ * instead: freeing the table would need to wait for the IOTLB flush the
+ * caller does later.
+ */
+static int __must_check dma_pte_set(struct domain *d, u64 addr, u64 maddr,
+                                    unsigned int level, unsigned int flags,
+                                    unsigned int *flush_flags)
 {
-    struct domain_iommu *hd = dom_iommu(d);
     struct dma_pte *page, *pte, old, new = {};
+    unsigned int i;
     u64 pg_maddr;
     int rc = 0;
 
-    /* Do nothing if VT-d shares EPT page table */
-    if ( iommu_use_hap_pt(d) )
-        return 0;
-
-    /* Do nothing if hardware domain and iommu supports pass thru. */
-    if ( iommu_hwdom_passthrough && is_hardware_domain(d) )
-        return 0;
-
-    spin_lock(&hd->arch.mapping_lock);
-
-    pg_maddr = addr_to_dma_page_maddr(d, dfn_to_daddr(dfn), 1);
+    pg_maddr = addr_to_dma_page_maddr(d, addr, level, flush_flags, true);
     if ( !pg_maddr )
-    {
-        spin_unlock(&hd->arch.mapping_lock);
         return -ENOMEM;
-    }
 
     page = (struct dma_pte *)map_vtd_domain_page(pg_maddr);
-    pte = &page[dfn_x(dfn) & LEVEL_MASK];
+    pte = &page[address_level_offset(addr, level)];
     old = *pte;
 
-    dma_set_pte_addr(new, mfn_to_maddr(mfn));
+    if ( level > 1 && dma_pte_present(old) && !dma_pte_superpage(old) )
+    {
+        unmap_vtd_domain_page(page);
+        for ( i = 0; i < PTE_NUM && !rc; i++ )
+            rc = dma_pte_set(d, addr + offset_level_address(i, level - 1),
+                             maddr + offset_level_address(i, level - 1),
+                             level - 1, flags, flush_flags);
+        return rc;
+    }
+
+    dma_set_pte_addr(new, maddr);
     dma_set_pte_prot(new,
                      ((flags & IOMMUF_readable) ? DMA_PTE_READ  : 0) |
                      ((flags & IOMMUF_writable) ? DMA_PTE_WRITE : 0));
+    if ( level > 1 )
+        dma_set_pte_superpage(new);
 
     /* Set the SNP on leaf page table if Snoop Control available */
     if ( iommu_snoop )
@@ -1817,7 +1966,6 @@ static int __must_check intel_iommu_map_page(struct domain *d, dfn_t dfn,
 
     if ( old.val == new.val )
     {
-        spin_unlock(&hd->arch.mapping_lock);
         unmap_vtd_domain_page(page);
         return 0;
     }
@@ -1825,17 +1973,41 @@ static int __must_check intel_iommu_map_page(struct domain *d, dfn_t dfn,
     *pte = new;
 
     iommu_flush_cache_entry(pte, sizeof(struct dma_pte));
-    spin_unlock(&hd->arch.mapping_lock);
     unmap_vtd_domain_page(page);
 
     *flush_flags |= IOMMU_FLUSHF_added;
     if ( dma_pte_present(old) )
         *flush_flags |= IOMMU_FLUSHF_modified;
 
+    return 0;
+}
+
+static int __must_check intel_iommu_map_page(struct domain *d, dfn_t dfn,
+                                             mfn_t mfn, unsigned int flags,
+                                             unsigned int *flush_flags)
+{
+    struct domain_iommu *hd = dom_iommu(d);
+    int rc;
+
+    /* Do nothing if VT-d shares EPT page table */
+    if ( iommu_use_hap_pt(d) )
+        return 0;
+
+    /* Do nothing if hardware domain and iommu supports pass thru. */
+    if ( iommu_hwdom_passthrough && is_hardware_domain(d) )
+        return 0;
+
+    spin_lock(&hd->arch.mapping_lock);
+    rc = dma_pte_set(d, dfn_to_daddr(dfn), mfn_to_maddr(mfn),
+                     IOMMUF_get_order(flags) / LEVEL_STRIDE + 1, flags,
+                     flush_flags);
+    spin_unlock(&hd->arch.mapping_lock);
+
     return rc;
 }
 
 static int __must_check intel_iommu_unmap_page(struct domain *d, dfn_t dfn,
+                                               unsigned int order,
                                                unsigned int *flush_flags)
 {
     /* Do nothing if VT-d shares EPT page table */
@@ -1846,15 +2018,15 @@ static int __must_check intel_iommu_unmap_page(struct domain *d, dfn_t dfn,
     if ( iommu_hwdom_passthrough && is_hardware_domain(d) )
         return 0;
 
-    return dma_pte_clear_one(d, dfn_to_daddr(dfn), flush_flags);
+    return dma_pte_clear_one(d, dfn_to_daddr(dfn), order, flush_flags);
 }
 
 static int intel_iommu_lookup_page(struct domain *d, dfn_t dfn, mfn_t *mfn,
                                    unsigned int *flags)
 {
     struct domain_iommu *hd = dom_iommu(d);
-    struct dma_pte *page, val;
-    u64 pg_maddr;
+    struct dma_pte val;
+    unsigned int level;
 
     /*
      * If VT-d shares EPT page table or if the domain is the hardware
@@ -1865,24 +2037,14 @@ static int intel_iommu_lookup_page(struct domain *d, dfn_t dfn, mfn_t *mfn,
         return -EOPNOTSUPP;
 
     spin_lock(&hd->arch.mapping_lock);
-
-    pg_maddr = addr_to_dma_page_maddr(d, dfn_to_daddr(dfn), 0);
-    if ( !pg_maddr )
-    {
-        spin_unlock(&hd->arch.mapping_lock);
-        return -ENOMEM;
-    }
-
-    page = map_vtd_domain_page(pg_maddr);
-    val = page[dfn_x(dfn) & LEVEL_MASK];
-
-    unmap_vtd_domain_page(page);
+    val = dma_pte_lookup(d, dfn_to_daddr(dfn), &level);
     spin_unlock(&hd->arch.mapping_lock);
 
     if ( !dma_pte_present(val) )
         return -ENOENT;
 
-    *mfn = maddr_to_mfn(dma_pte_addr(val));
+    *mfn = mfn_add(maddr_to_mfn(dma_pte_addr(val)),
+                   dfn_x(dfn) & ((1ul << ((level - 1) * LEVEL_STRIDE)) - 1));
     *flags = dma_pte_read(val) ? IOMMUF_readable : 0;
     *flags |= dma_pte_write(val) ? IOMMUF_writable : 0;
 
@@ -2325,6 +2487,12 @@ int __init intel_vtd_setup(void)
 
         printk(".\n");
 
+        /* Superpages get used only if all IOMMUs support them. */
+        if ( !cap_sps_2mb(iommu->cap) )
+            iommu_ops.page_sizes &= ~(PAGE_SIZE_4K << PAGE_ORDER_2M);
+        if ( !cap_sps_1gb(iommu->cap) )
+            iommu_ops.page_sizes &= ~(PAGE_SIZE_4K << PAGE_ORDER_1G);
+
         if ( iommu_snoop && !ecap_snp_ctl(iommu->ecap) )
             iommu_snoop = 0;
 
@@ -2681,14 +2849,15 @@ static void vtd_dump_p2m_table_level(paddr_t pt_maddr, int level, paddr_t gpa,
             continue;
 
         address = gpa + offset_level_address(i, level);
-        if ( next_level >= 1 ) 
+        if ( next_level >= 1 && !dma_pte_superpage(*pte) )
             vtd_dump_p2m_table_level(dma_pte_addr(*pte), next_level, 
                                      address, indent + 1);
         else
-            printk("%*sdfn: %08lx mfn: %08lx\n",
+            printk("%*sdfn: %08lx mfn: %08lx%s\n",
                    indent, "",
                    (unsigned long)(address >> PAGE_SHIFT_4K),
-                   (unsigned long)(dma_pte_addr(*pte) >> PAGE_SHIFT_4K));
+                   (unsigned long)(dma_pte_addr(*pte) >> PAGE_SHIFT_4K),
+                   next_level ? " superpage" : "");
     }
 
     unmap_vtd_domain_page(pt_vaddr);
@@ -2707,6 +2876,8 @@ static void vtd_dump_p2m_table(struct domain *d)
 }
 
 const struct iommu_ops __initconstrel intel_iommu_ops = {
+    .page_sizes = PAGE_SIZE_4K | (PAGE_SIZE_4K << PAGE_ORDER_2M) |
+                  (PAGE_SIZE_4K << PAGE_ORDER_1G),
     .init = intel_iommu_domain_init,
     .hwdom_init = intel_iommu_hwdom_init,
     .add_device = intel_iommu_add_device,
@@ -225,8 +225,9 @@ static bool __hwdom_init hwdom_iommu_map(const struct domain *d,
 
 void __hwdom_init arch_iommu_hwdom_init(struct domain *d)
 {
-    unsigned long i, top, max_pfn;
+    unsigned long i, top, max_pfn, start = 0, count = 0;
     unsigned int flush_flags = 0;
+    int rc;
 
     BUG_ON(!is_hardware_domain(d));
 
@@ -256,25 +257,46 @@ void __hwdom_init arch_iommu_hwdom_init(struct domain *d)
     for ( i = 0; i < top; i++ )
     {
         unsigned long pfn = pdx_to_pfn(i);
-        int rc;
+
+        if (!(i & 0xfffff))
+            process_pending_softirqs();
 
         if ( !hwdom_iommu_map(d, pfn, max_pfn) )
             continue;
 
         if ( paging_mode_translate(d) )
             rc = set_identity_p2m_entry(d, pfn, p2m_access_rw, 0);
+        /*
+         * Collect contiguous runs, for iommu_map_pages() to use superpages
+         * where possible.  Runs don't cross 1Gb boundaries, so as to bound
+         * the time spent mapping each of them.
+         */
+        else if ( count && pfn == start + count &&
+                  (pfn & ((1ul << PAGE_ORDER_1G) - 1)) )
+        {
+            count++;
+            continue;
+        }
         else
-            rc = iommu_map(d, _dfn(pfn), _mfn(pfn), PAGE_ORDER_4K,
-                           IOMMUF_readable | IOMMUF_writable, &flush_flags);
+        {
+            rc = iommu_map_pages(d, _dfn(start), _mfn(start), count,
+                                 IOMMUF_readable | IOMMUF_writable,
+                                 &flush_flags);
+            start = pfn;
+            count = 1;
+        }
 
         if ( rc )
             printk(XENLOG_WARNING " d%d: IOMMU mapping failed: %d\n",
                    d->domain_id, rc);
-
-        if (!(i & 0xfffff))
-            process_pending_softirqs();
     }
 
+    rc = iommu_map_pages(d, _dfn(start), _mfn(start), count,
+                         IOMMUF_readable | IOMMUF_writable, &flush_flags);
+    if ( rc )
+        printk(XENLOG_WARNING " d%d: IOMMU mapping failed: %d\n",
+               d->domain_id, rc);
+
     /* Use if to avoid compiler warning */
     if ( iommu_iotlb_flush_all(d, flush_flags) )
         return;
@@ -149,10 +149,18 @@ static void control_write(const struct pci_dev *pdev, unsigned int reg,
         pci_conf_write16(pdev->seg, pdev->bus, slot, func, reg, val);
 }
 
-static struct vpci_msix *msix_find(const struct domain *d, unsigned long addr)
+/*
+ * The list of MSI-X tables is modified with both the pcidevs lock and the
+ * domain's msix_lock held for writing, so either suffices to walk it.  Table
+ * accesses take the pcidevs lock, as they may end up (un)binding interrupts,
+ * which needs it anyway, and to keep the device from going away meanwhile.
+ */
+static struct vpci_msix *msix_find(struct domain *d, unsigned long addr)
 {
     struct vpci_msix *msix;
 
+    ASSERT(pcidevs_locked() || rw_is_locked(&d->arch.hvm.msix_lock));
+
     list_for_each_entry ( msix, &d->arch.hvm.msix_tables, next )
     {
         const struct vpci_bar *bars = msix->pdev->vpci->header.bars;
@@ -169,7 +177,14 @@ static struct vpci_msix *msix_find(const struct domain *d, unsigned long addr)
 
 static int msix_accept(struct vcpu *v, unsigned long addr)
 {
-    return !!msix_find(v->domain, addr);
+    struct domain *d = v->domain;
+    int found;
+
+    read_lock(&d->arch.hvm.msix_lock);
+    found = !!msix_find(d, addr);
+    read_unlock(&d->arch.hvm.msix_lock);
+
+    return found;
 }
 
 static bool access_allowed(const struct pci_dev *pdev, unsigned long addr,
@@ -197,18 +212,26 @@ static struct vpci_msix_entry *get_entry(struct vpci_msix *msix,
 static int msix_read(struct vcpu *v, unsigned long addr, unsigned int len,
                      unsigned long *data)
 {
-    const struct domain *d = v->domain;
-    struct vpci_msix *msix = msix_find(d, addr);
+    struct domain *d = v->domain;
+    struct vpci_msix *msix;
     const struct vpci_msix_entry *entry;
     unsigned int offset;
 
     *data = ~0ul;
 
+    pcidevs_lock();
+    msix = msix_find(d, addr);
     if ( !msix )
+    {
+        pcidevs_unlock();
         return X86EMUL_RETRY;
+    }
 
     if ( !access_allowed(msix->pdev, addr, len) )
+    {
+        pcidevs_unlock();
         return X86EMUL_OKAY;
+    }
 
     if ( VMSIX_ADDR_IN_RANGE(addr, msix->pdev->vpci, VPCI_MSIX_PBA) )
     {
@@ -234,6 +257,7 @@ static int msix_read(struct vcpu *v, unsigned long addr, unsigned int len,
             break;
         }
 
+        pcidevs_unlock();
         return X86EMUL_OKAY;
     }
 
@@ -267,6 +291,7 @@ static int msix_read(struct vcpu *v, unsigned long addr, unsigned int len,
         break;
     }
     spin_unlock(&msix->pdev->vpci->lock);
+    pcidevs_unlock();
 
     return X86EMUL_OKAY;
 }
@@ -274,16 +299,24 @@ static int msix_read(struct vcpu *v, unsigned long addr, unsigned int len,
 static int msix_write(struct vcpu *v, unsigned long addr, unsigned int len,
                       unsigned long data)
 {
-    const struct domain *d = v->domain;
-    struct vpci_msix *msix = msix_find(d, addr);
+    struct domain *d = v->domain;
+    struct vpci_msix *msix;
     struct vpci_msix_entry *entry;
     unsigned int offset;
 
+    pcidevs_lock();
+    msix = msix_find(d, addr);
     if ( !msix )
+    {
+        pcidevs_unlock();
         return X86EMUL_RETRY;
+    }
 
     if ( !access_allowed(msix->pdev, addr, len) )
+    {
+        pcidevs_unlock();
         return X86EMUL_OKAY;
+    }
 
     if ( VMSIX_ADDR_IN_RANGE(addr, msix->pdev->vpci, VPCI_MSIX_PBA) )
     {
@@ -306,6 +339,7 @@ static int msix_write(struct vcpu *v, unsigned long addr, unsigned int len,
             }
         }
 
+        pcidevs_unlock();
         return X86EMUL_OKAY;
     }
 
@@ -386,6 +420,7 @@ static int msix_write(struct vcpu *v, unsigned long addr, unsigned int len,
         break;
     }
     spin_unlock(&msix->pdev->vpci->lock);
+    pcidevs_unlock();
 
     return X86EMUL_OKAY;
 }
@@ -444,6 +479,50 @@ int vpci_make_msix_hole(const struct pci_dev *pdev)
     return 0;
 }
 
+void vpci_remove_msix(const struct pci_dev *pdev)
+{
+    struct vpci_msix *msix = pdev->vpci->msix;
+    /* The table got listed with the domain owning the device back then. */
+    struct domain *d = pdev->vpci->owner ?: pdev->domain;
+    unsigned int i;
+
+    ASSERT(pcidevs_locked());
+
+    write_lock(&d->arch.hvm.msix_lock);
+    list_del(&msix->next);
+    write_unlock(&d->arch.hvm.msix_lock);
+
+    /* Undo vpci_make_msix_hole() for BARs which are still mapped. */
+    for ( i = 0; i < ARRAY_SIZE(msix->tables); i++ )
+    {
+        unsigned long start = PFN_DOWN(vmsix_table_addr(pdev->vpci, i));
+        unsigned long end = PFN_DOWN(vmsix_table_addr(pdev->vpci, i) +
+                                     vmsix_table_size(pdev->vpci, i) - 1);
+
+        if ( !pdev->vpci->header.bars[msix->tables[i] &
+                                      PCI_MSIX_BIRMASK].enabled )
+            continue;
+
+        for ( ; start <= end; start++ )
+        {
+            p2m_type_t t;
+            int rc;
+
+            get_gfn_query(d, start, &t);
+            put_gfn(d, start);
+            if ( t != p2m_mmio_dm && t != p2m_invalid )
+                continue;
+
+            rc = map_mmio_regions(d, _gfn(start), 1, _mfn(start));
+            if ( rc )
+                gprintk(XENLOG_WARNING,
+                        "%04x:%02x:%02x.%u: unable to restore MSIX MMIO mapping at %#lx: %d\n",
+                        pdev->seg, pdev->bus, PCI_SLOT(pdev->devfn),
+                        PCI_FUNC(pdev->devfn), start, rc);
+        }
+    }
+}
+
 static int init_msix(struct pci_dev *pdev)
 {
     struct domain *d = pdev->domain;
@@ -468,6 +547,7 @@ static int init_msix(struct pci_dev *pdev)
 
     pdev->vpci->msix->max_entries = max_entries;
     pdev->vpci->msix->pdev = pdev;
+    INIT_LIST_HEAD(&pdev->vpci->msix->next);
 
     pdev->vpci->msix->tables[VPCI_MSIX_TABLE] =
         pci_conf_read32(pdev->seg, pdev->bus, slot, func,
@@ -490,7 +570,9 @@ static int init_msix(struct pci_dev *pdev)
     if ( list_empty(&d->arch.hvm.msix_tables) )
         register_mmio_handler(d, &vpci_msix_table_ops);
 
+    write_lock(&d->arch.hvm.msix_lock);
     list_add(&pdev->vpci->msix->next, &d->arch.hvm.msix_tables);
+    write_unlock(&d->arch.hvm.msix_lock);
 
     return 0;
 }
@@ -30,13 +30,77 @@ struct vpci_register {
     struct list_head node;
 };
 
+/*
+ * The register index has an entry per dword of config space, pointing to the
+ * lowest offset handler inside of that dword.  Handlers are naturally aligned
+ * and at most 4 bytes long, so each of them lives in a single dword, and the
+ * handlers of a dword are contiguous in the sorted list.  The index is sized
+ * to cover the highest registered offset, in VPCI_INDEX_CHUNK increments.
+ */
+#define VPCI_INDEX(offset)  ((offset) / 4)
+#define VPCI_INDEX_CHUNK    64
+
+/*
+ * Return the first handler that might overlap [reg, reg + size), or NULL if
+ * no handler lives in the dwords covered by the range.
+ */
+static struct vpci_register *vpci_first_handler(const struct vpci *vpci,
+                                                unsigned int reg,
+                                                unsigned int size)
+{
+    unsigned int i, end = min(VPCI_INDEX(reg + size - 1) + 1, vpci->nr_index);
+
+    for ( i = VPCI_INDEX(reg); i < end; i++ )
+        if ( vpci->index[i] )
+            return vpci->index[i];
+
+    return NULL;
+}
+
+static int vpci_index_grow(struct vpci *vpci, unsigned int offset)
+{
+    unsigned int nr = (VPCI_INDEX(offset) | (VPCI_INDEX_CHUNK - 1)) + 1;
+    struct vpci_register **index;
+
+    if ( VPCI_INDEX(offset) < vpci->nr_index )
+        return 0;
+
+    index = xzalloc_array(struct vpci_register *, nr);
+    if ( !index )
+        return -ENOMEM;
+
+    if ( vpci->nr_index )
+        memcpy(index, vpci->index, vpci->nr_index * sizeof(*index));
+    xfree(vpci->index);
+    vpci->index = index;
+    vpci->nr_index = nr;
+
+    return 0;
+}
+
 #ifdef __XEN__
 extern vpci_register_init_t *const __start_vpci_array[];
 extern vpci_register_init_t *const __end_vpci_array[];
 #define NUM_VPCI_INIT (__end_vpci_array - __start_vpci_array)
 
+static const struct pci_dev *vpci_get_pdev(struct domain *d, pci_sbdf_t sbdf)
+{
+    const struct pci_dev *pdev = radix_tree_lookup(&d->vpci_devs, sbdf.sbdf);
+
+    /* Devices reassigned away keep their handlers, but aren't d's anymore. */
+    return pdev && pdev->domain == d ? pdev : NULL;
+}
+
 void vpci_remove_device(struct pci_dev *pdev)
 {
+    /*
+     * The device may have been reassigned since the handlers were added, so
+     * drop it from the tree it was inserted into, not the current owner's.
+     */
+    if ( pdev->vpci->owner )
+        radix_tree_delete(&pdev->vpci->owner->vpci_devs,
+                          PCI_SBDF3(pdev->seg, pdev->bus, pdev->devfn));
+
     spin_lock(&pdev->vpci->lock);
     while ( !list_empty(&pdev->vpci->handlers) )
     {
@@ -47,7 +111,10 @@ void vpci_remove_device(struct pci_dev *pdev)
         list_del(&r->node);
         xfree(r);
     }
+    xfree(pdev->vpci->index);
     spin_unlock(&pdev->vpci->lock);
+    if ( pdev->vpci->msix )
+        vpci_remove_msix(pdev);
     xfree(pdev->vpci->msix);
     xfree(pdev->vpci->msi);
     xfree(pdev->vpci);
@@ -76,6 +143,15 @@ int __hwdom_init vpci_add_handlers(struct pci_dev *pdev)
             break;
     }
 
+    if ( !rc )
+    {
+        rc = radix_tree_insert(&pdev->domain->vpci_devs,
+                               PCI_SBDF3(pdev->seg, pdev->bus, pdev->devfn),
+                               pdev);
+        if ( !rc )
+            pdev->vpci->owner = pdev->domain;
+    }
+
     if ( rc )
         vpci_remove_device(pdev);
 
@@ -130,7 +206,8 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
                       unsigned int size, void *data)
 {
     struct list_head *prev;
-    struct vpci_register *r;
+    struct vpci_register *r, **slot;
+    int rc;
 
     /* Some sanity checks. */
     if ( (size != 1 && size != 2 && size != 4) ||
@@ -150,6 +227,14 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
 
     spin_lock(&vpci->lock);
 
+    rc = vpci_index_grow(vpci, offset);
+    if ( rc )
+    {
+        spin_unlock(&vpci->lock);
+        xfree(r);
+        return rc;
+    }
+
     /* The list of handlers must be kept sorted at all times. */
     list_for_each ( prev, &vpci->handlers )
     {
@@ -168,6 +253,11 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
     }
 
     list_add_tail(&r->node, prev);
+
+    slot = &vpci->index[VPCI_INDEX(offset)];
+    if ( !*slot || (*slot)->offset > offset )
+        *slot = r;
+
     spin_unlock(&vpci->lock);
 
     return 0;
@@ -180,7 +270,14 @@ int vpci_remove_register(struct vpci *vpci, unsigned int offset,
     struct vpci_register *rm;
 
     spin_lock(&vpci->lock);
-    list_for_each_entry ( rm, &vpci->handlers, node )
+    rm = vpci_first_handler(vpci, offset, size);
+    if ( !rm )
+    {
+        spin_unlock(&vpci->lock);
+        return -ENOENT;
+    }
+
+    list_for_each_entry_from ( rm, &vpci->handlers, node )
     {
         int cmp = vpci_register_cmp(&r, rm);
 
@@ -190,6 +287,18 @@ int vpci_remove_register(struct vpci *vpci, unsigned int offset,
          */
         if ( !cmp && rm->offset == offset && rm->size == size )
         {
+            struct vpci_register **slot = &vpci->index[VPCI_INDEX(offset)];
+
+            /* Point the index to the next handler in the dword, if any. */
+            if ( *slot == rm )
+            {
+                struct vpci_register *next =
+                    list_entry(rm->node.next, struct vpci_register, node);
+
+                *slot = (&next->node != &vpci->handlers &&
+                         VPCI_INDEX(next->offset) == VPCI_INDEX(offset))
+                        ? next : NULL;
+            }
             list_del(&rm->node);
             spin_unlock(&vpci->lock);
             xfree(rm);
@@ -314,7 +423,6 @@ static uint32_t merge_result(uint32_t data, uint32_t new, unsigned int size,
 
 uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
 {
-    const struct domain *d = current->domain;
     const struct pci_dev *pdev;
     const struct vpci_register *r;
     unsigned int data_offset = 0;
@@ -327,14 +435,21 @@ uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
     }
 
     /* Find the PCI dev matching the address. */
-    pdev = pci_get_pdev_by_domain(d, sbdf.seg, sbdf.bus, sbdf.extfunc);
+    pdev = vpci_get_pdev(current->domain, sbdf);
     if ( !pdev )
         return vpci_read_hw(sbdf, reg, size);
 
     spin_lock(&pdev->vpci->lock);
 
+    r = vpci_first_handler(pdev->vpci, reg, size);
+    if ( !r )
+    {
+        spin_unlock(&pdev->vpci->lock);
+        return vpci_read_hw(sbdf, reg, size);
+    }
+
     /* Read from the hardware or the emulated register handlers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    list_for_each_entry_from ( r, &pdev->vpci->handlers, node )
     {
         const struct vpci_register emu = {
             .offset = reg + data_offset,
@@ -417,7 +532,6 @@ static void vpci_write_helper(const struct pci_dev *pdev,
 void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
                 uint32_t data)
 {
-    const struct domain *d = current->domain;
     const struct pci_dev *pdev;
     const struct vpci_register *r;
     unsigned int data_offset = 0;
@@ -432,7 +546,7 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
      * Find the PCI dev matching the address.
      * Passthrough everything that's not trapped.
      */
-    pdev = pci_get_pdev_by_domain(d, sbdf.seg, sbdf.bus, sbdf.extfunc);
+    pdev = vpci_get_pdev(current->domain, sbdf);
     if ( !pdev )
     {
         vpci_write_hw(sbdf, reg, size, data);
@@ -441,8 +555,16 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
 
     spin_lock(&pdev->vpci->lock);
 
+    r = vpci_first_handler(pdev->vpci, reg, size);
+    if ( !r )
+    {
+        spin_unlock(&pdev->vpci->lock);
+        vpci_write_hw(sbdf, reg, size, data);
+        return;
+    }
+
     /* Write the value to the hardware or emulated registers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    list_for_each_entry_from ( r, &pdev->vpci->handlers, node )
     {
         const struct vpci_register emu = {
             .offset = reg + data_offset,
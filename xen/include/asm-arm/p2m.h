@@ -159,6 +159,10 @@ void p2m_altp2m_check(struct vcpu *v, uint16_t idx)
     /* Not supported on ARM. */
 }
 
+/* TLB flushes are already deferred to p2m_write_unlock() on ARM. */
+static inline void p2m_batch_begin(struct domain *d) {}
+static inline void p2m_batch_end(struct domain *d) {}
+
 /* Second stage paging setup, to be called on all CPUs */
 void setup_virt_paging(void);
 
@@ -108,6 +108,8 @@ struct shadow_domain {
 
     /* Shadow hashtable */
     struct page_info **hash_table;
+    unsigned int hash_buckets;  /* Size of the hash table */
+    unsigned int hash_entries;  /* Number of shadows in the hash table */
     bool_t hash_walking;  /* Some function is walking the hash table */
 
     /* Fast MMIO path heuristic */
@@ -150,6 +152,9 @@ struct shadow_vcpu {
         mfn_t smfn[SHADOW_OOS_FIXUPS];
         unsigned long off[SHADOW_OOS_FIXUPS];
     } oos_fixup[SHADOW_OOS_PAGES];
+    unsigned int oos_nr;        /* Slots currently in use for the hash */
+    unsigned int oos_evictions; /* Evictions since the last full resync */
+    unsigned int oos_idle;      /* Full resyncs finding the hash near empty */
 
     bool_t pagetable_dying;
 #endif
@@ -174,6 +179,16 @@ struct log_dirty_domain {
     unsigned int   allocs;
     unsigned int   failed_allocs;
 
+    /*
+     * PFNs newly marked dirty since the last XEN_DOMCTL_SHADOW_OP_CLEAN_LIST,
+     * allowing that operation to avoid walking the whole radix tree.  Once
+     * more than LOGDIRTY_RING_ENTRIES pages got dirtied the tree needs
+     * walking again.
+     */
+    unsigned long *ring;
+    unsigned int   ring_head, ring_tail;
+    bool           ring_overflow;
+
     /* log-dirty mode stats */
     unsigned int   fault_count;
     unsigned int   dirty_count;
@@ -210,6 +225,7 @@ struct paging_domain {
                 unsigned long done:PADDR_BITS - PAGE_SHIFT;
                 unsigned long i4:PAGETABLE_ORDER;
                 unsigned long i3:PAGETABLE_ORDER;
+                unsigned long walk:1;
             } log_dirty;
         };
     } preempt;
@@ -614,6 +630,9 @@ struct arch_vcpu
 
     struct paging_vcpu paging;
 
+    /* Host p2m this vCPU is batching updates to, see p2m_batch_begin(). */
+    struct p2m_domain *p2m_batch;
+
     uint32_t gdbsx_vcpu_event;
 
     /* A secondary copy of the vcpu time info. */
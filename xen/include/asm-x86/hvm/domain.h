@@ -65,7 +65,11 @@ struct hvm_ioreq_server {
     spinlock_t             bufioreq_lock;
     evtchn_port_t          bufioreq_evtchn;
     struct rangeset        *range[NR_IO_RANGE_TYPES];
+    /* Ranges whose writes are queued on the buffered ring (not PCI). */
+    struct rangeset        *posted[NR_IO_RANGE_TYPES];
     bool                   enabled;
+    /* Emulator opted into posted writes and batched notification. */
+    bool                   bufioreq_posted;
     uint8_t                bufioreq_handling;
 };
 
@@ -103,6 +107,8 @@ struct hvm_domain {
     struct {
         spinlock_t              lock;
         struct hvm_ioreq_server *server[MAX_NR_IOREQ_SERVERS];
+        /* Bumped whenever the outcome of server selection may change. */
+        unsigned int            generation;
     } ioreq_server;
 
     /* Cached CF8 for guest PCI config cycles */
@@ -134,6 +140,10 @@ struct hvm_domain {
     /* VCPU which is current target for 8259 interrupts. */
     struct vcpu           *i8259_target;
 
+    /* vLAPICs with a custom APIC ID, resp. LDR, see vlapic_dest.c. */
+    atomic_t               nr_vlapic_custom_id;
+    atomic_t               nr_vlapic_custom_ldr;
+
     /* emulated irq to pirq */
     struct radix_tree_root emuirq_pirq;
 
@@ -180,6 +190,7 @@ struct hvm_domain {
 
     /* List of MSI-X tables. */
     struct list_head msix_tables;
+    rwlock_t msix_lock;
 
     /* List of permanently write-mapped pages. */
     struct {
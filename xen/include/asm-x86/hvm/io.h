@@ -88,12 +88,19 @@ typedef int (*hvm_io_write_t)(const struct hvm_io_handler *,
 typedef bool_t (*hvm_io_accept_t)(const struct hvm_io_handler *,
                                   const ioreq_t *p);
 typedef void (*hvm_io_complete_t)(const struct hvm_io_handler *);
+/*
+ * Optional: handle a whole multi-rep request with data in guest memory
+ * (p->data_is_ptr) in one step, instead of rep by rep via read / write.
+ */
+typedef int (*hvm_io_rep_t)(const struct hvm_io_handler *,
+                            ioreq_t *p);
 
 struct hvm_io_ops {
     hvm_io_accept_t   accept;
     hvm_io_read_t     read;
     hvm_io_write_t    write;
     hvm_io_complete_t complete;
+    hvm_io_rep_t      rep;
 };
 
 int hvm_process_io_intercept(const struct hvm_io_handler *handler,
@@ -104,6 +111,7 @@ int hvm_io_intercept(ioreq_t *p);
 struct hvm_io_handler *hvm_next_io_handler(struct domain *d);
 
 bool_t hvm_mmio_internal(paddr_t gpa);
+bool hvm_mmio_same_handler(paddr_t gpa1, paddr_t gpa2);
 
 void register_mmio_handler(struct domain *d,
                            const struct hvm_mmio_ops *ops);
@@ -157,6 +165,7 @@ struct hvm_hw_stdvga {
     enum stdvga_cache_state cache;
     uint32_t latch;
     struct page_info *vram_page[64];  /* shadow of 0xa0000-0xaffff */
+    uint8_t *bounce;                  /* bulk (REP MOVS) transfer buffer */
     spinlock_t lock;
 };
 
@@ -23,6 +23,7 @@
 
 #include <xen/timer.h>
 
+#include <irq_vectors.h>
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/vpic.h>
 #include <asm/hvm/vioapic.h>
@@ -79,6 +80,12 @@ struct hvm_irq {
 
     struct hvm_irq_dpci *dpci;
 
+    /*
+     * Guest vectors of bound passthrough MSIs, so that EOIs of other vectors
+     * needn't look for a pirq to EOI.  Updated with the event_lock held.
+     */
+    DECLARE_BITMAP(dpci_msi_vectors, NR_VECTORS);
+
     /*
      * Number of wires asserting each GSI.
      *
@@ -136,6 +143,7 @@ struct hvm_gmsi_info {
     uint32_t gflags;
     int dest_vcpu_id; /* -1 :multi-dest, non-negative: dest_vcpu_id */
     bool posted; /* directly deliver to guest via VT-d PI? */
+    uint32_t direct; /* target for injection from the irq handler, or 0 */
 };
 
 struct hvm_girq_dpci_mapping {
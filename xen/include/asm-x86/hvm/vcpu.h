@@ -52,6 +52,24 @@ struct hvm_mmio_cache {
     uint8_t buffer[64] __aligned(sizeof(long));
 };
 
+/*
+ * Last-hit lookup hints for I/O dispatch, see hvm_find_io_handler() and
+ * hvm_select_ioreq_server().
+ */
+struct hvm_io_handler_hint {
+    uint8_t type;                 /* IOREQ_TYPE_* */
+    uint32_t size;
+    uint64_t addr;
+    const struct hvm_io_handler *handler;
+};
+
+struct hvm_ioreq_server_hint {
+    unsigned int generation;
+    uint8_t type;                 /* XEN_DMOP_IO_RANGE_* */
+    uint64_t start, end;
+    struct hvm_ioreq_server *server;
+};
+
 struct hvm_vcpu_io {
     /* I/O request in flight to device model. */
     enum hvm_io_completion io_completion;
@@ -83,11 +101,17 @@ struct hvm_vcpu_io {
      */
     bool_t mmio_retry;
 
+    /* Last decoded instruction, re-used while its bytes are unchanged. */
+    struct x86_emulate_decode_cache *decode_cache;
+
     unsigned long msix_unmask_address;
     unsigned long msix_snoop_address;
     unsigned long msix_snoop_gpa;
 
     const struct g2m_ioport *g2m_ioport;
+
+    struct hvm_io_handler_hint handler_hint;
+    struct hvm_ioreq_server_hint ioreq_server_hint;
 };
 
 static inline bool hvm_ioreq_needs_completion(const ioreq_t *ioreq)
@@ -165,9 +189,12 @@ struct hvm_vcpu {
     s64                 cache_tsc_offset;
     u64                 guest_time;
 
-    /* Lock and list for virtual platform timers. */
+    /* Lock, sorted list and single Xen timer for virtual platform timers. */
     spinlock_t          tm_lock;
     struct list_head    tm_list;
+    struct timer        tm_timer;
+    s_time_t            tm_deadline;    /* tm_timer expiry, 0 if stopped */
+    bool                tm_frozen;      /* timers stopped by pt_save_timer() */
 
     bool                flag_dr_dirty;
     bool                debug_state_latch;
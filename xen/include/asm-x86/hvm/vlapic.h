@@ -34,6 +34,8 @@
 #define _VLAPIC_ID(vlapic, id) (vlapic_x2apic_mode(vlapic) \
                                 ? (id) : GET_xAPIC_ID(id))
 #define VLAPIC_ID(vlapic) _VLAPIC_ID(vlapic, vlapic_get_reg(vlapic, APIC_ID))
+/* x2APIC LDR: cluster (vCPU ID / 16) in 31:16, bit (vCPU ID % 16) in 15:0. */
+#define VLAPIC_X2APIC_LDR(id) ((((id) & ~0xf) << 12) | (1 << ((id) & 0xf)))
 
 /*
  * APIC can be disabled in two ways:
@@ -91,6 +93,8 @@ struct vlapic {
         uint32_t             icr, dest;
         struct tasklet       tasklet;
     } init_sipi;
+    /* ID/LDR not derived from the vCPU ID?  See vlapic_update_dest_map(). */
+    bool                     custom_id, custom_ldr;
 };
 
 /* vlapic's frequence is 100 MHz */
@@ -150,4 +154,12 @@ bool_t vlapic_match_dest(
     const struct vlapic *target, const struct vlapic *source,
     int short_hand, uint32_t dest, bool_t dest_mode);
 
+void vlapic_update_dest_map(struct vlapic *vlapic);
+bool vlapic_dest_candidates(
+    const struct domain *d, const struct vlapic *source,
+    int short_hand, uint32_t dest, bool_t dest_mode,
+    unsigned int *first, unsigned int *mask);
+struct vcpu *vlapic_next_candidate(const struct domain *d, unsigned int first,
+                                   unsigned int *mask);
+
 #endif /* __ASM_X86_HVM_VLAPIC_H__ */
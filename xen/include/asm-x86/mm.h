@@ -285,8 +285,12 @@ struct page_info
 
 #define PRtype_info "016lx"/* should only be used for printk's */
 
-/* The number of out-of-sync shadows we allow per vcpu (prime, please) */
-#define SHADOW_OOS_PAGES 3
+/*
+ * The maximum number of out-of-sync shadows we allow per vcpu (prime,
+ * please).  The number actually allowed adapts to the guest's behaviour.
+ * Mind the size of struct vcpu, which has to fit in a page.
+ */
+#define SHADOW_OOS_PAGES 7
 
 /* OOS fixup entries */
 #define SHADOW_OOS_FIXUPS 2
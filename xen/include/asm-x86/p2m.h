@@ -28,6 +28,7 @@
 
 #include <xen/paging.h>
 #include <xen/mem_access.h>
+#include <xen/tasklet.h>
 #include <asm/mem_sharing.h>
 #include <asm/page.h>    /* for pagetable_t */
 
@@ -269,6 +270,9 @@ struct p2m_domain {
                                           unsigned long gfn, l1_pgentry_t *p,
                                           l1_pgentry_t new, unsigned int level);
     long               (*audit_p2m)(struct p2m_domain *p2m);
+    int                (*superpages)(struct p2m_domain *p2m,
+                                     unsigned long gfn, bool coalesce,
+                                     struct xen_domctl_p2m_superpages *sp);
 
     /*
      * P2M updates may require TLBs to be flushed (invalidated).
@@ -338,6 +342,8 @@ struct p2m_domain {
             unsigned long list[NR_POD_MRP_ENTRIES];
             unsigned int idx;
         } mrp;
+        /* Background reclaim, run when the cache gets low. */
+        struct tasklet   reclaim_tasklet;
         mm_lock_t        lock;         /* Locking of private pod structs,   *
                                         * not relying on the p2m lock.      */
     } pod;
@@ -416,6 +422,12 @@ static inline bool_t p2m_is_altp2m(const struct p2m_domain *p2m)
  */
 void p2m_tlb_flush_sync(struct p2m_domain *p2m);
 void p2m_unlock_and_tlb_flush(struct p2m_domain *p2m);
+void p2m_batch_begin(struct domain *d);
+void p2m_batch_end(struct domain *d);
+
+/* Superpage statistics / re-coalescing (XEN_DOMCTL_p2m_superpages). */
+long p2m_superpages_domctl(struct domain *d,
+                           struct xen_domctl_p2m_superpages *sp);
 
 /**** p2m query accessors. They lock p2m_lock, and thus serialize
  * lookups wrt modifications. They _do not_ release the lock on exit.
@@ -178,6 +178,13 @@ int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn);
                               (LOGDIRTY_NODE_ENTRIES-1))
 #define L4_LOGDIRTY_IDX(pfn) ((pfn_x(pfn) >> (PAGE_SHIFT + 3 + PAGETABLE_ORDER * 2)) & \
                               (LOGDIRTY_NODE_ENTRIES-1))
+#define LOGDIRTY_PFN(i4, i3, i2, i1)                                \
+    (((unsigned long)(i4) << (PAGE_SHIFT + 3 + PAGETABLE_ORDER * 2)) | \
+     ((unsigned long)(i3) << (PAGE_SHIFT + 3 + PAGETABLE_ORDER)) |     \
+     ((unsigned long)(i2) << (PAGE_SHIFT + 3)) | (i1))
+
+/* Number of PFNs remembered for XEN_DOMCTL_SHADOW_OP_CLEAN_LIST. */
+#define LOGDIRTY_RING_ENTRIES (1U << 15)
 
 /* VRAM dirty tracking support */
 struct sh_dirty_vram {
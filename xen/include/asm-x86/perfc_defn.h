@@ -23,6 +23,7 @@ PERFCOUNTER(calls_to_mmuext_op,         "calls to mmuext_op")
 PERFCOUNTER(num_mmuext_ops,             "mmuext ops")
 PERFCOUNTER(calls_to_mmu_update,        "calls to mmu_update")
 PERFCOUNTER(num_page_updates,           "page updates")
+PERFCOUNTER(mmu_update_batched,         "mmu_updates sharing a page lock")
 PERFCOUNTER(writable_mmu_updates,       "mmu_updates of writable pages")
 PERFCOUNTER(calls_to_update_va,         "calls to update_va_map")
 PERFCOUNTER(page_faults,            "page faults")
@@ -76,6 +77,8 @@ PERFCOUNTER(shadow_hash_lookup_miss, "shadow hash misses")
 PERFCOUNTER(shadow_get_shadow_status, "calls to get_shadow_status")
 PERFCOUNTER(shadow_hash_inserts,   "calls to shadow_hash_insert")
 PERFCOUNTER(shadow_hash_deletes,   "calls to shadow_hash_delete")
+PERFCOUNTER_ARRAY(shadow_hash_chain, "shadow hash lookup chain length", 8)
+PERFCOUNTER(shadow_hash_resize,    "shadow hash table resizes")
 PERFCOUNTER(shadow_writeable,      "shadow removes write access")
 PERFCOUNTER(shadow_writeable_h_1,  "shadow writeable: 32b w2k3")
 PERFCOUNTER(shadow_writeable_h_2,  "shadow writeable: 32pae w2k3")
@@ -111,6 +114,27 @@ PERFCOUNTER(shadow_oos_fixup_evict,"shadow OOS fixup evictions")
 PERFCOUNTER(shadow_unsync,         "shadow OOS unsyncs")
 PERFCOUNTER(shadow_unsync_evict,   "shadow OOS evictions")
 PERFCOUNTER(shadow_resync,         "shadow OOS resyncs")
+PERFCOUNTER(shadow_resync_all,     "shadow OOS resyncs of a whole vcpu")
+PERFCOUNTER(shadow_oos_grow,       "shadow OOS hash grown")
+PERFCOUNTER(shadow_oos_shrink,     "shadow OOS hash shrunk")
+
+PERFCOUNTER(hvm_io_handler_hint_hit,  "hvm io handler hint hits")
+PERFCOUNTER(hvm_io_handler_hint_miss, "hvm io handler hint misses")
+PERFCOUNTER(ioreq_server_hint_hit,    "ioreq server hint hits")
+PERFCOUNTER(ioreq_server_hint_miss,   "ioreq server hint misses")
+PERFCOUNTER(ioreq_posted_writes,      "ioreq posted writes")
+PERFCOUNTER(bufioreq_notify_suppressed, "bufioreq notifications suppressed")
+PERFCOUNTER(hvmemul_bulk_mmio,        "rep MMIO spanning multiple pages")
+
+PERFCOUNTER(dpci_direct_inject,       "passthrough MSIs injected directly")
+PERFCOUNTER(dpci_softirq,             "passthrough IRQs deferred to softirq")
+PERFCOUNTER(dpci_msi_eoi_skipped,     "guest EOIs of non-passthrough vectors")
+
+PERFCOUNTER(vpt_timer_fired,          "vpt vCPU timer expiries")
+PERFCOUNTER(vpt_timer_set,            "vpt vCPU timer reprogrammings")
+
+PERFCOUNTER(p2m_tlb_flush,            "p2m TLB flushes")
+PERFCOUNTER(p2m_tlb_flush_deferred,   "p2m TLB flushes deferred by batching")
 
 PERFCOUNTER(realmode_emulations, "realmode instructions emulated")
 PERFCOUNTER(realmode_exits,      "vmexits from realmode")
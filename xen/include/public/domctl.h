@@ -38,7 +38,7 @@
 #include "hvm/save.h"
 #include "memory.h"
 
-#define XEN_DOMCTL_INTERFACE_VERSION 0x00000011
+#define XEN_DOMCTL_INTERFACE_VERSION 0x00000012
 
 /*
  * NB. xen_domctl.domain is an IN/OUT parameter for this operation.
@@ -172,6 +172,13 @@ struct xen_domctl_getpageframeinfo3 {
 #define XEN_DOMCTL_SHADOW_OP_CLEAN       11
  /* Return the bitmap but do not modify internal copy. */
 #define XEN_DOMCTL_SHADOW_OP_PEEK        12
+ /*
+  * Return dirty PFNs as an array of uint64_t (rather than a bitmap) and
+  * clean them in the internal copy.  'pages' is the capacity of the array
+  * on input, and the number of PFNs returned on output.  A full array means
+  * more PFNs may be dirty, to be retrieved by a subsequent invocation.
+  */
+#define XEN_DOMCTL_SHADOW_OP_CLEAN_LIST  13
 
 /* Memory allocation accessors. */
 #define XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION   30
@@ -209,7 +216,7 @@ struct xen_domctl_getpageframeinfo3 {
   */
 #define XEN_DOMCTL_SHADOW_ENABLE_EXTERNAL  (1 << 4)
 
-/* Mode flags for XEN_DOMCTL_SHADOW_OP_{CLEAN,PEEK}. */
+/* Mode flags for XEN_DOMCTL_SHADOW_OP_{CLEAN,PEEK,CLEAN_LIST}. */
  /*
   * This is the final iteration: Requesting to include pages mapped
   * writably by the hypervisor in the dirty bitmap.
@@ -226,13 +233,13 @@ struct xen_domctl_shadow_op {
     uint32_t       op;       /* XEN_DOMCTL_SHADOW_OP_* */
 
     /* OP_ENABLE: XEN_DOMCTL_SHADOW_ENABLE_* */
-    /* OP_PEAK / OP_CLEAN: XEN_DOMCTL_SHADOW_LOGDIRTY_* */
+    /* OP_PEAK / OP_CLEAN / OP_CLEAN_LIST: XEN_DOMCTL_SHADOW_LOGDIRTY_* */
     uint32_t       mode;
 
     /* OP_GET_ALLOCATION / OP_SET_ALLOCATION */
     uint32_t       mb;       /* Shadow memory allocation in MB */
 
-    /* OP_PEEK / OP_CLEAN */
+    /* OP_PEEK / OP_CLEAN / OP_CLEAN_LIST */
     XEN_GUEST_HANDLE_64(uint8) dirty_bitmap;
     uint64_aligned_t pages; /* Size of buffer. Updated with actual size. */
     struct xen_domctl_shadow_op_stats stats;
@@ -847,11 +854,21 @@ struct xen_domctl_vm_event_op {
     union {
         struct {
             uint32_t port;       /* OUT: event channel for ring */
+            /*
+             * IN: 0 to use the single page at the ring's HVM_PARAM_*_RING_PFN
+             * gfn, otherwise the number of ring pages (up to
+             * XEN_VM_EVENT_MAX_RING_FRAMES) for Xen to allocate.  Such a
+             * ring comes initialised, and is mapped with
+             * XENMEM_acquire_resource (type XENMEM_resource_vm_event, id
+             * the XEN_DOMCTL_VM_EVENT_OP_* mode).
+             */
+            uint32_t nr_frames;
         } enable;
 
         uint32_t version;
     } u;
 };
+#define XEN_VM_EVENT_MAX_RING_FRAMES 32
 
 /*
  * Memory sharing operations
@@ -875,6 +892,25 @@ struct xen_domctl_audit_p2m {
     uint64_t p2m_bad;
 };
 
+/*
+ * XEN_DOMCTL_p2m_superpages: report how many leaf mappings of each size
+ * a domain's p2m is made of and, with XEN_DOMCTL_P2M_SUPERPAGES_COALESCE,
+ * rebuild superpage mappings for ranges that are fully populated, backed
+ * by contiguous and suitably aligned memory, and uniformly typed (e.g.
+ * ranges whose superpage got shattered by a temporary type or access
+ * change).  The domain is paused while coalescing.  The counts are
+ * accumulated into the OUT fields, which the caller should zero.
+ */
+#define XEN_DOMCTL_P2M_SUPERPAGES_STATS     0
+#define XEN_DOMCTL_P2M_SUPERPAGES_COALESCE  1
+struct xen_domctl_p2m_superpages {
+    uint32_t op;                     /* IN: XEN_DOMCTL_P2M_SUPERPAGES_* */
+    uint32_t pad;
+    uint64_aligned_t gfn;            /* IN: GFN to start at (normally 0) */
+    uint64_aligned_t mappings[3];    /* OUT: 4k, 2M, 1G leaf mappings */
+    uint64_aligned_t coalesced[2];   /* OUT: new 2M, 1G mappings */
+};
+
 struct xen_domctl_set_virq_handler {
     uint32_t virq; /* IN */
 };
@@ -1201,6 +1237,7 @@ struct xen_domctl {
 /* #define XEN_DOMCTL_set_gnttab_limits          80 - Moved into XEN_DOMCTL_createdomain */
 #define XEN_DOMCTL_vuart_op                      81
 #define XEN_DOMCTL_get_cpu_policy                82
+#define XEN_DOMCTL_p2m_superpages                83
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1251,6 +1288,7 @@ struct xen_domctl {
 #endif
         struct xen_domctl_set_access_required access_required;
         struct xen_domctl_audit_p2m         audit_p2m;
+        struct xen_domctl_p2m_superpages    p2m_superpages;
         struct xen_domctl_set_virq_handler  set_virq_handler;
         struct xen_domctl_gdbsx_memio       gdbsx_guest_memio;
         struct xen_domctl_set_broken_page_p2m set_broken_page_p2m;
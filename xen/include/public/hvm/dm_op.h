@@ -417,6 +417,38 @@ struct xen_dm_op_pin_memory_cacheattr {
     uint32_t pad;
 };
 
+/*
+ * XEN_DMOP_map_posted_io_range: Mark a port I/O or memory range as
+ *                               accepting posted writes for IOREQ Server
+ *                               <id>.
+ * XEN_DMOP_unmap_posted_io_range: Undo a previous
+ *                                 XEN_DMOP_map_posted_io_range.
+ *
+ * Writes which are routed to IOREQ Server <id> (see
+ * XEN_DMOP_map_io_range_to_ioreq_server) and which fall entirely within a
+ * posted range are not sent synchronously.  Instead they are queued, along
+ * with any REP iterations, on the buffered ioreq ring using the extended
+ * slot format described in public/hvm/ioreq.h, and the vCPU continues
+ * without waiting for the emulator.  Writes are only posted if the whole
+ * access fits in the ring; otherwise they are sent synchronously as
+ * before, so the emulator must drain the buffered ring before handling a
+ * synchronous request.
+ *
+ * Once a posted range has been registered Xen only raises the buffered
+ * ioreq event channel when the ring was empty before a batch was queued.
+ * The emulator must therefore re-read write_pointer after updating
+ * read_pointer (with a full barrier in between), and carry on processing
+ * if it has moved.
+ *
+ * Only <type> values XEN_DMOP_IO_RANGE_PORT and XEN_DMOP_IO_RANGE_MEMORY
+ * are valid, and the IOREQ Server must have been created with
+ * HVM_IOREQSRV_BUFIOREQ_ATOMIC buffered ioreq handling.
+ */
+#define XEN_DMOP_map_posted_io_range 19
+#define XEN_DMOP_unmap_posted_io_range 20
+
+/* Uses struct xen_dm_op_ioreq_server_range, see above. */
+
 struct xen_dm_op {
     uint32_t op;
     uint32_t pad;
@@ -440,6 +472,8 @@ struct xen_dm_op {
         struct xen_dm_op_remote_shutdown remote_shutdown;
         struct xen_dm_op_relocate_memory relocate_memory;
         struct xen_dm_op_pin_memory_cacheattr pin_memory_cacheattr;
+        struct xen_dm_op_ioreq_server_range map_posted_io_range;
+        struct xen_dm_op_ioreq_server_range unmap_posted_io_range;
     } u;
 };
 
@@ -73,7 +73,7 @@ typedef struct shared_iopage shared_iopage_t;
 
 struct buf_ioreq {
     uint8_t  type;   /* I/O type                    */
-    uint8_t  pad:1;
+    uint8_t  pad:1;  /* 1=extended slot pair (see below) */
     uint8_t  dir:1;  /* 1=read, 0=write             */
     uint8_t  size:2; /* 0=>1, 1=>2, 2=>4, 3=>8. If 8, use two buf_ioreqs */
     uint32_t addr:20;/* physical address            */
@@ -81,6 +81,18 @@ struct buf_ioreq {
 };
 typedef struct buf_ioreq buf_ioreq_t;
 
+/*
+ * Posted writes (see XEN_DMOP_map_posted_io_range) always occupy two
+ * consecutive slots.  The first is a struct buf_ioreq with <pad> set,
+ * holding address bits 0-19 and the low 32 bits of the data.  The second
+ * is a struct buf_ioreq_ext holding the remaining address and data bits,
+ * irrespective of the access size.
+ */
+struct buf_ioreq_ext {
+    uint32_t addr_hi; /* physical address bits 20-51 */
+    uint32_t data_hi; /* data bits 32-63             */
+};
+
 #define IOREQ_BUFFER_SLOT_NUM     511 /* 8 bytes each, plus 2 4-byte indexes */
 struct buffered_iopage {
 #ifdef __XEN__
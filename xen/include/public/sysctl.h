@@ -153,6 +153,37 @@ struct xen_sysctl_getdomaininfolist {
     uint32_t              num_domains;
 };
 
+/*
+ * XEN_SYSCTL_getvcpuinfolist: XEN_DOMCTL_getvcpuinfo for all vCPUs of all
+ * domains with ID first_domain or above, in order of domain and vCPU ID.
+ * A domain's vCPUs are either all reported or, if they don't fit into the
+ * buffer any more, not at all; the caller continues from the domain after
+ * the last one reported.  Fails with -ENOBUFS if not even the first
+ * domain's vCPUs fit.  Domains the caller may not use XEN_DOMCTL_getvcpuinfo
+ * on are skipped.
+ */
+struct xen_sysctl_vcpuinfo {
+    domid_t               domid;
+    uint8_t               online;   /* currently online (not hotplugged)? */
+    uint8_t               blocked;  /* blocked waiting for an event? */
+    uint8_t               running;  /* currently scheduled on its CPU? */
+    uint8_t               pad[3];
+    uint32_t              vcpu;
+    uint32_t              cpu;      /* current mapping */
+    uint64_aligned_t      cpu_time; /* total cpu time consumed (ns) */
+};
+typedef struct xen_sysctl_vcpuinfo xen_sysctl_vcpuinfo_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_vcpuinfo_t);
+
+struct xen_sysctl_getvcpuinfolist {
+    /* IN variables. */
+    domid_t               first_domain;
+    uint32_t              max_vcpus;
+    XEN_GUEST_HANDLE_64(xen_sysctl_vcpuinfo_t) buffer;
+    /* OUT variables. */
+    uint32_t              num_vcpus;
+};
+
 /* Inject debug keys into Xen. */
 /* XEN_SYSCTL_debug_keys */
 struct xen_sysctl_debug_keys {
@@ -1130,6 +1161,7 @@ struct xen_sysctl {
 #define XEN_SYSCTL_livepatch_op                  27
 #define XEN_SYSCTL_set_parameter                 28
 #define XEN_SYSCTL_get_cpu_policy                29
+#define XEN_SYSCTL_getvcpuinfolist               30
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1141,6 +1173,7 @@ struct xen_sysctl {
         struct xen_sysctl_sched_id          sched_id;
         struct xen_sysctl_perfc_op          perfc_op;
         struct xen_sysctl_getdomaininfolist getdomaininfolist;
+        struct xen_sysctl_getvcpuinfolist   getvcpuinfolist;
         struct xen_sysctl_debug_keys        debug_keys;
         struct xen_sysctl_getcpuinfo        getcpuinfo;
         struct xen_sysctl_availheap         availheap;
@@ -129,6 +129,7 @@
 #define TRC_MEM_POD_POPULATE        (TRC_MEM + 16)
 #define TRC_MEM_POD_ZERO_RECLAIM    (TRC_MEM + 17)
 #define TRC_MEM_POD_SUPERPAGE_SPLINTER (TRC_MEM + 18)
+#define TRC_MEM_POD_STALL           (TRC_MEM + 19)
 
 #define TRC_PV_ENTRY   0x00201000 /* Hypervisor entry points for PV guests. */
 #define TRC_PV_SUBCALL 0x00202000 /* Sub-call in a multicall hypercall */
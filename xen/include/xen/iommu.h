@@ -90,6 +90,10 @@ void iommu_teardown(struct domain *d);
 #define IOMMUF_readable  (1u<<_IOMMUF_readable)
 #define _IOMMUF_writable 1
 #define IOMMUF_writable  (1u<<_IOMMUF_writable)
+/* Page order of a mapping, for map_page() only. */
+#define _IOMMUF_order    2
+#define IOMMUF_order(o)  ((o) << _IOMMUF_order)
+#define IOMMUF_get_order(f) (((f) >> _IOMMUF_order) & 0x3f)
 
 /*
  * flush_flags:
@@ -116,6 +120,18 @@ int __must_check iommu_unmap(struct domain *d, dfn_t dfn,
                              unsigned int page_order,
                              unsigned int *flush_flags);
 
+/*
+ * Map or unmap an arbitrary range of pages, using the largest page sizes
+ * the IOMMU supports.  Flushing is left to the caller, which can cover the
+ * whole range with a single iommu_iotlb_flush().
+ */
+int __must_check iommu_map_pages(struct domain *d, dfn_t dfn, mfn_t mfn,
+                                 unsigned long page_count, unsigned int flags,
+                                 unsigned int *flush_flags);
+int __must_check iommu_unmap_pages(struct domain *d, dfn_t dfn,
+                                   unsigned long page_count,
+                                   unsigned int *flush_flags);
+
 int __must_check iommu_legacy_map(struct domain *d, dfn_t dfn, mfn_t mfn,
                                   unsigned int page_order,
                                   unsigned int flags);
@@ -187,6 +203,9 @@ struct page_info;
 typedef int iommu_grdm_t(xen_pfn_t start, xen_ulong_t nr, u32 id, void *ctxt);
 
 struct iommu_ops {
+    /* Bitmap of page sizes map_page() can install; 0 means 4k only. */
+    unsigned long page_sizes;
+
     int (*init)(struct domain *d);
     void (*hwdom_init)(struct domain *d);
     int (*add_device)(u8 devfn, device_t *dev);
@@ -206,11 +225,16 @@ struct iommu_ops {
     /*
      * This block of operations must be appropriately locked against each
      * other by the caller in order to have meaningful results.
+     *
+     * map_page() and unmap_page() get passed a page order (via
+     * IOMMUF_order() for the former) which is one of page_sizes, and which
+     * dfn and mfn are aligned to.
      */
     int __must_check (*map_page)(struct domain *d, dfn_t dfn, mfn_t mfn,
                                  unsigned int flags,
                                  unsigned int *flush_flags);
     int __must_check (*unmap_page)(struct domain *d, dfn_t dfn,
+                                   unsigned int order,
                                    unsigned int *flush_flags);
     int __must_check (*lookup_page)(struct domain *d, dfn_t dfn, mfn_t *mfn,
                                     unsigned int *flags);
@@ -8,6 +8,8 @@ PERFCOUNTER_ARRAY(hypercalls,           "hypercalls", NR_hypercalls)
 
 PERFCOUNTER(calls_to_multicall,         "calls to multicall")
 PERFCOUNTER(calls_from_multicall,       "calls from multicall")
+PERFCOUNTER(multicall_batches,          "multicall entry batches copied")
+PERFCOUNTER_ARRAY(multicall_sizes,      "multicalls by log2(#calls)", 8)
 
 PERFCOUNTER(irqs,                   "#interrupts")
 PERFCOUNTER(ipis,                   "#IPIs")
@@ -284,12 +284,16 @@ struct vm_event_domain
 {
     /* ring lock */
     spinlock_t ring_lock;
-    /* The ring has 64 entries */
-    unsigned char foreign_producers;
-    unsigned char target_producers;
-    /* shared ring page */
+    /* slots reserved for requests not yet put on the ring */
+    unsigned int foreign_producers;
+    unsigned int target_producers;
+    /* shared ring page(s) */
     void *ring_page;
+    /* guest frame holding a single page ring */
     struct page_info *ring_pg_struct;
+    /* Xen allocated frames of a multi-page ring */
+    struct page_info **ring_pages;
+    unsigned int nr_ring_pages;
     /* front-end ring */
     vm_event_front_ring_t front_ring;
     /* event channel port (vcpu0 only) */
@@ -372,6 +376,10 @@ struct domain
 
 #ifdef CONFIG_HAS_PASSTHROUGH
     struct domain_iommu iommu;
+#endif
+#ifdef CONFIG_HAS_VPCI
+    /* Devices with vPCI handlers, indexed by SBDF. */
+    struct radix_tree_root vpci_devs;
 #endif
     /* is node-affinity automatically computed? */
     bool             auto_node_affinity;
@@ -72,6 +72,11 @@ void vm_event_resume(struct domain *d, struct vm_event_domain *ved);
 int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec,
                     XEN_GUEST_HANDLE_PARAM(void) u_domctl);
 
+/* Look up the frames of a Xen allocated ring, for XENMEM_acquire_resource */
+int vm_event_get_ring_frames(struct domain *d, unsigned int mode,
+                             unsigned long frame, unsigned int nr_frames,
+                             xen_pfn_t mfn_list[]);
+
 void vm_event_vcpu_pause(struct vcpu *v);
 void vm_event_vcpu_unpause(struct vcpu *v);
 
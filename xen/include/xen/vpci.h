@@ -58,10 +58,16 @@ bool __must_check vpci_process_pending(struct vcpu *v);
 struct vpci {
     /* List of vPCI handlers for a device. */
     struct list_head handlers;
+    /* Handlers indexed by config space dword, see vpci.c. */
+    struct vpci_register **index;
+    unsigned int nr_index;
     spinlock_t lock;
 
 #ifdef __XEN__
     /* Hide the rest of the vpci struct from the user-space test harness. */
+    /* Domain whose vpci_devs tree indexes the device, NULL if none. */
+    struct domain *owner;
+
     struct vpci_header {
         /* Information about the PCI BARs of this device. */
         struct vpci_bar {
@@ -155,6 +161,9 @@ void vpci_dump_msi(void);
 /* Make sure there's a hole in the p2m for the MSIX mmio areas. */
 int vpci_make_msix_hole(const struct pci_dev *pdev);
 
+/* Stop trapping accesses to the MSIX mmio areas of a device going away. */
+void vpci_remove_msix(const struct pci_dev *pdev);
+
 /* Arch-specific vPCI MSI helpers. */
 void vpci_msi_arch_mask(struct vpci_msi *msi, const struct pci_dev *pdev,
                         unsigned int entry, bool mask);
@@ -221,6 +230,8 @@ static inline int vpci_add_handlers(struct pci_dev *pdev)
     return 0;
 }
 
+static inline void vpci_remove_device(struct pci_dev *pdev) { }
+
 static inline void vpci_dump_msi(void) { }
 
 static inline uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg,